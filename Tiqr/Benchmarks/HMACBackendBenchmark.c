@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the OCRA response latency of every HMAC backend the CPU
+ * supports for the suites tiqr uses, with a 32 byte key:
+ *
+ *   new key     HMACKeyInit, OCRAComputeCode and HMACKeyWipe, what a
+ *               single authentication costs
+ *   cached key  OCRAComputeCode with a key schedule prepared once
+ *
+ * followed by the cost of one compression call per algorithm. Backends
+ * without their own compression function for an algorithm run the
+ * portable one, which the output marks. Every backend has to produce the
+ * portable backend's codes. Add -DHMAC_BACKEND_OPENSSL and -lcrypto to
+ * include the OpenSSL backend. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/HMACBackendBenchmark.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      -lpthread -o hmac-backend-benchmark && ./hmac-backend-benchmark [iterations]
+ */
+
+#include "HMACBackend.h"
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkDefaultIterations 200000
+#define BenchmarkBlocks 4096
+
+static const char *const BenchmarkSuites[] = {
+    "OCRA-1:HOTP-SHA1-6:QH10-S",
+    "OCRA-1:HOTP-SHA256-8:QN08-S064",
+    "OCRA-1:HOTP-SHA512-8:C-QN08",
+};
+
+static const char *const BenchmarkAlgorithmNames[] = { "SHA1", "SHA256", "SHA512", "MD5" };
+
+static volatile uint32_t BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkPrepareInput(const OCRASuiteLayout *layout, OCRAInput *input, uint8_t *counter, uint8_t *question, uint8_t *session) {
+    static const char hexQuestion[] = "5c4a1f09e7";
+    static const char numericQuestion[] = "40231187";
+    static const char sessionKey[] = "9c4e1f7b2a6d8e3f0b5c7a9d1e2f4a6b";
+
+    OCRAEncodeCounter(2117, counter);
+    if (layout->numericQuestion) {
+        OCRAMessageSetNumericField(question, layout->questionLength, numericQuestion, sizeof(numericQuestion) - 1);
+    } else {
+        OCRAMessageSetHexField(question, layout->questionLength, hexQuestion, sizeof(hexQuestion) - 1, OCRAFieldAlignmentLeft);
+    }
+    OCRAMessageSetHexField(session, layout->sessionInformationLength, sessionKey, sizeof(sessionKey) - 1, OCRAFieldAlignmentRight);
+
+    *input = (OCRAInput){
+        .counter = { counter, layout->counterLength },
+        .question = { question, layout->questionLength },
+        .sessionInformation = { session, layout->sessionInformationLength },
+    };
+}
+
+static double BenchmarkNewKey(const OCRASuiteLayout *layout, HMACAlgorithm algorithm, const uint8_t *secret, const OCRAInput *input, long iterations) {
+    HMACKey key;
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        HMACKeyInit(&key, algorithm, secret, 32);
+        BenchmarkSink ^= OCRAComputeCode(layout, &key, input);
+        HMACKeyWipe(&key);
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+static double BenchmarkCachedKey(const OCRASuiteLayout *layout, HMACAlgorithm algorithm, const uint8_t *secret, const OCRAInput *input, long iterations) {
+    HMACKey key;
+    HMACKeyInit(&key, algorithm, secret, 32);
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        BenchmarkSink ^= OCRAComputeCode(layout, &key, input);
+    }
+    double nanoseconds = (BenchmarkNow() - start) * 1e9 / iterations;
+    HMACKeyWipe(&key);
+    return nanoseconds;
+}
+
+static double BenchmarkCompress(HMACCompressFunction compress, long iterations) {
+    static uint8_t blocks[BenchmarkBlocks * HMACMaxBlockLength];
+    HMACState state = { { 0 } };
+    long rounds = iterations / BenchmarkBlocks + 1;
+    double start = BenchmarkNow();
+    for (long i = 0; i < rounds; i++) {
+        compress(&state, blocks, BenchmarkBlocks);
+    }
+    BenchmarkSink ^= state.words32[0];
+    return (BenchmarkNow() - start) * 1e9 / (rounds * BenchmarkBlocks);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t secret[32];
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(0xa5 ^ i);
+    }
+
+    printf("%ld iterations, 32 byte key\n\n", iterations);
+    printf("%-32s %-10s %10s %12s\n", "suite", "backend", "new key", "cached key");
+    for (size_t s = 0; s < sizeof(BenchmarkSuites) / sizeof(BenchmarkSuites[0]); s++) {
+        OCRASuiteLayout layout;
+        if (OCRASuiteCompile(BenchmarkSuites[s], strlen(BenchmarkSuites[s]), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+            fprintf(stderr, "%s doesn't compile\n", BenchmarkSuites[s]);
+            return 1;
+        }
+        HMACAlgorithm algorithm;
+        OCRAHMACAlgorithm(layout.algorithm, &algorithm);
+
+        OCRAInput input;
+        uint8_t counter[8], question[128], session[512];
+        BenchmarkPrepareInput(&layout, &input, counter, question, session);
+
+        HMACKey reference;
+        HMACBackendSetActive(&HMACBackendPortable);
+        HMACKeyInit(&reference, algorithm, secret, sizeof(secret));
+        uint32_t expected = OCRAComputeCode(&layout, &reference, &input);
+        HMACKeyWipe(&reference);
+
+        const char *suite = BenchmarkSuites[s];
+        for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+            if (!(*backend)->supported()) {
+                continue;
+            }
+            HMACBackendSetActive(*backend);
+
+            HMACKey key;
+            HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+            uint32_t code = OCRAComputeCode(&layout, &key, &input);
+            HMACKeyWipe(&key);
+            if (code != expected) {
+                printf("%s on %s: code differs from the portable backend\n", suite, (*backend)->name);
+                return 1;
+            }
+
+            double newKey = BenchmarkNewKey(&layout, algorithm, secret, &input, iterations);
+            double cachedKey = BenchmarkCachedKey(&layout, algorithm, secret, &input, iterations);
+            int fallback = (*backend)->compress[algorithm] == NULL && (*backend)->oneShot == NULL;
+            printf("%-32s %-10s %7.0f ns %9.0f ns%s\n", suite, (*backend)->name, newKey, cachedKey,
+                   fallback ? " (portable)" : "");
+            suite = "";
+        }
+    }
+
+    printf("\n%-10s %-10s %12s\n", "algorithm", "backend", "per block");
+    for (HMACAlgorithm algorithm = HMACAlgorithmSHA1; algorithm <= HMACAlgorithmSHA512; algorithm++) {
+        for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+            if ((*backend)->supported() && (*backend)->compress[algorithm] != NULL) {
+                printf("%-10s %-10s %9.1f ns\n", BenchmarkAlgorithmNames[algorithm], (*backend)->name,
+                       BenchmarkCompress((*backend)->compress[algorithm], iterations * 4));
+            }
+        }
+    }
+
+    return 0;
+}
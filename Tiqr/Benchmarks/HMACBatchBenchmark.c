@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures OCRAComputeBatch throughput, in verifications per second, for
+ * QH10-S064 messages under distinct 32 byte keys, the shape of a verifier
+ * checking many responses at once. The first table caps the multi-buffer
+ * kernel at 1 (scalar), 4, 8 and 16 lanes with portable key schedules;
+ * widths the CPU doesn't support are left out. The second runs every
+ * backend the CPU supports uncapped, so the batch code can choose between
+ * its kernels and the backend the way it does in the app.
+ *
+ * Every code is checked against OCRAComputeCode before timing. Build and
+ * run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/HMACBatchBenchmark.c \
+ *      Tiqr/Classes/HMACBatch.c Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      -lpthread -o hmac-batch-benchmark && ./hmac-batch-benchmark
+ */
+
+#include "HMACBackend.h"
+#include "HMACBatch.h"
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkResponses 1024
+#define BenchmarkSeconds 0.25
+
+static const char *const BenchmarkSuites[] = {
+    "OCRA-1:HOTP-SHA1-6:QH10-S064",
+    "OCRA-1:HOTP-SHA256-6:QH10-S064",
+};
+
+typedef struct {
+    OCRASuiteLayout layout;
+    uint8_t secrets[BenchmarkResponses][32];
+    uint8_t questions[BenchmarkResponses][128];
+    uint8_t sessions[BenchmarkResponses][64];
+    OCRAInput inputs[BenchmarkResponses];
+    HMACKey keys[BenchmarkResponses];
+    const HMACKey *keyPointers[BenchmarkResponses];
+    uint32_t codes[BenchmarkResponses];
+} BenchmarkBatch;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint32_t BenchmarkRandom(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int BenchmarkPrepare(BenchmarkBatch *batch, const char *suite) {
+    if (OCRASuiteCompile(suite, strlen(suite), &OCRASuitePolicyV2, &batch->layout) != OCRASuiteCompileSuccess) {
+        fprintf(stderr, "%s doesn't compile\n", suite);
+        return 0;
+    }
+
+    uint32_t state = 0x9e3779b9;
+    for (size_t i = 0; i < BenchmarkResponses; i++) {
+        for (size_t j = 0; j < sizeof(batch->secrets[i]); j++) {
+            batch->secrets[i][j] = (uint8_t)BenchmarkRandom(&state);
+        }
+        memset(batch->questions[i], 0, sizeof(batch->questions[i]));
+        for (size_t j = 0; j < 5; j++) {
+            batch->questions[i][j] = (uint8_t)BenchmarkRandom(&state);
+        }
+        for (size_t j = 0; j < sizeof(batch->sessions[i]); j++) {
+            batch->sessions[i][j] = j < 48 ? 0 : (uint8_t)BenchmarkRandom(&state);
+        }
+        batch->inputs[i] = (OCRAInput){
+            .question = { batch->questions[i], sizeof(batch->questions[i]) },
+            .sessionInformation = { batch->sessions[i], sizeof(batch->sessions[i]) },
+        };
+        batch->keyPointers[i] = &batch->keys[i];
+    }
+    return 1;
+}
+
+static void BenchmarkInitKeys(BenchmarkBatch *batch) {
+    HMACAlgorithm algorithm;
+    OCRAHMACAlgorithm(batch->layout.algorithm, &algorithm);
+    for (size_t i = 0; i < BenchmarkResponses; i++) {
+        HMACKeyInit(&batch->keys[i], algorithm, batch->secrets[i], sizeof(batch->secrets[i]));
+    }
+}
+
+static int BenchmarkCheck(BenchmarkBatch *batch) {
+    OCRAComputeBatch(&batch->layout, batch->keyPointers, batch->inputs, BenchmarkResponses, batch->codes);
+    for (size_t i = 0; i < BenchmarkResponses; i++) {
+        if (batch->codes[i] != OCRAComputeCode(&batch->layout, &batch->keys[i], &batch->inputs[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static double BenchmarkThroughput(BenchmarkBatch *batch) {
+    long batches = 0;
+    double start = BenchmarkNow(), elapsed;
+    do {
+        OCRAComputeBatch(&batch->layout, batch->keyPointers, batch->inputs, BenchmarkResponses, batch->codes);
+        batches++;
+        elapsed = BenchmarkNow() - start;
+    } while (elapsed < BenchmarkSeconds);
+    return batches * BenchmarkResponses / elapsed;
+}
+
+int main(void) {
+    enum { suiteCount = sizeof(BenchmarkSuites) / sizeof(BenchmarkSuites[0]) };
+    static BenchmarkBatch batches[suiteCount];
+    for (size_t s = 0; s < suiteCount; s++) {
+        if (!BenchmarkPrepare(&batches[s], BenchmarkSuites[s])) {
+            return 1;
+        }
+    }
+
+    static const size_t laneWidths[] = { 1, 4, 8, 16 };
+    printf("%-20s %16s %16s\n", "lanes", "SHA1 verif/s", "SHA256 verif/s");
+    HMACBackendSetActive(&HMACBackendPortable);
+    for (size_t w = 0; w < sizeof(laneWidths) / sizeof(laneWidths[0]); w++) {
+        HMACBatchSetMaximumLaneWidth(laneWidths[w]);
+        if (HMACBatchLaneWidth() != laneWidths[w]) {
+            continue;
+        }
+        printf("%-20zu", laneWidths[w]);
+        for (size_t s = 0; s < suiteCount; s++) {
+            BenchmarkInitKeys(&batches[s]);
+            if (!BenchmarkCheck(&batches[s])) {
+                printf("\n%s with %zu lanes: codes differ\n", BenchmarkSuites[s], laneWidths[w]);
+                return 1;
+            }
+            printf(" %16.0f", BenchmarkThroughput(&batches[s]));
+        }
+        printf("\n");
+    }
+    HMACBatchSetMaximumLaneWidth(0);
+
+    printf("\n%-20s %16s %16s\n", "backend", "SHA1 verif/s", "SHA256 verif/s");
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if (!(*backend)->supported()) {
+            continue;
+        }
+        HMACBackendSetActive(*backend);
+        printf("%-20s", (*backend)->name);
+        for (size_t s = 0; s < suiteCount; s++) {
+            BenchmarkInitKeys(&batches[s]);
+            if (!BenchmarkCheck(&batches[s])) {
+                printf("\n%s on %s: codes differ\n", BenchmarkSuites[s], (*backend)->name);
+                return 1;
+            }
+            printf(" %16.0f", BenchmarkThroughput(&batches[s]));
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures one HMAC under a 32 byte key three ways for SHA-1, SHA-256 and
+ * SHA-512, with an 8 byte message (a HOTP counter) and an assembled
+ * OCRA-1:HOTP-SHA1-6:QH10-S064 message:
+ *
+ *   OpenSSL   libcrypto's HMAC(), which pads and hashes the key every call
+ *   one-shot  HMACKeyInit and HMACKeyCompute per MAC, the way the app
+ *             worked before it kept key schedules
+ *   cached    HMACKeyCompute with a key schedule prepared once
+ *
+ * The last two run on every backend the CPU supports. Every MAC is checked
+ * against OpenSSL before timing; add -DHMAC_BACKEND_OPENSSL to the build
+ * line to include the libcrypto block function backend. Build and run on
+ * Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/HMACKeyBenchmark.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      -lcrypto -lpthread -o hmac-key-benchmark && ./hmac-key-benchmark [iterations]
+ */
+
+#include "HMACBackend.h"
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkDefaultIterations 1000000
+#define BenchmarkSuite "OCRA-1:HOTP-SHA1-6:QH10-S064"
+
+typedef struct {
+    const char *name;
+    HMACAlgorithm algorithm;
+    const EVP_MD *(*digest)(void);
+} BenchmarkAlgorithm;
+
+static const BenchmarkAlgorithm BenchmarkAlgorithms[] = {
+    { "SHA1", HMACAlgorithmSHA1, EVP_sha1 },
+    { "SHA256", HMACAlgorithmSHA256, EVP_sha256 },
+    { "SHA512", HMACAlgorithmSHA512, EVP_sha512 },
+};
+
+static volatile uint8_t BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static double BenchmarkOpenSSL(const BenchmarkAlgorithm *algorithm, const uint8_t *secret, const uint8_t *message, size_t length, long iterations) {
+    uint8_t mac[HMACMaxDigestLength];
+    unsigned int macLength;
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        HMAC(algorithm->digest(), secret, 32, message, length, mac, &macLength);
+        BenchmarkSink ^= mac[0];
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+static double BenchmarkOneShot(const BenchmarkAlgorithm *algorithm, const uint8_t *secret, const uint8_t *message, size_t length, long iterations) {
+    uint8_t mac[HMACMaxDigestLength];
+    HMACKey key;
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        HMACKeyInit(&key, algorithm->algorithm, secret, 32);
+        HMACKeyCompute(&key, message, length, mac);
+        HMACKeyWipe(&key);
+        BenchmarkSink ^= mac[0];
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+static double BenchmarkCached(const BenchmarkAlgorithm *algorithm, const uint8_t *secret, const uint8_t *message, size_t length, long iterations) {
+    uint8_t mac[HMACMaxDigestLength];
+    HMACKey key;
+    HMACKeyInit(&key, algorithm->algorithm, secret, 32);
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        HMACKeyCompute(&key, message, length, mac);
+        BenchmarkSink ^= mac[0];
+    }
+    double nanoseconds = (BenchmarkNow() - start) * 1e9 / iterations;
+    HMACKeyWipe(&key);
+    return nanoseconds;
+}
+
+static int BenchmarkCheck(const BenchmarkAlgorithm *algorithm, const uint8_t *secret, const uint8_t *message, size_t length) {
+    uint8_t expected[HMACMaxDigestLength], mac[HMACMaxDigestLength];
+    unsigned int expectedLength;
+    HMAC(algorithm->digest(), secret, 32, message, length, expected, &expectedLength);
+
+    HMACKey key;
+    HMACKeyInit(&key, algorithm->algorithm, secret, 32);
+    HMACKeyCompute(&key, message, length, mac);
+    int same = expectedLength == key.digestLength && memcmp(mac, expected, expectedLength) == 0;
+    HMACKeyWipe(&key);
+    return same;
+}
+
+static size_t BenchmarkOCRAMessage(uint8_t *message) {
+    OCRASuiteLayout layout;
+    if (OCRASuiteCompile(BenchmarkSuite, strlen(BenchmarkSuite), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+        return 0;
+    }
+
+    static const char session[] = "6e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b41f37d58e2a9c0b";
+    OCRAInput input = {
+        .question = { (const uint8_t *)"5c4a1f09e7", 10 },
+        .sessionInformation = { (const uint8_t *)session, sizeof(session) - 1 },
+    };
+    OCRAMessageAssemble(&layout, &input, message);
+    return layout.messageLength;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t secret[32];
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(0x31 + i);
+    }
+
+    uint8_t counter[8] = { 0, 0, 0, 0, 0, 0, 0x12, 0x34 };
+    uint8_t ocra[OCRASuiteMaxMessageLength];
+    size_t ocraLength = BenchmarkOCRAMessage(ocra);
+    if (ocraLength == 0) {
+        fprintf(stderr, "%s doesn't compile\n", BenchmarkSuite);
+        return 1;
+    }
+
+    const struct {
+        const uint8_t *bytes;
+        size_t length;
+    } messages[] = { { counter, sizeof(counter) }, { ocra, ocraLength } };
+
+    printf("%ld iterations, 32 byte key, %s message of %zu bytes\n\n", iterations, BenchmarkSuite, ocraLength);
+    printf("%-8s %5s %-10s %12s %12s %12s\n", "", "msg", "backend", "OpenSSL", "one-shot", "cached");
+    for (size_t a = 0; a < sizeof(BenchmarkAlgorithms) / sizeof(BenchmarkAlgorithms[0]); a++) {
+        const BenchmarkAlgorithm *algorithm = &BenchmarkAlgorithms[a];
+        for (size_t m = 0; m < sizeof(messages) / sizeof(messages[0]); m++) {
+            double openssl = BenchmarkOpenSSL(algorithm, secret, messages[m].bytes, messages[m].length, iterations);
+            for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+                if (!(*backend)->supported() || (*backend)->compress[algorithm->algorithm] == NULL) {
+                    continue;
+                }
+                HMACBackendSetActive(*backend);
+                if (!BenchmarkCheck(algorithm, secret, messages[m].bytes, messages[m].length)) {
+                    printf("%s %s: MAC differs from OpenSSL\n", algorithm->name, (*backend)->name);
+                    return 1;
+                }
+
+                double oneShot = BenchmarkOneShot(algorithm, secret, messages[m].bytes, messages[m].length, iterations);
+                double cached = BenchmarkCached(algorithm, secret, messages[m].bytes, messages[m].length, iterations);
+                printf("%-8s %4zuB %-10s %9.0f ns %9.0f ns %9.0f ns\n", algorithm->name, messages[m].length,
+                       (*backend)->name, openssl, oneShot, cached);
+            }
+        }
+    }
+
+    return 0;
+}
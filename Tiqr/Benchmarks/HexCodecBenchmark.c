@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures HexCodec throughput, in MB/s of binary data, for 20 byte (SHA-1
+ * secrets), 32 byte (SHA-256 secrets, device tokens) and 4 KB buffers:
+ *
+ *   kernel    HexEncode and HexDecode with the vector kernel the CPU
+ *             supports (named in the output)
+ *   scalar    the same after HexCodecSetScalar(true)
+ *   printf    snprintf("%02X") per byte and sscanf("%2x") per pair, the
+ *             closest thing to appendFormat: and NSScanner that runs
+ *             without Foundation
+ *
+ * Both kernels have to match the printf version on every size before
+ * timing. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/HexCodecBenchmark.c \
+ *      Tiqr/Classes/HexCodec.c -o hex-codec-benchmark && ./hex-codec-benchmark
+ */
+
+#include "HexCodec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkSeconds 0.2
+#define BenchmarkMaxLength 4096
+
+static const size_t BenchmarkLengths[] = { 20, 32, 4096 };
+
+static volatile uint8_t BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkPrintfEncode(const uint8_t *bytes, size_t length, char *hex) {
+    for (size_t i = 0; i < length; i++) {
+        snprintf(hex + 2 * i, 3, "%02X", bytes[i]);
+    }
+}
+
+static void BenchmarkScanfDecode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    for (size_t i = 0; i + 2 <= hexLength; i += 2) {
+        unsigned int value;
+        sscanf(hex + i, "%2x", &value);
+        bytes[i / 2] = (uint8_t)value;
+    }
+}
+
+static double BenchmarkEncode(void (*encode)(const uint8_t *, size_t, char *), const uint8_t *bytes, size_t length, char *hex) {
+    long calls = 0;
+    double start = BenchmarkNow(), elapsed;
+    do {
+        for (int i = 0; i < 64; i++) {
+            encode(bytes, length, hex);
+            BenchmarkSink ^= (uint8_t)hex[0];
+        }
+        calls += 64;
+        elapsed = BenchmarkNow() - start;
+    } while (elapsed < BenchmarkSeconds);
+    return calls * (double)length / elapsed / 1e6;
+}
+
+static double BenchmarkDecode(void (*decode)(const char *, size_t, uint8_t *), const char *hex, size_t length, uint8_t *bytes) {
+    long calls = 0;
+    double start = BenchmarkNow(), elapsed;
+    do {
+        for (int i = 0; i < 64; i++) {
+            decode(hex, 2 * length, bytes);
+            BenchmarkSink ^= bytes[0];
+        }
+        calls += 64;
+        elapsed = BenchmarkNow() - start;
+    } while (elapsed < BenchmarkSeconds);
+    return calls * (double)length / elapsed / 1e6;
+}
+
+static void BenchmarkHexEncode(const uint8_t *bytes, size_t length, char *hex) {
+    HexEncode(bytes, length, hex, HexCaseUpper);
+}
+
+static void BenchmarkHexDecode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    if (!HexDecode(hex, hexLength, bytes)) {
+        abort();
+    }
+}
+
+static int BenchmarkCheck(const uint8_t *bytes, size_t length) {
+    char expected[2 * BenchmarkMaxLength + 1], hex[2 * BenchmarkMaxLength + 1];
+    uint8_t decoded[BenchmarkMaxLength];
+
+    BenchmarkPrintfEncode(bytes, length, expected);
+    HexEncode(bytes, length, hex, HexCaseUpper);
+    if (memcmp(hex, expected, 2 * length) != 0) {
+        return 0;
+    }
+    // Decoding has to accept both cases
+    HexEncode(bytes, length, hex, HexCaseLower);
+    return HexDecode(hex, 2 * length, decoded) && memcmp(decoded, bytes, length) == 0 &&
+           HexDecode(expected, 2 * length, decoded) && memcmp(decoded, bytes, length) == 0;
+}
+
+int main(void) {
+    static uint8_t bytes[BenchmarkMaxLength], decoded[BenchmarkMaxLength];
+    static char hex[2 * BenchmarkMaxLength + 1];
+    uint32_t state = 0x1b873593;
+    for (size_t i = 0; i < sizeof(bytes); i++) {
+        state = state * 1664525 + 1013904223;
+        bytes[i] = (uint8_t)(state >> 24);
+    }
+
+    const char *kernel = HexCodecKernelName();
+    printf("%-8s %-7s %12s %12s %12s\n", "", "length", kernel, "scalar", "printf");
+    for (int decode = 0; decode <= 1; decode++) {
+        for (size_t l = 0; l < sizeof(BenchmarkLengths) / sizeof(BenchmarkLengths[0]); l++) {
+            size_t length = BenchmarkLengths[l];
+            double results[3];
+            for (int scalar = 0; scalar <= 1; scalar++) {
+                HexCodecSetScalar(scalar);
+                if (!BenchmarkCheck(bytes, length)) {
+                    printf("%s kernel, %zu bytes: differs from printf\n", scalar ? "scalar" : kernel, length);
+                    return 1;
+                }
+                HexEncode(bytes, length, hex, HexCaseUpper);
+                results[scalar] = decode ? BenchmarkDecode(BenchmarkHexDecode, hex, length, decoded)
+                                         : BenchmarkEncode(BenchmarkHexEncode, bytes, length, hex);
+            }
+            HexCodecSetScalar(false);
+            results[2] = decode ? BenchmarkDecode(BenchmarkScanfDecode, hex, length, decoded)
+                                : BenchmarkEncode(BenchmarkPrintfEncode, bytes, length, hex);
+            printf("%-8s %5zu B %7.0f MB/s %7.0f MB/s %7.1f MB/s\n", l == 0 ? (decode ? "decode" : "encode") : "",
+                   length, results[0], results[1], results[2]);
+        }
+    }
+
+    return 0;
+}
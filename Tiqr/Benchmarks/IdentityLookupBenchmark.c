@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the latency of looking up an identity provider and one of its
+ * identities, the two lookups of every scan, push and enrollment, for 10 to
+ * 50,000 identities:
+ *
+ *   fetch    one SELECT per lookup on the tables Core Data creates for the
+ *            Tiqr 5 model (single column indexes)
+ *   compound the same with the (identityProvider, identifier) index of the
+ *            Tiqr 6 model
+ *   index    hash lookups in memory, after loading both tables once, as
+ *            IdentityIndex does
+ *
+ * Core Data prepares a statement for every fetch and also parses the
+ * predicate and registers the objects it returns, so the fetch numbers are
+ * a lower bound for executeFetchRequest:. The index row models the hash
+ * lookup only; testLookupPerformance in IdentityIndexTests times the real
+ * IdentityIndex against executeFetchRequest: and needs the iOS simulator.
+ * Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 Tiqr/Benchmarks/IdentityLookupBenchmark.c -lsqlite3 \
+ *      -o identity-lookup-benchmark && ./identity-lookup-benchmark [lookups] [directory]
+ */
+
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BenchmarkDefaultLookups 20000
+#define BenchmarkIdentitiesPerProvider 10
+
+static const int BenchmarkIdentityCounts[] = { 10, 100, 1000, 10000, 50000 };
+
+typedef struct {
+    int64_t provider;
+    char *identifier;
+    int64_t primaryKey;
+} BenchmarkEntry;
+
+/**
+ * Open addressing on (provider, identifier), providers are filed under
+ * provider 0.
+ */
+typedef struct {
+    BenchmarkEntry *entries;
+    size_t capacity;
+} BenchmarkTable;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static uint64_t BenchmarkHash(int64_t provider, const char *identifier) {
+    uint64_t hash = 14695981039346656037ULL ^ (uint64_t)provider;
+    for (const char *c = identifier; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void BenchmarkTableInit(BenchmarkTable *table, size_t count) {
+    table->capacity = 16;
+    while (table->capacity < count * 2) {
+        table->capacity *= 2;
+    }
+    table->entries = calloc(table->capacity, sizeof(BenchmarkEntry));
+}
+
+static void BenchmarkTableFree(BenchmarkTable *table) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->entries[i].identifier);
+    }
+    free(table->entries);
+}
+
+static void BenchmarkTableInsert(BenchmarkTable *table, int64_t provider, const char *identifier, int64_t primaryKey) {
+    size_t i = BenchmarkHash(provider, identifier) & (table->capacity - 1);
+    while (table->entries[i].identifier != NULL) {
+        i = (i + 1) & (table->capacity - 1);
+    }
+    table->entries[i].provider = provider;
+    table->entries[i].identifier = strdup(identifier);
+    table->entries[i].primaryKey = primaryKey;
+}
+
+static int64_t BenchmarkTableFind(const BenchmarkTable *table, int64_t provider, const char *identifier) {
+    size_t i = BenchmarkHash(provider, identifier) & (table->capacity - 1);
+    while (table->entries[i].identifier != NULL) {
+        if (table->entries[i].provider == provider && strcmp(table->entries[i].identifier, identifier) == 0) {
+            return table->entries[i].primaryKey;
+        }
+        i = (i + 1) & (table->capacity - 1);
+    }
+    return 0;
+}
+
+static void BenchmarkExec(sqlite3 *db, const char *sql) {
+    char *message = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &message) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, message);
+        exit(1);
+    }
+}
+
+static sqlite3 *BenchmarkCreateStore(const char *path, int identities, int providers) {
+    unlink(path);
+    sqlite3 *db = NULL;
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db));
+        exit(1);
+    }
+    
+    BenchmarkExec(db, "PRAGMA journal_mode = WAL");
+    BenchmarkExec(db, "CREATE TABLE ZIDENTITYPROVIDER (Z_PK INTEGER PRIMARY KEY, Z_ENT INTEGER, Z_OPT INTEGER, "
+                      "ZAUTHENTICATIONURL VARCHAR, ZDISPLAYNAME VARCHAR, ZIDENTIFIER VARCHAR, ZINFOURL VARCHAR, ZLOGO BLOB, ZOCRASUITE VARCHAR)");
+    BenchmarkExec(db, "CREATE INDEX ZIDENTITYPROVIDER_ZIDENTIFIER_INDEX ON ZIDENTITYPROVIDER (ZIDENTIFIER)");
+    BenchmarkExec(db, "CREATE TABLE ZIDENTITY (Z_PK INTEGER PRIMARY KEY, Z_ENT INTEGER, Z_OPT INTEGER, ZSORTINDEX INTEGER, "
+                      "ZVERSION INTEGER, ZIDENTITYPROVIDER INTEGER, ZKDFROUNDS INTEGER, ZBIOMETRICIDAVAILABLE INTEGER, "
+                      "ZBIOMETRICIDENABLED INTEGER, ZBLOCKED INTEGER, ZSHOULDASKTOENROLLINBIOMETRICID INTEGER, ZTOUCHID INTEGER, "
+                      "ZDISPLAYNAME VARCHAR, ZIDENTIFIER VARCHAR, ZINITIALIZATIONVECTOR BLOB, ZSALT BLOB)");
+    BenchmarkExec(db, "CREATE INDEX ZIDENTITY_ZIDENTIFIER_INDEX ON ZIDENTITY (ZIDENTIFIER)");
+    BenchmarkExec(db, "CREATE INDEX ZIDENTITY_ZIDENTITYPROVIDER_INDEX ON ZIDENTITY (ZIDENTITYPROVIDER)");
+    BenchmarkExec(db, "CREATE INDEX ZIDENTITY_ZSORTINDEX_INDEX ON ZIDENTITY (ZSORTINDEX)");
+    
+    BenchmarkExec(db, "BEGIN");
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, "INSERT INTO ZIDENTITYPROVIDER (Z_PK, Z_ENT, Z_OPT, ZIDENTIFIER, ZDISPLAYNAME, ZAUTHENTICATIONURL, ZINFOURL) "
+                           "VALUES (?, 2, 1, ?, ?, 'https://example.org/auth/', 'https://example.org/')", -1, &statement, NULL);
+    char identifier[64];
+    for (int i = 0; i < providers; i++) {
+        snprintf(identifier, sizeof(identifier), "idp%d.example.org", i);
+        sqlite3_bind_int64(statement, 1, i + 1);
+        sqlite3_bind_text(statement, 2, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(statement, 3, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_step(statement);
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    
+    sqlite3_prepare_v2(db, "INSERT INTO ZIDENTITY (Z_PK, Z_ENT, Z_OPT, ZSORTINDEX, ZVERSION, ZIDENTITYPROVIDER, ZKDFROUNDS, ZIDENTIFIER, ZDISPLAYNAME) "
+                           "VALUES (?, 1, 1, ?, 4, ?, 0, ?, ?)", -1, &statement, NULL);
+    for (int i = 0; i < identities; i++) {
+        snprintf(identifier, sizeof(identifier), "user%d", i);
+        sqlite3_bind_int64(statement, 1, i + 1);
+        sqlite3_bind_int(statement, 2, i);
+        sqlite3_bind_int64(statement, 3, i % providers + 1);
+        sqlite3_bind_text(statement, 4, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(statement, 5, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_step(statement);
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    BenchmarkExec(db, "COMMIT");
+    return db;
+}
+
+static int64_t BenchmarkFetch(sqlite3 *db, const char *sql, int64_t provider, const char *identifier) {
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, sql, -1, &statement, NULL);
+    int index = 1;
+    if (provider != 0) {
+        sqlite3_bind_int64(statement, index++, provider);
+    }
+    sqlite3_bind_text(statement, index, identifier, -1, SQLITE_STATIC);
+    
+    int64_t primaryKey = 0;
+    int rows = 0;
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        primaryKey = sqlite3_column_int64(statement, 0);
+        rows++;
+    }
+    sqlite3_finalize(statement);
+    return rows == 1 ? primaryKey : 0;
+}
+
+/**
+ * Looks up the provider and the identity for the lookups, pseudo randomly
+ * spread over all identities; returns the microseconds per lookup pair.
+ */
+static double BenchmarkRunFetches(sqlite3 *db, int identities, int providers, int lookups) {
+    static const char *providerQuery = "SELECT Z_PK, Z_ENT, Z_OPT, ZAUTHENTICATIONURL, ZDISPLAYNAME, ZIDENTIFIER, ZINFOURL, ZLOGO, ZOCRASUITE "
+                                       "FROM ZIDENTITYPROVIDER WHERE ZIDENTIFIER = ?";
+    static const char *identityQuery = "SELECT Z_PK, Z_ENT, Z_OPT, ZSORTINDEX, ZVERSION, ZIDENTITYPROVIDER, ZKDFROUNDS, ZBIOMETRICIDAVAILABLE, "
+                                       "ZBIOMETRICIDENABLED, ZBLOCKED, ZSHOULDASKTOENROLLINBIOMETRICID, ZTOUCHID, ZDISPLAYNAME, ZIDENTIFIER, "
+                                       "ZINITIALIZATIONVECTOR, ZSALT FROM ZIDENTITY WHERE ZIDENTITYPROVIDER = ? AND ZIDENTIFIER = ?";
+    char providerIdentifier[64];
+    char identifier[64];
+    double start = BenchmarkNow();
+    for (int i = 0; i < lookups; i++) {
+        int n = (int)(((int64_t)i * 7919) % identities);
+        snprintf(providerIdentifier, sizeof(providerIdentifier), "idp%d.example.org", n % providers);
+        snprintf(identifier, sizeof(identifier), "user%d", n);
+        int64_t provider = BenchmarkFetch(db, providerQuery, 0, providerIdentifier);
+        if (provider == 0 || BenchmarkFetch(db, identityQuery, provider, identifier) != n + 1) {
+            fprintf(stderr, "fetch missed user%d\n", n);
+            exit(1);
+        }
+    }
+    return (BenchmarkNow() - start) / lookups * 1e6;
+}
+
+static void BenchmarkLoadTable(sqlite3 *db, BenchmarkTable *table, int identities, int providers) {
+    BenchmarkTableInit(table, (size_t)(identities + providers));
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, "SELECT Z_PK, ZIDENTIFIER FROM ZIDENTITYPROVIDER", -1, &statement, NULL);
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        BenchmarkTableInsert(table, 0, (const char *)sqlite3_column_text(statement, 1), sqlite3_column_int64(statement, 0));
+    }
+    sqlite3_finalize(statement);
+    
+    sqlite3_prepare_v2(db, "SELECT Z_PK, ZIDENTITYPROVIDER, ZIDENTIFIER FROM ZIDENTITY", -1, &statement, NULL);
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        BenchmarkTableInsert(table, sqlite3_column_int64(statement, 1), (const char *)sqlite3_column_text(statement, 2), sqlite3_column_int64(statement, 0));
+    }
+    sqlite3_finalize(statement);
+}
+
+static double BenchmarkRunIndex(const BenchmarkTable *table, int identities, int providers, int lookups) {
+    char providerIdentifier[64];
+    char identifier[64];
+    double start = BenchmarkNow();
+    for (int i = 0; i < lookups; i++) {
+        int n = (int)(((int64_t)i * 7919) % identities);
+        snprintf(providerIdentifier, sizeof(providerIdentifier), "idp%d.example.org", n % providers);
+        snprintf(identifier, sizeof(identifier), "user%d", n);
+        int64_t provider = BenchmarkTableFind(table, 0, providerIdentifier);
+        if (provider == 0 || BenchmarkTableFind(table, provider, identifier) != n + 1) {
+            fprintf(stderr, "index missed user%d\n", n);
+            exit(1);
+        }
+    }
+    return (BenchmarkNow() - start) / lookups * 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    int lookups = argc > 1 ? atoi(argv[1]) : BenchmarkDefaultLookups;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (lookups <= 0) {
+        fprintf(stderr, "usage: %s [lookups] [directory]\n", argv[0]);
+        return 1;
+    }
+    
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/identity-lookup-benchmark-%d.sqlite", directory, (int)getpid());
+    
+    printf("%d lookup pairs (provider + identity), %d identities per provider\n\n", lookups, BenchmarkIdentitiesPerProvider);
+    printf("%10s %14s %14s %14s %14s\n", "identities", "fetch us", "compound us", "index us", "index load ms");
+    for (size_t c = 0; c < sizeof(BenchmarkIdentityCounts) / sizeof(BenchmarkIdentityCounts[0]); c++) {
+        int identities = BenchmarkIdentityCounts[c];
+        int providers = identities / BenchmarkIdentitiesPerProvider > 0 ? identities / BenchmarkIdentitiesPerProvider : 1;
+        sqlite3 *db = BenchmarkCreateStore(path, identities, providers);
+        
+        double fetch = BenchmarkRunFetches(db, identities, providers, lookups);
+        BenchmarkExec(db, "CREATE INDEX ZIDENTITY_BYIDENTITYPROVIDERANDIDENTIFIER ON ZIDENTITY (ZIDENTITYPROVIDER, ZIDENTIFIER)");
+        BenchmarkExec(db, "ANALYZE");
+        double compound = BenchmarkRunFetches(db, identities, providers, lookups);
+        
+        BenchmarkTable table;
+        double start = BenchmarkNow();
+        BenchmarkLoadTable(db, &table, identities, providers);
+        double load = (BenchmarkNow() - start) * 1e3;
+        double index = BenchmarkRunIndex(&table, identities, providers, lookups);
+        BenchmarkTableFree(&table);
+        
+        printf("%10d %14.2f %14.2f %14.3f %14.2f\n", identities, fetch, compound, index, load);
+        sqlite3_close(db);
+        unlink(path);
+    }
+    
+    char sidecar[1100];
+    snprintf(sidecar, sizeof(sidecar), "%s-wal", path);
+    unlink(sidecar);
+    snprintf(sidecar, sizeof(sidecar), "%s-shm", path);
+    unlink(sidecar);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compares the cost of unlocking several identities that share a PIN with
+ * a PBKDF2 run per identity salt, the way secrets have been stored so far,
+ * against one run for the key encryption key of the device followed by an
+ * unwrap per identity. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/KeyHierarchyBenchmark.c \
+ *      Tiqr/Classes/KeyHierarchy.c Tiqr/Classes/SecretCipher.c Tiqr/Classes/PBKDF2.c \
+ *      Tiqr/Classes/PBKDF2Calibration.c Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c \
+ *      -lcrypto -lpthread -o key-hierarchy-benchmark && ./key-hierarchy-benchmark
+ *
+ * The round count is calibrated for the 100 ms the app budgets for a
+ * derivation.
+ */
+
+#include "KeyHierarchy.h"
+#include "PBKDF2.h"
+#include "PBKDF2Calibration.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkMaxIdentities 32
+#define BenchmarkSecretLength 32
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    uint8_t salt[32];
+    uint8_t initializationVector[SecretCipherBlockLength];
+    uint8_t legacy[BenchmarkSecretLength];
+    uint8_t wrapped[KeyHierarchyHeaderLength + BenchmarkSecretLength];
+} BenchmarkIdentity;
+
+static BenchmarkIdentity identities[BenchmarkMaxIdentities];
+static const uint8_t deviceSalt[32] = { 0xd5 };
+static const uint8_t PIN[] = "1234";
+
+static void BenchmarkEnroll(uint32_t rounds) {
+    uint8_t keyEncryptionKey[KeyHierarchyKeyLength];
+    PBKDF2Derive(HMACAlgorithmSHA256, PIN, 4, deviceSalt, sizeof(deviceSalt), rounds, keyEncryptionKey, sizeof(keyEncryptionKey));
+
+    for (int i = 0; i < BenchmarkMaxIdentities; i++) {
+        BenchmarkIdentity *identity = &identities[i];
+        uint8_t secret[BenchmarkSecretLength], dataKey[KeyHierarchyKeyLength], key[SecretCipherKeyLength];
+        memset(identity->salt, i + 1, sizeof(identity->salt));
+        memset(identity->initializationVector, i + 2, sizeof(identity->initializationVector));
+        memset(secret, i + 3, sizeof(secret));
+        memset(dataKey, i + 4, sizeof(dataKey));
+
+        PBKDF2Derive(HMACAlgorithmSHA256, PIN, 4, identity->salt, sizeof(identity->salt), rounds, key, sizeof(key));
+        SecretCipherCrypt(SecretCipherOperationEncrypt, key, identity->initializationVector, secret, sizeof(secret), identity->legacy);
+        KeyHierarchyWrap(keyEncryptionKey, dataKey, identity->initializationVector, secret, sizeof(secret), identity->wrapped, sizeof(identity->wrapped));
+    }
+}
+
+static double BenchmarkUnlockPerIdentity(int count, uint32_t rounds) {
+    double start = BenchmarkNow();
+    for (int i = 0; i < count; i++) {
+        uint8_t key[SecretCipherKeyLength], secret[BenchmarkSecretLength];
+        PBKDF2Derive(HMACAlgorithmSHA256, PIN, 4, identities[i].salt, sizeof(identities[i].salt), rounds, key, sizeof(key));
+        SecretCipherCrypt(SecretCipherOperationDecrypt, key, identities[i].initializationVector, identities[i].legacy, sizeof(secret), secret);
+    }
+    return BenchmarkNow() - start;
+}
+
+static double BenchmarkUnlockHierarchy(int count, uint32_t rounds) {
+    double start = BenchmarkNow();
+    uint8_t keyEncryptionKey[KeyHierarchyKeyLength];
+    PBKDF2Derive(HMACAlgorithmSHA256, PIN, 4, deviceSalt, sizeof(deviceSalt), rounds, keyEncryptionKey, sizeof(keyEncryptionKey));
+    for (int i = 0; i < count; i++) {
+        uint8_t secret[BenchmarkSecretLength];
+        KeyHierarchyUnwrap(keyEncryptionKey, identities[i].initializationVector, identities[i].wrapped, sizeof(identities[i].wrapped), secret, sizeof(secret));
+    }
+    return BenchmarkNow() - start;
+}
+
+static double BenchmarkUnwrapOnly(void) {
+    uint8_t keyEncryptionKey[KeyHierarchyKeyLength] = { 0 }, secret[BenchmarkSecretLength];
+    const int iterations = 100000;
+    double start = BenchmarkNow();
+    for (int i = 0; i < iterations; i++) {
+        KeyHierarchyUnwrap(keyEncryptionKey, identities[0].initializationVector, identities[0].wrapped, sizeof(identities[0].wrapped), secret, sizeof(secret));
+    }
+    return (BenchmarkNow() - start) / iterations;
+}
+
+int main(void) {
+    const PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, sizeof(deviceSalt), KeyHierarchyKeyLength };
+    uint32_t rounds = PBKDF2CalibrateRounds(&parameters, 100);
+    if (rounds == 0) {
+        printf("calibration failed\n");
+        return 1;
+    }
+    BenchmarkEnroll(rounds);
+
+    printf("%u rounds, unwrapping one identity takes %.2f us\n\n", rounds, BenchmarkUnwrapOnly() * 1e6);
+    printf("%10s %14s %14s %8s\n", "identities", "per identity", "hierarchy", "speedup");
+    for (int count = 1; count <= BenchmarkMaxIdentities; count *= 2) {
+        double perIdentity = BenchmarkUnlockPerIdentity(count, rounds);
+        double hierarchy = BenchmarkUnlockHierarchy(count, rounds);
+        printf("%10d %11.1f ms %11.1f ms %7.1fx\n", count, perIdentity * 1000, hierarchy * 1000, perIdentity / hierarchy);
+    }
+
+    return 0;
+}
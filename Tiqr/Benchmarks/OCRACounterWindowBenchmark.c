@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the worst case of OCRAVerifyCounterWindow, a response that
+ * matches none of the counters c ... c + window, for windows of 10, 100
+ * and 1000:
+ *
+ *   look-ahead  OCRAVerifyCounterWindow, which hashes the blocks in front
+ *               of the counter once and runs the candidates through
+ *               HMACBatchCompute
+ *   scratch     OCRAComputeCode per counter
+ *
+ * Both have to find a response planted at the end of the window at the
+ * same counter before timing. The second part times CounterJournalNext,
+ * the durable increment the app does before every counter based response,
+ * on a journal in the given directory. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/OCRACounterWindowBenchmark.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c \
+ *      Tiqr/Classes/CounterJournal.c -lpthread -o ocra-counter-window-benchmark && \
+ *      ./ocra-counter-window-benchmark [iterations] [directory]
+ */
+
+#include "CounterJournal.h"
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BenchmarkDefaultIterations 2000
+#define BenchmarkIncrements 2000
+#define BenchmarkCounter 40000
+
+static const char *const BenchmarkSuites[] = {
+    "OCRA-1:HOTP-SHA1-6:C-QN08",
+    "OCRA-1:HOTP-SHA256-8:C-QN08-S064",
+};
+
+static const uint32_t BenchmarkWindows[] = { 10, 100, 1000 };
+
+static volatile int BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint32_t BenchmarkCodeAt(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t counter) {
+    uint8_t field[8];
+    OCRAEncodeCounter(counter, field);
+    OCRAInput counted = *input;
+    counted.counter = (OCRABytes){ field, sizeof(field) };
+    return OCRAComputeCode(layout, key, &counted);
+}
+
+static int BenchmarkScratch(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t counter, uint32_t window, uint32_t code, uint64_t *matchedCounter) {
+    for (uint64_t candidate = counter; candidate <= counter + window; candidate++) {
+        if (BenchmarkCodeAt(layout, key, input, candidate) == code) {
+            *matchedCounter = candidate;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int BenchmarkWindow(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint32_t window, long iterations) {
+    // A code no counter in the largest window produces, and one only its last counter does
+    uint64_t matched;
+    uint32_t missing = 0;
+    while (BenchmarkScratch(layout, key, input, BenchmarkCounter, 1000, missing, &matched)) {
+        missing++;
+    }
+    uint64_t last = BenchmarkCounter + window;
+    uint32_t planted = BenchmarkCodeAt(layout, key, input, last);
+
+    uint64_t lookAheadCounter = 0, scratchCounter = 0;
+    if (!OCRAVerifyCounterWindow(layout, key, input, BenchmarkCounter, window, planted, &lookAheadCounter) ||
+        !BenchmarkScratch(layout, key, input, BenchmarkCounter, window, planted, &scratchCounter) ||
+        lookAheadCounter != scratchCounter || OCRAVerifyCounterWindow(layout, key, input, BenchmarkCounter, window, missing, NULL)) {
+        printf("window %u: searches disagree\n", window);
+        return 0;
+    }
+
+    long rounds = iterations * 10 / window + 1;
+    double start = BenchmarkNow();
+    for (long i = 0; i < rounds; i++) {
+        BenchmarkSink ^= OCRAVerifyCounterWindow(layout, key, input, BenchmarkCounter, window, missing, NULL);
+    }
+    double lookAhead = (BenchmarkNow() - start) * 1e6 / rounds;
+
+    start = BenchmarkNow();
+    for (long i = 0; i < rounds; i++) {
+        BenchmarkSink ^= BenchmarkScratch(layout, key, input, BenchmarkCounter, window, missing, &matched);
+    }
+    double scratch = (BenchmarkNow() - start) * 1e6 / rounds;
+
+    printf(" %9.1f us %9.1f us", lookAhead, scratch);
+    return 1;
+}
+
+static int BenchmarkJournal(const char *directory) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/ocra-counter-window-benchmark-%d.journal", directory, (int)getpid());
+
+    CounterJournal *journal;
+    int result = CounterJournalOpen(path, &journal);
+    if (result != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(result));
+        return 0;
+    }
+
+    uint64_t counter = 0;
+    double start = BenchmarkNow();
+    for (int i = 0; i < BenchmarkIncrements && result == 0; i++) {
+        result = CounterJournalNext(journal, "identity", &counter);
+    }
+    double seconds = BenchmarkNow() - start;
+    CounterJournalClose(journal);
+    unlink(path);
+
+    if (result != 0 || counter != BenchmarkIncrements - 1) {
+        fprintf(stderr, "journal increment failed: %s\n", strerror(result));
+        return 0;
+    }
+    printf("\n%d journal increments in %s: %.1f us each\n", BenchmarkIncrements, directory, seconds * 1e6 / BenchmarkIncrements);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t secret[32];
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(0x5a ^ (i * 7));
+    }
+
+    printf("%ld iterations, look-ahead vs scratch without a match\n\n", iterations);
+    printf("%-34s", "suite");
+    for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+        char label[32];
+        snprintf(label, sizeof(label), "window %u", BenchmarkWindows[w]);
+        printf("%26s", label);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(BenchmarkSuites) / sizeof(BenchmarkSuites[0]); s++) {
+        OCRASuiteLayout layout;
+        if (OCRASuiteCompile(BenchmarkSuites[s], strlen(BenchmarkSuites[s]), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+            fprintf(stderr, "%s doesn't compile\n", BenchmarkSuites[s]);
+            return 1;
+        }
+        HMACAlgorithm algorithm;
+        OCRAHMACAlgorithm(layout.algorithm, &algorithm);
+        HMACKey key;
+        HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+
+        uint8_t question[128], session[512];
+        OCRAMessageSetNumericField(question, layout.questionLength, "73120954", 8);
+        OCRAMessageSetHexField(session, layout.sessionInformationLength, "9c4e1f7b2a6d8e3f", 16, OCRAFieldAlignmentRight);
+        const OCRAInput input = {
+            .question = { question, layout.questionLength },
+            .sessionInformation = { session, layout.sessionInformationLength },
+        };
+
+        printf("%-34s", BenchmarkSuites[s]);
+        for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+            if (!BenchmarkWindow(&layout, &key, &input, BenchmarkWindows[w], iterations)) {
+                return 1;
+            }
+        }
+        printf("\n");
+        HMACKeyWipe(&key);
+    }
+
+    return BenchmarkJournal(directory) ? 0 : 1;
+}
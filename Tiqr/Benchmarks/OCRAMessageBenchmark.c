@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures assembling one OCRA-1:HOTP-SHA1-6:C-QH40-S### message for each
+ * session information size, with a 32 digit session key the way tiqr
+ * servers send it:
+ *
+ *   strings   a C rendering of what OCRA.m did before OCRAMessage: pad
+ *             every field one "0" at a time into a freshly allocated
+ *             string, then decode it one byte at a time, each through a
+ *             new two character string and scanner
+ *   layout    OCRAMessageSetHexField into fixed size stack fields and
+ *             OCRAMessageAssemble, as OCRA.m does now
+ *
+ * Both produce the same bytes, which is checked before timing. The
+ * allocation column counts what the string version allocates per message;
+ * OcraTests checks that OCRAMessage allocates nothing. Build and run on
+ * Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/OCRAMessageBenchmark.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c \
+ *      -lpthread -o ocra-message-benchmark && ./ocra-message-benchmark [iterations]
+ */
+
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkDefaultIterations 20000
+
+static const char BenchmarkCounter[] = "1a";
+static const char BenchmarkQuestion[] = "8f3a2b1c09";
+static const char BenchmarkSession[] = "9c4e1f7b2a6d8e3f0b5c7a9d1e2f4a6b";
+
+static size_t BenchmarkAllocations;
+static volatile uint8_t BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void *BenchmarkAllocate(size_t size) {
+    void *pointer = malloc(size);
+    if (pointer == NULL) {
+        abort();
+    }
+    BenchmarkAllocations++;
+    return pointer;
+}
+
+/* [@"0" stringByAppendingString:string], or appending when padding right */
+static char *BenchmarkPad(const char *value, size_t length, int right) {
+    char *string = BenchmarkAllocate(strlen(value) + 1);
+    strcpy(string, value);
+    for (size_t current = strlen(string); current < length; current++) {
+        char *padded = BenchmarkAllocate(current + 2);
+        if (right) {
+            memcpy(padded, string, current);
+            padded[current] = '0';
+        } else {
+            padded[0] = '0';
+            memcpy(padded + 1, string, current);
+        }
+        padded[current + 1] = '\0';
+        free(string);
+        string = padded;
+    }
+    return string;
+}
+
+/* hexToBytes:, a substring and an NSScanner per byte into NSMutableData */
+static void BenchmarkDecode(const char *hex, uint8_t *field, size_t fieldLength) {
+    size_t capacity = 16, length = 0;
+    uint8_t *data = BenchmarkAllocate(capacity);
+    for (size_t i = 0; i + 2 <= strlen(hex); i += 2) {
+        char *pair = BenchmarkAllocate(3);
+        memcpy(pair, hex + i, 2);
+        pair[2] = '\0';
+        unsigned int *scanner = BenchmarkAllocate(sizeof(unsigned int));
+        sscanf(pair, "%x", scanner);
+        if (length == capacity) {
+            capacity *= 2;
+            uint8_t *grown = BenchmarkAllocate(capacity);
+            memcpy(grown, data, length);
+            free(data);
+            data = grown;
+        }
+        data[length++] = (uint8_t)*scanner;
+        free(scanner);
+        free(pair);
+    }
+    memcpy(field, data, length < fieldLength ? length : fieldLength);
+    free(data);
+}
+
+static void BenchmarkStrings(const OCRASuiteLayout *layout, uint8_t *message) {
+    memcpy(message, layout->suite, layout->suiteLength + 1);
+
+    char *counter = BenchmarkPad(BenchmarkCounter, layout->counterLength * 2, 0);
+    BenchmarkDecode(counter, message + layout->counterOffset, layout->counterLength);
+    char *question = BenchmarkPad(BenchmarkQuestion, layout->questionLength * 2, 1);
+    BenchmarkDecode(question, message + layout->questionOffset, layout->questionLength);
+    char *session = BenchmarkPad(BenchmarkSession, layout->sessionInformationLength * 2, 0);
+    BenchmarkDecode(session, message + layout->sessionInformationOffset, layout->sessionInformationLength);
+
+    free(counter);
+    free(question);
+    free(session);
+}
+
+/* What OCRA.m does now: decode every field into its final shape, then assemble */
+static void BenchmarkLayout(const OCRASuiteLayout *layout, uint8_t *message) {
+    uint8_t counter[8], question[128], session[512];
+    OCRAMessageSetHexField(counter, layout->counterLength, BenchmarkCounter, sizeof(BenchmarkCounter) - 1, OCRAFieldAlignmentRight);
+    OCRAMessageSetHexField(question, layout->questionLength, BenchmarkQuestion, sizeof(BenchmarkQuestion) - 1, OCRAFieldAlignmentLeft);
+    OCRAMessageSetHexField(session, layout->sessionInformationLength, BenchmarkSession, sizeof(BenchmarkSession) - 1, OCRAFieldAlignmentRight);
+
+    const OCRAInput input = {
+        .counter = { counter, layout->counterLength },
+        .question = { question, layout->questionLength },
+        .sessionInformation = { session, layout->sessionInformationLength },
+    };
+    OCRAMessageAssemble(layout, &input, message);
+}
+
+static double BenchmarkRun(void (*assemble)(const OCRASuiteLayout *, uint8_t *), const OCRASuiteLayout *layout, long iterations) {
+    uint8_t message[OCRASuiteMaxMessageLength];
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        assemble(layout, message);
+        BenchmarkSink ^= message[layout->messageLength - 1];
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%ld iterations\n\n", iterations);
+    printf("%-32s %13s %13s %10s %13s\n", "suite", "strings", "layout", "speedup", "allocations");
+    for (int size = 64; size <= 512; size *= 2) {
+        char suite[OCRASuiteMaxLength];
+        snprintf(suite, sizeof(suite), "OCRA-1:HOTP-SHA1-6:C-QH40-S%03d", size);
+        OCRASuiteLayout layout;
+        if (OCRASuiteCompile(suite, strlen(suite), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+            fprintf(stderr, "%s doesn't compile\n", suite);
+            return 1;
+        }
+
+        uint8_t expected[OCRASuiteMaxMessageLength], message[OCRASuiteMaxMessageLength];
+        BenchmarkAllocations = 0;
+        BenchmarkStrings(&layout, expected);
+        size_t allocations = BenchmarkAllocations;
+        BenchmarkLayout(&layout, message);
+        if (memcmp(message, expected, layout.messageLength) != 0) {
+            printf("%s: messages differ\n", suite);
+            return 1;
+        }
+
+        double strings = BenchmarkRun(BenchmarkStrings, &layout, iterations);
+        double assembled = BenchmarkRun(BenchmarkLayout, &layout, iterations * 100);
+        printf("%-32s %10.0f ns %10.1f ns %9.0fx %13zu\n", suite, strings, assembled, strings / assembled, allocations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures converting numeric (QN) OCRA questions to their hex value:
+ *
+ *   kernel    OCRANumericQuestionToHex for 8, 16, 32 and 64 digits
+ *   batch     OCRAMessageSetNumericFields filling 1024 question fields
+ *   strtoull  strtoull plus snprintf("%llX"), the closest thing to the
+ *             old NSDecimalNumber path that runs without Foundation; it
+ *             only covers questions up to 19 digits
+ *
+ * Every conversion is first checked against a byte-wise multiply and add
+ * reference, for random questions of every length from 1 to 64 digits.
+ * Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/OCRANumericQuestionBenchmark.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/HexCodec.c Tiqr/Classes/HMACKey.c \
+ *      Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c -lpthread \
+ *      -o ocra-numeric-question-benchmark && ./ocra-numeric-question-benchmark [iterations]
+ */
+
+#include "OCRAMessage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkDefaultIterations 2000000
+#define BenchmarkQuestions 1024
+#define BenchmarkChecks 100000
+#define BenchmarkFieldLength 128
+
+static const size_t BenchmarkDigits[] = { 8, 16, 32, 64 };
+
+static volatile size_t BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint32_t BenchmarkRandom(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void BenchmarkQuestion(char *decimal, size_t length, uint32_t *state) {
+    for (size_t i = 0; i < length; i++) {
+        decimal[i] = (char)('0' + BenchmarkRandom(state) % 10);
+    }
+    decimal[length] = '\0';
+}
+
+/* value = value * 10 + digit on a big endian byte array, then %X without leading zeros */
+static void BenchmarkReference(const char *decimal, size_t length, char *hex) {
+    uint8_t value[OCRAMaxNumericQuestionHexLength / 2 + 1] = { 0 };
+    for (size_t i = 0; i < length; i++) {
+        unsigned carry = (unsigned)(decimal[i] - '0');
+        for (size_t j = sizeof(value); j-- > 0;) {
+            carry += value[j] * 10u;
+            value[j] = (uint8_t)carry;
+            carry >>= 8;
+        }
+    }
+
+    static const char digits[] = "0123456789ABCDEF";
+    size_t written = 0;
+    for (size_t j = 0; j < sizeof(value); j++) {
+        for (int shift = 4; shift >= 0; shift -= 4) {
+            unsigned nibble = (value[j] >> shift) & 0xf;
+            if (nibble != 0 || written > 0) {
+                hex[written++] = digits[nibble];
+            }
+        }
+    }
+    if (written == 0) {
+        hex[written++] = '0';
+    }
+    hex[written] = '\0';
+}
+
+static int BenchmarkCheck(void) {
+    uint32_t state = 0x2545f491;
+    char decimal[OCRAMaxNumericQuestionDigits + 1];
+    char hex[OCRAMaxNumericQuestionHexLength + 1], expected[OCRAMaxNumericQuestionHexLength + 1];
+    for (int i = 0; i < BenchmarkChecks; i++) {
+        size_t length = 1 + (size_t)i % OCRAMaxNumericQuestionDigits;
+        BenchmarkQuestion(decimal, length, &state);
+        BenchmarkReference(decimal, length, expected);
+        if (OCRANumericQuestionToHex(decimal, length, hex) != strlen(expected) || strcmp(hex, expected) != 0) {
+            printf("%s: %s, expected %s\n", decimal, hex, expected);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static double BenchmarkKernel(char (*questions)[OCRAMaxNumericQuestionDigits + 1], size_t digits, long iterations) {
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        BenchmarkSink += OCRANumericQuestionToHex(questions[i % BenchmarkQuestions], digits, hex);
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+static double BenchmarkStrtoull(char (*questions)[OCRAMaxNumericQuestionDigits + 1], long iterations) {
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    double start = BenchmarkNow();
+    for (long i = 0; i < iterations; i++) {
+        unsigned long long value = strtoull(questions[i % BenchmarkQuestions], NULL, 10);
+        BenchmarkSink += (size_t)snprintf(hex, sizeof(hex), "%llX", value);
+    }
+    return (BenchmarkNow() - start) * 1e9 / iterations;
+}
+
+static double BenchmarkBatch(char (*questions)[OCRAMaxNumericQuestionDigits + 1], size_t digits, long iterations) {
+    static uint8_t fields[BenchmarkQuestions][BenchmarkFieldLength];
+    OCRABytes decimals[BenchmarkQuestions];
+    for (size_t i = 0; i < BenchmarkQuestions; i++) {
+        decimals[i] = (OCRABytes){ (const uint8_t *)questions[i], digits };
+    }
+
+    long rounds = iterations / BenchmarkQuestions + 1;
+    double start = BenchmarkNow();
+    for (long i = 0; i < rounds; i++) {
+        BenchmarkSink += OCRAMessageSetNumericFields(&fields[0][0], BenchmarkFieldLength, decimals, BenchmarkQuestions);
+    }
+    return (BenchmarkNow() - start) * 1e9 / ((double)rounds * BenchmarkQuestions);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    if (!BenchmarkCheck()) {
+        return 1;
+    }
+
+    static char questions[BenchmarkQuestions][OCRAMaxNumericQuestionDigits + 1];
+    printf("%ld iterations, %d random questions of every length checked\n\n", iterations, BenchmarkChecks);
+    printf("%-8s %12s %12s %12s\n", "digits", "kernel", "batch", "strtoull");
+    for (size_t d = 0; d < sizeof(BenchmarkDigits) / sizeof(BenchmarkDigits[0]); d++) {
+        size_t digits = BenchmarkDigits[d];
+        uint32_t state = 0x6c8e9cf5 + (uint32_t)digits;
+        for (size_t i = 0; i < BenchmarkQuestions; i++) {
+            BenchmarkQuestion(questions[i], digits, &state);
+        }
+
+        double kernel = BenchmarkKernel(questions, digits, iterations);
+        double batch = BenchmarkBatch(questions, digits, iterations);
+        printf("%-8zu %9.1f ns %9.1f ns", digits, kernel, batch);
+        if (digits <= 19) {
+            printf(" %9.1f ns\n", BenchmarkStrtoull(questions, iterations));
+        } else {
+            printf(" %12s\n", "-");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the worst case of OCRAVerifyTimeWindow, a response that matches
+ * no step, for windows of +/-1 to +/-100 time steps:
+ *
+ *   absorbed  OCRAVerifyTimeWindow, which hashes the blocks in front of
+ *             the timestamp once and only the rest per step
+ *   naive     OCRAComputeCode per step with the timestamp field rewritten
+ *
+ * Both search the steps in the same order. Before timing, each search
+ * has to find a response planted at the edge of the window with the same
+ * drift. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/OCRATimeWindowBenchmark.c \
+ *      Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c Tiqr/Classes/HexCodec.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c Tiqr/Classes/HMACBatch.c \
+ *      -lpthread -o ocra-time-window-benchmark && ./ocra-time-window-benchmark [iterations]
+ */
+
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkDefaultIterations 20000
+#define BenchmarkUnixTime 1700000000
+
+static const char *const BenchmarkSuites[] = {
+    "OCRA-1:HOTP-SHA1-6:QN08-T1M",
+    "OCRA-1:HOTP-SHA256-8:QN08-S064-T1M",
+};
+
+static const uint32_t BenchmarkWindows[] = { 1, 5, 10, 50, 100 };
+
+static volatile int BenchmarkSink;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static uint64_t BenchmarkStep(uint64_t currentSteps, uint32_t attempt) {
+    // 0, -1, +1, -2, +2, ... like OCRAVerifyTimeWindow
+    uint64_t distance = (attempt + 1) / 2;
+    return attempt % 2 == 1 ? currentSteps - distance : currentSteps + distance;
+}
+
+static uint32_t BenchmarkCodeAt(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t steps) {
+    uint8_t timestamp[8];
+    OCRAEncodeTimestamp(steps, timestamp);
+    OCRAInput stamped = *input;
+    stamped.timestamp = (OCRABytes){ timestamp, sizeof(timestamp) };
+    return OCRAComputeCode(layout, key, &stamped);
+}
+
+static int BenchmarkNaive(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t currentSteps, uint32_t window, uint32_t code, int64_t *drift) {
+    for (uint32_t attempt = 0; attempt <= 2 * window; attempt++) {
+        uint64_t steps = BenchmarkStep(currentSteps, attempt);
+        if (BenchmarkCodeAt(layout, key, input, steps) == code) {
+            *drift = (int64_t)(steps - currentSteps);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t BenchmarkMissingCode(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t currentSteps) {
+    int64_t drift;
+    uint32_t code = 0;
+    while (BenchmarkNaive(layout, key, input, currentSteps, 100, code, &drift)) {
+        code++;
+    }
+    return code;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BenchmarkDefaultIterations;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t secret[32];
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(0x30 + i);
+    }
+
+    printf("%ld iterations, us per verification without a match\n\n", iterations);
+    printf("%-36s %-9s", "suite", "");
+    for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+        char label[16];
+        snprintf(label, sizeof(label), "+/-%u", BenchmarkWindows[w]);
+        printf(" %9s", label);
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(BenchmarkSuites) / sizeof(BenchmarkSuites[0]); s++) {
+        OCRASuiteLayout layout;
+        if (OCRASuiteCompile(BenchmarkSuites[s], strlen(BenchmarkSuites[s]), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+            fprintf(stderr, "%s doesn't compile\n", BenchmarkSuites[s]);
+            return 1;
+        }
+        HMACAlgorithm algorithm;
+        OCRAHMACAlgorithm(layout.algorithm, &algorithm);
+        HMACKey key;
+        HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+
+        uint8_t question[128], session[512];
+        OCRAMessageSetNumericField(question, layout.questionLength, "40231187", 8);
+        OCRAMessageSetHexField(session, layout.sessionInformationLength, "9c4e1f7b2a6d8e3f", 16, OCRAFieldAlignmentRight);
+        const OCRAInput input = {
+            .question = { question, layout.questionLength },
+            .sessionInformation = { session, layout.sessionInformationLength },
+        };
+        uint64_t currentSteps = OCRATimeStepsForTime(&layout, BenchmarkUnixTime);
+
+        double absorbed[sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0])];
+        double naive[sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0])];
+        uint32_t missing = BenchmarkMissingCode(&layout, &key, &input, currentSteps);
+        for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+            uint32_t window = BenchmarkWindows[w];
+
+            // The first step at the edge of the window with a code of its own
+            uint32_t planted = 0;
+            uint64_t plantedSteps = 0;
+            for (uint32_t attempt = 2 * window; ; attempt--) {
+                plantedSteps = BenchmarkStep(currentSteps, attempt);
+                planted = BenchmarkCodeAt(&layout, &key, &input, plantedSteps);
+                int64_t first;
+                if (BenchmarkNaive(&layout, &key, &input, currentSteps, window, planted, &first) &&
+                    first == (int64_t)(plantedSteps - currentSteps)) {
+                    break;
+                }
+            }
+            int64_t drift = 0, naiveDrift = 0;
+            if (!OCRAVerifyTimeWindow(&layout, &key, &input, currentSteps, window, planted, &drift) ||
+                !BenchmarkNaive(&layout, &key, &input, currentSteps, window, planted, &naiveDrift) ||
+                drift != naiveDrift || OCRAVerifyTimeWindow(&layout, &key, &input, currentSteps, window, missing, NULL)) {
+                printf("%s +/-%u: searches disagree\n", BenchmarkSuites[s], window);
+                return 1;
+            }
+
+            long rounds = iterations / window + 1;
+            double start = BenchmarkNow();
+            for (long i = 0; i < rounds; i++) {
+                BenchmarkSink ^= OCRAVerifyTimeWindow(&layout, &key, &input, currentSteps, window, missing, NULL);
+            }
+            absorbed[w] = (BenchmarkNow() - start) * 1e6 / rounds;
+
+            start = BenchmarkNow();
+            for (long i = 0; i < rounds; i++) {
+                BenchmarkSink ^= BenchmarkNaive(&layout, &key, &input, currentSteps, window, missing, &naiveDrift);
+            }
+            naive[w] = (BenchmarkNow() - start) * 1e6 / rounds;
+        }
+        HMACKeyWipe(&key);
+
+        printf("%-36s %-9s", BenchmarkSuites[s], "absorbed");
+        for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+            printf(" %9.2f", absorbed[w]);
+        }
+        printf("\n%-36s %-9s", "", "naive");
+        for (size_t w = 0; w < sizeof(BenchmarkWindows) / sizeof(BenchmarkWindows[0]); w++) {
+            printf(" %9.2f", naive[w]);
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
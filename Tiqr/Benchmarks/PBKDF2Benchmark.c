@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures PBKDF2-HMAC-SHA256 iterations per second for every HMAC backend
+ * the CPU supports, next to a loop that runs a complete HMAC per iteration
+ * the way a generic implementation does. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/PBKDF2Benchmark.c \
+ *      Tiqr/Classes/PBKDF2.c Tiqr/Classes/PBKDF2Calibration.c Tiqr/Classes/HMACKey.c \
+ *      Tiqr/Classes/HMACBackend*.c -lpthread -o pbkdf2-benchmark && ./pbkdf2-benchmark
+ *
+ * The last column is the round count that fits the 100 ms the app budgets
+ * for unlocking an identity. The second table runs the calibration the app
+ * uses for that budget a few times per backend: the spread of the round
+ * counts it picks, how long calibrating takes and how long a derivation
+ * with the median count then really takes.
+ */
+
+#include "PBKDF2.h"
+#include "PBKDF2Calibration.h"
+#include "HMACBackend.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkRounds 200000
+#define BenchmarkBudgetSeconds 0.1
+#define BenchmarkCalibrations 7
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkReport(const char *name, double seconds) {
+    double perSecond = BenchmarkRounds / seconds;
+    printf("%-24s %12.0f %10.1f ns %10.0f\n", name, perSecond, 1e9 / perSecond, perSecond * BenchmarkBudgetSeconds);
+}
+
+static double BenchmarkPBKDF2(uint8_t *key) {
+    static const uint8_t salt[32] = { 0 };
+    double best = 1e9;
+    for (int run = 0; run < 3; run++) {
+        double start = BenchmarkNow();
+        PBKDF2Derive(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, salt, sizeof(salt), BenchmarkRounds, key, 32);
+        double seconds = BenchmarkNow() - start;
+        best = seconds < best ? seconds : best;
+    }
+    return best;
+}
+
+static double BenchmarkGeneric(uint8_t *key) {
+    static const uint8_t salt[36] = { [35] = 1 };
+    double best = 1e9;
+    for (int run = 0; run < 3; run++) {
+        double start = BenchmarkNow();
+        uint8_t u[32];
+        HMACKey hmac;
+        HMACKeyInit(&hmac, HMACAlgorithmSHA256, (const uint8_t *)"1234", 4);
+        HMACKeyCompute(&hmac, salt, sizeof(salt), u);
+        memcpy(key, u, 32);
+        for (int round = 1; round < BenchmarkRounds; round++) {
+            HMACKeyCompute(&hmac, u, 32, u);
+            for (int i = 0; i < 32; i++) {
+                key[i] ^= u[i];
+            }
+        }
+        double seconds = BenchmarkNow() - start;
+        best = seconds < best ? seconds : best;
+    }
+    return best;
+}
+
+static int BenchmarkCompareRounds(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void BenchmarkCalibration(const char *name) {
+    static const uint8_t salt[32] = { 0 };
+    const PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, sizeof(salt), 32 };
+    uint32_t rounds[BenchmarkCalibrations];
+    uint8_t key[32];
+
+    double start = BenchmarkNow();
+    for (int run = 0; run < BenchmarkCalibrations; run++) {
+        rounds[run] = PBKDF2CalibrateRounds(&parameters, (uint32_t)(BenchmarkBudgetSeconds * 1000));
+    }
+    double calibrationSeconds = (BenchmarkNow() - start) / BenchmarkCalibrations;
+    qsort(rounds, BenchmarkCalibrations, sizeof(rounds[0]), BenchmarkCompareRounds);
+
+    uint32_t median = rounds[BenchmarkCalibrations / 2];
+    start = BenchmarkNow();
+    PBKDF2Derive(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, salt, sizeof(salt), median, key, sizeof(key));
+    double derivationSeconds = BenchmarkNow() - start;
+
+    printf("%-24s %10u %10u %10u %8.1f ms %8.1f ms\n", name, rounds[0], median, rounds[BenchmarkCalibrations - 1],
+           calibrationSeconds * 1000, derivationSeconds * 1000);
+}
+
+int main(void) {
+    uint8_t reference[32], key[32];
+
+    printf("%-24s %12s %13s %10s\n", "backend", "rounds/s", "per round", "in 100 ms");
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if (!(*backend)->supported()) {
+            continue;
+        }
+        HMACBackendSetActive(*backend);
+
+        char name[64];
+        snprintf(name, sizeof(name), "%s HMAC per round", (*backend)->name);
+        BenchmarkReport(name, BenchmarkGeneric(reference));
+
+        BenchmarkReport((*backend)->name, BenchmarkPBKDF2(key));
+        if (memcmp(key, reference, sizeof(key)) != 0) {
+            printf("%s: derived key differs\n", (*backend)->name);
+            return 1;
+        }
+    }
+
+    printf("\n%-24s %10s %10s %10s %11s %11s\n", "calibration", "min", "median", "max", "calibrate", "derive");
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if ((*backend)->supported()) {
+            HMACBackendSetActive(*backend);
+            BenchmarkCalibration((*backend)->name);
+        }
+    }
+
+    return 0;
+}
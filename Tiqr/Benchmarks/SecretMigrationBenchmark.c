@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Checks SecretMigration against version 3 secrets recorded with an
+ * independent implementation (Python's hashlib and the openssl command
+ * line tool) and then measures how fast it migrates a few thousand
+ * identities. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/SecretMigrationBenchmark.c \
+ *      Tiqr/Classes/SecretMigration.c Tiqr/Classes/SecretCipher.c Tiqr/Classes/PBKDF2.c \
+ *      Tiqr/Classes/HexCodec.c Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c \
+ *      -lcrypto -lpthread -o secret-migration-benchmark && ./secret-migration-benchmark
+ *
+ * The benchmark uses few rounds so it finishes quickly, the cost of a
+ * migration on a device is dominated by its derivations.
+ */
+
+#include "SecretMigration.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BenchmarkIdentities 4096
+#define BenchmarkRounds 1000
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkHex(const char *hex, uint8_t *bytes) {
+    for (size_t i = 0; hex[2 * i] != 0; i++) {
+        sscanf(hex + 2 * i, "%2hhx", &bytes[i]);
+    }
+}
+
+typedef struct {
+    const char *PIN;
+    uint8_t saltStart;
+    uint8_t initializationVectorStart;
+    uint32_t rounds;
+    const char *version3;
+    const char *version4;
+} BenchmarkRecording;
+
+/*
+ * Salts and initialization vectors count up from their start byte, a
+ * start of 0 for the initialization vector means none (zeroes). The two
+ * identities with PIN 1234 share a salt, so they share a derivation.
+ */
+static const BenchmarkRecording recordings[] = {
+    { "1234", 0x00, 0x20, 32894,
+      "780e512713efec5e397795e840f8c4577eeece9b54ce7ea58c83f1abd720d839",
+      "35af5add16df4fe08d7ce5faf05aef9e67d269f189f46ea2e4ff429429023036" },
+    { "1234", 0x00, 0x60, 32894,
+      "30d989d6dab1da0e52a763a0958d85b88d322eef15c3745a6901f997c96c9c6a",
+      "c80e5d62994e4648459cabe698fa1f972576f3f190a4c75bd78ddcbc2db3e239" },
+    { "98765", 0xa0, 0x00, 10000,
+      "2cf38d38e124434b7a009be9fcb0529b62a8d2f526d61bd2de5a85fca61ffa25",
+      "fa82f071ecbfb990a8f5206a82ad0edb4408016bfb8f4714f174ff3495ff05bb" },
+};
+
+#define BenchmarkRecordingCount (sizeof(recordings) / sizeof(recordings[0]))
+
+/**
+ * Stands in for the keychain, adds up the bytes of the migrated secrets it
+ * is handed so the runs can check that every secret reached it.
+ */
+static int BenchmarkWrite(void *context, SecretMigrationItem *const *items, size_t count) {
+    size_t *written = context;
+    for (size_t i = 0; i < count; i++) {
+        *written += items[i]->secretLength;
+    }
+    return 0;
+}
+
+static int BenchmarkCheckRecordings(void) {
+    uint8_t salts[BenchmarkRecordingCount][32], initializationVectors[BenchmarkRecordingCount][SecretCipherBlockLength];
+    uint8_t secrets[BenchmarkRecordingCount][32], expected[BenchmarkRecordingCount][32];
+    SecretMigrationItem items[BenchmarkRecordingCount];
+    memset(items, 0, sizeof(items));
+
+    for (size_t i = 0; i < BenchmarkRecordingCount; i++) {
+        const BenchmarkRecording *recording = &recordings[i];
+        for (int j = 0; j < 32; j++) {
+            salts[i][j] = (uint8_t)(recording->saltStart + j);
+        }
+        for (int j = 0; j < SecretCipherBlockLength; j++) {
+            initializationVectors[i][j] = (uint8_t)(recording->initializationVectorStart + j);
+        }
+        BenchmarkHex(recording->version3, secrets[i]);
+        BenchmarkHex(recording->version4, expected[i]);
+
+        items[i].PIN = (const uint8_t *)recording->PIN;
+        items[i].PINLength = strlen(recording->PIN);
+        items[i].salt = salts[i];
+        items[i].saltLength = sizeof(salts[i]);
+        items[i].rounds = recording->rounds;
+        items[i].initializationVector = recording->initializationVectorStart != 0 ? initializationVectors[i] : NULL;
+        items[i].secret = secrets[i];
+        items[i].secretLength = sizeof(secrets[i]);
+    }
+
+    SecretMigrationPool *pool;
+    SecretMigrationStatistics statistics;
+    size_t written = 0;
+    if (SecretMigrationPoolCreate(2, 4, &pool) != 0) {
+        printf("creating the pool failed\n");
+        return 1;
+    }
+    int result = SecretMigrationRun(pool, items, BenchmarkRecordingCount, BenchmarkWrite, &written, &statistics);
+    SecretMigrationPoolDestroy(pool);
+
+    for (size_t i = 0; i < BenchmarkRecordingCount; i++) {
+        if (result != 0 || items[i].result != 0 || memcmp(items[i].migratedSecret, expected[i], sizeof(expected[i])) != 0) {
+            printf("recording %zu: migrated secret differs\n", i);
+            return 1;
+        }
+    }
+    if (written != BenchmarkRecordingCount * sizeof(expected[0])) {
+        printf("%zu of %zu migrated bytes written\n", written, BenchmarkRecordingCount * sizeof(expected[0]));
+        return 1;
+    }
+    printf("%zu recorded secrets migrated with %zu derivations in %zu batches\n\n",
+           statistics.migrated, statistics.derivations, statistics.batches);
+    return 0;
+}
+
+static void BenchmarkRun(const char *name, int distinctSalts, size_t batchSize) {
+    static SecretMigrationItem items[BenchmarkIdentities];
+    static uint8_t salts[BenchmarkIdentities][32];
+    static uint8_t secret[32];
+
+    for (size_t i = 0; i < BenchmarkIdentities; i++) {
+        memset(salts[i], 0, sizeof(salts[i]));
+        if (distinctSalts) {
+            memcpy(salts[i], &i, sizeof(i));
+        }
+        SecretMigrationItem item = {
+            .PIN = (const uint8_t *)"1234", .PINLength = 4,
+            .salt = salts[i], .saltLength = sizeof(salts[i]),
+            .rounds = BenchmarkRounds,
+            .secret = secret, .secretLength = sizeof(secret)
+        };
+        items[i] = item;
+    }
+
+    SecretMigrationPool *pool;
+    SecretMigrationStatistics statistics;
+    size_t written = 0;
+    if (SecretMigrationPoolCreate(batchSize, 64, &pool) != 0) {
+        printf("%s: creating the pool failed\n", name);
+        return;
+    }
+    double start = BenchmarkNow();
+    SecretMigrationRun(pool, items, BenchmarkIdentities, BenchmarkWrite, &written, &statistics);
+    double seconds = BenchmarkNow() - start;
+    SecretMigrationPoolDestroy(pool);
+    if (written != BenchmarkIdentities * sizeof(secret)) {
+        printf("%s: %zu of %zu migrated bytes written\n", name, written, BenchmarkIdentities * sizeof(secret));
+        return;
+    }
+
+    printf("%-28s %6zu %12zu %8zu %10.2f us\n", name, batchSize, statistics.derivations, statistics.batches,
+           seconds * 1e6 / BenchmarkIdentities);
+}
+
+int main(void) {
+    if (BenchmarkCheckRecordings() != 0) {
+        return 1;
+    }
+
+    printf("%d identities, %d rounds\n", BenchmarkIdentities, BenchmarkRounds);
+    printf("%-28s %6s %12s %8s %13s\n", "", "batch", "derivations", "writes", "per identity");
+    BenchmarkRun("salt per identity", 1, 1);
+    BenchmarkRun("salt per identity", 1, 64);
+    BenchmarkRun("shared PIN and salt", 0, 1);
+    BenchmarkRun("shared PIN and salt", 0, 64);
+
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures the store, load, update and delete throughput of SecretStoreFile
+ * with a few thousand identities spread over a handful of identity
+ * providers, plus the cost of replaying and compacting the file. Build and
+ * run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/SecretStoreBenchmark.c \
+ *      Tiqr/Classes/SecretStoreFile.c Tiqr/Classes/SecretCipher.c Tiqr/Classes/HMACKey.c \
+ *      Tiqr/Classes/HMACBackend*.c -lcrypto -lpthread -o secret-store-benchmark && \
+ *      ./secret-store-benchmark [identities] [directory]
+ *
+ * Every write is synced like it is in the app, so run it in the directory
+ * of the file system you care about; it defaults to /tmp.
+ */
+
+#include "SecretStoreFile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BenchmarkDefaultIdentities 4096
+#define BenchmarkProviders 8
+// A version 4 secret; secrets under the key hierarchy are 68 bytes
+#define BenchmarkSecretLength 32
+#define BenchmarkWrappedSecretLength 68
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkName(size_t identity, char *service, char *account) {
+    sprintf(service, "org.example.provider-%zu", identity % BenchmarkProviders);
+    sprintf(account, "user-%zu@example.org", identity);
+}
+
+static void BenchmarkSecret(size_t identity, unsigned generation, uint8_t *secret, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        secret[i] = (uint8_t)(identity * 31 + generation * 7 + i);
+    }
+}
+
+static void BenchmarkReport(const char *name, size_t operations, double seconds) {
+    printf("%-24s %10.0f ops/s %10.2f us/op\n", name, operations / seconds, seconds * 1e6 / operations);
+}
+
+/**
+ * A permutation of the identities, so loads don't walk the file in order.
+ */
+static size_t *BenchmarkShuffle(size_t count) {
+    size_t *order = malloc(count * sizeof(size_t));
+    if (order == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    uint64_t state = 0x9e3779b97f4a7c15;
+    for (size_t i = count - 1; i > 0; i--) {
+        state = state * 6364136223846793005 + 1442695040888963407;
+        size_t j = (size_t)(state >> 33) % (i + 1);
+        size_t swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    return order;
+}
+
+static int BenchmarkLoadAll(const SecretStoreBackend *backend, const size_t *order, size_t count, unsigned generation, size_t length) {
+    char service[64], account[64];
+    uint8_t secret[SecretStoreMaxSecretLength], expected[SecretStoreMaxSecretLength];
+    for (size_t i = 0; i < count; i++) {
+        size_t identity = order[i];
+        BenchmarkName(identity, service, account);
+        size_t loadedLength;
+        SecretStoreAttributes attributes;
+        int result = backend->load(backend->context, service, account, secret, sizeof(secret), &loadedLength, &attributes);
+        BenchmarkSecret(identity, generation, expected, length);
+        if (result != 0 || loadedLength != length || memcmp(secret, expected, length) != 0) {
+            printf("identity %zu: load failed (%d)\n", identity, result);
+            return result != 0 ? result : EIO;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : BenchmarkDefaultIdentities;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (count == 0) {
+        printf("usage: %s [identities] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/secret-store-benchmark-%ld", directory, (long)getpid());
+    unlink(path);
+
+    uint8_t key[SecretStoreFileKeyLength];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (uint8_t)i;
+    }
+
+    SecretStoreFile *store = NULL;
+    int result = SecretStoreFileOpen(path, key, &store);
+    size_t *order = BenchmarkShuffle(count);
+    if (result != 0 || order == NULL) {
+        printf("opening %s failed (%d)\n", path, result);
+        return 1;
+    }
+    SecretStoreBackend backend;
+    SecretStoreFileGetBackend(store, &backend);
+
+    printf("%zu identities, %d providers, %s\n", count, BenchmarkProviders, path);
+    char service[64], account[64];
+    uint8_t secret[BenchmarkWrappedSecretLength];
+    SecretStoreAttributes attributes = { .rounds = 100000, .type = 4 };
+
+    double start = BenchmarkNow();
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(i, service, account);
+        BenchmarkSecret(i, 0, secret, BenchmarkSecretLength);
+        result = backend.add(backend.context, service, account, secret, BenchmarkSecretLength, &attributes);
+    }
+    BenchmarkReport("store", count, BenchmarkNow() - start);
+
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkLoadAll(&backend, order, count, 0, BenchmarkSecretLength);
+    }
+    BenchmarkReport("load", count, BenchmarkNow() - start);
+
+    // Re-wrap every secret under the key hierarchy
+    start = BenchmarkNow();
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(order[i], service, account);
+        BenchmarkSecret(order[i], 1, secret, BenchmarkWrappedSecretLength);
+        result = backend.update(backend.context, service, account, secret, BenchmarkWrappedSecretLength, &attributes);
+    }
+    BenchmarkReport("update", count, BenchmarkNow() - start);
+
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkLoadAll(&backend, order, count, 1, BenchmarkWrappedSecretLength);
+    }
+    BenchmarkReport("load after update", count, BenchmarkNow() - start);
+
+    struct stat status;
+    stat(path, &status);
+    size_t records = SecretStoreFileRecordCount(store);
+    SecretStoreFileClose(store);
+    store = NULL;
+
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = SecretStoreFileOpen(path, key, &store);
+    }
+    BenchmarkReport("replay (per record)", records, BenchmarkNow() - start);
+    printf("%-24s %10zu records %8lld bytes\n", "before compaction", records, (long long)status.st_size);
+
+    if (result == 0) {
+        SecretStoreFileGetBackend(store, &backend);
+        start = BenchmarkNow();
+        result = SecretStoreFileCompact(store);
+        double seconds = BenchmarkNow() - start;
+        stat(path, &status);
+        printf("%-24s %10.2f ms %15lld bytes\n", "compaction", seconds * 1e3, (long long)status.st_size);
+    }
+
+    start = BenchmarkNow();
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(order[i], service, account);
+        result = backend.remove(backend.context, service, account);
+    }
+    BenchmarkReport("delete", count, BenchmarkNow() - start);
+
+    if (result == 0 && SecretStoreFileItemCount(store) != 0) {
+        printf("items left after deleting all of them\n");
+        result = EIO;
+    }
+
+    SecretStoreFileClose(store);
+    free(order);
+    unlink(path);
+    if (result != 0) {
+        printf("failed (%d)\n", result);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Counts the store round trips of the secret operations the app performs
+ * for many identities, the way they were done item by item before and with
+ * the bulk operations of SecretStoreBackend. Every backend call stands for
+ * one keychain round trip; the calls go to a SecretStoreFile so the time
+ * is measured too. Build and run on Linux with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/SecretStoreRoundTripBenchmark.c \
+ *      Tiqr/Classes/SecretStoreBackend.c Tiqr/Classes/SecretStoreFile.c Tiqr/Classes/SecretCipher.c \
+ *      Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c -lcrypto -lpthread \
+ *      -o secret-store-round-trip-benchmark && ./secret-store-round-trip-benchmark [identities] [directory]
+ */
+
+#include "SecretStoreFile.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BenchmarkDefaultIdentities 1024
+#define BenchmarkProviders 8
+#define BenchmarkSecretLength 32
+
+/**
+ * Forwards to another backend and counts the calls.
+ */
+typedef struct {
+    SecretStoreBackend target;
+    size_t roundTrips;
+} BenchmarkCounter;
+
+static int BenchmarkCountLoad(void *context, const char *service, const char *account, uint8_t *secret, size_t capacity, size_t *length, SecretStoreAttributes *attributes) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.load(counter->target.context, service, account, secret, capacity, length, attributes);
+}
+
+static int BenchmarkCountAdd(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.add(counter->target.context, service, account, secret, length, attributes);
+}
+
+static int BenchmarkCountUpdate(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.update(counter->target.context, service, account, secret, length, attributes);
+}
+
+static int BenchmarkCountRemove(void *context, const char *service, const char *account) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.remove(counter->target.context, service, account);
+}
+
+static int BenchmarkCountProbe(void *context, const char *service, const char *account, SecretStoreAttributes *attributes) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.probe(counter->target.context, service, account, attributes);
+}
+
+static int BenchmarkCountList(void *context, const char *service, SecretStoreListFunction found, void *foundContext) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.list(counter->target.context, service, found, foundContext);
+}
+
+static int BenchmarkCountRemoveAll(void *context, const char *service) {
+    BenchmarkCounter *counter = context;
+    counter->roundTrips++;
+    return counter->target.removeAll(counter->target.context, service);
+}
+
+static void BenchmarkCounterInit(BenchmarkCounter *counter, const SecretStoreBackend *target, SecretStoreBackend *backend) {
+    counter->target = *target;
+    counter->roundTrips = 0;
+    backend->context = counter;
+    backend->load = BenchmarkCountLoad;
+    backend->add = BenchmarkCountAdd;
+    backend->update = BenchmarkCountUpdate;
+    backend->remove = BenchmarkCountRemove;
+    backend->probe = BenchmarkCountProbe;
+    backend->list = BenchmarkCountList;
+    backend->removeAll = BenchmarkCountRemoveAll;
+}
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static void BenchmarkService(size_t provider, char *service) {
+    sprintf(service, "org.example.provider-%zu", provider);
+}
+
+/**
+ * Identities are numbered per provider: provider p holds p, p + P, ...
+ */
+static void BenchmarkName(size_t identity, char *service, char *account) {
+    BenchmarkService(identity % BenchmarkProviders, service);
+    sprintf(account, "user-%zu@example.org", identity);
+}
+
+static void BenchmarkSecret(size_t identity, unsigned generation, uint8_t *secret) {
+    for (size_t i = 0; i < BenchmarkSecretLength; i++) {
+        secret[i] = (uint8_t)(identity * 31 + generation * 7 + i);
+    }
+}
+
+static void BenchmarkReport(const char *name, BenchmarkCounter *counter, size_t identities, double seconds) {
+    printf("%-28s %8zu round trips %6.2f per identity %10.2f us per identity\n",
+           name, counter->roundTrips, (double)counter->roundTrips / identities, seconds * 1e6 / identities);
+    counter->roundTrips = 0;
+}
+
+/**
+ * Stores every secret like updateOrStoreSecret did: a load to find out
+ * whether the item exists, then an add or an update.
+ */
+static int BenchmarkStoreItemByItem(const SecretStoreBackend *backend, size_t count, unsigned generation) {
+    char service[64], account[64];
+    uint8_t secret[BenchmarkSecretLength], loaded[SecretStoreMaxSecretLength];
+    SecretStoreAttributes attributes = { .rounds = 100000, .type = 4 };
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(i, service, account);
+        BenchmarkSecret(i, generation, secret);
+        size_t length;
+        result = backend->load(backend->context, service, account, loaded, sizeof(loaded), &length, NULL);
+        if (result == ENOENT) {
+            result = backend->add(backend->context, service, account, secret, sizeof(secret), &attributes);
+        } else if (result == 0) {
+            result = backend->update(backend->context, service, account, secret, sizeof(secret), &attributes);
+        }
+    }
+    return result;
+}
+
+static int BenchmarkUpsert(const SecretStoreBackend *backend, size_t count, unsigned generation) {
+    char service[64], account[64];
+    uint8_t secret[BenchmarkSecretLength];
+    SecretStoreAttributes attributes = { .rounds = 100000, .type = 4 };
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(i, service, account);
+        BenchmarkSecret(i, generation, secret);
+        result = SecretStoreUpsert(backend, service, account, secret, sizeof(secret), &attributes);
+    }
+    return result;
+}
+
+static int BenchmarkStoreAll(const SecretStoreBackend *backend, size_t count, unsigned generation) {
+    size_t perProvider = (count + BenchmarkProviders - 1) / BenchmarkProviders;
+    SecretStoreItem *items = calloc(perProvider, sizeof(SecretStoreItem));
+    char (*accounts)[64] = calloc(perProvider, 64);
+    uint8_t (*secrets)[BenchmarkSecretLength] = calloc(perProvider, BenchmarkSecretLength);
+    if (items == NULL || accounts == NULL || secrets == NULL) {
+        free(items);
+        free(accounts);
+        free(secrets);
+        return ENOMEM;
+    }
+
+    char service[64];
+    int result = 0;
+    for (size_t provider = 0; provider < BenchmarkProviders && result == 0; provider++) {
+        size_t itemCount = 0;
+        for (size_t i = provider; i < count; i += BenchmarkProviders) {
+            BenchmarkName(i, service, accounts[itemCount]);
+            BenchmarkSecret(i, generation, secrets[itemCount]);
+            items[itemCount].account = accounts[itemCount];
+            items[itemCount].secret = secrets[itemCount];
+            items[itemCount].length = BenchmarkSecretLength;
+            items[itemCount].attributes.rounds = 100000;
+            items[itemCount].attributes.type = 4;
+            itemCount++;
+        }
+        BenchmarkService(provider, service);
+        result = SecretStoreStoreAll(backend, service, items, itemCount);
+    }
+
+    free(items);
+    free(accounts);
+    free(secrets);
+    return result;
+}
+
+static int BenchmarkCheckAll(const SecretStoreBackend *backend, size_t count, bool probe) {
+    char service[64], account[64];
+    uint8_t loaded[SecretStoreMaxSecretLength];
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(i, service, account);
+        if (probe) {
+            result = backend->probe(backend->context, service, account, NULL);
+        } else {
+            size_t length;
+            result = backend->load(backend->context, service, account, loaded, sizeof(loaded), &length, NULL);
+        }
+    }
+    return result;
+}
+
+/**
+ * Deletes like deleteSecretForIdentityIdentifier did, the second remove
+ * stands for the biometric item.
+ */
+static int BenchmarkDeleteItemByItem(const SecretStoreBackend *backend, size_t count) {
+    char service[64], account[64];
+    int result = 0;
+    for (size_t i = 0; i < count && result == 0; i++) {
+        BenchmarkName(i, service, account);
+        result = backend->remove(backend->context, service, account);
+        if (result == 0) {
+            strcat(account, "-biometric");
+            result = backend->remove(backend->context, service, account);
+            result = result == ENOENT ? 0 : result;
+        }
+    }
+    return result;
+}
+
+static int BenchmarkDeleteAll(const SecretStoreBackend *backend) {
+    char service[64];
+    int result = 0;
+    for (size_t provider = 0; provider < BenchmarkProviders && result == 0; provider++) {
+        BenchmarkService(provider, service);
+        result = backend->removeAll(backend->context, service);
+    }
+    return result;
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : BenchmarkDefaultIdentities;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (count == 0) {
+        printf("usage: %s [identities] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/secret-store-round-trip-benchmark-%ld", directory, (long)getpid());
+    unlink(path);
+
+    uint8_t key[SecretStoreFileKeyLength];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (uint8_t)i;
+    }
+
+    SecretStoreFile *store = NULL;
+    int result = SecretStoreFileOpen(path, key, &store);
+    if (result != 0) {
+        printf("opening %s failed (%d)\n", path, result);
+        return 1;
+    }
+    SecretStoreBackend file, backend;
+    SecretStoreFileGetBackend(store, &file);
+    BenchmarkCounter counter;
+    BenchmarkCounterInit(&counter, &file, &backend);
+
+    printf("%zu identities, %d providers, %s\n", count, BenchmarkProviders, path);
+
+    // Item by item, as before
+    double start = BenchmarkNow();
+    result = BenchmarkStoreItemByItem(&backend, count, 0);
+    BenchmarkReport("store, load + add", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkStoreItemByItem(&backend, count, 1);
+    }
+    BenchmarkReport("re-store, load + update", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkCheckAll(&backend, count, false);
+    }
+    BenchmarkReport("exists, load", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkDeleteItemByItem(&backend, count);
+    }
+    BenchmarkReport("delete, 2 removes", &counter, count, BenchmarkNow() - start);
+
+    // Single items with upsert and probe
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkUpsert(&backend, count, 0);
+    }
+    BenchmarkReport("store, upsert", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkUpsert(&backend, count, 1);
+    }
+    BenchmarkReport("re-store, upsert", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkCheckAll(&backend, count, true);
+    }
+    BenchmarkReport("exists, probe", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkDeleteAll(&backend);
+    }
+    BenchmarkReport("delete, remove all", &counter, count, BenchmarkNow() - start);
+
+    // Bulk
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkStoreAll(&backend, count, 0);
+    }
+    BenchmarkReport("store, store all", &counter, count, BenchmarkNow() - start);
+    start = BenchmarkNow();
+    if (result == 0) {
+        result = BenchmarkStoreAll(&backend, count, 1);
+    }
+    BenchmarkReport("re-store, store all", &counter, count, BenchmarkNow() - start);
+
+    if (result == 0 && SecretStoreFileItemCount(store) != count) {
+        printf("%zu items stored instead of %zu\n", SecretStoreFileItemCount(store), count);
+        result = EIO;
+    }
+
+    SecretStoreFileClose(store);
+    unlink(path);
+    if (result != 0) {
+        printf("failed (%d)\n", result);
+        return 1;
+    }
+    return 0;
+}
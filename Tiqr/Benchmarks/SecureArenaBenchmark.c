@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs the key material path of a login the way the app does with the
+ * secure arena: load the encrypted secret, derive the PIN key, decrypt the
+ * secret and compute the OCRA response, every buffer holding key material
+ * taken from a SecureArena. It checks that this path makes no heap
+ * allocations once the arena exists and that every buffer is zeroed when
+ * it is released, and compares the time with heap buffers like the
+ * NSData objects the app used before. Build and run on Linux (glibc) with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/SecureArenaBenchmark.c \
+ *      Tiqr/Classes/SecureArena.c Tiqr/Classes/SecretStoreFile.c Tiqr/Classes/SecretCipher.c \
+ *      Tiqr/Classes/PBKDF2.c Tiqr/Classes/OCRAMessage.c Tiqr/Classes/OCRASuitePolicy.c \
+ *      Tiqr/Classes/HexCodec.c Tiqr/Classes/HMACBatch.c Tiqr/Classes/HMACKey.c Tiqr/Classes/HMACBackend*.c \
+ *      -lcrypto -lpthread \
+ *      -o secure-arena-benchmark && ./secure-arena-benchmark [logins] [rounds]
+ *
+ * On Linux SecretCipher runs on OpenSSL, which allocates a context per
+ * call where CommonCrypto's CCCrypt does not, and the secret store is a
+ * SecretStoreFile standing in for the keychain, which decrypts with it.
+ * The allocations of those stand-ins are measured separately and left out.
+ * Exits with 1 when a login allocates from the heap otherwise or leaves key
+ * material behind.
+ */
+
+#include "HMACKey.h"
+#include "OCRAMessage.h"
+#include "OCRASuitePolicy.h"
+#include "PBKDF2.h"
+#include "SecretCipher.h"
+#include "SecretStoreFile.h"
+#include "SecureArena.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BenchmarkDefaultLogins 1000
+#define BenchmarkDefaultRounds 1000
+#define BenchmarkSuite "OCRA-1:HOTP-SHA1-6:QH40-S064"
+
+/*
+ * Counts the heap allocations of the process by wrapping the glibc
+ * allocator.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static atomic_size_t BenchmarkHeapAllocations;
+
+void *malloc(size_t size) {
+    atomic_fetch_add(&BenchmarkHeapAllocations, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add(&BenchmarkHeapAllocations, 1);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    atomic_fetch_add(&BenchmarkHeapAllocations, 1);
+    return __libc_realloc(pointer, size);
+}
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static bool BenchmarkIsZero(const uint8_t *bytes, size_t length) {
+    uint8_t bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        bits |= bytes[i];
+    }
+    return bits == 0;
+}
+
+typedef struct {
+    const SecretStoreBackend *store;
+    const OCRASuiteLayout *layout;
+    const uint8_t *PIN;
+    size_t PINLength;
+    uint8_t salt[32];
+    uint8_t initializationVector[16];
+    uint32_t rounds;
+    uint8_t question[128];
+    uint8_t sessionInformation[64];
+} BenchmarkLogin;
+
+/**
+ * The key material of one login: the PIN key, the secret and the HMAC key
+ * of the secret.
+ */
+typedef struct {
+    uint8_t *key;
+    uint8_t *secret;
+    HMACKey *hmacKey;
+} BenchmarkBuffers;
+
+/**
+ * One login with the given buffers, returns the response code.
+ */
+static int BenchmarkRunLogin(const BenchmarkLogin *login, const BenchmarkBuffers *buffers, uint32_t *code) {
+    uint8_t encrypted[SecretStoreMaxSecretLength];
+    size_t length = 0;
+    int result = login->store->load(login->store->context, "nl.surfnet", "john", encrypted, sizeof(encrypted), &length, NULL);
+    if (result == 0) {
+        result = PBKDF2Derive(HMACAlgorithmSHA256, login->PIN, login->PINLength, login->salt, sizeof(login->salt), login->rounds, buffers->key, SecretCipherKeyLength);
+    }
+    if (result == 0) {
+        result = SecretCipherCrypt(SecretCipherOperationDecrypt, buffers->key, login->initializationVector, encrypted, length, buffers->secret);
+    }
+    if (result == 0) {
+        HMACKeyInit(buffers->hmacKey, HMACAlgorithmSHA1, buffers->secret, length);
+        OCRAInput input = {
+            { NULL, 0 },
+            { login->question, login->layout->questionLength },
+            { NULL, 0 },
+            { login->sessionInformation, login->layout->sessionInformationLength },
+            { NULL, 0 }
+        };
+        *code = OCRAComputeCode(login->layout, buffers->hmacKey, &input);
+    }
+    return result;
+}
+
+static int BenchmarkArenaLogin(SecureArena *arena, const BenchmarkLogin *login, uint32_t *code, const uint8_t **released) {
+    SecureBuffer key SecureBufferScoped = { 0 };
+    SecureBuffer secret SecureBufferScoped = { 0 };
+    SecureBuffer hmacKey SecureBufferScoped = { 0 };
+    int result = SecureBufferAcquire(arena, SecretCipherKeyLength, &key);
+    if (result == 0) {
+        result = SecureBufferAcquire(arena, SecretStoreMaxSecretLength, &secret);
+    }
+    if (result == 0) {
+        result = SecureBufferAcquire(arena, sizeof(HMACKey), &hmacKey);
+    }
+    if (result == 0) {
+        BenchmarkBuffers buffers = { key.bytes, secret.bytes, (HMACKey *)hmacKey.bytes };
+        result = BenchmarkRunLogin(login, &buffers, code);
+    }
+    released[0] = key.bytes;
+    released[1] = secret.bytes;
+    released[2] = hmacKey.bytes;
+    return result;
+}
+
+static int BenchmarkHeapLogin(const BenchmarkLogin *login, uint32_t *code) {
+    BenchmarkBuffers buffers = { malloc(SecretCipherKeyLength), malloc(SecretStoreMaxSecretLength), malloc(sizeof(HMACKey)) };
+    int result = ENOMEM;
+    if (buffers.key != NULL && buffers.secret != NULL && buffers.hmacKey != NULL) {
+        result = BenchmarkRunLogin(login, &buffers, code);
+    }
+    free(buffers.key);
+    free(buffers.secret);
+    free(buffers.hmacKey);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    size_t logins = argc > 1 ? strtoul(argv[1], NULL, 10) : BenchmarkDefaultLogins;
+    uint32_t rounds = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : BenchmarkDefaultRounds;
+    if (logins == 0 || rounds == 0) {
+        printf("usage: %s [logins] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/secure-arena-benchmark-%ld", (long)getpid());
+    unlink(path);
+    uint8_t storeKey[SecretStoreFileKeyLength] = { 0 };
+    SecretStoreFile *file = NULL;
+    SecureArena *arena = NULL;
+    OCRASuiteLayout layout;
+    int result = SecretStoreFileOpen(path, storeKey, &file);
+    if (result == 0) {
+        result = SecureArenaCreate(SecureArenaSharedCapacity, &arena);
+    }
+    if (result == 0 && OCRASuiteCompile(BenchmarkSuite, strlen(BenchmarkSuite), &OCRASuitePolicyV2, &layout) != OCRASuiteCompileSuccess) {
+        result = EINVAL;
+    }
+    if (result != 0) {
+        printf("setup failed (%d)\n", result);
+        return 1;
+    }
+    SecretStoreBackend store;
+    SecretStoreFileGetBackend(file, &store);
+
+    BenchmarkLogin login = { &store, &layout, (const uint8_t *)"1234", 4, { 0 }, { 0 }, rounds, { 0 }, { 0 } };
+    for (size_t i = 0; i < sizeof(login.salt); i++) {
+        login.salt[i] = (uint8_t)(i * 7);
+    }
+    memset(login.question, 0x42, sizeof(login.question));
+    memset(login.sessionInformation, 0x17, sizeof(login.sessionInformation));
+
+    // Enroll a version 4 secret
+    uint8_t key[SecretCipherKeyLength], secret[32], encrypted[32];
+    memset(secret, 0x5a, sizeof(secret));
+    PBKDF2Derive(HMACAlgorithmSHA256, login.PIN, login.PINLength, login.salt, sizeof(login.salt), rounds, key, sizeof(key));
+    SecretCipherCrypt(SecretCipherOperationEncrypt, key, login.initializationVector, secret, sizeof(secret), encrypted);
+    SecretStoreAttributes attributes = { rounds, 4 };
+    result = store.add(store.context, "nl.surfnet", "john", encrypted, sizeof(encrypted), &attributes);
+
+    uint32_t expected = 0, code = 0;
+    if (result == 0) {
+        result = BenchmarkHeapLogin(&login, &expected);
+    }
+
+    // Allocations of the stand-ins: loading from the store and the cipher
+    size_t standInBefore = atomic_load(&BenchmarkHeapAllocations);
+    uint8_t loaded[SecretStoreMaxSecretLength];
+    size_t loadedLength;
+    store.load(store.context, "nl.surfnet", "john", loaded, sizeof(loaded), &loadedLength, NULL);
+    SecretCipherCrypt(SecretCipherOperationDecrypt, key, login.initializationVector, encrypted, sizeof(encrypted), secret);
+    size_t standInAllocations = atomic_load(&BenchmarkHeapAllocations) - standInBefore;
+
+    size_t heapBefore = atomic_load(&BenchmarkHeapAllocations);
+    double start = BenchmarkNow();
+    for (size_t i = 0; i < logins && result == 0; i++) {
+        result = BenchmarkHeapLogin(&login, &code);
+    }
+    double heapSeconds = BenchmarkNow() - start;
+    size_t heapAllocations = atomic_load(&BenchmarkHeapAllocations) - heapBefore - logins * standInAllocations;
+
+    size_t leaks = 0;
+    size_t arenaBefore = atomic_load(&BenchmarkHeapAllocations);
+    start = BenchmarkNow();
+    for (size_t i = 0; i < logins && result == 0; i++) {
+        const uint8_t *released[3];
+        result = BenchmarkArenaLogin(arena, &login, &code, released);
+        if (result == 0 && code != expected) {
+            result = EIO;
+        }
+        // The buffers are back in the arena, which is still mapped
+        leaks += !BenchmarkIsZero(released[0], SecretCipherKeyLength) || !BenchmarkIsZero(released[1], SecretStoreMaxSecretLength) ||
+                 !BenchmarkIsZero(released[2], sizeof(HMACKey));
+    }
+    double arenaSeconds = BenchmarkNow() - start;
+    size_t arenaAllocations = atomic_load(&BenchmarkHeapAllocations) - arenaBefore - logins * standInAllocations;
+
+    SecureArenaMetrics metrics;
+    SecureArenaGetMetrics(arena, &metrics);
+    printf("%zu logins, %u rounds, %s, %zu stand-in allocations per login left out\n", logins, rounds, BenchmarkSuite, standInAllocations);
+    printf("%-8s %10.2f us/login %8.2f heap allocations/login\n", "heap", heapSeconds * 1e6 / logins, (double)heapAllocations / logins);
+    printf("%-8s %10.2f us/login %8.2f heap allocations/login %6zu bytes peak in arena %6zu in use\n",
+           "arena", arenaSeconds * 1e6 / logins, (double)arenaAllocations / logins, metrics.peakInUse, metrics.inUse);
+
+    SecureArenaDestroy(arena);
+    SecretStoreFileClose(file);
+    unlink(path);
+    if (result != 0) {
+        printf("failed (%d)\n", result);
+        return 1;
+    }
+    if (arenaAllocations != 0 || leaks != 0 || metrics.inUse != 0) {
+        printf("key material left the arena: %zu heap allocations, %zu logins left bytes behind\n", arenaAllocations, leaks);
+        return 1;
+    }
+    return 0;
+}
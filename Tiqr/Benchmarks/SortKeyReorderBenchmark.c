@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measures what dragging one identity to a new row costs with 10,000
+ * identities, committing each move to a table shaped like the one Core
+ * Data creates for the Tiqr 7 model:
+ *
+ *   renumber  the old moveRow: every identity gets its list position as
+ *             sortIndex and the rows whose position changed are written
+ *   sort key  the moved identity gets a key between its new neighbours;
+ *             SortKeyPlace respreads a small window when they are adjacent
+ *
+ * Both runs do the same pseudo random moves, half of them to the second row
+ * so the gaps there are used up as fast as possible. Build and run on Linux
+ * with:
+ *
+ *   cc -O2 -std=gnu11 -ITiqr/Classes Tiqr/Benchmarks/SortKeyReorderBenchmark.c \
+ *      Tiqr/Classes/SortKey.c -lsqlite3 -o sort-key-reorder-benchmark && \
+ *      ./sort-key-reorder-benchmark [moves] [directory]
+ */
+
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SortKey.h"
+
+#define BenchmarkDefaultMoves 2000
+#define BenchmarkIdentities 10000
+
+typedef struct {
+    int64_t primaryKey;
+    int64_t key;
+} BenchmarkRow;
+
+typedef struct {
+    double microseconds;
+    double rows;
+    size_t respreads;
+} BenchmarkResult;
+
+static double BenchmarkNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void BenchmarkExec(sqlite3 *db, const char *sql) {
+    char *message = NULL;
+    if (sqlite3_exec(db, sql, NULL, NULL, &message) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, message);
+        exit(1);
+    }
+}
+
+static sqlite3 *BenchmarkCreateStore(const char *path, BenchmarkRow *rows, int count) {
+    unlink(path);
+    sqlite3 *db = NULL;
+    if (sqlite3_open(path, &db) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", path, sqlite3_errmsg(db));
+        exit(1);
+    }
+    
+    BenchmarkExec(db, "PRAGMA journal_mode = WAL");
+    BenchmarkExec(db, "CREATE TABLE ZIDENTITY (Z_PK INTEGER PRIMARY KEY, Z_ENT INTEGER, Z_OPT INTEGER, ZSORTINDEX INTEGER, "
+                      "ZSORTKEY INTEGER, ZVERSION INTEGER, ZIDENTITYPROVIDER INTEGER, ZDISPLAYNAME VARCHAR, ZIDENTIFIER VARCHAR)");
+    BenchmarkExec(db, "CREATE INDEX ZIDENTITY_ZSORTKEY_INDEX ON ZIDENTITY (ZSORTKEY)");
+    
+    BenchmarkExec(db, "BEGIN");
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, "INSERT INTO ZIDENTITY (Z_PK, Z_ENT, Z_OPT, ZSORTINDEX, ZSORTKEY, ZVERSION, ZIDENTITYPROVIDER, ZDISPLAYNAME, ZIDENTIFIER) "
+                           "VALUES (?, 1, 1, ?, ?, 4, 1, ?, ?)", -1, &statement, NULL);
+    char identifier[64];
+    for (int i = 0; i < count; i++) {
+        snprintf(identifier, sizeof(identifier), "user%d", i);
+        rows[i].primaryKey = i + 1;
+        rows[i].key = (int64_t)(i + 1) * SortKeyGap;
+        sqlite3_bind_int64(statement, 1, rows[i].primaryKey);
+        sqlite3_bind_int(statement, 2, i);
+        sqlite3_bind_int64(statement, 3, rows[i].key);
+        sqlite3_bind_text(statement, 4, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(statement, 5, identifier, -1, SQLITE_TRANSIENT);
+        sqlite3_step(statement);
+        sqlite3_reset(statement);
+    }
+    sqlite3_finalize(statement);
+    BenchmarkExec(db, "COMMIT");
+    return db;
+}
+
+static void BenchmarkMove(BenchmarkRow *rows, size_t from, size_t to) {
+    BenchmarkRow moved = rows[from];
+    if (from < to) {
+        memmove(rows + from, rows + from + 1, (to - from) * sizeof(BenchmarkRow));
+    } else {
+        memmove(rows + to + 1, rows + to, (from - to) * sizeof(BenchmarkRow));
+    }
+    rows[to] = moved;
+}
+
+static void BenchmarkWrite(sqlite3_stmt *statement, const BenchmarkRow *row) {
+    sqlite3_bind_int64(statement, 1, row->key);
+    sqlite3_bind_int64(statement, 2, row->primaryKey);
+    sqlite3_step(statement);
+    sqlite3_reset(statement);
+}
+
+static void BenchmarkPickMove(int move, size_t count, size_t *from, size_t *to) {
+    *from = (size_t)(((int64_t)move * 7919 + 13) % count);
+    *to = move % 2 == 0 ? 1 : (size_t)(((int64_t)move * 104729 + 7) % count);
+}
+
+static BenchmarkResult BenchmarkRunRenumber(sqlite3 *db, BenchmarkRow *rows, size_t count, int moves) {
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, "UPDATE ZIDENTITY SET ZSORTINDEX = ?, Z_OPT = Z_OPT + 1 WHERE Z_PK = ?", -1, &statement, NULL);
+    for (size_t i = 0; i < count; i++) {
+        rows[i].key = (int64_t)i;
+    }
+    
+    size_t written = 0;
+    double start = BenchmarkNow();
+    for (int move = 0; move < moves; move++) {
+        size_t from, to;
+        BenchmarkPickMove(move, count, &from, &to);
+        BenchmarkMove(rows, from, to);
+        
+        BenchmarkExec(db, "BEGIN");
+        for (size_t i = 0; i < count; i++) {
+            if (rows[i].key != (int64_t)i) {
+                rows[i].key = (int64_t)i;
+                BenchmarkWrite(statement, &rows[i]);
+                written++;
+            }
+        }
+        BenchmarkExec(db, "COMMIT");
+    }
+    BenchmarkResult result = { (BenchmarkNow() - start) / moves * 1e6, (double)written / moves, 0 };
+    sqlite3_finalize(statement);
+    return result;
+}
+
+static BenchmarkResult BenchmarkRunSortKey(sqlite3 *db, BenchmarkRow *rows, size_t count, int moves) {
+    sqlite3_stmt *statement = NULL;
+    sqlite3_prepare_v2(db, "UPDATE ZIDENTITY SET ZSORTKEY = ?, Z_OPT = Z_OPT + 1 WHERE Z_PK = ?", -1, &statement, NULL);
+    int64_t *keys = calloc(count, sizeof(int64_t));
+    
+    size_t written = 0;
+    size_t respreads = 0;
+    double start = BenchmarkNow();
+    for (int move = 0; move < moves; move++) {
+        size_t from, to;
+        BenchmarkPickMove(move, count, &from, &to);
+        BenchmarkMove(rows, from, to);
+        
+        // Only the neighbours are read unless they are adjacent
+        int64_t key = 0;
+        size_t first = 0, last = 0;
+        const int64_t *lower = to > 0 ? &rows[to - 1].key : NULL;
+        const int64_t *upper = to + 1 < count ? &rows[to + 1].key : NULL;
+        if (SortKeyBetween(lower, upper, &key) != 0) {
+            size_t others = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (i != to) {
+                    keys[others++] = rows[i].key;
+                }
+            }
+            if (SortKeyPlace(keys, others, to, &key, &first, &last) != 0) {
+                fprintf(stderr, "no room for move %d\n", move);
+                exit(1);
+            }
+            respreads++;
+        }
+        
+        BenchmarkExec(db, "BEGIN");
+        for (size_t i = first; i < last; i++) {
+            BenchmarkRow *row = &rows[i < to ? i : i + 1];
+            row->key = keys[i];
+            BenchmarkWrite(statement, row);
+            written++;
+        }
+        rows[to].key = key;
+        BenchmarkWrite(statement, &rows[to]);
+        written++;
+        BenchmarkExec(db, "COMMIT");
+    }
+    BenchmarkResult result = { (BenchmarkNow() - start) / moves * 1e6, (double)written / moves, respreads };
+    free(keys);
+    sqlite3_finalize(statement);
+    
+    for (size_t i = 1; i < count; i++) {
+        if (rows[i].key <= rows[i - 1].key) {
+            fprintf(stderr, "sort keys out of order at %zu\n", i);
+            exit(1);
+        }
+    }
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    int moves = argc > 1 ? atoi(argv[1]) : BenchmarkDefaultMoves;
+    const char *directory = argc > 2 ? argv[2] : "/tmp";
+    if (moves <= 0) {
+        fprintf(stderr, "usage: %s [moves] [directory]\n", argv[0]);
+        return 1;
+    }
+    
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/sort-key-reorder-benchmark-%d.sqlite", directory, (int)getpid());
+    BenchmarkRow *rows = calloc(BenchmarkIdentities, sizeof(BenchmarkRow));
+    
+    printf("%d moves, %d identities\n\n", moves, BenchmarkIdentities);
+    printf("%10s %14s %14s %14s\n", "", "us per move", "rows per move", "respreads");
+    
+    sqlite3 *db = BenchmarkCreateStore(path, rows, BenchmarkIdentities);
+    BenchmarkResult renumber = BenchmarkRunRenumber(db, rows, BenchmarkIdentities, moves);
+    printf("%10s %14.1f %14.1f %14s\n", "renumber", renumber.microseconds, renumber.rows, "-");
+    sqlite3_close(db);
+    
+    db = BenchmarkCreateStore(path, rows, BenchmarkIdentities);
+    BenchmarkResult sortKey = BenchmarkRunSortKey(db, rows, BenchmarkIdentities, moves);
+    printf("%10s %14.1f %14.2f %14zu\n", "sort key", sortKey.microseconds, sortKey.rows, sortKey.respreads);
+    sqlite3_close(db);
+    
+    free(rows);
+    unlink(path);
+    char sidecar[1100];
+    snprintf(sidecar, sizeof(sidecar), "%s-wal", path);
+    unlink(sidecar);
+    snprintf(sidecar, sizeof(sidecar), "%s-shm", path);
+    unlink(sidecar);
+    return 0;
+}
@@ -143,7 +143,7 @@
 
                 case TIQRACRAccountBlockedError: {
                     self.challenge.identity.blocked = @YES;
-                    [ServiceContainer.sharedInstance.identityService saveIdentities];
+                    [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
 
                     [self presentErrorViewControllerWithError:error];
                     break;
@@ -152,7 +152,7 @@
                     NSNumber *attemptsLeft = [error userInfo][TIQRACRAttemptsLeftErrorKey];
                     if (attemptsLeft != nil && [attemptsLeft intValue] == 0) {
                         [ServiceContainer.sharedInstance.identityService blockAllIdentities];
-                        [ServiceContainer.sharedInstance.identityService saveIdentities];
+                        [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
                     }
 
                     [self presentErrorViewControllerWithError:error];
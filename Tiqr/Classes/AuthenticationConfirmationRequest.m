@@ -29,6 +29,7 @@
 
 #import "AuthenticationConfirmationRequest.h"
 #import "NotificationRegistration.h"
+#import "ServerClock.h"
 
 
 NSString *const TIQRACRErrorDomain = @"org.tiqr.acr";
@@ -43,6 +44,7 @@ typedef void (^CompletionBlock)(BOOL success, NSError *error);
 @property (nonatomic, strong) NSMutableData *data;
 @property (nonatomic, copy) NSString *protocolVersion;
 @property (nonatomic, strong) NSURLConnection *sendConnection;
+@property (nonatomic, strong) NSDate *sendDate;
 @property (nonatomic, strong) CompletionBlock completionBlock;
 
 @end
@@ -61,6 +63,7 @@ typedef void (^CompletionBlock)(BOOL success, NSError *error);
 
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
     [self.data setLength:0];
+    [[ServerClock sharedInstance] recordResponse:response requestDate:self.sendDate responseDate:[NSDate date]];
     
     NSDictionary* headers = [(NSHTTPURLResponse *)response allHeaderFields];
     if (headers[@"X-TIQR-Protocol-Version"]) {
@@ -256,6 +259,7 @@ typedef void (^CompletionBlock)(BOOL success, NSError *error);
     [request setValue:TIQR_PROTOCOL_VERSION forHTTPHeaderField:@"X-TIQR-Protocol-Version"];
     
     self.data = [NSMutableData data];
+	self.sendDate = [NSDate date];
 	self.sendConnection = [[NSURLConnection alloc] initWithRequest:request delegate:self];
 }
 
@@ -41,6 +41,7 @@
 
 @property (nonatomic, strong) AuthenticationChallenge *challenge;
 @property (nonatomic, copy) NSString *PIN;
+@property (nonatomic, strong) SecretServiceCancellationToken *unlockToken;
 
 @end
 
@@ -64,18 +65,46 @@
     self.pinDescription = NSLocalizedString(@"enter_four_digit_pin", @"You need to enter your 4-digit PIN to login.");
 }
 
+- (void)dealloc {
+    [self.unlockToken cancel];
+}
+
+- (void)viewWillDisappear:(BOOL)animated {
+    [super viewWillDisappear:animated];
+    
+    // Leaving the challenge supersedes it, don't keep deriving its key
+    if (self.isMovingFromParentViewController && self.unlockToken != nil) {
+        [self.unlockToken cancel];
+        self.unlockToken = nil;
+        [MBProgressHUD hideHUDForView:self.navigationController.view animated:YES];
+    }
+}
+
 - (void)PINViewController:(PINViewController *)pinViewController didFinishWithPIN:(NSString *)PIN {
     self.PIN = PIN;
-    NSData *secret = [ServiceContainer.sharedInstance.secretService secretForIdentity:self.challenge.identity withPIN:PIN];
-    
     
     [MBProgressHUD showHUDAddedTo:self.navigationController.view animated:YES];
     
+    [self.unlockToken cancel];
+    __weak AuthenticationPINViewController *weakSelf = self;
+    self.unlockToken = [ServiceContainer.sharedInstance.secretService secretForIdentity:self.challenge.identity withPIN:PIN completionHandler:^(NSData *secret, BOOL cancelled) {
+        AuthenticationPINViewController *strongSelf = weakSelf;
+        if (strongSelf == nil || cancelled) {
+            return;
+        }
+        
+        strongSelf.unlockToken = nil;
+        [strongSelf completeChallengeWithSecret:secret];
+    }];
+}
+
+- (void)completeChallengeWithSecret:(NSData *)secret {
     [ServiceContainer.sharedInstance.challengeService completeAuthenticationChallenge:self.challenge withSecret:secret completionHandler:^(BOOL succes, NSString *response, NSError *error) {
         [MBProgressHUD hideHUDForView:self.navigationController.view animated:YES];
         
         if (succes) {
             [ServiceContainer.sharedInstance.identityService upgradeIdentity:self.challenge.identity withPIN:self.PIN];
+            [ServiceContainer.sharedInstance.identityService rewrapIdentityIfNeeded:self.challenge.identity withPIN:self.PIN];
             
             [MBProgressHUD hideHUDForView:self.navigationController.view animated:YES];
             AuthenticationSummaryViewController *viewController = [[AuthenticationSummaryViewController alloc] initWithAuthenticationChallenge:self.challenge usedPIN:self.PIN];
@@ -92,7 +121,7 @@
                     
                 case TIQRACRAccountBlockedError: {
                     self.challenge.identity.blocked = @YES;
-                    [ServiceContainer.sharedInstance.identityService saveIdentities];
+                    [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
                     
                     [self presentErrorViewControllerWithError:error];
                     break;
@@ -102,7 +131,7 @@
                     NSNumber *attemptsLeft = [error userInfo][TIQRACRAttemptsLeftErrorKey];
                     if (attemptsLeft != nil && [attemptsLeft intValue] == 0) {
                         [ServiceContainer.sharedInstance.identityService blockAllIdentities];
-                        [ServiceContainer.sharedInstance.identityService saveIdentities];
+                        [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
                         
                         [self presentErrorViewControllerWithError:error];
                     } else {
@@ -36,6 +36,7 @@
 #import "OCRAWrapper.h"
 #import "OCRAWrapper_v1.h"
 #import "OCRAProtocol.h"
+#import "ServerClock.h"
 
 
 @interface ChallengeService ()
@@ -123,14 +124,16 @@
     if (identity == nil) {
         identity = [self.identityService createIdentity];
         identity.identifier = challenge.identityIdentifier;
-        identity.sortIndex = [NSNumber numberWithInteger:self.identityService.maxSortIndex + 1];
+        identity.sortKey = [self.identityService nextSortKey];
         identity.identityProvider = identityProvider;
         identity.salt = [self.secretService generateSecret];
+        identity.version = @4;
     }
     
     identity.displayName = challenge.identityDisplayName;
+    identity.kdfRounds = @(self.secretService.keyDerivationRoundsForNewSecrets);
     
-    if (![self.identityService saveIdentities]) {
+    if (![self.identityService saveIdentitiesDurably]) {
         [self.identityService rollbackIdentities];
         
         NSString *errorTitle = NSLocalizedString(@"error_enroll_failed_to_store_identity_title", @"Account cannot be saved title");
@@ -151,12 +154,12 @@
         [request sendWithCompletionHandler:^(BOOL success, NSError *error) {
             if (success) {
                 challenge.identity.blocked = @NO;
-                [ServiceContainer.sharedInstance.identityService saveIdentities];
+                [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
                 completionHandler(true, nil);
             } else {
                 if (![challenge.identity.blocked boolValue]) {
                     [self.identityService deleteIdentity:challenge.identity];
-                    [self.identityService saveIdentities];
+                    [self.identityService saveIdentitiesDurably];
                 }
                 
                 [self.secretService deleteSecretForIdentityIdentifier:challenge.identityIdentifier
@@ -166,62 +169,87 @@
         }];
     };
     
-    if (biometricID) {
-        [self.secretService setSecret:challenge.identitySecret
-                          forIdentity:challenge.identity
-                              withPIN:challenge.identityPIN];
+    void (^storeFailedBlock)(void) = ^{
+        NSString *errorTitle = NSLocalizedString(@"error_enroll_failed_to_store_identity_title", @"Account cannot be saved title");
+        NSString *errorMessage = NSLocalizedString(@"error_enroll_failed_to_generate_secret", @"Failed to generate identity secret. Please contact support.");
+        NSDictionary *details = @{NSLocalizedDescriptionKey: errorTitle, NSLocalizedFailureReasonErrorKey: errorMessage};
+        
+        NSError *error = [NSError errorWithDomain:TIQRECErrorDomain code:TIQRECUnknownError userInfo:details];
+        completionHandler(false, error);
+    };
+    
+    // The PIN key is derived on the PIN unlock queue, the enrollment continues once the secret is stored
+    [self.secretService setSecret:challenge.identitySecret forIdentity:challenge.identity withPIN:challenge.identityPIN completionHandler:^(BOOL success, BOOL cancelled) {
+        if (!success) {
+            storeFailedBlock();
+            return;
+        }
         
-        [self.secretService setSecret:challenge.identitySecret usingTouchIDforIdentity:challenge.identity withCompletionHandler:^(BOOL success) {
-            if (!success) {
-                NSString *errorTitle = NSLocalizedString(@"error_enroll_failed_to_store_identity_title", @"Account cannot be saved title");
-                NSString *errorMessage = NSLocalizedString(@"error_enroll_failed_to_generate_secret", @"Failed to generate identity secret. Please contact support.");
-                NSDictionary *details = @{NSLocalizedDescriptionKey: errorTitle, NSLocalizedFailureReasonErrorKey: errorMessage};
+        if (biometricID) {
+            [self.secretService setSecret:challenge.identitySecret usingTouchIDforIdentity:challenge.identity withCompletionHandler:^(BOOL success) {
+                if (!success) {
+                    storeFailedBlock();
+                    return;
+                }
                 
-                NSError *error = [NSError errorWithDomain:TIQRECErrorDomain code:TIQRECUnknownError userInfo:details];
-                completionHandler(false, error);
-                return;
-            }
-            
+                challenge.identity.usesOldBiometricFlow = @NO;
+                challenge.identity.biometricIDEnabled = @YES;
+                challenge.identity.biometricIDAvailable = @YES;
+                challenge.identity.shouldAskToEnrollInBiometricID = @NO;
+                
+                sendConfirmationBlock();
+            }];
+        } else {
             challenge.identity.usesOldBiometricFlow = @NO;
-            challenge.identity.biometricIDEnabled = @YES;
-            challenge.identity.biometricIDAvailable = @YES;
+            challenge.identity.biometricIDEnabled = @NO;
+            challenge.identity.biometricIDAvailable = @NO;
             challenge.identity.shouldAskToEnrollInBiometricID = @NO;
             
             sendConfirmationBlock();
-        }];
-    } else {
-        [self.secretService setSecret:challenge.identitySecret
-                          forIdentity:challenge.identity
-                              withPIN:challenge.identityPIN];
-        
-        challenge.identity.usesOldBiometricFlow = @NO;
-        challenge.identity.biometricIDEnabled = @NO;
-        challenge.identity.biometricIDAvailable = @NO;
-        challenge.identity.shouldAskToEnrollInBiometricID = @NO;
-        
-        sendConfirmationBlock();
-    }
-    
+        }
+    }];
 }
 
 - (void)completeAuthenticationChallenge:(AuthenticationChallenge *)challenge withSecret:(NSData *)secret completionHandler:(void (^)(BOOL succes, NSString *response, NSError *error))completionHandler {
     
     NSObject<OCRAProtocol> *ocra;
+    OCRASuiteDialect dialect;
     if (challenge.protocolVersion && [challenge.protocolVersion intValue] >= 2) {
         ocra = [[OCRAWrapper alloc] init];
+        dialect = OCRASuiteDialectV2;
     } else {
         ocra = [[OCRAWrapper_v1 alloc] init];
+        dialect = OCRASuiteDialectV1;
     }
     
     NSError *error = nil;
-    NSString *response = [ocra generateOCRA:challenge.identityProvider.ocraSuite secret:secret challenge:challenge.challenge sessionKey:challenge.sessionKey error:&error];
+    NSString *response = nil;
+    // Whatever the response is computed with is released (and the key
+    // material in the secure arena zeroed) before the response is sent
+    @autoreleasepool {
+        OCRASuite *ocraSuite = [challenge.identityProvider compiledOcraSuiteForDialect:dialect error:&error];
+        if (ocraSuite != nil) {
+            // A counter is taken (and durably advanced) before the response exists, so it's never reused
+            uint64_t counter = 0;
+            if (ocraSuite.layout->counterLength == 0 || [self.identityService nextCounter:&counter forIdentity:challenge.identity error:&error]) {
+                NSDate *date = [[ServerClock sharedInstance] serverDateForURL:[NSURL URLWithString:challenge.identityProvider.authenticationUrl]];
+                response = [ocra generateOCRAWithSuite:ocraSuite secret:secret challenge:challenge.challenge sessionKey:challenge.sessionKey counter:counter date:date error:&error];
+            }
+        }
+    }
+    
     if (response == nil) {
+        [self.secretService wipeDerivedKeys];
         completionHandler(false, nil, error);
         return;
     }
     
     AuthenticationConfirmationRequest *request = [[AuthenticationConfirmationRequest alloc] initWithAuthenticationChallenge:challenge response:response];
     [request sendWithCompletionHandler:^(BOOL success, NSError *error) {
+        if (!success) {
+            // The PIN may have been wrong, don't let its key serve a retry
+            [self.secretService wipeDerivedKeys];
+        }
         completionHandler(success, response, error);
     }];
 }
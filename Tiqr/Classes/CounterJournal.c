@@ -0,0 +1,506 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "CounterJournal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File layout, all integers big endian:
+ *
+ *   header  "TQCJ", uint32 version
+ *   record  uint8 type, uint8 reserved, uint16 name length, uint64 counter,
+ *           name, uint32 CRC-32 of everything in front of it
+ */
+
+static const uint8_t CounterJournalMagic[4] = { 'T', 'Q', 'C', 'J' };
+static const uint32_t CounterJournalVersion = 1;
+
+#define CounterJournalHeaderLength 8
+#define CounterJournalRecordOverhead (1 + 1 + 2 + 8 + 4)
+#define CounterJournalMaxRecordLength (CounterJournalRecordOverhead + CounterJournalMaxNameLength)
+
+// Compact once there are this many records and most of them are superseded
+#define CounterJournalCompactionThreshold 256
+
+enum {
+    CounterJournalRecordSet = 1,
+    CounterJournalRecordRemove = 2
+};
+
+typedef struct {
+    char *name;
+    uint64_t counter;
+} CounterJournalEntry;
+
+struct CounterJournal {
+    char *path;
+    int fd;
+    off_t size;
+    size_t recordCount;
+    CounterJournalEntry *entries;
+    size_t entryCount;
+    size_t entryCapacity;
+};
+
+static uint32_t CounterJournalCRC32(const uint8_t *bytes, size_t length) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static void CounterJournalStore32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+static uint32_t CounterJournalLoad32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static void CounterJournalStore64(uint8_t *bytes, uint64_t value) {
+    CounterJournalStore32(bytes, (uint32_t)(value >> 32));
+    CounterJournalStore32(bytes + 4, (uint32_t)value);
+}
+
+static uint64_t CounterJournalLoad64(const uint8_t *bytes) {
+    return ((uint64_t)CounterJournalLoad32(bytes) << 32) | CounterJournalLoad32(bytes + 4);
+}
+
+// Writes and orders the record before anything that follows. A barrier is enough where
+// the platform has one: a crash can only lose a suffix of the journal, never reorder it.
+static int CounterJournalSync(int fd) {
+#if defined(F_BARRIERFSYNC)
+    if (fcntl(fd, F_BARRIERFSYNC) == 0) {
+        return 0;
+    }
+#endif
+#if defined(__linux__)
+    return fdatasync(fd) == 0 ? 0 : errno;
+#else
+    return fsync(fd) == 0 ? 0 : errno;
+#endif
+}
+
+static int CounterJournalWriteAll(int fd, const uint8_t *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static CounterJournalEntry *CounterJournalFind(const CounterJournal *journal, const char *name) {
+    for (size_t i = 0; i < journal->entryCount; i++) {
+        if (strcmp(journal->entries[i].name, name) == 0) {
+            return &journal->entries[i];
+        }
+    }
+    return NULL;
+}
+
+static int CounterJournalReserve(CounterJournal *journal) {
+    if (journal->entryCount < journal->entryCapacity) {
+        return 0;
+    }
+
+    size_t capacity = journal->entryCapacity == 0 ? 8 : journal->entryCapacity * 2;
+    CounterJournalEntry *entries = realloc(journal->entries, capacity * sizeof(CounterJournalEntry));
+    if (entries == NULL) {
+        return ENOMEM;
+    }
+    journal->entries = entries;
+    journal->entryCapacity = capacity;
+    return 0;
+}
+
+static int CounterJournalApply(CounterJournal *journal, int type, const char *name, size_t nameLength, uint64_t counter) {
+    CounterJournalEntry *entry = NULL;
+    for (size_t i = 0; i < journal->entryCount; i++) {
+        if (strlen(journal->entries[i].name) == nameLength && memcmp(journal->entries[i].name, name, nameLength) == 0) {
+            entry = &journal->entries[i];
+            break;
+        }
+    }
+
+    if (type == CounterJournalRecordRemove) {
+        if (entry != NULL) {
+            free(entry->name);
+            *entry = journal->entries[--journal->entryCount];
+        }
+        return 0;
+    }
+
+    if (entry == NULL) {
+        int result = CounterJournalReserve(journal);
+        if (result != 0) {
+            return result;
+        }
+
+        char *copy = malloc(nameLength + 1);
+        if (copy == NULL) {
+            return ENOMEM;
+        }
+        memcpy(copy, name, nameLength);
+        copy[nameLength] = '\0';
+
+        entry = &journal->entries[journal->entryCount++];
+        entry->name = copy;
+    }
+
+    entry->counter = counter;
+    return 0;
+}
+
+static size_t CounterJournalEncode(uint8_t *record, int type, const char *name, size_t nameLength, uint64_t counter) {
+    record[0] = (uint8_t)type;
+    record[1] = 0;
+    record[2] = (uint8_t)(nameLength >> 8);
+    record[3] = (uint8_t)nameLength;
+    CounterJournalStore64(record + 4, counter);
+    memcpy(record + 12, name, nameLength);
+    CounterJournalStore32(record + 12 + nameLength, CounterJournalCRC32(record, 12 + nameLength));
+    return CounterJournalRecordOverhead + nameLength;
+}
+
+// Replays the records in buffer, returns the length of the valid prefix
+static size_t CounterJournalReplay(CounterJournal *journal, const uint8_t *buffer, size_t length, int *result) {
+    size_t offset = CounterJournalHeaderLength;
+    *result = 0;
+
+    while (length - offset >= CounterJournalRecordOverhead) {
+        const uint8_t *record = buffer + offset;
+        size_t nameLength = ((size_t)record[2] << 8) | record[3];
+        int type = record[0];
+        if (nameLength > CounterJournalMaxNameLength || length - offset < CounterJournalRecordOverhead + nameLength) {
+            break;
+        }
+        if ((type != CounterJournalRecordSet && type != CounterJournalRecordRemove) || record[1] != 0) {
+            break;
+        }
+        if (CounterJournalLoad32(record + 12 + nameLength) != CounterJournalCRC32(record, 12 + nameLength)) {
+            break;
+        }
+
+        *result = CounterJournalApply(journal, type, (const char *)record + 12, nameLength, CounterJournalLoad64(record + 4));
+        if (*result != 0) {
+            break;
+        }
+
+        journal->recordCount++;
+        offset += CounterJournalRecordOverhead + nameLength;
+    }
+
+    return offset;
+}
+
+static int CounterJournalLoad(CounterJournal *journal) {
+    struct stat status;
+    if (fstat(journal->fd, &status) != 0) {
+        return errno;
+    }
+
+    uint8_t header[CounterJournalHeaderLength];
+    memcpy(header, CounterJournalMagic, sizeof(CounterJournalMagic));
+    CounterJournalStore32(header + 4, CounterJournalVersion);
+
+    // A new file, or one that crashed before its header made it to disk
+    if (status.st_size < CounterJournalHeaderLength) {
+        if (ftruncate(journal->fd, 0) != 0 || lseek(journal->fd, 0, SEEK_SET) < 0) {
+            return errno;
+        }
+        int result = CounterJournalWriteAll(journal->fd, header, sizeof(header));
+        if (result == 0) {
+            result = CounterJournalSync(journal->fd);
+        }
+        journal->size = sizeof(header);
+        return result;
+    }
+
+    size_t length = (size_t)status.st_size;
+    uint8_t *buffer = malloc(length);
+    if (buffer == NULL) {
+        return ENOMEM;
+    }
+
+    size_t read = 0;
+    while (read < length) {
+        ssize_t count = pread(journal->fd, buffer + read, length - read, (off_t)read);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            free(buffer);
+            return count < 0 ? errno : EIO;
+        }
+        read += (size_t)count;
+    }
+
+    // Not a journal (or a newer version), don't touch it
+    if (memcmp(buffer, header, sizeof(header)) != 0) {
+        free(buffer);
+        return EINVAL;
+    }
+
+    int result;
+    size_t valid = CounterJournalReplay(journal, buffer, length, &result);
+    free(buffer);
+    if (result != 0) {
+        return result;
+    }
+
+    // Drop a torn tail so new records are appended right behind the last valid one
+    if (valid < length) {
+        if (ftruncate(journal->fd, (off_t)valid) != 0) {
+            return errno;
+        }
+        result = CounterJournalSync(journal->fd);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    journal->size = (off_t)valid;
+    return 0;
+}
+
+int CounterJournalOpen(const char *path, CounterJournal **journal) {
+    CounterJournal *result = calloc(1, sizeof(CounterJournal));
+    if (result == NULL) {
+        return ENOMEM;
+    }
+
+    result->path = strdup(path);
+    result->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (result->path == NULL || result->fd < 0) {
+        int error = result->path == NULL ? ENOMEM : errno;
+        CounterJournalClose(result);
+        return error;
+    }
+
+    int error = CounterJournalLoad(result);
+    if (error != 0) {
+        CounterJournalClose(result);
+        return error;
+    }
+
+    *journal = result;
+    return 0;
+}
+
+void CounterJournalClose(CounterJournal *journal) {
+    if (journal == NULL) {
+        return;
+    }
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    for (size_t i = 0; i < journal->entryCount; i++) {
+        free(journal->entries[i].name);
+    }
+    free(journal->entries);
+    free(journal->path);
+    free(journal);
+}
+
+bool CounterJournalGet(const CounterJournal *journal, const char *name, uint64_t *counter) {
+    const CounterJournalEntry *entry = CounterJournalFind(journal, name);
+    if (entry == NULL) {
+        return false;
+    }
+    if (counter != NULL) {
+        *counter = entry->counter;
+    }
+    return true;
+}
+
+static int CounterJournalAppend(CounterJournal *journal, int type, const char *name, uint64_t counter) {
+    size_t nameLength = strlen(name);
+    if (nameLength > CounterJournalMaxNameLength) {
+        return ENAMETOOLONG;
+    }
+    if (journal->fd < 0) {
+        return EIO;
+    }
+
+    uint8_t record[CounterJournalMaxRecordLength];
+    size_t length = CounterJournalEncode(record, type, name, nameLength, counter);
+
+    // Allocate everything a new counter needs up front, so a durable record is always applied
+    char *copy = NULL;
+    if (type == CounterJournalRecordSet && CounterJournalFind(journal, name) == NULL) {
+        int result = CounterJournalReserve(journal);
+        if (result != 0) {
+            return result;
+        }
+        copy = strdup(name);
+        if (copy == NULL) {
+            return ENOMEM;
+        }
+    }
+
+    int result = CounterJournalWriteAll(journal->fd, record, length);
+    if (result == 0) {
+        result = CounterJournalSync(journal->fd);
+    }
+    if (result != 0) {
+        // Don't leave a partial record in front of later ones. If that fails as well, stop
+        // writing: replay would stop at the partial record and lose anything behind it.
+        if (ftruncate(journal->fd, journal->size) != 0) {
+            close(journal->fd);
+            journal->fd = -1;
+        }
+        free(copy);
+        return result;
+    }
+
+    journal->size += (off_t)length;
+    journal->recordCount++;
+    if (copy != NULL) {
+        journal->entries[journal->entryCount].name = copy;
+        journal->entries[journal->entryCount].counter = counter;
+        journal->entryCount++;
+    } else {
+        CounterJournalApply(journal, type, name, nameLength, counter);
+    }
+
+    if (journal->recordCount >= CounterJournalCompactionThreshold && journal->recordCount > 4 * journal->entryCount) {
+        // The record is durable already, a failed compaction only postpones the cleanup
+        CounterJournalCompact(journal);
+    }
+    return 0;
+}
+
+int CounterJournalSet(CounterJournal *journal, const char *name, uint64_t counter) {
+    return CounterJournalAppend(journal, CounterJournalRecordSet, name, counter);
+}
+
+int CounterJournalNext(CounterJournal *journal, const char *name, uint64_t *counter) {
+    uint64_t current = 0;
+    CounterJournalGet(journal, name, &current);
+
+    int result = CounterJournalAppend(journal, CounterJournalRecordSet, name, current + 1);
+    if (result == 0) {
+        *counter = current;
+    }
+    return result;
+}
+
+int CounterJournalRemove(CounterJournal *journal, const char *name) {
+    if (!CounterJournalGet(journal, name, NULL)) {
+        return 0;
+    }
+    return CounterJournalAppend(journal, CounterJournalRecordRemove, name, 0);
+}
+
+int CounterJournalCompact(CounterJournal *journal) {
+    if (journal->fd < 0) {
+        return EIO;
+    }
+
+    size_t length = CounterJournalHeaderLength;
+    for (size_t i = 0; i < journal->entryCount; i++) {
+        length += CounterJournalRecordOverhead + strlen(journal->entries[i].name);
+    }
+
+    uint8_t *buffer = malloc(length);
+    size_t pathLength = strlen(journal->path);
+    char *temporaryPath = malloc(pathLength + 5);
+    if (buffer == NULL || temporaryPath == NULL) {
+        free(buffer);
+        free(temporaryPath);
+        return ENOMEM;
+    }
+
+    memcpy(buffer, CounterJournalMagic, sizeof(CounterJournalMagic));
+    CounterJournalStore32(buffer + 4, CounterJournalVersion);
+    size_t offset = CounterJournalHeaderLength;
+    for (size_t i = 0; i < journal->entryCount; i++) {
+        const CounterJournalEntry *entry = &journal->entries[i];
+        offset += CounterJournalEncode(buffer + offset, CounterJournalRecordSet, entry->name, strlen(entry->name), entry->counter);
+    }
+
+    // Write a complete new journal next to the old one and swap it in with rename, a
+    // crash leaves either the old or the new file in place
+    memcpy(temporaryPath, journal->path, pathLength);
+    memcpy(temporaryPath + pathLength, ".tmp", 5);
+    int result = 0;
+    int fd = open(temporaryPath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0) {
+        result = errno;
+    } else {
+        result = CounterJournalWriteAll(fd, buffer, length);
+        if (result == 0 && fsync(fd) != 0) {
+            result = errno;
+        }
+        if (result == 0 && rename(temporaryPath, journal->path) != 0) {
+            result = errno;
+        }
+        if (result != 0) {
+            close(fd);
+            unlink(temporaryPath);
+        }
+    }
+
+    free(buffer);
+    free(temporaryPath);
+    if (result != 0) {
+        return result;
+    }
+
+    close(journal->fd);
+    journal->fd = fd;
+    journal->size = (off_t)length;
+    journal->recordCount = journal->entryCount;
+    return 0;
+}
+
+size_t CounterJournalRecordCount(const CounterJournal *journal) {
+    return journal->recordCount;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CounterJournal_h
+#define CounterJournal_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only journal of named 64-bit counters (OCRA and HOTP counters).
+ *
+ * Every update appends one small checksummed record and syncs it, which
+ * is far cheaper than saving the Core Data store. The current values are
+ * kept in memory; the file is only read when the journal is opened. A
+ * record that was cut short by a crash fails its checksum and is dropped
+ * (together with anything after it) on the next open, so a counter is
+ * either at its previous or at its new value, never corrupt. Once the file
+ * is mostly superseded records it is compacted into a fresh file that
+ * atomically replaces the old one.
+ *
+ * Functions return 0 or an errno value. A journal is not thread safe.
+ */
+
+typedef struct CounterJournal CounterJournal;
+
+/**
+ * Maximum length of a counter name in bytes.
+ */
+#define CounterJournalMaxNameLength 512
+
+/**
+ * Opens (or creates) the journal at path and replays it.
+ *
+ * @param path     file path
+ * @param journal  set to the opened journal
+ *
+ * @return 0 or an errno value
+ */
+int CounterJournalOpen(const char *path, CounterJournal **journal);
+
+/**
+ * Closes the journal and frees it.
+ */
+void CounterJournalClose(CounterJournal *journal);
+
+/**
+ * Looks up a counter.
+ *
+ * @param journal  journal
+ * @param name     counter name
+ * @param counter  set to the counter value if it exists
+ *
+ * @return whether the counter exists
+ */
+bool CounterJournalGet(const CounterJournal *journal, const char *name, uint64_t *counter);
+
+/**
+ * Durably sets a counter.
+ *
+ * @param journal  journal
+ * @param name     counter name, at most CounterJournalMaxNameLength bytes
+ * @param counter  new value
+ *
+ * @return 0 or an errno value, the counter is unchanged on failure
+ */
+int CounterJournalSet(CounterJournal *journal, const char *name, uint64_t counter);
+
+/**
+ * Durably takes the next value of a counter: returns the current value
+ * (0 for a new counter) and stores the value after it. The returned value
+ * is never handed out again, not even after a crash.
+ *
+ * @param journal  journal
+ * @param name     counter name
+ * @param counter  set to the value to use
+ *
+ * @return 0 or an errno value
+ */
+int CounterJournalNext(CounterJournal *journal, const char *name, uint64_t *counter);
+
+/**
+ * Durably removes a counter.
+ *
+ * @return 0 or an errno value
+ */
+int CounterJournalRemove(CounterJournal *journal, const char *name);
+
+/**
+ * Rewrites the journal with one record per counter. Happens automatically
+ * once most records are superseded.
+ *
+ * @return 0 or an errno value
+ */
+int CounterJournalCompact(CounterJournal *journal);
+
+/**
+ * Number of records in the file, including superseded ones.
+ */
+size_t CounterJournalRecordCount(const CounterJournal *journal);
+
+#endif /* CounterJournal_h */
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DerivedKeyCache.h"
+#include "HMACKey.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DerivedKeyCacheTagLength 32
+
+typedef struct {
+    bool used;
+    uint8_t tag[DerivedKeyCacheTagLength];
+    uint8_t key[DerivedKeyCacheMaxKeyLength];
+    size_t keyLength;
+    uint64_t expires;
+    uint32_t usesLeft;
+} DerivedKeyCacheEntry;
+
+struct DerivedKeyCache {
+    pthread_mutex_t lock;
+    size_t pageLength;
+    DerivedKeyCachePolicy policy;
+    DerivedKeyCacheMetrics metrics;
+    HMACKey tagKey;
+    DerivedKeyCacheEntry entries[DerivedKeyCacheCapacity];
+};
+
+static int DerivedKeyCacheRandom(uint8_t *buffer, size_t length) {
+#ifdef __APPLE__
+    arc4random_buf(buffer, length);
+    return 0;
+#else
+    return getentropy(buffer, length) == 0 ? 0 : errno;
+#endif
+}
+
+static void DerivedKeyCacheClearEntry(DerivedKeyCacheEntry *entry) {
+    HMACSecureZero(entry, sizeof(*entry));
+}
+
+/**
+ * Zeroes the entries that expired by now, every operation starts with
+ * this so an expired key never outlives the next access.
+ */
+static size_t DerivedKeyCacheExpire(DerivedKeyCache *cache, uint64_t now) {
+    size_t remaining = 0;
+    for (size_t i = 0; i < DerivedKeyCacheCapacity; i++) {
+        DerivedKeyCacheEntry *entry = &cache->entries[i];
+        if (entry->used && now >= entry->expires) {
+            DerivedKeyCacheClearEntry(entry);
+            cache->metrics.expirations++;
+        } else if (entry->used) {
+            remaining++;
+        }
+    }
+    return remaining;
+}
+
+static void DerivedKeyCacheAppend(uint8_t *message, size_t *offset, const uint8_t *field, size_t length) {
+    uint32_t prefix = (uint32_t)length;
+    memcpy(message + *offset, &prefix, sizeof(prefix));
+    if (length > 0) {
+        memcpy(message + *offset + sizeof(prefix), field, length);
+    }
+    *offset += sizeof(prefix) + length;
+}
+
+/**
+ * The tag is the HMAC of the length prefixed fields, so no two different
+ * inputs share a message.
+ */
+static bool DerivedKeyCacheTag(const DerivedKeyCache *cache, const DerivedKeyCacheInput *input, uint8_t *tag) {
+    size_t length = input->identityLength + input->saltLength + input->passwordLength;
+    if (input->identityLength > DerivedKeyCacheMaxInputLength || input->saltLength > DerivedKeyCacheMaxInputLength ||
+        input->passwordLength > DerivedKeyCacheMaxInputLength || length > DerivedKeyCacheMaxInputLength) {
+        return false;
+    }
+
+    uint8_t message[DerivedKeyCacheMaxInputLength + 4 * sizeof(uint32_t)];
+    size_t offset = 0;
+    DerivedKeyCacheAppend(message, &offset, input->identity, input->identityLength);
+    DerivedKeyCacheAppend(message, &offset, input->salt, input->saltLength);
+    DerivedKeyCacheAppend(message, &offset, input->password, input->passwordLength);
+    memcpy(message + offset, &input->rounds, sizeof(input->rounds));
+    offset += sizeof(input->rounds);
+
+    HMACKeyCompute(&cache->tagKey, message, offset, tag);
+    HMACSecureZero(message, offset);
+    return true;
+}
+
+static bool DerivedKeyCacheTagsEqual(const uint8_t *a, const uint8_t *b) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < DerivedKeyCacheTagLength; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+static DerivedKeyCacheEntry *DerivedKeyCacheFind(DerivedKeyCache *cache, const uint8_t *tag) {
+    DerivedKeyCacheEntry *found = NULL;
+    for (size_t i = 0; i < DerivedKeyCacheCapacity; i++) {
+        if (cache->entries[i].used && DerivedKeyCacheTagsEqual(cache->entries[i].tag, tag)) {
+            found = &cache->entries[i];
+        }
+    }
+    return found;
+}
+
+int DerivedKeyCacheCreate(const DerivedKeyCachePolicy *policy, DerivedKeyCache **cache) {
+    if (policy->timeToLive == 0) {
+        return EINVAL;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t pageLength = pageSize > 0 ? (size_t)pageSize : 4096;
+    pageLength = (sizeof(DerivedKeyCache) + pageLength - 1) / pageLength * pageLength;
+
+    void *page = mmap(NULL, pageLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (page == MAP_FAILED) {
+        return errno;
+    }
+    if (mlock(page, pageLength) != 0) {
+        int error = errno;
+        munmap(page, pageLength);
+        return error;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(page, pageLength, MADV_DONTDUMP);
+#endif
+
+    DerivedKeyCache *created = page;
+    created->pageLength = pageLength;
+    created->policy = *policy;
+
+    uint8_t tagSecret[DerivedKeyCacheTagLength];
+    int error = DerivedKeyCacheRandom(tagSecret, sizeof(tagSecret));
+    if (error == 0) {
+        HMACKeyInit(&created->tagKey, HMACAlgorithmSHA256, tagSecret, sizeof(tagSecret));
+        HMACSecureZero(tagSecret, sizeof(tagSecret));
+        error = pthread_mutex_init(&created->lock, NULL);
+    }
+    if (error != 0) {
+        HMACSecureZero(page, pageLength);
+        munlock(page, pageLength);
+        munmap(page, pageLength);
+        return error;
+    }
+
+    *cache = created;
+    return 0;
+}
+
+void DerivedKeyCacheDestroy(DerivedKeyCache *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+    size_t pageLength = cache->pageLength;
+    HMACSecureZero(cache, pageLength);
+    munlock(cache, pageLength);
+    munmap(cache, pageLength);
+}
+
+bool DerivedKeyCacheLookup(DerivedKeyCache *cache, const DerivedKeyCacheInput *input, uint64_t now, uint8_t *key, size_t keyLength) {
+    uint8_t tag[DerivedKeyCacheTagLength];
+    bool tagged = DerivedKeyCacheTag(cache, input, tag);
+
+    pthread_mutex_lock(&cache->lock);
+    DerivedKeyCacheExpire(cache, now);
+
+    DerivedKeyCacheEntry *entry = tagged ? DerivedKeyCacheFind(cache, tag) : NULL;
+    bool hit = entry != NULL && entry->keyLength == keyLength;
+    if (hit) {
+        memcpy(key, entry->key, keyLength);
+        cache->metrics.hits++;
+        if (cache->policy.maximumUses != 0 && --entry->usesLeft == 0) {
+            DerivedKeyCacheClearEntry(entry);
+            cache->metrics.expirations++;
+        }
+    } else {
+        cache->metrics.misses++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    HMACSecureZero(tag, sizeof(tag));
+    return hit;
+}
+
+int DerivedKeyCacheInsert(DerivedKeyCache *cache, const DerivedKeyCacheInput *input, uint64_t now, const uint8_t *key, size_t keyLength) {
+    uint8_t tag[DerivedKeyCacheTagLength];
+    if (keyLength == 0 || keyLength > DerivedKeyCacheMaxKeyLength || !DerivedKeyCacheTag(cache, input, tag)) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    DerivedKeyCacheExpire(cache, now);
+
+    // The same input, else a free slot, else the entry that expires first
+    DerivedKeyCacheEntry *entry = DerivedKeyCacheFind(cache, tag);
+    for (size_t i = 0; entry == NULL && i < DerivedKeyCacheCapacity; i++) {
+        if (!cache->entries[i].used) {
+            entry = &cache->entries[i];
+        }
+    }
+    if (entry == NULL) {
+        entry = &cache->entries[0];
+        for (size_t i = 1; i < DerivedKeyCacheCapacity; i++) {
+            if (cache->entries[i].expires < entry->expires) {
+                entry = &cache->entries[i];
+            }
+        }
+        cache->metrics.evictions++;
+    }
+
+    DerivedKeyCacheClearEntry(entry);
+    entry->used = true;
+    memcpy(entry->tag, tag, sizeof(tag));
+    memcpy(entry->key, key, keyLength);
+    entry->keyLength = keyLength;
+    entry->expires = now + cache->policy.timeToLive;
+    entry->usesLeft = cache->policy.maximumUses;
+    cache->metrics.insertions++;
+    pthread_mutex_unlock(&cache->lock);
+
+    HMACSecureZero(tag, sizeof(tag));
+    return 0;
+}
+
+size_t DerivedKeyCachePurge(DerivedKeyCache *cache, uint64_t now) {
+    pthread_mutex_lock(&cache->lock);
+    size_t remaining = DerivedKeyCacheExpire(cache, now);
+    pthread_mutex_unlock(&cache->lock);
+    return remaining;
+}
+
+void DerivedKeyCacheWipe(DerivedKeyCache *cache) {
+    pthread_mutex_lock(&cache->lock);
+    HMACSecureZero(cache->entries, sizeof(cache->entries));
+    cache->metrics.wipes++;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void DerivedKeyCacheGetMetrics(DerivedKeyCache *cache, DerivedKeyCacheMetrics *metrics) {
+    pthread_mutex_lock(&cache->lock);
+    *metrics = cache->metrics;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+uint64_t DerivedKeyCacheNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
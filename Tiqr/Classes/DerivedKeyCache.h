@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DerivedKeyCache_h
+#define DerivedKeyCache_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Short-lived cache of PIN derived keys, so back-to-back logins don't run
+ * PBKDF2 twice.
+ *
+ * Everything, including the bookkeeping, lives in a single page that is
+ * locked into memory (never written to swap) and excluded from core dumps
+ * where the platform allows it. Entries are found by an HMAC of the
+ * identity, salt, rounds and PIN under a random key of the cache, so a
+ * different PIN never hits, and the cache holds no readable copy of the
+ * PINs or identities. Expired and evicted entries are zeroed, and so is the
+ * whole cache when it is wiped or destroyed.
+ *
+ * Times are milliseconds on the clock of DerivedKeyCacheNow, callers pass
+ * them in so expiry can be tested. A cache is thread safe.
+ *
+ * Functions return 0 or an errno value.
+ */
+
+typedef struct DerivedKeyCache DerivedKeyCache;
+
+/**
+ * Number of keys the cache holds, the oldest one is evicted to make room.
+ */
+#define DerivedKeyCacheCapacity 16
+
+/**
+ * Longest key the cache stores, in bytes.
+ */
+#define DerivedKeyCacheMaxKeyLength 64
+
+/**
+ * Longest input (identity, salt and password together) the cache accepts,
+ * in bytes. Longer inputs are never cached.
+ */
+#define DerivedKeyCacheMaxInputLength 1024
+
+typedef struct {
+    /** How long a key stays in the cache after it was derived, in milliseconds. */
+    uint32_t timeToLive;
+    /** How many lookups a key serves before it is dropped, 0 for no limit. */
+    uint32_t maximumUses;
+} DerivedKeyCachePolicy;
+
+/**
+ * What a key was derived from.
+ */
+typedef struct {
+    const uint8_t *identity;
+    size_t identityLength;
+    const uint8_t *salt;
+    size_t saltLength;
+    const uint8_t *password;
+    size_t passwordLength;
+    uint32_t rounds;
+} DerivedKeyCacheInput;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    /** Keys dropped to make room for a new one. */
+    uint64_t evictions;
+    /** Keys dropped because they were too old or used up. */
+    uint64_t expirations;
+    /** Calls to DerivedKeyCacheWipe. */
+    uint64_t wipes;
+} DerivedKeyCacheMetrics;
+
+/**
+ * Creates an empty cache.
+ *
+ * @param policy  expiry policy, timeToLive must not be 0
+ * @param cache   set to the new cache
+ *
+ * @return 0, EINVAL, or the error of allocating or locking the page
+ */
+int DerivedKeyCacheCreate(const DerivedKeyCachePolicy *policy, DerivedKeyCache **cache);
+
+/**
+ * Wipes the cache and releases its page.
+ */
+void DerivedKeyCacheDestroy(DerivedKeyCache *cache);
+
+/**
+ * Looks up a key, counting a hit or a miss.
+ *
+ * @param cache      cache
+ * @param input      what the key was derived from
+ * @param now        current time
+ * @param key        receives the key on a hit
+ * @param keyLength  length of the key, must match the stored key
+ *
+ * @return whether the key was found
+ */
+bool DerivedKeyCacheLookup(DerivedKeyCache *cache, const DerivedKeyCacheInput *input, uint64_t now, uint8_t *key, size_t keyLength);
+
+/**
+ * Stores a key, replacing the key for the same input.
+ *
+ * @return 0 or EINVAL when the key or the input is too long
+ */
+int DerivedKeyCacheInsert(DerivedKeyCache *cache, const DerivedKeyCacheInput *input, uint64_t now, const uint8_t *key, size_t keyLength);
+
+/**
+ * Zeroes the entries that have expired.
+ *
+ * @return number of keys still in the cache
+ */
+size_t DerivedKeyCachePurge(DerivedKeyCache *cache, uint64_t now);
+
+/**
+ * Zeroes every entry.
+ */
+void DerivedKeyCacheWipe(DerivedKeyCache *cache);
+
+/**
+ * Copies the counters.
+ */
+void DerivedKeyCacheGetMetrics(DerivedKeyCache *cache, DerivedKeyCacheMetrics *metrics);
+
+/**
+ * Monotonic clock in milliseconds, keeps running while the device sleeps.
+ */
+uint64_t DerivedKeyCacheNow(void);
+
+#endif /* DerivedKeyCache_h */
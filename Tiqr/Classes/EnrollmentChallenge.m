@@ -30,6 +30,7 @@
 #import "EnrollmentChallenge.h"
 #import "NSString+DecodeURL.h"
 #import "ServiceContainer.h"
+#import "ServerClock.h"
 
 NSString *const TIQRECErrorDomain = @"org.tiqr.ec";
 
@@ -135,6 +136,18 @@ NSString *const TIQRECErrorDomain = @"org.tiqr.ec";
         return nil;
     }
     
+    // Reject suites we won't be able to compute a response for when logging in,
+    // which dialect is used depends on the protocol version of the login.
+    NSError *suiteError = nil;
+    if ([OCRASuite suiteWithString:challenge.identityProviderOcraSuite dialect:OCRASuiteDialectV2 error:&suiteError] == nil &&
+        [OCRASuite suiteWithString:challenge.identityProviderOcraSuite dialect:OCRASuiteDialectV1 error:nil] == nil) {
+        NSString *errorTitle = NSLocalizedString(@"error_enroll_invalid_response_title", @"Invalid response title");
+        NSString *errorMessage = NSLocalizedString(@"error_enroll_invalid_response", @"Invalid response message");
+        NSDictionary *details = @{NSLocalizedDescriptionKey: errorTitle, NSLocalizedFailureReasonErrorKey: errorMessage, NSUnderlyingErrorKey: suiteError};
+        [self applyError:[NSError errorWithDomain:TIQRECErrorDomain code:TIQRECInvalidResponseError userInfo:details] toError:error];
+        return nil;
+    }
+    
     NSDictionary *identityMetadata = metadata[@"identity"];
     NSError *assignError = [challenge assignIdentityMetadata:identityMetadata];
     if (assignError) {
@@ -175,7 +188,9 @@ NSString *const TIQRECErrorDomain = @"org.tiqr.ec";
 - (NSData *)downloadSynchronously:(NSURL *)url error:(NSError **)error {
 	NSURLResponse *response = nil;
 	NSURLRequest *request = [NSURLRequest requestWithURL:url];
+	NSDate *requestDate = [NSDate date];
 	NSData *data = [NSURLConnection sendSynchronousRequest:request returningResponse:&response error:error];
+	[[ServerClock sharedInstance] recordResponse:response requestDate:requestDate responseDate:[NSDate date]];
 	return data;
 }
 
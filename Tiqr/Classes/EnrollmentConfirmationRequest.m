@@ -29,6 +29,7 @@
 
 #import "EnrollmentConfirmationRequest.h"
 #import "NotificationRegistration.h"
+#import "ServerClock.h"
 #import "NSData+Hex.h"
 
 NSString *const TIQRECRErrorDomain = @"org.tiqr.ecr";
@@ -41,6 +42,7 @@ typedef void (^CompletionBlock)(BOOL success, NSError *error);
 @property (nonatomic, strong) NSMutableData *data;
 @property (nonatomic, copy) NSString *protocolVersion;
 @property (nonatomic, strong) NSURLConnection *sendConnection;
+@property (nonatomic, strong) NSDate *sendDate;
 @property (nonatomic, strong) CompletionBlock completionBlock;
 
 @end
@@ -77,12 +79,14 @@ typedef void (^CompletionBlock)(BOOL success, NSError *error);
     [request setValue:@"application/json" forHTTPHeaderField:@"Accept"];
     [request setValue:TIQR_PROTOCOL_VERSION forHTTPHeaderField:@"X-TIQR-Protocol-Version"];
 
+    self.sendDate = [NSDate date];
     self.sendConnection = [[NSURLConnection alloc] initWithRequest:request delegate:self];
 	self.data = [NSMutableData data];
 }
 
 - (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
     [self.data setLength:0];
+    [[ServerClock sharedInstance] recordResponse:response requestDate:self.sendDate responseDate:[NSDate date]];
     
     NSDictionary* headers = [(NSHTTPURLResponse *)response allHeaderFields];
     if (headers[@"X-TIQR-Protocol-Version"]) {
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+
+#include <pthread.h>
+
+const HMACBackend *const HMACBackends[] = {
+#if defined(HMAC_BACKEND_SHANI)
+    &HMACBackendSHANI,
+#endif
+#if defined(HMAC_BACKEND_ARMV8)
+    &HMACBackendARMv8,
+#endif
+#if defined(HMAC_BACKEND_OPENSSL)
+    &HMACBackendOpenSSL,
+#endif
+#if defined(HMAC_BACKEND_COMMONCRYPTO)
+    &HMACBackendCommonCrypto,
+#endif
+    &HMACBackendPortable,
+    NULL
+};
+
+static pthread_once_t detectOnce = PTHREAD_ONCE_INIT;
+static const HMACBackend *detectedBackend = NULL;
+static const HMACBackend *volatile overrideBackend = NULL;
+
+static void HMACBackendDetect(void) {
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if ((*backend)->supported()) {
+            detectedBackend = *backend;
+            return;
+        }
+    }
+    detectedBackend = &HMACBackendPortable;
+}
+
+const HMACBackend *HMACBackendActive(void) {
+    const HMACBackend *backend = overrideBackend;
+    if (backend != NULL) {
+        return backend;
+    }
+
+    pthread_once(&detectOnce, HMACBackendDetect);
+    return detectedBackend;
+}
+
+void HMACBackendSetActive(const HMACBackend *backend) {
+    overrideBackend = backend;
+}
+
+HMACCompressFunction HMACBackendCompressFunction(const HMACBackend *backend, HMACAlgorithm algorithm) {
+    HMACCompressFunction compress = backend->compress[algorithm];
+    return compress != NULL ? compress : HMACBackendPortable.compress[algorithm];
+}
+
+HMACIterateFunction HMACBackendIterateFunction(const HMACBackend *backend, HMACAlgorithm algorithm) {
+    HMACIterateFunction iterate = backend->iterate[algorithm];
+    return iterate != NULL ? iterate : HMACBackendPortable.iterate[algorithm];
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HMACBackend_h
+#define HMACBackend_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "HMACKey.h"
+
+/*
+ * Hash backends for HMACKey.
+ *
+ * A backend supplies the compression functions HMACKey runs on top of its
+ * cached midstates. The fastest backend the CPU supports is picked the first
+ * time a key is initialized; every key remembers the backend it was
+ * initialized with.
+ *
+ * Which backends are compiled in depends on the platform:
+ *
+ *   SHA-NI         x86-64 SHA extensions (SHA-1, SHA-256)
+ *   ARMv8          ARMv8 cryptography extensions (SHA-1, SHA-256), when the
+ *                  compiler targets them, which is always the case for iOS
+ *   OpenSSL        libcrypto block functions, define HMAC_BACKEND_OPENSSL
+ *                  and link libcrypto to enable
+ *   CommonCrypto   CCHmac, Apple platforms only
+ *   Portable       plain C, always available
+ *
+ * Algorithms a backend doesn't implement fall back to the portable code.
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HMAC_BACKEND_SHANI 1
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#define HMAC_BACKEND_ARMV8 1
+#endif
+
+#if defined(__APPLE__)
+#define HMAC_BACKEND_COMMONCRYPTO 1
+#endif
+
+/**
+ * Processes count consecutive blocks.
+ */
+typedef void (*HMACCompressFunction)(HMACState *state, const uint8_t *blocks, size_t count);
+
+/**
+ * One-shot HMAC for backends that can't continue from a midstate. The key
+ * is passed as a single block (hashed and zero padded), which gives the same
+ * result as the original key.
+ */
+typedef void (*HMACOneShotFunction)(HMACAlgorithm algorithm, const uint8_t *key, size_t keyLength, const uint8_t *message, size_t length, uint8_t *mac);
+
+/**
+ * Runs count PBKDF2 iterations (see PBKDF2.h) of the HMAC given by its inner
+ * and outer midstates: u = HMAC(u), t ^= u. u and t hold a digest in the
+ * state words, so no bytes are converted between iterations.
+ */
+typedef void (*HMACIterateFunction)(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count);
+
+typedef struct HMACBackend {
+    const char *name;
+
+    /**
+     * Whether the CPU supports the backend.
+     */
+    int (*supported)(void);
+
+    /**
+     * Compression function per HMACAlgorithm, NULL for algorithms the
+     * backend doesn't implement.
+     */
+    HMACCompressFunction compress[HMACAlgorithmCount];
+
+    /**
+     * Set instead of the compression functions when the backend only
+     * offers complete HMAC computations.
+     */
+    HMACOneShotFunction oneShot;
+
+    /**
+     * Narrowest multi-buffer kernel (see HMACBatch.h) that is faster than
+     * hashing one message at a time with this backend, 0 for any.
+     */
+    size_t minimumBatchLanes;
+
+    /**
+     * PBKDF2 iteration loop per HMACAlgorithm, NULL for algorithms the
+     * backend doesn't implement.
+     */
+    HMACIterateFunction iterate[HMACAlgorithmCount];
+} HMACBackend;
+
+extern const HMACBackend HMACBackendPortable;
+
+#if defined(HMAC_BACKEND_SHANI)
+extern const HMACBackend HMACBackendSHANI;
+#endif
+
+#if defined(HMAC_BACKEND_ARMV8)
+extern const HMACBackend HMACBackendARMv8;
+#endif
+
+#if defined(HMAC_BACKEND_OPENSSL)
+extern const HMACBackend HMACBackendOpenSSL;
+#endif
+
+#if defined(HMAC_BACKEND_COMMONCRYPTO)
+extern const HMACBackend HMACBackendCommonCrypto;
+#endif
+
+/**
+ * Compiled in backends in order of preference, NULL terminated.
+ */
+extern const HMACBackend *const HMACBackends[];
+
+/**
+ * Backend new keys are initialized with, the first supported backend from
+ * HMACBackends unless HMACBackendSetActive was called.
+ */
+const HMACBackend *HMACBackendActive(void);
+
+/**
+ * Overrides the backend for keys initialized from now on, e.g. to compare
+ * backends in tests and benchmarks. Pass NULL to go back to the default.
+ */
+void HMACBackendSetActive(const HMACBackend *backend);
+
+/**
+ * Compression function of the backend for the given algorithm, falling back
+ * to the portable implementation.
+ */
+HMACCompressFunction HMACBackendCompressFunction(const HMACBackend *backend, HMACAlgorithm algorithm);
+
+/**
+ * PBKDF2 iteration loop of the backend for the given algorithm, falling back
+ * to the portable implementation, NULL if neither has one.
+ */
+HMACIterateFunction HMACBackendIterateFunction(const HMACBackend *backend, HMACAlgorithm algorithm);
+
+#endif /* HMACBackend_h */
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+
+#if defined(HMAC_BACKEND_ARMV8)
+
+#include <arm_neon.h>
+
+#if defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include "HMACKeyPrivate.h"
+
+/*
+ * SHA-1 and SHA-256 with the ARMv8 cryptography extensions. Only compiled
+ * when the compiler targets them, so the instructions can be used directly.
+ */
+
+static const uint32_t sha1K[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+static uint32x4_t armv8Load(const uint8_t *bytes) {
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(bytes)));
+}
+
+static void armv8SHA1(HMACState *state, const uint8_t *blocks, size_t count) {
+    uint32x4_t abcd = vld1q_u32(state->words32);
+    uint32_t e0 = state->words32[4];
+
+    for (size_t b = 0; b < count; b++) {
+        const uint8_t *block = blocks + 64 * b;
+        uint32x4_t abcdSaved = abcd;
+        uint32_t e0Saved = e0, e = e0;
+        uint32x4_t w[4];
+
+#pragma GCC unroll 20
+        for (int g = 0; g < 20; g++) {
+            uint32x4_t message;
+            if (g < 4) {
+                message = armv8Load(block + 16 * g);
+            } else {
+                message = vsha1su1q_u32(vsha1su0q_u32(w[g & 3], w[(g + 1) & 3], w[(g + 2) & 3]), w[(g + 3) & 3]);
+            }
+            w[g & 3] = message;
+
+            uint32x4_t k = vaddq_u32(message, vdupq_n_u32(sha1K[g / 5]));
+            uint32_t next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+            if (g < 5) {
+                abcd = vsha1cq_u32(abcd, e, k);
+            } else if (g < 10 || g >= 15) {
+                abcd = vsha1pq_u32(abcd, e, k);
+            } else {
+                abcd = vsha1mq_u32(abcd, e, k);
+            }
+            e = next;
+        }
+
+        e0 = e + e0Saved;
+        abcd = vaddq_u32(abcd, abcdSaved);
+    }
+
+    vst1q_u32(state->words32, abcd);
+    state->words32[4] = e0;
+}
+
+/**
+ * One SHA-256 block, the message words are already in lane order.
+ */
+static inline __attribute__((always_inline)) void armv8SHA256Block(uint32x4_t *state0, uint32x4_t *state1, uint32x4_t w0, uint32x4_t w1, uint32x4_t w2, uint32x4_t w3) {
+    uint32x4_t abcdSaved = *state0, efghSaved = *state1;
+    uint32x4_t w[4] = { w0, w1, w2, w3 };
+
+#pragma GCC unroll 16
+    for (int g = 0; g < 16; g++) {
+        uint32x4_t message;
+        if (g < 4) {
+            message = w[g];
+        } else {
+            message = vsha256su1q_u32(vsha256su0q_u32(w[g & 3], w[(g + 1) & 3]), w[(g + 2) & 3], w[(g + 3) & 3]);
+        }
+        w[g & 3] = message;
+
+        uint32x4_t k = vaddq_u32(message, vld1q_u32(&HMACSHA256RoundConstants[4 * g]));
+        uint32x4_t previous = *state0;
+        *state0 = vsha256hq_u32(*state0, *state1, k);
+        *state1 = vsha256h2q_u32(*state1, previous, k);
+    }
+
+    *state0 = vaddq_u32(*state0, abcdSaved);
+    *state1 = vaddq_u32(*state1, efghSaved);
+}
+
+static void armv8SHA256(HMACState *state, const uint8_t *blocks, size_t count) {
+    uint32x4_t state0 = vld1q_u32(&state->words32[0]);
+    uint32x4_t state1 = vld1q_u32(&state->words32[4]);
+
+    for (size_t b = 0; b < count; b++) {
+        const uint8_t *block = blocks + 64 * b;
+        armv8SHA256Block(&state0, &state1, armv8Load(block), armv8Load(block + 16), armv8Load(block + 32), armv8Load(block + 48));
+    }
+
+    vst1q_u32(&state->words32[0], state0);
+    vst1q_u32(&state->words32[4], state1);
+}
+
+static void armv8IterateSHA256(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count) {
+    // Padding of a 32 byte message after a 64 byte key block
+    static const uint32_t padding[8] = { 0x80000000, 0, 0, 0, 0, 0, 0, (64 + 32) * 8 };
+    const uint32x4_t padding0 = vld1q_u32(&padding[0]);
+    const uint32x4_t padding1 = vld1q_u32(&padding[4]);
+
+    const uint32x4_t inner0 = vld1q_u32(&inner->words32[0]), inner1 = vld1q_u32(&inner->words32[4]);
+    const uint32x4_t outer0 = vld1q_u32(&outer->words32[0]), outer1 = vld1q_u32(&outer->words32[4]);
+    uint32x4_t u0 = vld1q_u32(&u->words32[0]), u1 = vld1q_u32(&u->words32[4]);
+    uint32x4_t t0 = vld1q_u32(&t->words32[0]), t1 = vld1q_u32(&t->words32[4]);
+
+    for (size_t round = 0; round < count; round++) {
+        uint32x4_t state0 = inner0, state1 = inner1;
+        armv8SHA256Block(&state0, &state1, u0, u1, padding0, padding1);
+
+        u0 = outer0;
+        u1 = outer1;
+        armv8SHA256Block(&u0, &u1, state0, state1, padding0, padding1);
+
+        t0 = veorq_u32(t0, u0);
+        t1 = veorq_u32(t1, u1);
+    }
+
+    vst1q_u32(&u->words32[0], u0);
+    vst1q_u32(&u->words32[4], u1);
+    vst1q_u32(&t->words32[0], t0);
+    vst1q_u32(&t->words32[4], t1);
+}
+
+static int armv8Supported(void) {
+#if defined(__linux__)
+    unsigned long capabilities = getauxval(AT_HWCAP);
+    return (capabilities & HWCAP_SHA1) && (capabilities & HWCAP_SHA2);
+#else
+    // Every 64-bit Apple CPU has the extensions
+    return 1;
+#endif
+}
+
+const HMACBackend HMACBackendARMv8 = {
+    "ARMv8",
+    armv8Supported,
+    { armv8SHA1, armv8SHA256, NULL, NULL },
+    NULL,
+    // The NEON kernel is always slower than the SHA instructions
+    SIZE_MAX,
+    { NULL, armv8IterateSHA256, NULL, NULL }
+};
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+
+#if defined(HMAC_BACKEND_COMMONCRYPTO)
+
+#include <CommonCrypto/CommonHMAC.h>
+
+/*
+ * CommonCrypto doesn't expose its block functions, so this backend computes
+ * complete HMACs with CCHmac from the key block kept in HMACKey.
+ */
+
+static void commonCryptoHMAC(HMACAlgorithm algorithm, const uint8_t *key, size_t keyLength, const uint8_t *message, size_t length, uint8_t *mac) {
+    CCHmacAlgorithm ccAlgorithm;
+    switch (algorithm) {
+        case HMACAlgorithmSHA1:
+            ccAlgorithm = kCCHmacAlgSHA1;
+            break;
+        case HMACAlgorithmSHA256:
+            ccAlgorithm = kCCHmacAlgSHA256;
+            break;
+        case HMACAlgorithmSHA512:
+            ccAlgorithm = kCCHmacAlgSHA512;
+            break;
+        default:
+            ccAlgorithm = kCCHmacAlgMD5;
+            break;
+    }
+    CCHmac(ccAlgorithm, key, keyLength, message, length, mac);
+}
+
+static int commonCryptoSupported(void) {
+    return 1;
+}
+
+const HMACBackend HMACBackendCommonCrypto = {
+    "CommonCrypto",
+    commonCryptoSupported,
+    { NULL, NULL, NULL, NULL },
+    commonCryptoHMAC,
+    0
+};
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+
+#if defined(HMAC_BACKEND_OPENSSL)
+
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+/*
+ * Block functions of libcrypto. The context structs are only used to hand
+ * the chaining value to the *_Transform functions.
+ */
+
+static void opensslSHA1(HMACState *state, const uint8_t *blocks, size_t count) {
+    SHA_CTX context;
+    context.h0 = state->words32[0];
+    context.h1 = state->words32[1];
+    context.h2 = state->words32[2];
+    context.h3 = state->words32[3];
+    context.h4 = state->words32[4];
+    for (size_t i = 0; i < count; i++) {
+        SHA1_Transform(&context, blocks + 64 * i);
+    }
+    state->words32[0] = context.h0;
+    state->words32[1] = context.h1;
+    state->words32[2] = context.h2;
+    state->words32[3] = context.h3;
+    state->words32[4] = context.h4;
+    HMACSecureZero(&context, sizeof(context));
+}
+
+static void opensslSHA256(HMACState *state, const uint8_t *blocks, size_t count) {
+    SHA256_CTX context;
+    for (int i = 0; i < 8; i++) {
+        context.h[i] = state->words32[i];
+    }
+    for (size_t i = 0; i < count; i++) {
+        SHA256_Transform(&context, blocks + 64 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        state->words32[i] = context.h[i];
+    }
+    HMACSecureZero(&context, sizeof(context));
+}
+
+static void opensslSHA512(HMACState *state, const uint8_t *blocks, size_t count) {
+    SHA512_CTX context;
+    for (int i = 0; i < 8; i++) {
+        context.h[i] = state->words64[i];
+    }
+    for (size_t i = 0; i < count; i++) {
+        SHA512_Transform(&context, blocks + 128 * i);
+    }
+    for (int i = 0; i < 8; i++) {
+        state->words64[i] = context.h[i];
+    }
+    HMACSecureZero(&context, sizeof(context));
+}
+
+static void opensslMD5(HMACState *state, const uint8_t *blocks, size_t count) {
+    MD5_CTX context;
+    context.A = state->words32[0];
+    context.B = state->words32[1];
+    context.C = state->words32[2];
+    context.D = state->words32[3];
+    for (size_t i = 0; i < count; i++) {
+        MD5_Transform(&context, blocks + 64 * i);
+    }
+    state->words32[0] = context.A;
+    state->words32[1] = context.B;
+    state->words32[2] = context.C;
+    state->words32[3] = context.D;
+    HMACSecureZero(&context, sizeof(context));
+}
+
+static int opensslSupported(void) {
+    return 1;
+}
+
+const HMACBackend HMACBackendOpenSSL = {
+    "OpenSSL",
+    opensslSupported,
+    { opensslSHA1, opensslSHA256, opensslSHA512, opensslMD5 },
+    NULL,
+    // libcrypto uses the SHA extensions itself where available
+    16
+};
+
+#endif
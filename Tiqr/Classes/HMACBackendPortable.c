@@ -0,0 +1,395 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+#include "HMACKeyPrivate.h"
+
+#include <string.h>
+
+/*
+ * Plain C implementations of the compression functions (FIPS 180-4, RFC 1321).
+ */
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#pragma mark - SHA-1
+
+/**
+ * Compresses the message words w[0..15], w has room for the whole schedule.
+ */
+static inline void sha1CompressWords(uint32_t *h, uint32_t *w) {
+    for (int i = 16; i < 80; i++) {
+        w[i] = ROTL32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = ROTL32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = ROTL32(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static void sha1Compress(uint32_t *h, const uint8_t *block) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = HMACLoad32(block + 4 * i);
+    }
+    sha1CompressWords(h, w);
+}
+
+#pragma mark - SHA-256
+
+const uint32_t HMACSHA256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline void sha256CompressWords(uint32_t *h, uint32_t *w) {
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = hh + s1 + ch + HMACSHA256RoundConstants[i] + w[i];
+        uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
+
+static void sha256Compress(uint32_t *h, const uint8_t *block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = HMACLoad32(block + 4 * i);
+    }
+    sha256CompressWords(h, w);
+}
+
+#pragma mark - SHA-512
+
+static const uint64_t sha512K[80] = {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+static inline void sha512CompressWords(uint64_t *h, uint64_t *w) {
+    for (int i = 16; i < 80; i++) {
+        uint64_t s0 = ROTR64(w[i - 15], 1) ^ ROTR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+        uint64_t s1 = ROTR64(w[i - 2], 19) ^ ROTR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint64_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 80; i++) {
+        uint64_t s1 = ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41);
+        uint64_t ch = (e & f) ^ (~e & g);
+        uint64_t t1 = hh + s1 + ch + sha512K[i] + w[i];
+        uint64_t s0 = ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39);
+        uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint64_t t2 = s0 + maj;
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
+
+static void sha512Compress(uint64_t *h, const uint8_t *block) {
+    uint64_t w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = HMACLoad64(block + 8 * i);
+    }
+    sha512CompressWords(h, w);
+}
+
+#pragma mark - MD5
+
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5Shifts[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+static void md5Compress(uint32_t *h, const uint8_t *block) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = HMACLoad32LE(block + 4 * i);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + ROTL32(a + f + md5K[i] + m[g], md5Shifts[i]);
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+}
+
+#pragma mark - Backend
+
+static void portableSHA1(HMACState *state, const uint8_t *blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sha1Compress(state->words32, blocks + 64 * i);
+    }
+}
+
+static void portableSHA256(HMACState *state, const uint8_t *blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sha256Compress(state->words32, blocks + 64 * i);
+    }
+}
+
+static void portableSHA512(HMACState *state, const uint8_t *blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        sha512Compress(state->words64, blocks + 128 * i);
+    }
+}
+
+static void portableMD5(HMACState *state, const uint8_t *blocks, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        md5Compress(state->words32, blocks + 64 * i);
+    }
+}
+
+#pragma mark - PBKDF2 iterations
+
+/*
+ * The message of both the inner and the outer hash of an iteration is a
+ * previous digest, which always fits one block together with its padding.
+ * The padding words are constant, only the digest words change per round.
+ */
+
+static void portableIterateSHA1(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count) {
+    uint32_t w[80], h[5];
+    for (size_t round = 0; round < count; round++) {
+        memcpy(w, u->words32, 20);
+        w[5] = 0x80000000;
+        memset(&w[6], 0, 9 * sizeof(uint32_t));
+        w[15] = (64 + 20) * 8;
+        memcpy(h, inner->words32, sizeof(h));
+        sha1CompressWords(h, w);
+
+        memcpy(w, h, 20);
+        w[5] = 0x80000000;
+        memset(&w[6], 0, 9 * sizeof(uint32_t));
+        w[15] = (64 + 20) * 8;
+        memcpy(h, outer->words32, sizeof(h));
+        sha1CompressWords(h, w);
+
+        for (int i = 0; i < 5; i++) {
+            u->words32[i] = h[i];
+            t->words32[i] ^= h[i];
+        }
+    }
+    HMACSecureZero(w, sizeof(w));
+    HMACSecureZero(h, sizeof(h));
+}
+
+static void portableIterateSHA256(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count) {
+    uint32_t w[64], h[8];
+    for (size_t round = 0; round < count; round++) {
+        memcpy(w, u->words32, 32);
+        w[8] = 0x80000000;
+        memset(&w[9], 0, 6 * sizeof(uint32_t));
+        w[15] = (64 + 32) * 8;
+        memcpy(h, inner->words32, sizeof(h));
+        sha256CompressWords(h, w);
+
+        memcpy(w, h, 32);
+        w[8] = 0x80000000;
+        memset(&w[9], 0, 6 * sizeof(uint32_t));
+        w[15] = (64 + 32) * 8;
+        memcpy(h, outer->words32, sizeof(h));
+        sha256CompressWords(h, w);
+
+        for (int i = 0; i < 8; i++) {
+            u->words32[i] = h[i];
+            t->words32[i] ^= h[i];
+        }
+    }
+    HMACSecureZero(w, sizeof(w));
+    HMACSecureZero(h, sizeof(h));
+}
+
+static void portableIterateSHA512(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count) {
+    uint64_t w[80], h[8];
+    for (size_t round = 0; round < count; round++) {
+        memcpy(w, u->words64, 64);
+        w[8] = 0x8000000000000000ULL;
+        memset(&w[9], 0, 6 * sizeof(uint64_t));
+        w[15] = (128 + 64) * 8;
+        memcpy(h, inner->words64, sizeof(h));
+        sha512CompressWords(h, w);
+
+        memcpy(w, h, 64);
+        w[8] = 0x8000000000000000ULL;
+        memset(&w[9], 0, 6 * sizeof(uint64_t));
+        w[15] = (128 + 64) * 8;
+        memcpy(h, outer->words64, sizeof(h));
+        sha512CompressWords(h, w);
+
+        for (int i = 0; i < 8; i++) {
+            u->words64[i] = h[i];
+            t->words64[i] ^= h[i];
+        }
+    }
+    HMACSecureZero(w, sizeof(w));
+    HMACSecureZero(h, sizeof(h));
+}
+
+static int portableSupported(void) {
+    return 1;
+}
+
+const HMACBackend HMACBackendPortable = {
+    "Portable",
+    portableSupported,
+    { portableSHA1, portableSHA256, portableSHA512, portableMD5 },
+    NULL,
+    0,
+    { portableIterateSHA1, portableIterateSHA256, portableIterateSHA512, NULL }
+};
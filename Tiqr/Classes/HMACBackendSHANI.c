@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBackend.h"
+
+#if defined(HMAC_BACKEND_SHANI)
+
+#include "HMACKeyPrivate.h"
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/*
+ * SHA-1 and SHA-256 with the x86 SHA extensions. The state is kept in the
+ * register layout the instructions expect and converted back at the end.
+ */
+
+#define SHANI_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+static SHANI_TARGET void shaniSHA1(HMACState *state, const uint8_t *blocks, size_t count) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state->words32), 0x1b);
+    __m128i e0 = _mm_set_epi32((int)state->words32[4], 0, 0, 0);
+
+    for (size_t b = 0; b < count; b++) {
+        const uint8_t *block = blocks + 64 * b;
+        __m128i abcdSaved = abcd, e0Saved = e0, previous = abcd, e;
+        __m128i w[4];
+
+        // Fully unrolled, the message schedule and round selectors become constants
+#pragma GCC unroll 20
+        for (int g = 0; g < 20; g++) {
+            __m128i message;
+            if (g < 4) {
+                message = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16 * g)), mask);
+            } else {
+                // W[g] = msg2(msg1(W[g-4], W[g-3]) ^ W[g-2], W[g-1])
+                message = _mm_sha1msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+                message = _mm_xor_si128(message, w[(g + 2) & 3]);
+                message = _mm_sha1msg2_epu32(message, w[(g + 3) & 3]);
+            }
+            w[g & 3] = message;
+
+            if (g == 0) {
+                e = _mm_add_epi32(e0, message);
+            } else {
+                e = _mm_sha1nexte_epu32(previous, message);
+            }
+            previous = abcd;
+
+            // The round function selector has to be an immediate
+            switch (g / 5) {
+                case 0:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+                    break;
+                case 1:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+                    break;
+                case 2:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+                    break;
+                default:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+                    break;
+            }
+        }
+
+        e0 = _mm_sha1nexte_epu32(previous, e0Saved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128((__m128i *)state->words32, _mm_shuffle_epi32(abcd, 0x1b));
+    state->words32[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+/**
+ * One SHA-256 block on a state in the ABEF / CDGH layout, the message words
+ * are already in lane order.
+ */
+static inline SHANI_TARGET __attribute__((always_inline)) void shaniSHA256Block(__m128i *state0, __m128i *state1, __m128i w0, __m128i w1, __m128i w2, __m128i w3) {
+    __m128i abefSaved = *state0, cdghSaved = *state1;
+    __m128i w[4] = { w0, w1, w2, w3 };
+
+#pragma GCC unroll 16
+    for (int g = 0; g < 16; g++) {
+        __m128i message;
+        if (g < 4) {
+            message = w[g];
+        } else {
+            message = _mm_sha256msg1_epu32(w[g & 3], w[(g + 1) & 3]);
+            message = _mm_add_epi32(message, _mm_alignr_epi8(w[(g + 3) & 3], w[(g + 2) & 3], 4));
+            message = _mm_sha256msg2_epu32(message, w[(g + 3) & 3]);
+        }
+        w[g & 3] = message;
+
+        __m128i k = _mm_add_epi32(message, _mm_loadu_si128((const __m128i *)&HMACSHA256RoundConstants[4 * g]));
+        *state1 = _mm_sha256rnds2_epu32(*state1, *state0, k);
+        *state0 = _mm_sha256rnds2_epu32(*state0, *state1, _mm_shuffle_epi32(k, 0x0e));
+    }
+
+    *state0 = _mm_add_epi32(*state0, abefSaved);
+    *state1 = _mm_add_epi32(*state1, cdghSaved);
+}
+
+// a b c d / e f g h into the ABEF / CDGH layout
+static inline SHANI_TARGET __attribute__((always_inline)) void shaniSHA256ToLanes(const uint32_t *words, __m128i *state0, __m128i *state1) {
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&words[0]), 0xb1);
+    *state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&words[4]), 0x1b);
+    *state0 = _mm_alignr_epi8(tmp, *state1, 8);
+    *state1 = _mm_blend_epi16(*state1, tmp, 0xf0);
+}
+
+// and back, as the word vectors a b c d and e f g h
+static inline SHANI_TARGET __attribute__((always_inline)) void shaniSHA256FromLanes(__m128i state0, __m128i state1, __m128i *abcd, __m128i *efgh) {
+    __m128i tmp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    *abcd = _mm_blend_epi16(tmp, state1, 0xf0);
+    *efgh = _mm_alignr_epi8(state1, tmp, 8);
+}
+
+static SHANI_TARGET void shaniSHA256(HMACState *state, const uint8_t *blocks, size_t count) {
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1;
+    shaniSHA256ToLanes(state->words32, &state0, &state1);
+
+    for (size_t b = 0; b < count; b++) {
+        const uint8_t *block = blocks + 64 * b;
+        shaniSHA256Block(&state0, &state1,
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 0)), mask),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 16)), mask),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 32)), mask),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(block + 48)), mask));
+    }
+
+    __m128i abcd, efgh;
+    shaniSHA256FromLanes(state0, state1, &abcd, &efgh);
+    _mm_storeu_si128((__m128i *)&state->words32[0], abcd);
+    _mm_storeu_si128((__m128i *)&state->words32[4], efgh);
+}
+
+static SHANI_TARGET void shaniIterateSHA256(const HMACState *inner, const HMACState *outer, HMACState *u, HMACState *t, size_t count) {
+    // Padding of a 32 byte message after a 64 byte key block
+    const __m128i padding0 = _mm_set_epi32(0, 0, 0, (int)0x80000000);
+    const __m128i padding1 = _mm_set_epi32((64 + 32) * 8, 0, 0, 0);
+
+    __m128i inner0, inner1, outer0, outer1;
+    shaniSHA256ToLanes(inner->words32, &inner0, &inner1);
+    shaniSHA256ToLanes(outer->words32, &outer0, &outer1);
+
+    __m128i u0 = _mm_loadu_si128((const __m128i *)&u->words32[0]);
+    __m128i u1 = _mm_loadu_si128((const __m128i *)&u->words32[4]);
+    __m128i t0 = _mm_loadu_si128((const __m128i *)&t->words32[0]);
+    __m128i t1 = _mm_loadu_si128((const __m128i *)&t->words32[4]);
+
+    for (size_t round = 0; round < count; round++) {
+        __m128i state0 = inner0, state1 = inner1;
+        shaniSHA256Block(&state0, &state1, u0, u1, padding0, padding1);
+        shaniSHA256FromLanes(state0, state1, &u0, &u1);
+
+        state0 = outer0;
+        state1 = outer1;
+        shaniSHA256Block(&state0, &state1, u0, u1, padding0, padding1);
+        shaniSHA256FromLanes(state0, state1, &u0, &u1);
+
+        t0 = _mm_xor_si128(t0, u0);
+        t1 = _mm_xor_si128(t1, u1);
+    }
+
+    _mm_storeu_si128((__m128i *)&u->words32[0], u0);
+    _mm_storeu_si128((__m128i *)&u->words32[4], u1);
+    _mm_storeu_si128((__m128i *)&t->words32[0], t0);
+    _mm_storeu_si128((__m128i *)&t->words32[4], t1);
+}
+
+static int shaniSupported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_SSE4_1) || !(ecx & bit_SSSE3)) {
+        return 0;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    return (ebx & (1u << 29)) != 0;
+}
+
+const HMACBackend HMACBackendSHANI = {
+    "SHA-NI",
+    shaniSupported,
+    { shaniSHA1, shaniSHA256, NULL, NULL },
+    NULL,
+    // Measured: scalar SHA-NI beats the SSE2 and AVX2 kernels, AVX-512 still wins
+    16,
+    { NULL, shaniIterateSHA256, NULL, NULL }
+};
+
+#endif
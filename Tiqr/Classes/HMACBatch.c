@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACBatch.h"
+#include "HMACKeyPrivate.h"
+#include "HMACBackend.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HMAC_BATCH_X86 1
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define HMAC_BATCH_NEON 1
+#endif
+
+typedef void (*HMACBatchKernelFunction)(const HMACKey *const *keys, const uint8_t *const *messages, size_t length, uint8_t *macs);
+
+typedef struct {
+    size_t lanes;
+    HMACBatchKernelFunction compute;
+    int (*supported)(void);
+} HMACBatchKernelInfo;
+
+#if defined(HMAC_BATCH_X86) || defined(HMAC_BATCH_NEON)
+
+// SSE2 and NEON are part of the baseline instruction set of these architectures
+#define HMAC_BATCH_LANES 4
+#define HMAC_BATCH_TARGET
+#include "HMACBatchKernel.h"
+#undef HMAC_BATCH_TARGET
+#undef HMAC_BATCH_LANES
+
+static int HMACBatchBaselineSupported(void) {
+    return 1;
+}
+
+#endif
+
+#if defined(HMAC_BATCH_X86)
+
+#define HMAC_BATCH_LANES 8
+#define HMAC_BATCH_TARGET __attribute__((target("avx2")))
+#include "HMACBatchKernel.h"
+#undef HMAC_BATCH_TARGET
+#undef HMAC_BATCH_LANES
+
+#define HMAC_BATCH_LANES 16
+#define HMAC_BATCH_TARGET __attribute__((target("avx512f")))
+#include "HMACBatchKernel.h"
+#undef HMAC_BATCH_TARGET
+#undef HMAC_BATCH_LANES
+
+static int HMACBatchAVX2Supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+static int HMACBatchAVX512Supported(void) {
+    return __builtin_cpu_supports("avx512f");
+}
+
+#endif
+
+/* Available kernels, widest first */
+static const HMACBatchKernelInfo kernels[] = {
+#if defined(HMAC_BATCH_X86)
+    { 16, HMACBatchKernel16, HMACBatchAVX512Supported },
+    { 8, HMACBatchKernel8, HMACBatchAVX2Supported },
+#endif
+#if defined(HMAC_BATCH_X86) || defined(HMAC_BATCH_NEON)
+    { 4, HMACBatchKernel4, HMACBatchBaselineSupported },
+#endif
+    { 0, NULL, NULL }
+};
+
+static size_t maximumLaneWidth = 0;
+
+static int HMACBatchKernelUsable(const HMACBatchKernelInfo *kernel) {
+    return (maximumLaneWidth == 0 || kernel->lanes <= maximumLaneWidth) && kernel->supported();
+}
+
+size_t HMACBatchLaneWidth(void) {
+    for (const HMACBatchKernelInfo *kernel = kernels; kernel->compute != NULL; kernel++) {
+        if (HMACBatchKernelUsable(kernel)) {
+            return kernel->lanes;
+        }
+    }
+    return 1;
+}
+
+void HMACBatchSetMaximumLaneWidth(size_t lanes) {
+    maximumLaneWidth = lanes;
+}
+
+/* The kernels share one padding layout, which needs the same absorbed length for every key */
+static int HMACBatchKeysCompatible(const HMACKey *const *keys, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        if (keys[i]->innerLength != keys[0]->innerLength || keys[i]->algorithm != keys[0]->algorithm) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void HMACBatchCompute(const HMACKey *const *keys, const uint8_t *const *messages, size_t length, size_t count, uint8_t *macs) {
+    if (count == 0) {
+        return;
+    }
+
+    size_t digestLength = keys[0]->digestLength;
+    size_t i = 0;
+
+    // Fill the widest lanes first, the remainder goes to narrower kernels as
+    // long as they beat the backend the keys were initialized with
+    if ((keys[0]->algorithm == HMACAlgorithmSHA1 || keys[0]->algorithm == HMACAlgorithmSHA256) && HMACBatchKeysCompatible(keys, count)) {
+        size_t minimumLanes = keys[0]->backend->compress[keys[0]->algorithm] != NULL ? keys[0]->backend->minimumBatchLanes : 0;
+        for (const HMACBatchKernelInfo *kernel = kernels; kernel->compute != NULL; kernel++) {
+            if (!HMACBatchKernelUsable(kernel) || kernel->lanes < minimumLanes) {
+                continue;
+            }
+            for (; i + kernel->lanes <= count; i += kernel->lanes) {
+                kernel->compute(keys + i, messages + i, length, macs + i * digestLength);
+            }
+        }
+    }
+
+    for (; i < count; i++) {
+        HMACKeyCompute(keys[i], messages[i], length, macs + i * digestLength);
+    }
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HMACBatch_h
+#define HMACBatch_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "HMACKey.h"
+
+/*
+ * Multi-buffer HMAC for many short messages of the same length.
+ *
+ * SHA-1 and SHA-256 batches are hashed several messages at a time, one
+ * message per vector lane: 4 lanes with SSE2 or NEON, 8 with AVX2 and 16
+ * with AVX-512. The widest kernel the CPU supports is picked at runtime.
+ * SHA-512, MD5 and CPUs without a vector kernel use HMACKeyCompute per
+ * message, as do kernels that are narrower than the key's backend's
+ * minimumBatchLanes (hardware SHA instructions beat narrow kernels).
+ * Results are identical to HMACKeyCompute.
+ */
+
+/**
+ * Computes count MACs, macs[i] = HMAC(keys[i], messages[i]).
+ *
+ * @param keys      key schedules, all for the same algorithm
+ * @param messages  messages, all of the given length
+ * @param length    length of every message in bytes
+ * @param count     number of messages
+ * @param macs      output, count * keys[0]->digestLength bytes
+ */
+void HMACBatchCompute(const HMACKey *const *keys, const uint8_t *const *messages, size_t length, size_t count, uint8_t *macs);
+
+/**
+ * Number of lanes the batch kernels use on this CPU, 1 if there is no
+ * vector kernel.
+ */
+size_t HMACBatchLaneWidth(void);
+
+/**
+ * Caps the lane width, e.g. to compare kernels in tests and benchmarks.
+ * Pass 0 to go back to the widest supported kernel.
+ */
+void HMACBatchSetMaximumLaneWidth(size_t lanes);
+
+#endif /* HMACBatch_h */
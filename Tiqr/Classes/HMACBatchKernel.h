@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Multi-buffer SHA-1/SHA-256 HMAC kernel, included by HMACBatch.c once per
+ * lane width. Before including, define:
+ *
+ *   HMAC_BATCH_LANES   number of messages hashed in parallel
+ *   HMAC_BATCH_TARGET  function attribute enabling the instruction set, or empty
+ *
+ * Every instance defines HMACBatchKernel<lanes>(), which computes exactly
+ * HMAC_BATCH_LANES MACs. All keys must have absorbed the same number of
+ * inner bytes. There is deliberately no include guard.
+ */
+
+#define HMAC_BATCH_PASTE2(a, b) a##b
+#define HMAC_BATCH_PASTE(a, b) HMAC_BATCH_PASTE2(a, b)
+#define HMAC_BATCH_FN(name) HMAC_BATCH_PASTE(name, HMAC_BATCH_LANES)
+
+typedef uint32_t HMAC_BATCH_FN(HMACBatchVector) __attribute__((vector_size(4 * HMAC_BATCH_LANES)));
+#define HMAC_BATCH_V HMAC_BATCH_FN(HMACBatchVector)
+
+#define HMAC_BATCH_ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define HMAC_BATCH_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static HMAC_BATCH_TARGET void HMAC_BATCH_FN(HMACBatchLoad)(HMAC_BATCH_V *w, const uint8_t *const *blocks) {
+    for (int i = 0; i < 16; i++) {
+        for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+            w[i][lane] = HMACLoad32(blocks[lane] + 4 * i);
+        }
+    }
+}
+
+static HMAC_BATCH_TARGET void HMAC_BATCH_FN(HMACBatchSHA1)(HMAC_BATCH_V *h, const HMAC_BATCH_V *block) {
+    HMAC_BATCH_V w[80];
+    for (int i = 0; i < 16; i++) {
+        w[i] = block[i];
+    }
+    for (int i = 16; i < 80; i++) {
+        HMAC_BATCH_V x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+        w[i] = HMAC_BATCH_ROTL(x, 1);
+    }
+
+    HMAC_BATCH_V a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+        HMAC_BATCH_V f;
+        uint32_t k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        HMAC_BATCH_V t = HMAC_BATCH_ROTL(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = HMAC_BATCH_ROTL(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+static HMAC_BATCH_TARGET void HMAC_BATCH_FN(HMACBatchSHA256)(HMAC_BATCH_V *h, const HMAC_BATCH_V *block) {
+    HMAC_BATCH_V w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = block[i];
+    }
+    for (int i = 16; i < 64; i++) {
+        HMAC_BATCH_V s0 = HMAC_BATCH_ROTR(w[i - 15], 7) ^ HMAC_BATCH_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        HMAC_BATCH_V s1 = HMAC_BATCH_ROTR(w[i - 2], 17) ^ HMAC_BATCH_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    HMAC_BATCH_V a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+    for (int i = 0; i < 64; i++) {
+        HMAC_BATCH_V s1 = HMAC_BATCH_ROTR(e, 6) ^ HMAC_BATCH_ROTR(e, 11) ^ HMAC_BATCH_ROTR(e, 25);
+        HMAC_BATCH_V ch = (e & f) ^ (~e & g);
+        HMAC_BATCH_V t1 = hh + s1 + ch + HMACSHA256RoundConstants[i] + w[i];
+        HMAC_BATCH_V s0 = HMAC_BATCH_ROTR(a, 2) ^ HMAC_BATCH_ROTR(a, 13) ^ HMAC_BATCH_ROTR(a, 22);
+        HMAC_BATCH_V maj = (a & b) ^ (a & c) ^ (b & c);
+        HMAC_BATCH_V t2 = s0 + maj;
+        hh = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += hh;
+}
+
+static HMAC_BATCH_TARGET void HMAC_BATCH_FN(HMACBatchCompress)(HMACAlgorithm algorithm, HMAC_BATCH_V *h, const HMAC_BATCH_V *block) {
+    if (algorithm == HMACAlgorithmSHA1) {
+        HMAC_BATCH_FN(HMACBatchSHA1)(h, block);
+    } else {
+        HMAC_BATCH_FN(HMACBatchSHA256)(h, block);
+    }
+}
+
+static HMAC_BATCH_TARGET void HMAC_BATCH_FN(HMACBatchKernel)(const HMACKey *const *keys, const uint8_t *const *messages, size_t length, uint8_t *macs) {
+    HMACAlgorithm algorithm = keys[0]->algorithm;
+    size_t words = algorithm == HMACAlgorithmSHA1 ? 5 : 8;
+    size_t digestLength = 4 * words;
+    HMAC_BATCH_V state[8], block[16];
+    const uint8_t *blocks[HMAC_BATCH_LANES];
+
+    // Inner hash, starting from each lane's (key ^ ipad) midstate
+    for (size_t i = 0; i < words; i++) {
+        for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+            state[i][lane] = keys[lane]->inner.words32[i];
+        }
+    }
+
+    size_t fullBlocks = length / 64;
+    for (size_t b = 0; b < fullBlocks; b++) {
+        for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+            blocks[lane] = messages[lane] + 64 * b;
+        }
+        HMAC_BATCH_FN(HMACBatchLoad)(block, blocks);
+        HMAC_BATCH_FN(HMACBatchCompress)(algorithm, state, block);
+    }
+
+    // All messages have the same length, so they share the padding layout
+    size_t remainder = length - 64 * fullBlocks;
+    size_t tailLength = remainder + 9 <= 64 ? 64 : 128;
+    uint8_t tails[HMAC_BATCH_LANES][128];
+    for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+        memset(tails[lane], 0, tailLength);
+        memcpy(tails[lane], messages[lane] + 64 * fullBlocks, remainder);
+        tails[lane][remainder] = 0x80;
+        HMACStore64(tails[lane] + tailLength - 8, (uint64_t)(keys[0]->innerLength + length) * 8);
+    }
+    for (size_t offset = 0; offset < tailLength; offset += 64) {
+        for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+            blocks[lane] = tails[lane] + offset;
+        }
+        HMAC_BATCH_FN(HMACBatchLoad)(block, blocks);
+        HMAC_BATCH_FN(HMACBatchCompress)(algorithm, state, block);
+    }
+
+    // Outer hash of the inner digest, which always fits in one padded block
+    for (size_t i = 0; i < words; i++) {
+        block[i] = state[i];
+    }
+    HMAC_BATCH_V zero = { 0 };
+    for (size_t i = words; i < 16; i++) {
+        block[i] = zero;
+    }
+    block[words] = zero + 0x80000000;
+    block[15] = zero + (uint32_t)((64 + digestLength) * 8);
+
+    for (size_t i = 0; i < words; i++) {
+        for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+            state[i][lane] = keys[lane]->outer.words32[i];
+        }
+    }
+    HMAC_BATCH_FN(HMACBatchCompress)(algorithm, state, block);
+
+    for (int lane = 0; lane < HMAC_BATCH_LANES; lane++) {
+        for (size_t i = 0; i < words; i++) {
+            HMACStore32(macs + lane * digestLength + 4 * i, state[i][lane]);
+        }
+    }
+
+    HMACSecureZero(tails, sizeof(tails));
+    HMACSecureZero(state, sizeof(state));
+    HMACSecureZero(block, sizeof(block));
+}
+
+#undef HMAC_BATCH_ROTR
+#undef HMAC_BATCH_ROTL
+#undef HMAC_BATCH_V
+#undef HMAC_BATCH_FN
+#undef HMAC_BATCH_PASTE
+#undef HMAC_BATCH_PASTE2
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HMACKey.h"
+#include "HMACKeyPrivate.h"
+#include "HMACBackend.h"
+
+#include <string.h>
+
+static const uint32_t sha1IV[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+
+static const uint32_t sha256IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const uint64_t sha512IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint32_t md5IV[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+#pragma mark - Generic hashing
+
+static void HMACStateReset(HMACAlgorithm algorithm, HMACState *state) {
+    switch (algorithm) {
+        case HMACAlgorithmSHA1:
+            memcpy(state->words32, sha1IV, sizeof(sha1IV));
+            break;
+        case HMACAlgorithmSHA256:
+            memcpy(state->words32, sha256IV, sizeof(sha256IV));
+            break;
+        case HMACAlgorithmSHA512:
+            memcpy(state->words64, sha512IV, sizeof(sha512IV));
+            break;
+        case HMACAlgorithmMD5:
+        case HMACAlgorithmCount:
+            memcpy(state->words32, md5IV, sizeof(md5IV));
+            break;
+    }
+}
+
+static size_t HMACBlockLength(HMACAlgorithm algorithm) {
+    return algorithm == HMACAlgorithmSHA512 ? 128 : 64;
+}
+
+static size_t HMACDigestLength(HMACAlgorithm algorithm) {
+    switch (algorithm) {
+        case HMACAlgorithmSHA1:
+            return 20;
+        case HMACAlgorithmSHA256:
+            return 32;
+        case HMACAlgorithmSHA512:
+            return 64;
+        case HMACAlgorithmMD5:
+        case HMACAlgorithmCount:
+            return 16;
+    }
+    return 0;
+}
+
+/**
+ * Hashes data on top of a state that has already absorbed processed bytes
+ * (a multiple of the block length) and writes the final digest.
+ */
+static void HMACStateFinish(HMACAlgorithm algorithm, HMACCompressFunction compress, HMACState *state, size_t processed, const uint8_t *data, size_t length, uint8_t *digest) {
+    size_t blockLength = HMACBlockLength(algorithm);
+    uint64_t bits = (uint64_t)(processed + length) * 8;
+
+    size_t fullBlocks = length / blockLength;
+    if (fullBlocks > 0) {
+        compress(state, data, fullBlocks);
+        data += fullBlocks * blockLength;
+        length -= fullBlocks * blockLength;
+    }
+
+    // Padding: 0x80, zeros and the bit length in the last 8 bytes, big endian
+    // except for MD5 (SHA-512 has a 16 byte length field, the upper half is
+    // always zero here)
+    uint8_t tail[2 * HMACMaxBlockLength];
+    size_t lengthFieldSize = blockLength == 128 ? 16 : 8;
+    size_t tailLength = length + 1 + lengthFieldSize <= blockLength ? blockLength : 2 * blockLength;
+    memset(tail, 0, tailLength);
+    if (length > 0) {
+        memcpy(tail, data, length);
+    }
+    tail[length] = 0x80;
+    if (algorithm == HMACAlgorithmMD5) {
+        HMACStore64LE(tail + tailLength - 8, bits);
+    } else {
+        HMACStore64(tail + tailLength - 8, bits);
+    }
+
+    compress(state, tail, tailLength / blockLength);
+    HMACSecureZero(tail, tailLength);
+
+    size_t digestLength = HMACDigestLength(algorithm);
+    if (algorithm == HMACAlgorithmSHA512) {
+        for (size_t i = 0; i < digestLength / 8; i++) {
+            HMACStore64(digest + 8 * i, state->words64[i]);
+        }
+    } else if (algorithm == HMACAlgorithmMD5) {
+        for (size_t i = 0; i < digestLength / 4; i++) {
+            HMACStore32LE(digest + 4 * i, state->words32[i]);
+        }
+    } else {
+        for (size_t i = 0; i < digestLength / 4; i++) {
+            HMACStore32(digest + 4 * i, state->words32[i]);
+        }
+    }
+}
+
+#pragma mark - HMAC
+
+void HMACKeyInit(HMACKey *key, HMACAlgorithm algorithm, const uint8_t *secret, size_t secretLength) {
+    size_t blockLength = HMACBlockLength(algorithm);
+    uint8_t pad[HMACMaxBlockLength];
+    HMACState state;
+
+    key->algorithm = algorithm;
+    key->blockLength = blockLength;
+    key->digestLength = HMACDigestLength(algorithm);
+    key->backend = HMACBackendActive();
+    key->innerLength = blockLength;
+
+    HMACCompressFunction compress = HMACBackendCompressFunction(key->backend, algorithm);
+
+    // Keys longer than a block are replaced by their hash
+    memset(key->block, 0, sizeof(key->block));
+    if (secretLength > blockLength) {
+        HMACStateReset(algorithm, &state);
+        HMACStateFinish(algorithm, compress, &state, 0, secret, secretLength, key->block);
+    } else if (secretLength > 0) {
+        memcpy(key->block, secret, secretLength);
+    }
+
+    for (size_t i = 0; i < blockLength; i++) {
+        pad[i] = key->block[i] ^ 0x36;
+    }
+    HMACStateReset(algorithm, &key->inner);
+    compress(&key->inner, pad, 1);
+
+    for (size_t i = 0; i < blockLength; i++) {
+        pad[i] = key->block[i] ^ 0x5c;
+    }
+    HMACStateReset(algorithm, &key->outer);
+    compress(&key->outer, pad, 1);
+
+    HMACSecureZero(pad, sizeof(pad));
+    HMACSecureZero(&state, sizeof(state));
+}
+
+size_t HMACKeyAbsorb(const HMACKey *key, const uint8_t *prefix, size_t length, HMACKey *derived) {
+    size_t blocks = length / key->blockLength;
+
+    *derived = *key;
+    if (blocks > 0) {
+        HMACBackendCompressFunction(key->backend, key->algorithm)(&derived->inner, prefix, blocks);
+        derived->innerLength += blocks * key->blockLength;
+    }
+
+    return blocks * key->blockLength;
+}
+
+void HMACKeyCompute(const HMACKey *key, const uint8_t *message, size_t length, uint8_t *mac) {
+    // A one-shot backend can only start from the key, not from an absorbed prefix
+    if (key->backend->oneShot != NULL && key->innerLength == key->blockLength) {
+        key->backend->oneShot(key->algorithm, key->block, key->blockLength, message, length, mac);
+        return;
+    }
+
+    HMACCompressFunction compress = HMACBackendCompressFunction(key->backend, key->algorithm);
+    uint8_t innerDigest[HMACMaxDigestLength];
+    HMACState state;
+
+    state = key->inner;
+    HMACStateFinish(key->algorithm, compress, &state, key->innerLength, message, length, innerDigest);
+
+    state = key->outer;
+    HMACStateFinish(key->algorithm, compress, &state, key->blockLength, innerDigest, key->digestLength, mac);
+
+    HMACSecureZero(innerDigest, sizeof(innerDigest));
+    HMACSecureZero(&state, sizeof(state));
+}
+
+void HMACKeyWipe(HMACKey *key) {
+    HMACSecureZero(key, sizeof(*key));
+}
+
+void HMACSecureZero(void *buffer, size_t length) {
+#if defined(__GNUC__)
+    // The empty asm claims to read the buffer, so the memset can't be removed as a dead store
+    memset(buffer, 0, length);
+    __asm__ __volatile__("" : : "r"(buffer) : "memory");
+#else
+    volatile uint8_t *bytes = (volatile uint8_t *)buffer;
+    while (length--) {
+        *bytes++ = 0;
+    }
+#endif
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HMACKey_h
+#define HMACKey_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * HMAC (RFC 2104) with a precomputed key schedule.
+ *
+ * HMAC hashes the padded key once for the inner and once for the outer hash
+ * before it gets to the message. HMACKeyInit does that work once and keeps
+ * the two compression midstates, so computing a MAC over a short message
+ * (OCRA, HOTP) only costs the compression of the message and the digest.
+ * A key can be reused for any number of messages, e.g. when a verifier walks
+ * a window of counters or timestamps.
+ *
+ * The hashing itself is done by the active backend (see HMACBackend.h).
+ * Nothing here allocates memory.
+ */
+
+typedef enum {
+    HMACAlgorithmSHA1,
+    HMACAlgorithmSHA256,
+    HMACAlgorithmSHA512,
+    HMACAlgorithmMD5,
+    HMACAlgorithmCount
+} HMACAlgorithm;
+
+/**
+ * Largest digest and block sizes of the supported algorithms (SHA-512).
+ */
+#define HMACMaxDigestLength 64
+#define HMACMaxBlockLength 128
+
+/**
+ * Chaining value of one of the hash functions, MD5 uses 4, SHA-1 uses 5 and
+ * SHA-256 uses 8 of the 32 bit words, SHA-512 uses the 64 bit words.
+ */
+typedef union {
+    uint32_t words32[8];
+    uint64_t words64[8];
+} HMACState;
+
+struct HMACBackend;
+
+/**
+ * Key schedule, holds the hash state after the inner (key ^ ipad) and the
+ * outer (key ^ opad) block. innerLength counts the bytes absorbed by the
+ * inner state, normally one block. Backends without midstate support use the
+ * key block instead. Treat as secret and release with HMACKeyWipe.
+ */
+typedef struct {
+    HMACAlgorithm algorithm;
+    size_t blockLength;
+    size_t digestLength;
+    const struct HMACBackend *backend;
+    size_t innerLength;
+    HMACState inner;
+    HMACState outer;
+    uint8_t block[HMACMaxBlockLength];
+} HMACKey;
+
+/**
+ * Computes the key schedule for the given secret.
+ *
+ * @param key           key schedule to initialize
+ * @param algorithm     hash function
+ * @param secret        HMAC key, keys longer than the block size are hashed first
+ * @param secretLength  length of the key in bytes
+ */
+void HMACKeyInit(HMACKey *key, HMACAlgorithm algorithm, const uint8_t *secret, size_t secretLength);
+
+/**
+ * Computes the HMAC of a message.
+ *
+ * @param key      initialized key schedule, isn't modified
+ * @param message  message bytes
+ * @param length   length of the message in bytes
+ * @param mac      output buffer of at least key->digestLength bytes
+ */
+void HMACKeyCompute(const HMACKey *key, const uint8_t *message, size_t length, uint8_t *mac);
+
+/**
+ * Derives a key schedule whose inner hash has already absorbed a common
+ * message prefix, so HMACKeyCompute(derived, rest) equals
+ * HMACKeyCompute(key, prefix || rest). Only whole blocks are absorbed, the
+ * remaining prefix bytes have to be passed along with the rest.
+ *
+ * Useful when many messages only differ near the end, e.g. the timestamp of
+ * an OCRA message.
+ *
+ * @param key      initialized key schedule
+ * @param prefix   common start of the messages
+ * @param length   length of the prefix in bytes
+ * @param derived  key schedule to initialize, wipe it like any other key
+ *
+ * @return number of prefix bytes absorbed, a multiple of the block length
+ */
+size_t HMACKeyAbsorb(const HMACKey *key, const uint8_t *prefix, size_t length, HMACKey *derived);
+
+/**
+ * Overwrites the key schedule, it has to be initialized again before use.
+ */
+void HMACKeyWipe(HMACKey *key);
+
+/**
+ * Zeroes a buffer in a way the compiler can't optimize away.
+ */
+void HMACSecureZero(void *buffer, size_t length);
+
+#endif /* HMACKey_h */
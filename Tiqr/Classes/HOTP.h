@@ -28,7 +28,6 @@
  */
 
 #import <Foundation/Foundation.h>
-#import <CommonCrypto/CommonHMAC.h>
 
 @interface HOTP : NSObject
 
@@ -41,4 +40,16 @@
 + (HOTP *)hotpWithKey:(NSData *)key counter:(NSUInteger)counter numDigits:(int)digits;
 - (void)computePassword;
 
+/**
+ * Looks for the given decimal password among the counters counter ...
+ * counter + window, for resynchronising with a token that ran ahead.
+ *
+ * @param password decimal password of numDigits digits
+ * @param window   number of counters to look ahead
+ *
+ * @return number of counters ahead of counter the password matched, or
+ *         NSNotFound
+ */
+- (NSUInteger)lookAheadForPassword:(NSString *)password window:(NSUInteger)window;
+
 @end
@@ -30,6 +30,16 @@
 // TODO: add credits, this is based on the open source oauth_token app
 
 #import "HOTP.h"
+#import "HMACKey.h"
+#import "HMACBatch.h"
+#import "OCRAMessage.h"
+
+@interface HOTP () {
+    // Key schedule for self.key, computed once so each password only hashes the counter
+    HMACKey _hmacKey;
+}
+
+@end
 
 @implementation HOTP
 
@@ -50,28 +60,43 @@ static const int powers10[] = { 10, 100, 1000, 10000, 100000, 1000000, 10000000,
     return hotp;
 }
 
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        HMACKeyInit(&_hmacKey, HMACAlgorithmSHA1, NULL, 0);
+    }
+    return self;
+}
+
+- (void)setKey:(NSData *)key {
+    _key = key;
+    HMACKeyInit(&_hmacKey, HMACAlgorithmSHA1, key.bytes, key.length);
+}
+
+- (void)dealloc {
+    HMACKeyWipe(&_hmacKey);
+}
+
+- (uint32_t)truncate:(const uint8_t *)hash {
+    /* Extract selected bytes to get 32 bit integer value */
+    int offset = hash[_hmacKey.digestLength - 1] & 0x0f;
+    return ((uint32_t)(hash[offset] & 0x7f) << 24)
+    | ((uint32_t)(hash[offset + 1] & 0xff) << 16)
+    | ((uint32_t)(hash[offset + 2] & 0xff) << 8)
+    | (uint32_t)(hash[offset + 3] & 0xff);
+}
+
 - (void)computePassword {
-    uint8_t hash[CC_SHA1_DIGEST_LENGTH];
+    uint8_t hash[HMACMaxDigestLength];
     uint8_t tosign[8];
-    int offset;
     int value;
-    int i;
     
-    /* Encode counter */
-    for (i = sizeof(tosign) - 1; i >= 0; i--) {
-        tosign[i] = self.counter & 0xff;
-        self.counter >>= 8;
-    }
+    /* Encode counter, self.counter itself is left alone */
+    OCRAEncodeCounter(self.counter, tosign);
     
     /* Compute HMAC */
-    CCHmac(kCCHmacAlgSHA1, self.key.bytes, self.key.length, tosign, sizeof(tosign), hash);
-    
-    /* Extract selected bytes to get 32 bit integer value */
-    offset = hash[CC_SHA1_DIGEST_LENGTH - 1] & 0x0f;
-    value = ((hash[offset] & 0x7f) << 24)
-    | ((hash[offset + 1] & 0xff) << 16)
-    | ((hash[offset + 2] & 0xff) << 8)
-    | (hash[offset + 3] & 0xff);
+    HMACKeyCompute(&_hmacKey, tosign, sizeof(tosign), hash);
+    value = (int)[self truncate:hash];
     
     /* Generate decimal digits */
     self.dec = [NSString stringWithFormat:@"%0*d",
@@ -84,4 +109,47 @@ static const int powers10[] = { 10, 100, 1000, 10000, 100000, 1000000, 10000000,
                 (self.numDigits < MAX_DIGITS_16 ? (value & ((1 << (4 * self.numDigits)) - 1)) : value)];
 }
 
+- (NSUInteger)lookAheadForPassword:(NSString *)password window:(NSUInteger)window {
+    if ([password length] != (NSUInteger)self.numDigits) {
+        return NSNotFound;
+    }
+    
+    uint32_t expected = (uint32_t)[password longLongValue];
+    BOOL truncated = self.numDigits < MAX_DIGITS_10;
+    
+    /* Counters are hashed 16 at a time, each lane advances its own big endian counter */
+    uint8_t counters[16][8];
+    const uint8_t *messages[16];
+    const HMACKey *keys[16];
+    uint8_t hashes[16 * HMACMaxDigestLength];
+    for (int i = 0; i < 16; i++) {
+        OCRAEncodeCounter(self.counter, counters[i]);
+        OCRAAdvanceCounter(counters[i], i);
+        messages[i] = counters[i];
+        keys[i] = &_hmacKey;
+    }
+    
+    NSUInteger found = NSNotFound;
+    for (NSUInteger start = 0; start <= window && found == NSNotFound; start += 16) {
+        size_t chunk = window - start < 16 ? window - start + 1 : 16;
+        if (start > 0) {
+            for (size_t i = 0; i < chunk; i++) {
+                OCRAAdvanceCounter(counters[i], 16);
+            }
+        }
+        
+        HMACBatchCompute(keys, messages, sizeof(counters[0]), chunk, hashes);
+        for (size_t i = 0; i < chunk; i++) {
+            uint32_t value = [self truncate:hashes + i * _hmacKey.digestLength];
+            if ((truncated ? value % powers10[self.numDigits - 1] : value) == expected) {
+                found = start + i;
+                break;
+            }
+        }
+    }
+    
+    HMACSecureZero(hashes, sizeof(hashes));
+    return found;
+}
+
 @end
\ No newline at end of file
@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HexCodec.h"
+
+#include <pthread.h>
+
+#if defined(HEX_CODEC_X86)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(HEX_CODEC_NEON)
+#include <arm_neon.h>
+#endif
+
+static const char upperDigits[16] = "0123456789ABCDEF";
+static const char lowerDigits[16] = "0123456789abcdef";
+
+/* Nibble value per ASCII character with bit 4 set, 0 for anything that isn't a hex digit */
+static const uint8_t nibbles[256] = {
+    ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+    ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+    ['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e, ['f'] = 0x1f,
+    ['A'] = 0x1a, ['B'] = 0x1b, ['C'] = 0x1c, ['D'] = 0x1d, ['E'] = 0x1e, ['F'] = 0x1f
+};
+
+/*
+ * A kernel converts as many whole blocks as it can and returns the number
+ * of input bytes (encode) or digits (decode) it consumed. A decode kernel
+ * returns SIZE_MAX when it finds an invalid digit.
+ */
+typedef size_t (*HexEncodeKernel)(const uint8_t *bytes, size_t length, char *hex, const char *digits);
+typedef size_t (*HexDecodeKernel)(const char *hex, size_t hexLength, uint8_t *bytes);
+
+static size_t scalarEncode(const uint8_t *bytes, size_t length, char *hex, const char *digits) {
+    (void)bytes; (void)length; (void)hex; (void)digits;
+    return 0;
+}
+
+static size_t scalarDecode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    (void)hex; (void)hexLength; (void)bytes;
+    return 0;
+}
+
+#if defined(HEX_CODEC_X86)
+
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+/* 16 bytes become 32 digits: split the nibbles, look them up, interleave */
+static SSSE3_TARGET size_t ssse3Encode(const uint8_t *bytes, size_t length, char *hex, const char *digits) {
+    const __m128i table = _mm_loadu_si128((const __m128i *)digits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        __m128i input = _mm_loadu_si128((const __m128i *)(bytes + i));
+        __m128i high = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(input, 4), mask));
+        __m128i low = _mm_shuffle_epi8(table, _mm_and_si128(input, mask));
+        _mm_storeu_si128((__m128i *)(hex + 2 * i), _mm_unpacklo_epi8(high, low));
+        _mm_storeu_si128((__m128i *)(hex + 2 * i + 16), _mm_unpackhi_epi8(high, low));
+    }
+    return i;
+}
+
+/* Nibble values of 16 digits, invalid lanes are cleared in *valid */
+static inline __attribute__((always_inline)) SSSE3_TARGET __m128i ssse3Nibbles(__m128i input, __m128i *valid) {
+    // Signed compares: c - '0' lands in 0...9 only for digits, (c | 0x20) - 'a' in 0...5 only for letters
+    __m128i digit = _mm_sub_epi8(input, _mm_set1_epi8('0'));
+    __m128i letter = _mm_sub_epi8(_mm_or_si128(input, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(digit, _mm_set1_epi8(-1)), _mm_cmplt_epi8(digit, _mm_set1_epi8(10)));
+    __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(letter, _mm_set1_epi8(-1)), _mm_cmplt_epi8(letter, _mm_set1_epi8(6)));
+
+    *valid = _mm_and_si128(*valid, _mm_or_si128(isDigit, isLetter));
+    return _mm_or_si128(_mm_and_si128(isDigit, digit), _mm_andnot_si128(isDigit, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+}
+
+/* 32 digits become 16 bytes, maddubs combines high * 16 + low */
+static SSSE3_TARGET size_t ssse3Decode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    __m128i valid = _mm_set1_epi8(-1);
+    size_t i = 0;
+
+    for (; i + 32 <= hexLength; i += 32) {
+        __m128i first = ssse3Nibbles(_mm_loadu_si128((const __m128i *)(hex + i)), &valid);
+        __m128i second = ssse3Nibbles(_mm_loadu_si128((const __m128i *)(hex + i + 16)), &valid);
+        __m128i packed = _mm_packus_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+        _mm_storeu_si128((__m128i *)(bytes + i / 2), packed);
+    }
+    return _mm_movemask_epi8(valid) == 0xffff ? i : SIZE_MAX;
+}
+
+/* Same as SSSE3 with 32 bytes per step, the 128 bit lanes need reordering */
+static AVX2_TARGET size_t avx2Encode(const uint8_t *bytes, size_t length, char *hex, const char *digits) {
+    const __m256i table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)digits));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+
+    for (; i + 32 <= length; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(bytes + i));
+        __m256i high = _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(input, 4), mask));
+        __m256i low = _mm256_shuffle_epi8(table, _mm256_and_si256(input, mask));
+        // unpacklo holds bytes 0-7 and 16-23, unpackhi holds 8-15 and 24-31
+        __m256i first = _mm256_unpacklo_epi8(high, low);
+        __m256i second = _mm256_unpackhi_epi8(high, low);
+        _mm256_storeu_si256((__m256i *)(hex + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *)(hex + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    // Short inputs such as secrets and device tokens still get one 16 byte step
+    return i + ssse3Encode(bytes + i, length - i, hex + 2 * i, digits);
+}
+
+static inline __attribute__((always_inline)) AVX2_TARGET __m256i avx2Nibbles(__m256i input, __m256i *valid) {
+    __m256i digit = _mm256_sub_epi8(input, _mm256_set1_epi8('0'));
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(input, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isDigit = _mm256_and_si256(_mm256_cmpgt_epi8(digit, _mm256_set1_epi8(-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(10), digit));
+    __m256i isLetter = _mm256_and_si256(_mm256_cmpgt_epi8(letter, _mm256_set1_epi8(-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8(6), letter));
+
+    *valid = _mm256_and_si256(*valid, _mm256_or_si256(isDigit, isLetter));
+    return _mm256_blendv_epi8(_mm256_add_epi8(letter, _mm256_set1_epi8(10)), digit, isDigit);
+}
+
+static AVX2_TARGET size_t avx2Decode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    __m256i valid = _mm256_set1_epi8(-1);
+    size_t i = 0;
+
+    for (; i + 64 <= hexLength; i += 64) {
+        __m256i first = avx2Nibbles(_mm256_loadu_si256((const __m256i *)(hex + i)), &valid);
+        __m256i second = avx2Nibbles(_mm256_loadu_si256((const __m256i *)(hex + i + 32)), &valid);
+        __m256i packed = _mm256_packus_epi16(_mm256_maddubs_epi16(first, weights), _mm256_maddubs_epi16(second, weights));
+        // packus works per lane: quadwords are first.0, second.0, first.1, second.1
+        _mm256_storeu_si256((__m256i *)(bytes + i / 2), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    if (_mm256_movemask_epi8(valid) != -1) {
+        return SIZE_MAX;
+    }
+
+    size_t rest = ssse3Decode(hex + i, hexLength - i, bytes + i / 2);
+    return rest != SIZE_MAX ? i + rest : SIZE_MAX;
+}
+
+static bool ssse3Supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3);
+}
+
+static bool avx2Supported(void) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        return false;
+    }
+
+    // The OS has to save the YMM registers
+    unsigned int xcr0Low, xcr0High;
+    __asm__ ("xgetbv" : "=a" (xcr0Low), "=d" (xcr0High) : "c" (0));
+    if ((xcr0Low & 0x6) != 0x6) {
+        return false;
+    }
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+}
+
+#endif
+
+#if defined(HEX_CODEC_NEON)
+
+/* 16 bytes become 32 digits, vst2q interleaves the high and low digits */
+static size_t neonEncode(const uint8_t *bytes, size_t length, char *hex, const char *digits) {
+    const uint8x16_t table = vld1q_u8((const uint8_t *)digits);
+    size_t i = 0;
+
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t input = vld1q_u8(bytes + i);
+        uint8x16x2_t output;
+        output.val[0] = vqtbl1q_u8(table, vshrq_n_u8(input, 4));
+        output.val[1] = vqtbl1q_u8(table, vandq_u8(input, vdupq_n_u8(0x0f)));
+        vst2q_u8((uint8_t *)hex + 2 * i, output);
+    }
+    return i;
+}
+
+static inline uint8x16_t neonNibbles(uint8x16_t input, uint8x16_t *valid) {
+    uint8x16_t digit = vsubq_u8(input, vdupq_n_u8('0'));
+    uint8x16_t letter = vsubq_u8(vorrq_u8(input, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t isDigit = vcltq_u8(digit, vdupq_n_u8(10));
+    uint8x16_t isLetter = vcltq_u8(letter, vdupq_n_u8(6));
+
+    *valid = vandq_u8(*valid, vorrq_u8(isDigit, isLetter));
+    return vbslq_u8(isDigit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+}
+
+/* 32 digits become 16 bytes, vld2q separates the high and low digits */
+static size_t neonDecode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    uint8x16_t valid = vdupq_n_u8(0xff);
+    size_t i = 0;
+
+    for (; i + 32 <= hexLength; i += 32) {
+        uint8x16x2_t input = vld2q_u8((const uint8_t *)hex + i);
+        uint8x16_t high = neonNibbles(input.val[0], &valid);
+        uint8x16_t low = neonNibbles(input.val[1], &valid);
+        vst1q_u8(bytes + i / 2, vorrq_u8(vshlq_n_u8(high, 4), low));
+    }
+    return vminvq_u8(valid) == 0xff ? i : SIZE_MAX;
+}
+
+#endif
+
+static pthread_once_t selectOnce = PTHREAD_ONCE_INIT;
+static HexEncodeKernel selectedEncode = scalarEncode;
+static HexDecodeKernel selectedDecode = scalarDecode;
+static const char *selectedName = "Scalar";
+static bool forceScalar = false;
+
+static void HexCodecSelect(void) {
+#if defined(HEX_CODEC_X86)
+    if (avx2Supported()) {
+        selectedEncode = avx2Encode;
+        selectedDecode = avx2Decode;
+        selectedName = "AVX2";
+    } else if (ssse3Supported()) {
+        selectedEncode = ssse3Encode;
+        selectedDecode = ssse3Decode;
+        selectedName = "SSSE3";
+    }
+#elif defined(HEX_CODEC_NEON)
+    selectedEncode = neonEncode;
+    selectedDecode = neonDecode;
+    selectedName = "NEON";
+#endif
+}
+
+const char *HexCodecKernelName(void) {
+    pthread_once(&selectOnce, HexCodecSelect);
+    return forceScalar ? "Scalar" : selectedName;
+}
+
+void HexCodecSetScalar(bool scalar) {
+    forceScalar = scalar;
+}
+
+void HexEncode(const uint8_t *bytes, size_t length, char *hex, HexCase hexCase) {
+    const char *digits = hexCase == HexCaseLower ? lowerDigits : upperDigits;
+
+    pthread_once(&selectOnce, HexCodecSelect);
+    size_t i = forceScalar ? 0 : selectedEncode(bytes, length, hex, digits);
+
+    for (; i < length; i++) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[2 * i + 1] = digits[bytes[i] & 0x0f];
+    }
+}
+
+bool HexDecode(const char *hex, size_t hexLength, uint8_t *bytes) {
+    if (hexLength & 1) {
+        return false;
+    }
+
+    pthread_once(&selectOnce, HexCodecSelect);
+    size_t i = forceScalar ? 0 : selectedDecode(hex, hexLength, bytes);
+    if (i == SIZE_MAX) {
+        return false;
+    }
+
+    const uint8_t *digits = (const uint8_t *)hex;
+    uint8_t valid = 0x10;
+    for (; i < hexLength; i += 2) {
+        uint8_t high = nibbles[digits[i]];
+        uint8_t low = nibbles[digits[i + 1]];
+        valid &= high & low;
+        bytes[i / 2] = (uint8_t)(high << 4 | (low & 0x0f));
+    }
+    return valid != 0;
+}
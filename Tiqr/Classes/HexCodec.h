@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HexCodec_h
+#define HexCodec_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hex encoding and strict hex decoding into caller supplied buffers.
+ *
+ * Whole blocks are converted with vector instructions when the CPU has
+ * them: AVX2 or SSSE3 on x86-64 (picked at runtime) and NEON on ARM64.
+ * The remainder and older CPUs use a table driven loop. None of the
+ * functions allocate memory.
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HEX_CODEC_X86 1
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define HEX_CODEC_NEON 1
+#endif
+
+typedef enum {
+    HexCaseUpper,
+    HexCaseLower
+} HexCase;
+
+/**
+ * Writes two hex digits per byte, the output is not NUL terminated.
+ *
+ * @param bytes   input
+ * @param length  number of bytes
+ * @param hex     output, at least 2 * length bytes
+ * @param hexCase case of the digits a-f
+ */
+void HexEncode(const uint8_t *bytes, size_t length, char *hex, HexCase hexCase);
+
+/**
+ * Decodes hex digits, both upper and lower case are accepted.
+ *
+ * @param hex        input, doesn't need to be NUL terminated
+ * @param hexLength  number of hex digits, must be even
+ * @param bytes      output, at least hexLength / 2 bytes
+ *
+ * @return false if the length is odd or the input contains anything but
+ *         hex digits, the contents of bytes are unspecified in that case
+ */
+bool HexDecode(const char *hex, size_t hexLength, uint8_t *bytes);
+
+/**
+ * Name of the kernel in use ("AVX2", "SSSE3", "NEON" or "Scalar"),
+ * for benchmarks and logging.
+ */
+const char *HexCodecKernelName(void);
+
+/**
+ * Forces the table driven code when set, to compare it with the vector
+ * kernels. Not thread safe, meant for tests.
+ */
+void HexCodecSetScalar(bool scalar);
+
+#endif /* HexCodec_h */
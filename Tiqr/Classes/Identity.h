@@ -41,7 +41,17 @@
 @property (nonatomic, strong) NSNumber * version;
 @property (nonatomic, strong) NSData * salt;
 @property (nonatomic, strong) NSData * initializationVector;
+/**
+ * Position in the identity list before sortKey, only read to order the
+ * identities that predate it.
+ */
 @property (nonatomic, strong) NSNumber * sortIndex;
+
+/**
+ * Position in the identity list, see SortKey.h. Only nil for identities
+ * that haven't been given a key after the model upgrade yet.
+ */
+@property (nonatomic, strong) NSNumber * sortKey;
 @property (nonatomic, strong) NSNumber * blocked;
 @property (nonatomic, strong) IdentityProvider * identityProvider;
 @property (nonatomic, strong) NSNumber * usesOldBiometricFlow;
@@ -49,6 +59,12 @@
 @property (nonatomic, strong) NSNumber * biometricIDEnabled;
 @property (nonatomic, strong) NSNumber * shouldAskToEnrollInBiometricID;
 
+/**
+ * PBKDF2 rounds the secret is wrapped with, 0 for identities that predate
+ * calibration and still use the original fixed count.
+ */
+@property (nonatomic, strong) NSNumber * kdfRounds;
+
 @property (readonly) BOOL usesBiometrics;
 
 @end
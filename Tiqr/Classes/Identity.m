@@ -38,12 +38,14 @@
 @dynamic salt;
 @dynamic initializationVector;
 @dynamic sortIndex;
+@dynamic sortKey;
 @dynamic blocked;
 @dynamic identityProvider;
 @dynamic usesOldBiometricFlow;
 @dynamic biometricIDAvailable;
 @dynamic biometricIDEnabled;
 @dynamic shouldAskToEnrollInBiometricID;
+@dynamic kdfRounds;
 
 - (BOOL)usesBiometrics {
     return [self.usesOldBiometricFlow boolValue] || [self.biometricIDEnabled boolValue];
@@ -174,6 +174,7 @@
     
     NSString *identityIdentifier = self.identity.identifier;
     NSString *providerIdentifier = identityProvider.identifier;
+    BOOL providerDeleted = NO;
     
     if (identityProvider != nil) {
 		
@@ -181,13 +182,19 @@
         [identityService deleteIdentity:self.identity];
         if ([identityProvider.identities count] == 0) {
             [identityService deleteIdentityProvider:identityProvider];
+            providerDeleted = YES;
         }
     } else {
         [identityService deleteIdentity:self.identity];
     }
-    if ([identityService saveIdentities]) {
-        [ServiceContainer.sharedInstance.secretService deleteSecretForIdentityIdentifier:identityIdentifier
-                                                                      providerIdentifier:providerIdentifier];
+    if ([identityService saveIdentitiesDurably]) {
+        // The last identity of a provider takes all its secrets along at once
+        if (providerDeleted) {
+            [ServiceContainer.sharedInstance.secretService deleteSecretsForProviderIdentifier:providerIdentifier];
+        } else {
+            [ServiceContainer.sharedInstance.secretService deleteSecretForIdentityIdentifier:identityIdentifier
+                                                                          providerIdentifier:providerIdentifier];
+        }
         
         [self.navigationController popViewControllerAnimated:YES];
     } else {
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+@class Identity;
+@class IdentityProvider;
+
+/**
+ * In-memory index of the identity providers and identities of a managed
+ * object context, keyed by provider identifier and by (provider, identity
+ * identifier).
+ *
+ * The index is loaded with two fetches on the first lookup and from then on
+ * kept up to date from the object changes the context posts, so lookups
+ * don't go to the store. Pending changes are processed before every lookup,
+ * which makes inserted, changed and deleted objects show up right away, the
+ * same as they would in a fetch. Lookups that match more than one object
+ * return nil, again the same as the fetches this replaces.
+ *
+ * The identity count, maximum sort key and number of unblocked identities
+ * are kept as counters next to the index, so reading them is O(1) too.
+ */
+@interface IdentityIndex : NSObject
+
+- (instancetype)initWithManagedObjectContext:(NSManagedObjectContext *)managedObjectContext;
+
+/**
+ * Returns the identity provider with the given identifier.
+ *
+ * @param identifier identity provider identifier
+ *
+ * @return the identity provider (or nil)
+ */
+- (IdentityProvider *)identityProviderWithIdentifier:(NSString *)identifier;
+
+/**
+ * Returns the identity with the given identifier for the given identity
+ * provider.
+ *
+ * @param identifier         identity identifier
+ * @param identityProvider   identity provider
+ *
+ * @return the identity (or nil)
+ */
+- (Identity *)identityWithIdentifier:(NSString *)identifier forIdentityProvider:(IdentityProvider *)identityProvider;
+
+/**
+ * Returns the number of identities.
+ *
+ * @return number of identities
+ */
+- (NSUInteger)identityCount;
+
+/**
+ * Returns the highest sort key of the identities.
+ *
+ * @return maximum sort key, nil without identities that have one
+ */
+- (NSNumber *)maxSortKey;
+
+/**
+ * Returns whether there are identities and all of them are blocked.
+ *
+ * @return all identities blocked?
+ */
+- (BOOL)allIdentitiesBlocked;
+
+/**
+ * Sets attributes of all identities, or of the identities of one provider,
+ * with a single batch update of the store instead of fetching and changing
+ * every identity. Identities with unsaved changes get the values in memory
+ * as well, identities registered in the context are refreshed, and the
+ * counters are adjusted without loading anything.
+ *
+ * When the context has parent contexts, their pending changes are saved
+ * before the update and they are refreshed with the updated identities too.
+ *
+ * Only attributes the index doesn't file under can be set this way, like
+ * blocked and the biometric flags.
+ *
+ * @param values            attribute name -> value
+ * @param identityProvider  provider of the identities to update, nil for all
+ * @param error             set when the store couldn't be updated
+ *
+ * @return whether the identities were updated
+ */
+- (BOOL)updateIdentitiesWithValues:(NSDictionary *)values forIdentityProvider:(IdentityProvider *)identityProvider error:(NSError **)error;
+
+/**
+ * Drops the index, the next lookup loads it again. Call this after changes
+ * the context doesn't report object by object, like a rollback.
+ */
+- (void)invalidate;
+
+/**
+ * Number of times the index was loaded from the store.
+ */
+@property (nonatomic, assign, readonly) NSUInteger loadCount;
+
+@end
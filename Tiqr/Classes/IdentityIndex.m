@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "IdentityIndex.h"
+#import "Identity.h"
+#import "IdentityProvider.h"
+
+/**
+ * Where an object is filed and what it adds to the aggregates. Identities
+ * that have no provider are filed under NSNull, objects without identifier
+ * aren't filed but identities still count.
+ */
+@interface IdentityIndexKey : NSObject
+
+@property (nonatomic, strong) id identityProvider;
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, strong) NSNumber *sortKey;
+@property (nonatomic, assign) BOOL unblocked;
+
+@end
+
+@implementation IdentityIndexKey
+
+@end
+
+@interface IdentityIndex ()
+
+@property (nonatomic, weak) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, assign) BOOL loaded;
+@property (nonatomic, assign, readwrite) NSUInteger loadCount;
+
+// identifier -> providers
+@property (nonatomic, strong) NSMutableDictionary *identityProviders;
+
+// provider -> identifier -> identities
+@property (nonatomic, strong) NSMapTable *identities;
+
+// object -> IdentityIndexKey
+@property (nonatomic, strong) NSMapTable *keys;
+
+// Aggregates over all identities
+@property (nonatomic, assign) NSUInteger totalCount;
+@property (nonatomic, assign) NSUInteger unblockedCount;
+@property (nonatomic, strong) NSCountedSet *sortKeys;
+@property (nonatomic, strong) NSNumber *highestSortKey;
+
+@end
+
+@implementation IdentityIndex
+
+- (instancetype)initWithManagedObjectContext:(NSManagedObjectContext *)managedObjectContext {
+    self = [super init];
+    if (self != nil) {
+        self.managedObjectContext = managedObjectContext;
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(objectsDidChange:) name:NSManagedObjectContextObjectsDidChangeNotification object:managedObjectContext];
+    }
+    
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+}
+
+- (IdentityProvider *)identityProviderWithIdentifier:(NSString *)identifier {
+    if (identifier == nil || ![self prepare]) {
+        return nil;
+    }
+    
+    @synchronized (self) {
+        NSArray *matches = self.identityProviders[identifier];
+        return [matches count] == 1 ? matches[0] : nil;
+    }
+}
+
+- (Identity *)identityWithIdentifier:(NSString *)identifier forIdentityProvider:(IdentityProvider *)identityProvider {
+    if (identifier == nil || ![self prepare]) {
+        return nil;
+    }
+    
+    @synchronized (self) {
+        NSDictionary *identities = [self.identities objectForKey:identityProvider ?: [NSNull null]];
+        NSArray *matches = identities[identifier];
+        return [matches count] == 1 ? matches[0] : nil;
+    }
+}
+
+- (NSUInteger)identityCount {
+    if (![self prepare]) {
+        return 0;
+    }
+    
+    @synchronized (self) {
+        return self.totalCount;
+    }
+}
+
+- (NSNumber *)maxSortKey {
+    if (![self prepare]) {
+        return nil;
+    }
+    
+    @synchronized (self) {
+        return self.highestSortKey;
+    }
+}
+
+- (BOOL)allIdentitiesBlocked {
+    if (![self prepare]) {
+        return NO;
+    }
+    
+    @synchronized (self) {
+        return self.totalCount > 0 && self.unblockedCount == 0;
+    }
+}
+
+- (void)invalidate {
+    @synchronized (self) {
+        self.loaded = NO;
+        self.identityProviders = nil;
+        self.identities = nil;
+        self.keys = nil;
+        self.totalCount = 0;
+        self.unblockedCount = 0;
+        self.sortKeys = nil;
+        self.highestSortKey = nil;
+    }
+}
+
+#pragma mark -
+#pragma mark Batch updates
+
+- (BOOL)updateIdentitiesWithValues:(NSDictionary *)values forIdentityProvider:(IdentityProvider *)identityProvider error:(NSError **)error {
+    NSParameterAssert(values[@"identifier"] == nil && values[@"identityProvider"] == nil && values[@"sortKey"] == nil);
+    
+    NSManagedObjectContext *managedObjectContext = self.managedObjectContext;
+    if (managedObjectContext == nil) {
+        return NO;
+    }
+    [managedObjectContext processPendingChanges];
+    
+    // The store update doesn't reach unsaved changes, a save would undo it for changed identities
+    NSPredicate *predicate = identityProvider != nil ? [NSPredicate predicateWithFormat:@"identityProvider = %@", identityProvider] : nil;
+    for (NSSet *objects in @[[managedObjectContext insertedObjects], [managedObjectContext updatedObjects]]) {
+        for (NSManagedObject *object in objects) {
+            if ([object isKindOfClass:[Identity class]] && (predicate == nil || [predicate evaluateWithObject:object])) {
+                [object setValuesForKeysWithDictionary:values];
+            }
+        }
+    }
+    
+    // Identities of an unsaved provider are all unsaved too
+    if (identityProvider == nil || ![[identityProvider objectID] isTemporaryID]) {
+        NSBatchUpdateRequest *request = [[NSBatchUpdateRequest alloc] initWithEntityName:@"Identity"];
+        [request setPredicate:predicate];
+        [request setPropertiesToUpdate:values];
+        [request setResultType:NSUpdatedObjectIDsResultType];
+        
+        // Batch updates go straight to the store, so they run on the context at the root. Changes that
+        // are pending in the parent contexts are written first, their save would undo the update.
+        NSMutableArray *contexts = [NSMutableArray arrayWithObject:managedObjectContext];
+        while ([[contexts lastObject] parentContext] != nil) {
+            [contexts addObject:[[contexts lastObject] parentContext]];
+        }
+        
+        __block NSBatchUpdateResult *result = nil;
+        __block NSError *updateError = nil;
+        for (NSManagedObjectContext *context in [contexts subarrayWithRange:NSMakeRange(1, [contexts count] - 1)]) {
+            [context performBlockAndWait:^{
+                if (updateError == nil && [context hasChanges]) {
+                    [context save:&updateError];
+                }
+            }];
+        }
+        if (updateError == nil) {
+            NSManagedObjectContext *rootContext = [contexts lastObject];
+            [rootContext performBlockAndWait:^{
+                result = [rootContext executeRequest:request error:&updateError];
+            }];
+        }
+        if (result == nil) {
+            if (error != NULL) {
+                *error = updateError;
+            }
+            return NO;
+        }
+        
+        // Refreshes the registered identities and the row caches their faults are filled from
+        [NSManagedObjectContext mergeChangesFromRemoteContextSave:@{NSUpdatedObjectsKey: [result result]} intoContexts:contexts];
+    }
+    
+    @synchronized (self) {
+        if (self.loaded && values[@"blocked"] != nil) {
+            BOOL unblocked = ![values[@"blocked"] boolValue];
+            for (NSManagedObject *object in self.keys) {
+                IdentityIndexKey *key = [self.keys objectForKey:object];
+                if (key.identityProvider == nil || (identityProvider != nil && key.identityProvider != identityProvider) || key.unblocked == unblocked) {
+                    continue;
+                }
+                key.unblocked = unblocked;
+                if (unblocked) {
+                    self.unblockedCount++;
+                } else {
+                    self.unblockedCount--;
+                }
+            }
+        }
+    }
+    
+    return YES;
+}
+
+#pragma mark -
+#pragma mark Loading
+
+- (BOOL)prepare {
+    NSManagedObjectContext *managedObjectContext = self.managedObjectContext;
+    if (managedObjectContext == nil) {
+        return NO;
+    }
+    
+    // Reports the pending changes to objectsDidChange: first
+    [managedObjectContext processPendingChanges];
+    
+    @synchronized (self) {
+        return self.loaded || [self loadFromManagedObjectContext:managedObjectContext];
+    }
+}
+
+- (BOOL)loadFromManagedObjectContext:(NSManagedObjectContext *)managedObjectContext {
+    // Only the filed and counted attributes, providers come without their logo
+    NSFetchRequest *identityProviderRequest = [NSFetchRequest fetchRequestWithEntityName:@"IdentityProvider"];
+    [identityProviderRequest setReturnsObjectsAsFaults:NO];
+    [identityProviderRequest setPropertiesToFetch:@[@"identifier"]];
+    
+    NSFetchRequest *identityRequest = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [identityRequest setReturnsObjectsAsFaults:NO];
+    [identityRequest setPropertiesToFetch:@[@"identifier", @"identityProvider", @"sortKey", @"blocked"]];
+    
+    NSError *error = nil;
+    NSArray *identityProviders = [managedObjectContext executeFetchRequest:identityProviderRequest error:&error];
+    NSArray *identities = identityProviders != nil ? [managedObjectContext executeFetchRequest:identityRequest error:&error] : nil;
+    if (identities == nil) {
+        NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
+        return NO;
+    }
+    
+    self.identityProviders = [NSMutableDictionary dictionaryWithCapacity:[identityProviders count]];
+    self.identities = [NSMapTable strongToStrongObjectsMapTable];
+    self.keys = [NSMapTable strongToStrongObjectsMapTable];
+    self.totalCount = 0;
+    self.unblockedCount = 0;
+    self.sortKeys = [NSCountedSet set];
+    self.highestSortKey = nil;
+    for (IdentityProvider *identityProvider in identityProviders) {
+        [self addObject:identityProvider];
+    }
+    for (Identity *identity in identities) {
+        [self addObject:identity];
+    }
+    
+    self.loaded = YES;
+    self.loadCount++;
+    return YES;
+}
+
+#pragma mark -
+#pragma mark Changes
+
+- (void)objectsDidChange:(NSNotification *)notification {
+    NSDictionary *userInfo = [notification userInfo];
+    
+    @synchronized (self) {
+        if (!self.loaded) {
+            return;
+        }
+        
+        if (userInfo[NSInvalidatedAllObjectsKey] != nil) {
+            [self invalidate];
+            return;
+        }
+        
+        for (NSString *key in @[NSDeletedObjectsKey, NSInvalidatedObjectsKey]) {
+            for (NSManagedObject *object in userInfo[key]) {
+                [self removeObject:object];
+            }
+        }
+        
+        // Identifiers, providers and the aggregated attributes can change, so changed objects are filed
+        // again. Faults have no changes of their own and filing them again would load each one, the
+        // store only changes underneath the context through updateIdentitiesWithValues:, which keeps
+        // the index up to date itself.
+        for (NSString *key in @[NSInsertedObjectsKey, NSUpdatedObjectsKey, NSRefreshedObjectsKey]) {
+            for (NSManagedObject *object in userInfo[key]) {
+                if ([object isFault] && [self.keys objectForKey:object] != nil) {
+                    continue;
+                }
+                [self removeObject:object];
+                if (![object isDeleted]) {
+                    [self addObject:object];
+                }
+            }
+        }
+    }
+}
+
+- (void)addObject:(NSManagedObject *)object {
+    IdentityIndexKey *key = [[IdentityIndexKey alloc] init];
+    if ([object isKindOfClass:[IdentityProvider class]]) {
+        key.identifier = ((IdentityProvider *)object).identifier;
+    } else if ([object isKindOfClass:[Identity class]]) {
+        Identity *identity = (Identity *)object;
+        key.identityProvider = identity.identityProvider ?: [NSNull null];
+        key.identifier = identity.identifier;
+        key.sortKey = identity.sortKey;
+        
+        // Matches the former blocked = NO count, which leaves out NULL
+        key.unblocked = identity.blocked != nil && ![identity.blocked boolValue];
+        [self addAggregatesOfKey:key];
+    } else {
+        return;
+    }
+    
+    [self.keys setObject:key forKey:object];
+    if (key.identifier == nil) {
+        return;
+    }
+    
+    NSMutableDictionary *table = [self tableForKey:key create:YES];
+    NSMutableArray *matches = table[key.identifier];
+    if (matches == nil) {
+        matches = [NSMutableArray arrayWithCapacity:1];
+        table[key.identifier] = matches;
+    }
+    [matches addObject:object];
+}
+
+- (void)removeObject:(NSManagedObject *)object {
+    IdentityIndexKey *key = [self.keys objectForKey:object];
+    if (key == nil) {
+        return;
+    }
+    
+    [self.keys removeObjectForKey:object];
+    if (key.identityProvider != nil) {
+        [self removeAggregatesOfKey:key];
+    }
+    if (key.identifier == nil) {
+        return;
+    }
+    
+    NSMutableDictionary *table = [self tableForKey:key create:NO];
+    NSMutableArray *matches = table[key.identifier];
+    [matches removeObjectIdenticalTo:object];
+    if ([matches count] == 0) {
+        [table removeObjectForKey:key.identifier];
+    }
+    if (key.identityProvider != nil && [table count] == 0) {
+        [self.identities removeObjectForKey:key.identityProvider];
+    }
+}
+
+- (NSMutableDictionary *)tableForKey:(IdentityIndexKey *)key create:(BOOL)create {
+    if (key.identityProvider == nil) {
+        return self.identityProviders;
+    }
+    
+    NSMutableDictionary *table = [self.identities objectForKey:key.identityProvider];
+    if (table == nil && create) {
+        table = [NSMutableDictionary dictionary];
+        [self.identities setObject:table forKey:key.identityProvider];
+    }
+    return table;
+}
+
+- (void)addAggregatesOfKey:(IdentityIndexKey *)key {
+    self.totalCount++;
+    if (key.unblocked) {
+        self.unblockedCount++;
+    }
+    
+    // Like max: in a fetch, identities without sort key are left out
+    if (key.sortKey != nil) {
+        if (self.highestSortKey == nil || [key.sortKey longLongValue] > [self.highestSortKey longLongValue]) {
+            self.highestSortKey = key.sortKey;
+        }
+        [self.sortKeys addObject:key.sortKey];
+    }
+}
+
+- (void)removeAggregatesOfKey:(IdentityIndexKey *)key {
+    self.totalCount--;
+    if (key.unblocked) {
+        self.unblockedCount--;
+    }
+    
+    if (key.sortKey != nil) {
+        [self.sortKeys removeObject:key.sortKey];
+        
+        // Only removing the last identity with the maximum needs a scan
+        if ([key.sortKey isEqualToNumber:self.highestSortKey] && [self.sortKeys countForObject:key.sortKey] == 0) {
+            self.highestSortKey = nil;
+            for (NSNumber *remaining in self.sortKeys) {
+                if (self.highestSortKey == nil || [remaining longLongValue] > [self.highestSortKey longLongValue]) {
+                    self.highestSortKey = remaining;
+                }
+            }
+        }
+    }
+}
+
+@end
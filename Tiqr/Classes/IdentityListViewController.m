@@ -152,6 +152,7 @@
     
     NSString *identityIdentifier = identity.identifier;
     NSString *providerIdentifier = identityProvider.identifier;
+    BOOL providerDeleted = NO;
     
     if (identityProvider != nil) {
         
@@ -159,14 +160,20 @@
         [identityService deleteIdentity:identity];
         if ([identityProvider.identities count] == 0) {
             [identityService deleteIdentityProvider:identityProvider];
+            providerDeleted = YES;
         }
     } else {
         [identityService deleteIdentity:identity];
     }
     
-    if ([identityService saveIdentities]) {
-        [ServiceContainer.sharedInstance.secretService deleteSecretForIdentityIdentifier:identityIdentifier
-                                                                      providerIdentifier:providerIdentifier];
+    if ([identityService saveIdentitiesDurably]) {
+        // The last identity of a provider takes all its secrets along at once
+        if (providerDeleted) {
+            [ServiceContainer.sharedInstance.secretService deleteSecretsForProviderIdentifier:providerIdentifier];
+        } else {
+            [ServiceContainer.sharedInstance.secretService deleteSecretForIdentityIdentifier:identityIdentifier
+                                                                          providerIdentifier:providerIdentifier];
+        }
         
         if (ServiceContainer.sharedInstance.identityService.identityCount == 0) {
             [self.navigationController popViewControllerAnimated:YES];
@@ -187,18 +194,10 @@
 - (void)tableView:(UITableView *)tableView moveRowAtIndexPath:(NSIndexPath *)fromIndexPath toIndexPath:(NSIndexPath *)toIndexPath {
 	self.processingMoveRow = YES;
 	
-	NSMutableArray *fetchedObjects = [NSMutableArray arrayWithArray:[self.fetchedResultsController fetchedObjects]];  	
-	id movedObject = fetchedObjects[fromIndexPath.row];
-	[fetchedObjects removeObjectAtIndex:fromIndexPath.row];
-	[fetchedObjects insertObject:movedObject atIndex:toIndexPath.row];
-	
-	NSInteger sortIndex = 0;
-	for (Identity *identity in fetchedObjects) {
-		identity.sortIndex = [NSNumber numberWithInteger:sortIndex];
-		sortIndex++;
-	}
+	IdentityService *identityService = ServiceContainer.sharedInstance.identityService;
+	[identityService moveIdentityAtIndex:fromIndexPath.row toIndex:toIndexPath.row inIdentities:[self.fetchedResultsController fetchedObjects]];
 	
-    if (![ServiceContainer.sharedInstance.identityService saveIdentities]) {
+    if (![identityService saveIdentities]) {
         NSString *title = NSLocalizedString(@"error", "Alert title for error");		
         NSString *message = NSLocalizedString(@"error_auth_unknown_error", "Unexpected error message");		        
         NSString *okTitle = NSLocalizedString(@"ok_button", "OK button title");			
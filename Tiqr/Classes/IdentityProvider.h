@@ -29,6 +29,7 @@
 
 #import <Foundation/Foundation.h>
 #import <CoreData/CoreData.h>
+#import "OCRASuite.h"
 
 @class Identity;
 
@@ -41,6 +42,20 @@
 @property (nonatomic, strong) NSString * identifier;
 @property (nonatomic, strong) NSData * logo;
 @property (nonatomic, strong) NSSet *identities;
+
+/**
+ * Returns the compiled form of ocraSuite for the given dialect.
+ *
+ * The suite is compiled once and cached on the provider; the cache is
+ * dropped when the provider turns into a fault or its ocraSuite changes.
+ *
+ * @param dialect  parsing rules to apply
+ * @param error    set when the suite is malformed
+ *
+ * @return compiled suite or nil
+ */
+- (OCRASuite *)compiledOcraSuiteForDialect:(OCRASuiteDialect)dialect error:(NSError **)error;
+
 @end
 
 @interface IdentityProvider (CoreDataGeneratedAccessors)
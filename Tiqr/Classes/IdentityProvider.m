@@ -31,6 +31,13 @@
 #import "Identity.h"
 
 
+@interface IdentityProvider () {
+    OCRASuite *_compiledOcraSuites[2];
+}
+
+@end
+
+
 @implementation IdentityProvider
 
 @dynamic displayName;
@@ -41,4 +48,22 @@
 @dynamic logo;
 @dynamic identities;
 
+- (OCRASuite *)compiledOcraSuiteForDialect:(OCRASuiteDialect)dialect error:(NSError **)error {
+    NSString *ocraSuite = self.ocraSuite;
+    OCRASuite *suite = _compiledOcraSuites[dialect];
+    if (suite != nil && [suite.string isEqualToString:ocraSuite]) {
+        return suite;
+    }
+    
+    suite = [OCRASuite suiteWithString:ocraSuite dialect:dialect error:error];
+    _compiledOcraSuites[dialect] = suite;
+    return suite;
+}
+
+- (void)didTurnIntoFault {
+    _compiledOcraSuites[OCRASuiteDialectV1] = nil;
+    _compiledOcraSuites[OCRASuiteDialectV2] = nil;
+    [super didTurnIntoFault];
+}
+
 @end
@@ -38,6 +38,15 @@
 
 - (instancetype)initWithSecretService:(SecretService *)secretService;
 
+/**
+ * Initializes the service with the identity store at the given location
+ * instead of Tiqr.sqlite in the documents directory.
+ *
+ * @param secretService  secret service
+ * @param storeURL       URL of the SQLite store
+ */
+- (instancetype)initWithSecretService:(SecretService *)secretService storeURL:(NSURL *)storeURL;
+
 /**
  * Insert a new Identity object into the internal managed object context
  *
@@ -71,6 +80,9 @@
 /**
  * Tries to find the identity provider with the given identifier.
  *
+ * Served from an in-memory index of the managed object context, so this
+ * doesn't hit the store.
+ *
  * @param identifier identity provider identifier
  *
  * @return the identity provider (or nil)
@@ -80,20 +92,39 @@
 /**
  * Returns the number of identities
  *
+ * Kept up to date in memory by the identity index, reading it does no I/O.
+ *
  * @return number of identities
  */
 - (NSUInteger)identityCount;
 
 /**
- * Returns the maximum identity sort index
+ * Returns the sort key that puts a new identity after all others.
+ *
+ * The highest sort key is tracked in memory, like identityCount.
+ *
+ * @return sort key for a new identity
+ */
+- (NSNumber *)nextSortKey;
+
+/**
+ * Moves an identity to another position in the identity list.
  *
- * @return maximum sort index
+ * Normally only the moved identity gets a new sort key, the one halfway
+ * between its new neighbours. When they are too close, the keys of a few
+ * identities around the position are spread out as well. Does not save.
+ *
+ * @param fromIndex   current position of the identity
+ * @param toIndex     new position of the identity
+ * @param identities  all identities, ordered by sort key
  */
-- (NSUInteger)maxSortIndex;
+- (void)moveIdentityAtIndex:(NSUInteger)fromIndex toIndex:(NSUInteger)toIndex inIdentities:(NSArray *)identities;
 
 /**
  * Returns whether all identities are currently blocked or not.
  *
+ * Counted in memory as well, this doesn't query the store.
+ *
  * @return all identities blocked?
  */
 - (BOOL)allIdentitiesBlocked;
@@ -101,6 +132,8 @@
 /**
  * Searches for an identity with the given identifier for the given identity provider.
  *
+ * Served from the same in-memory index as findIdentityProviderWithIdentifier:.
+ *
  * @param identifier         identity identifier
  * @param identityProvider   identity provider
  *
@@ -120,14 +153,47 @@
 /**
  * Blocks all identities.
  *
- * NOTE: this method does not call save
+ * Identities are blocked in the store with a single update, so this takes
+ * the same time and memory for any number of identities. Identities with
+ * unsaved changes are blocked in memory too and still need a save.
  */
 - (void)blockAllIdentities;
 
+/**
+ * Blocks or unblocks the identities of a provider, or all identities, with a
+ * single store update like blockAllIdentities.
+ *
+ * @param blocked           whether to block or unblock
+ * @param identityProvider  identity provider, nil for all identities
+ *
+ * @return whether the identities were updated
+ */
+- (BOOL)setBlocked:(BOOL)blocked forIdentitiesOfIdentityProvider:(IdentityProvider *)identityProvider;
+
+/**
+ * Turns biometric unlock on or off for the identities of a provider, or for
+ * all identities, with a single store update.
+ *
+ * Only the flag is changed, enabling it doesn't enroll secrets for
+ * biometric unlock.
+ *
+ * @param enabled           whether biometric unlock is enabled
+ * @param identityProvider  identity provider, nil for all identities
+ *
+ * @return whether the identities were updated
+ */
+- (BOOL)setBiometricIDEnabled:(BOOL)enabled forIdentitiesOfIdentityProvider:(IdentityProvider *)identityProvider;
+
 
 /**
  * Upgrades the identity to use salt and a initialization vector. If TouchID is available this will setup TouchID for this identity
  *
+ * Returns right away: the secret of a version 1 identity is decrypted and
+ * stored under its new salt on the PIN unlock queue, and version 3
+ * identities are migrated to version 4 in the background. Only call this
+ * with a PIN that was accepted by the server. An upgrade that is cancelled
+ * or fails is tried again the next time.
+ *
  * @param PIN The PIN for this identity or nil
  *
  */
@@ -136,16 +202,64 @@
 /**
  * Upgrades the identity to use TouchID
  *
+ * The secret is decrypted with the PIN on the PIN unlock queue, this
+ * returns right away.
+ *
  * @param PIN The current PIN for this identity
  *
  */
 - (void)upgradeIdentityToTouchID:(Identity *)identity withPIN:(NSString *)PIN;
 
+/**
+ * Wraps the PIN protected secret of the identity again, in the background,
+ * when its PBKDF2 rounds are well off the rounds calibrated for this
+ * device, and saves the new rounds in the identity. With the key hierarchy
+ * enabled this also moves the secret under it.
+ *
+ * Only call this after the PIN was accepted by the server.
+ *
+ * @param identity  identity
+ * @param PIN       The PIN for this identity
+ */
+- (void)rewrapIdentityIfNeeded:(Identity *)identity withPIN:(NSString *)PIN;
+
+/**
+ * Takes the next counter for counter based OCRA suites (-C).
+ *
+ * Counters are kept in an append-only journal next to the store, so this
+ * doesn't require saving the managed object context. A counter that has
+ * been returned once is never returned again, not even after a crash.
+ *
+ * @param counter   set to the counter to use for the next response
+ * @param identity  identity
+ * @param error     set when the journal couldn't be written
+ *
+ * @return whether a counter was taken
+ */
+- (BOOL)nextCounter:(uint64_t *)counter forIdentity:(Identity *)identity error:(NSError **)error;
+
 /**
  * Saves the internal managed object context
+ *
+ * The changes are handed to a writer context that writes them to the store
+ * on its own queue shortly after, together with those of any saves that
+ * follow. A failure to write them is only logged and the write is retried
+ * with the next save.
  */
 - (BOOL)saveIdentities;
 
+/**
+ * Saves the internal managed object context and waits until the changes are
+ * in the store. Meant for changes that must survive the app being killed
+ * right after, like blocking identities after failed attempts, and for
+ * changes that go together with changes outside the store, like secrets in
+ * the keychain or an enrollment confirmed with the server: only act on those
+ * once this returns YES.
+ *
+ * @return whether the changes were written to the store
+ */
+- (BOOL)saveIdentitiesDurably;
+
 /**
  * Performs a rollback on the internal managed object context
  */
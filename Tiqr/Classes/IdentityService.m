@@ -30,17 +30,31 @@
 #import "IdentityService.h"
 #import "IdentityProvider.h"
 #import "SecretService.h"
+#import "CounterJournal.h"
+#import "IdentityIndex.h"
+#import "PBKDF2Calibration.h"
+#import "SortKey.h"
 
 #import "Identity.h"
 #import "IdentityProvider.h"
 
+/**
+ * Saves that follow each other within this many seconds are written to the
+ * store together.
+ */
+static const NSTimeInterval IdentityServiceWriteDelay = 0.5;
 
 @interface IdentityService ()
 
 @property (nonatomic, strong, readwrite) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, strong) NSManagedObjectContext *writerContext;
+@property (nonatomic, assign) BOOL writeScheduled;
 @property (nonatomic, strong, readwrite) NSManagedObjectModel *managedObjectModel;
 @property (nonatomic, strong, readwrite) NSPersistentStoreCoordinator *persistentStoreCoordinator;
 @property (nonatomic, weak) SecretService *secretService;
+@property (nonatomic, copy) NSURL *storeURL;
+@property (nonatomic, assign) CounterJournal *counterJournal;
+@property (nonatomic, strong) IdentityIndex *identityIndex;
 
 @end
 
@@ -48,13 +62,22 @@
 @implementation IdentityService
 
 - (instancetype)initWithSecretService:(SecretService *)secretService {
+    return [self initWithSecretService:secretService storeURL:nil];
+}
+
+- (instancetype)initWithSecretService:(SecretService *)secretService storeURL:(NSURL *)storeURL {
     if (self = [super init]) {
         self.secretService = secretService;
+        self.storeURL = storeURL;
     }
     
     return self;
 }
 
+- (void)dealloc {
+    CounterJournalClose(_counterJournal);
+}
+
 - (Identity *)createIdentity {
     return [NSEntityDescription insertNewObjectForEntityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
 }
@@ -81,7 +104,7 @@
     [fetchRequest setEntity:entity];
     [fetchRequest setFetchBatchSize:20];
     
-    NSSortDescriptor *sortDescriptor = [[NSSortDescriptor alloc] initWithKey:@"sortIndex" ascending:YES];
+    NSSortDescriptor *sortDescriptor = [[NSSortDescriptor alloc] initWithKey:@"sortKey" ascending:YES];
     NSArray *sortDescriptors = @[sortDescriptor];
     [fetchRequest setSortDescriptors:sortDescriptors];
     
@@ -90,98 +113,19 @@
 }
 
 - (IdentityProvider *)findIdentityProviderWithIdentifier:(NSString *)identifier  {
-    NSEntityDescription *entityDescription = [NSEntityDescription entityForName:@"IdentityProvider" inManagedObjectContext:self.managedObjectContext];
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    [request setEntity:entityDescription];
-    
-    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"identifier = %@", identifier];
-    [request setPredicate:predicate];
-    
-    NSError *error = nil;
-    NSArray *result = [self.managedObjectContext executeFetchRequest:request error:&error];
-    
-    IdentityProvider *identityProvider = nil;
-    if (result != nil && [result count] == 1) {
-        identityProvider = result[0];
-    }
-    
-    return identityProvider;
+    return [self.identityIndex identityProviderWithIdentifier:identifier];
 }
 
 - (NSUInteger)identityCount {
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    NSEntityDescription *entity = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
-    [request setEntity:entity];
-    
-    NSError *error = nil;
-    NSUInteger count = [self.managedObjectContext countForFetchRequest:request error:&error];
-    
-    
-    return error == nil ? count : 0;
-}
-
-- (NSUInteger)maxSortIndex {
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    NSEntityDescription *entity = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
-    [request setEntity:entity];
-    
-    NSExpression *keyPathExpression = [NSExpression expressionForKeyPath:@"sortIndex"];
-    NSExpression *maxExpression = [NSExpression expressionForFunction:@"max:" arguments:@[keyPathExpression]];
-    
-    NSExpressionDescription *expressionDescription = [[NSExpressionDescription alloc] init];
-    [expressionDescription setName:@"maxSortIndex"];
-    [expressionDescription setExpression:maxExpression];
-    [expressionDescription setExpressionResultType:NSInteger16AttributeType];
-    
-    [request setResultType:NSDictionaryResultType];
-    [request setPropertiesToFetch:@[expressionDescription]];
-    
-    NSError *error = nil;
-    NSArray *objects = [self.managedObjectContext executeFetchRequest:request error:&error];
-    NSUInteger result = 0;
-    if (objects != nil && [objects count] > 0) {
-        result = [[objects[0] valueForKey:@"maxSortIndex"] intValue];
-    }
-    
-    
-    return result;
+    return [self.identityIndex identityCount];
 }
 
 - (BOOL)allIdentitiesBlocked {
-    if (self.identityCount == 0) {
-        return NO;
-    }
-    
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    NSEntityDescription *entity = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
-    [request setEntity:entity];
-    
-    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"blocked = %@", @NO];
-    [request setPredicate:predicate];
-    
-    NSError *error = nil;
-    NSUInteger count = [self.managedObjectContext countForFetchRequest:request error:&error];
-    
-    return error == nil && count == 0;
+    return [self.identityIndex allIdentitiesBlocked];
 }
 
 - (Identity *)findIdentityWithIdentifier:(NSString *)identifier forIdentityProvider:(IdentityProvider *)identityProvider {
-    NSEntityDescription *entityDescription = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    [request setEntity:entityDescription];
-    
-    NSPredicate *predicate = [NSPredicate predicateWithFormat:@"identifier = %@ AND identityProvider = %@", identifier, identityProvider];
-    [request setPredicate:predicate];
-    
-    NSError *error = nil;
-    NSArray *result = [self.managedObjectContext executeFetchRequest:request error:&error];
-    
-    Identity *identity = nil;
-    if (result != nil && [result count] == 1) {
-        identity = result[0];
-    }
-    
-    return identity;
+    return [self.identityIndex identityWithIdentifier:identifier forIdentityProvider:identityProvider];
 }
 
 - (NSArray *)findIdentitiesForIdentityProvider:(IdentityProvider *)identityProvider  {
@@ -192,7 +136,7 @@
     NSPredicate *predicate = [NSPredicate predicateWithFormat:@"identityProvider = %@", identityProvider];
     [request setPredicate:predicate];
     
-    NSSortDescriptor *sortDescriptor = [[NSSortDescriptor alloc] initWithKey:@"sortIndex" ascending:YES];
+    NSSortDescriptor *sortDescriptor = [[NSSortDescriptor alloc] initWithKey:@"sortKey" ascending:YES];
     [request setSortDescriptors:@[sortDescriptor]];
     
     NSError *error = nil;
@@ -202,64 +146,128 @@
 }
 
 - (void)blockAllIdentities  {
-    NSEntityDescription *entityDescription = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:self.managedObjectContext];
-    NSFetchRequest *request = [[NSFetchRequest alloc] init];
-    [request setEntity:entityDescription];
-    
+    [self setBlocked:YES forIdentitiesOfIdentityProvider:nil];
+}
+
+- (BOOL)setBlocked:(BOOL)blocked forIdentitiesOfIdentityProvider:(IdentityProvider *)identityProvider {
+    return [self updateIdentitiesWithValues:@{@"blocked": @(blocked)} forIdentityProvider:identityProvider];
+}
+
+- (BOOL)setBiometricIDEnabled:(BOOL)enabled forIdentitiesOfIdentityProvider:(IdentityProvider *)identityProvider {
+    return [self updateIdentitiesWithValues:@{@"biometricIDEnabled": @(enabled)} forIdentityProvider:identityProvider];
+}
+
+- (BOOL)updateIdentitiesWithValues:(NSDictionary *)values forIdentityProvider:(IdentityProvider *)identityProvider {
     NSError *error = nil;
-    NSArray *identities = [self.managedObjectContext executeFetchRequest:request error:&error];
-    
-    if (error == noErr && identities != nil) {
-        for (Identity *identity in identities) {
-            identity.blocked = @YES;
-        }
+    if (![self.identityIndex updateIdentitiesWithValues:values forIdentityProvider:identityProvider error:&error]) {
+        NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
+        return NO;
     }
+    
+    return YES;
 }
 
 - (void)upgradeIdentity:(Identity *)identity withPIN:(NSString *)PIN {
-    if (identity.version.integerValue < 2) {
-        NSData *secret = [self.secretService secretForIdentity:identity withPIN:PIN salt:nil initializationVector:nil];
-        if (secret) {
-            NSData *salt = [self.secretService generateSecret];
-            NSData *initializationVector = [self.secretService generateSecret];
-            
-            if ([self.secretService setSecret:secret forIdentity:identity withPIN:PIN salt:salt initializationVector:initializationVector]) {
-                identity.salt = salt;
-                identity.initializationVector = initializationVector;
-                identity.version = @2;
-                
-                [self saveIdentities];
-            }
-        }
+    if (identity.version.integerValue >= 2) {
+        [self upgradeSaltedIdentity:identity withPIN:PIN];
+        return;
     }
     
+    // Both derivations run on the PIN unlock queue, the identity may be gone when they finish
+    [self.secretService secretForIdentity:identity withPIN:PIN salt:nil initializationVector:nil completionHandler:^(NSData *secret, BOOL cancelled) {
+        if (secret == nil || identity.isDeleted || identity.managedObjectContext == nil) {
+            return;
+        }
+        
+        NSData *salt = [self.secretService generateSecret];
+        NSData *initializationVector = [self.secretService generateSecret];
+        [self.secretService setSecret:secret forIdentity:identity withPIN:PIN salt:salt initializationVector:initializationVector completionHandler:^(BOOL success, BOOL cancelled) {
+            if (!success || identity.isDeleted || identity.managedObjectContext == nil) {
+                return;
+            }
+            
+            identity.salt = salt;
+            identity.initializationVector = initializationVector;
+            identity.version = @2;
+            [self saveIdentitiesDurably];
+            
+            [self upgradeSaltedIdentity:identity withPIN:PIN];
+        }];
+    }];
+}
+
+- (void)upgradeSaltedIdentity:(Identity *)identity withPIN:(NSString *)PIN {
     if (identity.version.integerValue == 2) {
         identity.version = @3;
         [self saveIdentities];
     }
     
-    return;
+    if (identity.version.integerValue == 3 && PIN != nil) {
+        [self.secretService migrateSecretsOfIdentities:@[identity] PINs:@[PIN] completionHandler:^(NSArray *migratedIdentities) {
+            if ([migratedIdentities containsObject:identity] && !identity.isDeleted && identity.managedObjectContext != nil) {
+                identity.version = @4;
+                [self saveIdentitiesDurably];
+                [self rewrapIdentityIfNeeded:identity withPIN:PIN];
+            }
+        }];
+    }
 }
 
+- (void)rewrapIdentityIfNeeded:(Identity *)identity withPIN:(NSString *)PIN {
+    // Version 3 secrets are re-wrapped once their migration is done
+    if (PIN == nil || identity.salt == nil || identity.version.integerValue < 4) {
+        return;
+    }
+    
+    [self.secretService calibrateKeyDerivationRoundsWithCompletionHandler:^(NSUInteger calibratedRounds) {
+        if (identity.isDeleted || identity.managedObjectContext == nil) {
+            return;
+        }
+        
+        NSUInteger currentRounds = [self.secretService keyDerivationRoundsForIdentity:identity];
+        NSUInteger rounds = calibratedRounds;
+        BOOL needed = PBKDF2RoundsOffTarget((uint32_t)currentRounds, (uint32_t)calibratedRounds);
+        if (self.secretService.keyHierarchyEnabled) {
+            // Secrets under the hierarchy share the rounds of the key encryption key,
+            // secrets in the per identity format move under it
+            rounds = [self.secretService keyEncryptionKeyRoundsForCalibratedRounds:calibratedRounds];
+            needed = currentRounds != rounds || ![self.secretService secretUsesKeyHierarchyForIdentity:identity];
+        }
+        if (!needed) {
+            return;
+        }
+        
+        [self.secretService rewrapSecretForIdentity:identity withPIN:PIN rounds:rounds completionHandler:^(BOOL success) {
+            if (success && !identity.isDeleted && identity.managedObjectContext != nil) {
+                identity.kdfRounds = @(rounds);
+                [self saveIdentitiesDurably];
+            }
+        }];
+    }];
+}
 
 - (void)upgradeIdentityToTouchID:(Identity *)identity withPIN:(NSString *)PIN {
-    NSData *secret = [self.secretService secretForIdentity:identity withPIN:PIN];
-    
-    if (!secret || identity.version.integerValue < 3) {
+    if (identity.version.integerValue < 3) {
         return;
     }
     
-    [self.secretService setSecret:secret usingTouchIDforIdentity:identity withCompletionHandler:^(BOOL success) {
-        if (success) {
-            identity.usesOldBiometricFlow = @NO;
-            identity.shouldAskToEnrollInBiometricID = @NO;
-            identity.biometricIDEnabled = @YES;
-            identity.biometricIDAvailable = @YES;
-            [self saveIdentities];
-        } else {
-            identity.shouldAskToEnrollInBiometricID = @YES;
-            [self saveIdentities];
+    [self.secretService secretForIdentity:identity withPIN:PIN completionHandler:^(NSData *secret, BOOL cancelled) {
+        if (secret == nil || identity.isDeleted || identity.managedObjectContext == nil) {
+            return;
         }
+        
+        [self.secretService setSecret:secret usingTouchIDforIdentity:identity withCompletionHandler:^(BOOL success) {
+            if (success) {
+                identity.usesOldBiometricFlow = @NO;
+                identity.shouldAskToEnrollInBiometricID = @NO;
+                identity.biometricIDEnabled = @YES;
+                identity.biometricIDAvailable = @YES;
+                [self saveIdentitiesDurably];
+            } else {
+                identity.shouldAskToEnrollInBiometricID = @YES;
+                [self saveIdentities];
+            }
+        }];
     }];
 }
 
@@ -267,17 +275,211 @@
 
 
 
+#pragma mark -
+#pragma mark Ordering
+
+- (NSNumber *)nextSortKey {
+    NSNumber *maxSortKey = [self.identityIndex maxSortKey];
+    
+    int64_t key = 0;
+    if (SortKeyAppend([maxSortKey longLongValue], maxSortKey != nil, &key) != 0) {
+        key = (int64_t)([self spreadSortKeys] + 1) * SortKeyGap;
+    }
+    
+    return @(key);
+}
+
+- (void)moveIdentityAtIndex:(NSUInteger)fromIndex toIndex:(NSUInteger)toIndex inIdentities:(NSArray *)identities {
+    NSParameterAssert(fromIndex < [identities count] && toIndex < [identities count]);
+    
+    NSMutableArray *others = [identities mutableCopy];
+    Identity *identity = others[fromIndex];
+    [others removeObjectAtIndex:fromIndex];
+    
+    // Usually there is room between the new neighbours and nothing else has to be read
+    NSUInteger count = [others count];
+    int64_t lower = toIndex > 0 ? [[others[toIndex - 1] sortKey] longLongValue] : 0;
+    int64_t upper = toIndex < count ? [[others[toIndex] sortKey] longLongValue] : 0;
+    int64_t key = 0;
+    int result = SortKeyBetween(toIndex > 0 ? &lower : NULL, toIndex < count ? &upper : NULL, &key);
+    if (result == 0) {
+        identity.sortKey = @(key);
+        return;
+    }
+    
+    NSMutableData *keys = [NSMutableData dataWithLength:MAX(count, 1) * sizeof(int64_t)];
+    int64_t *keyBytes = [keys mutableBytes];
+    for (NSUInteger i = 0; i < count; i++) {
+        keyBytes[i] = [[others[i] sortKey] longLongValue];
+    }
+    
+    size_t first = 0;
+    size_t last = 0;
+    if (SortKeyPlace(keyBytes, count, toIndex, &key, &first, &last) != 0) {
+        // The keys went out of bounds, start over with evenly spaced keys
+        [others insertObject:identity atIndex:toIndex];
+        [self setSpreadSortKeysOfIdentities:others];
+        return;
+    }
+    
+    for (size_t i = first; i < last; i++) {
+        ((Identity *)others[i]).sortKey = @(keyBytes[i]);
+    }
+    identity.sortKey = @(key);
+}
+
+/**
+ * Gives all identities evenly spaced sort keys in their current order,
+ * identities without a key go last in the order of their old sort index.
+ *
+ * @return number of identities
+ */
+- (NSUInteger)spreadSortKeys {
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [request setSortDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"sortIndex" ascending:YES]]];
+    
+    NSError *error = nil;
+    NSArray *identities = [self.managedObjectContext executeFetchRequest:request error:&error];
+    if (identities == nil) {
+        NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
+        return 0;
+    }
+    
+    NSArray *ordered = [identities sortedArrayWithOptions:NSSortStable usingComparator:^NSComparisonResult(Identity *a, Identity *b) {
+        if (a.sortKey == nil || b.sortKey == nil) {
+            return a.sortKey == nil ? (b.sortKey == nil ? NSOrderedSame : NSOrderedDescending) : NSOrderedAscending;
+        }
+        return [a.sortKey compare:b.sortKey];
+    }];
+    
+    [self setSpreadSortKeysOfIdentities:ordered];
+    return [ordered count];
+}
+
+- (void)setSpreadSortKeysOfIdentities:(NSArray *)identities {
+    NSMutableData *keys = [NSMutableData dataWithLength:MAX([identities count], 1) * sizeof(int64_t)];
+    int64_t *keyBytes = [keys mutableBytes];
+    SortKeySpread(keyBytes, [identities count]);
+    [identities enumerateObjectsUsingBlock:^(Identity *identity, NSUInteger index, BOOL *stop) {
+        identity.sortKey = @(keyBytes[index]);
+    }];
+}
+
+- (void)assignMissingSortKeys {
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [request setPredicate:[NSPredicate predicateWithFormat:@"sortKey = nil"]];
+    
+    NSError *error = nil;
+    NSUInteger count = [self.managedObjectContext countForFetchRequest:request error:&error];
+    if (error == nil && count > 0) {
+        [self spreadSortKeys];
+        [self saveIdentities];
+    }
+}
+
+#pragma mark -
+#pragma mark Counters
+
+- (BOOL)nextCounter:(uint64_t *)counter forIdentity:(Identity *)identity error:(NSError **)error {
+    // Counters aren't removed together with their identity: a rollback would bring the
+    // identity back with its counter reset, after which values would be used twice
+    NSString *name = [NSString stringWithFormat:@"%@\n%@", identity.identityProvider.identifier, identity.identifier];
+    
+    int result = 0;
+    @synchronized(self) {
+        if (self.counterJournal == NULL) {
+            NSURL *applicationDocumentsDirectory = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+            NSURL *journalURL = [applicationDocumentsDirectory URLByAppendingPathComponent:@"Tiqr.counters"];
+            CounterJournal *journal = NULL;
+            result = CounterJournalOpen([journalURL fileSystemRepresentation], &journal);
+            self.counterJournal = journal;
+        }
+        
+        if (result == 0) {
+            result = CounterJournalNext(self.counterJournal, [name UTF8String], counter);
+        }
+    }
+    
+    if (result != 0) {
+        NSLog(@"Unresolved counter journal error %d", result);
+        if (error != NULL) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:result userInfo:nil];
+        }
+        return NO;
+    }
+    
+    return YES;
+}
+
 #pragma mark -
 #pragma mark Core Data stack
 
 - (BOOL)saveIdentities {
     NSError *error = nil;
     NSManagedObjectContext *managedObjectContext = self.managedObjectContext;
-    if (managedObjectContext != nil) {
-        if ([managedObjectContext hasChanges] && ![managedObjectContext save:&error]) {
+    if (managedObjectContext != nil && [managedObjectContext hasChanges]) {
+        // Objects saved into the writer keep a temporary ID in this context unless it is replaced
+        // now, a batch update would then take their provider for an unsaved one
+        NSArray *insertedObjects = [[managedObjectContext insertedObjects] allObjects];
+        if ([insertedObjects count] > 0 && ![managedObjectContext obtainPermanentIDsForObjects:insertedObjects error:&error]) {
+            NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
+            return NO;
+        }
+        
+        if (![managedObjectContext save:&error]) {
             NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
             return NO;
         }
+        
+        [self scheduleWrite];
+    }
+    
+    return YES;
+}
+
+- (BOOL)saveIdentitiesDurably {
+    if (![self saveIdentities]) {
+        return NO;
+    }
+    
+    __block BOOL written = YES;
+    NSManagedObjectContext *writerContext = self.writerContext;
+    [writerContext performBlockAndWait:^{
+        written = [self writeIdentities];
+    }];
+    return written;
+}
+
+- (void)scheduleWrite {
+    NSManagedObjectContext *writerContext = self.writerContext;
+    [writerContext performBlock:^{
+        if (self.writeScheduled || ![writerContext hasChanges]) {
+            return;
+        }
+        
+        self.writeScheduled = YES;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(IdentityServiceWriteDelay * NSEC_PER_SEC)), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+            [writerContext performBlock:^{
+                [self writeIdentities];
+            }];
+        });
+    }];
+}
+
+/**
+ * Writes the changes collected in the writer context to the store, only
+ * call this on the queue of the writer context.
+ *
+ * @return whether the store is up to date
+ */
+- (BOOL)writeIdentities {
+    self.writeScheduled = NO;
+    
+    // A failed write keeps its changes in the writer, the next one tries again
+    NSError *error = nil;
+    if ([self.writerContext hasChanges] && ![self.writerContext save:&error]) {
+        NSLog(@"Unresolved error %@, %@", error, [error userInfo]);
+        return NO;
     }
     
     return YES;
@@ -285,6 +487,14 @@
 
 - (void)rollbackIdentities {
     [self.managedObjectContext rollback];
+    [_identityIndex invalidate];
+}
+
+- (IdentityIndex *)identityIndex {
+    if (_identityIndex == nil) {
+        _identityIndex = [[IdentityIndex alloc] initWithManagedObjectContext:self.managedObjectContext];
+    }
+    return _identityIndex;
 }
 
 - (NSManagedObjectContext *)managedObjectContext {
@@ -294,8 +504,15 @@
     
     NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
     if (coordinator != nil) {
-        _managedObjectContext = [[NSManagedObjectContext alloc] init];
-        [_managedObjectContext setPersistentStoreCoordinator:coordinator];
+        // The main thread only pushes its changes to the writer, which does the store I/O on its own queue
+        self.writerContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+        [self.writerContext setPersistentStoreCoordinator:coordinator];
+        
+        _managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+        [_managedObjectContext setParentContext:self.writerContext];
+        
+        // Identities from before sort keys get one once
+        [self assignMissingSortKeys];
     }
     return _managedObjectContext;
 }
@@ -310,8 +527,12 @@
         modelPath = [[NSBundle mainBundle] pathForResource:@"Tiqr" ofType:@"mom"];
     }
     
-    NSURL *modelURL = [NSURL fileURLWithPath:modelPath];
-    _managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+    if (modelPath != nil) {
+        _managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:[NSURL fileURLWithPath:modelPath]];
+    } else {
+        // Outside the app, e.g. in the logic tests, the model is compiled into the bundle of this class
+        _managedObjectModel = [NSManagedObjectModel mergedModelFromBundles:@[[NSBundle bundleForClass:[self class]]]];
+    }
     return _managedObjectModel;
 }
 
@@ -320,9 +541,11 @@
         return _persistentStoreCoordinator;
     }
     
-    NSURL *applicationDocumentsDirectory = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
-    
-    NSURL *storeURL = [applicationDocumentsDirectory URLByAppendingPathComponent:@"Tiqr.sqlite"];
+    NSURL *storeURL = self.storeURL;
+    if (storeURL == nil) {
+        NSURL *applicationDocumentsDirectory = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+        storeURL = [applicationDocumentsDirectory URLByAppendingPathComponent:@"Tiqr.sqlite"];
+    }
     
     NSDictionary *options = @{NSMigratePersistentStoresAutomaticallyOption: @YES,
                               NSInferMappingModelAutomaticallyOption: @YES};
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "KeyHierarchy.h"
+#include "HMACKey.h"
+
+#include <errno.h>
+#include <string.h>
+
+static const uint8_t KeyHierarchyMagic[4] = { 'T', 'Q', 'K', 0x01 };
+
+size_t KeyHierarchyWrappedLength(size_t secretLength) {
+    return KeyHierarchyHeaderLength + secretLength;
+}
+
+bool KeyHierarchyIsWrapped(const uint8_t *blob, size_t length) {
+    return blob != NULL && length >= KeyHierarchyHeaderLength &&
+           (length - KeyHierarchyHeaderLength) % SecretCipherBlockLength == 0 &&
+           memcmp(blob, KeyHierarchyMagic, sizeof(KeyHierarchyMagic)) == 0;
+}
+
+int KeyHierarchyWrap(const uint8_t *keyEncryptionKey, const uint8_t *dataKey, const uint8_t *initializationVector,
+                     const uint8_t *secret, size_t secretLength, uint8_t *blob, size_t blobLength) {
+    if (keyEncryptionKey == NULL || dataKey == NULL || blob == NULL || secretLength % SecretCipherBlockLength != 0 ||
+        blobLength != KeyHierarchyWrappedLength(secretLength)) {
+        return EINVAL;
+    }
+    
+    memcpy(blob, KeyHierarchyMagic, sizeof(KeyHierarchyMagic));
+    int result = SecretCipherCrypt(SecretCipherOperationEncrypt, keyEncryptionKey, initializationVector,
+                                   dataKey, KeyHierarchyKeyLength, blob + sizeof(KeyHierarchyMagic));
+    if (result == 0) {
+        result = SecretCipherCrypt(SecretCipherOperationEncrypt, dataKey, initializationVector,
+                                   secret, secretLength, blob + KeyHierarchyHeaderLength);
+    }
+    if (result != 0) {
+        HMACSecureZero(blob, blobLength);
+    }
+    return result;
+}
+
+int KeyHierarchyUnwrap(const uint8_t *keyEncryptionKey, const uint8_t *initializationVector,
+                       const uint8_t *blob, size_t blobLength, uint8_t *secret, size_t secretLength) {
+    if (keyEncryptionKey == NULL || secret == NULL || !KeyHierarchyIsWrapped(blob, blobLength) ||
+        secretLength != blobLength - KeyHierarchyHeaderLength) {
+        return EINVAL;
+    }
+    
+    uint8_t dataKey[KeyHierarchyKeyLength];
+    int result = SecretCipherCrypt(SecretCipherOperationDecrypt, keyEncryptionKey, initializationVector,
+                                   blob + sizeof(KeyHierarchyMagic), KeyHierarchyKeyLength, dataKey);
+    if (result == 0) {
+        result = SecretCipherCrypt(SecretCipherOperationDecrypt, dataKey, initializationVector,
+                                   blob + KeyHierarchyHeaderLength, secretLength, secret);
+    }
+    HMACSecureZero(dataKey, sizeof(dataKey));
+    if (result != 0) {
+        HMACSecureZero(secret, secretLength);
+    }
+    return result;
+}
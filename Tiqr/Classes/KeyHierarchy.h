@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef KeyHierarchy_h
+#define KeyHierarchy_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SecretCipher.h"
+
+/*
+ * Two-tier format for PIN protected secrets.
+ *
+ * The PIN and a salt shared by all identities on the device derive a key
+ * encryption key. Every identity has its own random data key, stored
+ * encrypted under the key encryption key next to the secret it encrypts:
+ *
+ *   "TQK" 0x01 | data key encrypted under the KEK (32) | secret encrypted under the data key
+ *
+ * Both parts use SecretCipher with the initialization vector of the
+ * identity. Identities that share a PIN share the key encryption key, so
+ * one PBKDF2 run unlocks all of them, where the older format needs a run
+ * per identity salt. Like that format there is no way to tell whether the
+ * key encryption key was right, a wrong PIN unwraps to a different secret.
+ *
+ * Secrets in the older format are exactly one secret long and never start
+ * with the header, KeyHierarchyIsWrapped tells the two apart.
+ *
+ * Functions return 0 or an errno value.
+ */
+
+#define KeyHierarchyKeyLength SecretCipherKeyLength
+#define KeyHierarchyHeaderLength (4 + KeyHierarchyKeyLength)
+
+/**
+ * Length of the wrapped form of a secret.
+ */
+size_t KeyHierarchyWrappedLength(size_t secretLength);
+
+/**
+ * Whether the stored secret is in the two-tier format.
+ */
+bool KeyHierarchyIsWrapped(const uint8_t *blob, size_t length);
+
+/**
+ * Encrypts a secret under a data key and wraps the data key.
+ *
+ * @param keyEncryptionKey      KeyHierarchyKeyLength bytes derived from the PIN
+ * @param dataKey               KeyHierarchyKeyLength fresh random bytes
+ * @param initializationVector  SecretCipherBlockLength bytes, NULL for zeroes
+ * @param secret                secret, a multiple of SecretCipherBlockLength long
+ * @param secretLength          length of the secret
+ * @param blob                  receives the wrapped secret
+ * @param blobLength            KeyHierarchyWrappedLength(secretLength)
+ *
+ * @return 0, EINVAL, or EIO when the cipher fails
+ */
+int KeyHierarchyWrap(const uint8_t *keyEncryptionKey, const uint8_t *dataKey, const uint8_t *initializationVector,
+                     const uint8_t *secret, size_t secretLength, uint8_t *blob, size_t blobLength);
+
+/**
+ * Unwraps the data key and decrypts the secret with it.
+ *
+ * @param keyEncryptionKey      KeyHierarchyKeyLength bytes derived from the PIN
+ * @param initializationVector  SecretCipherBlockLength bytes, NULL for zeroes
+ * @param blob                  wrapped secret
+ * @param blobLength            length of the wrapped secret
+ * @param secret                receives the secret
+ * @param secretLength          blobLength - KeyHierarchyHeaderLength
+ *
+ * @return 0, EINVAL when the blob isn't wrapped, or EIO when the cipher fails
+ */
+int KeyHierarchyUnwrap(const uint8_t *keyEncryptionKey, const uint8_t *initializationVector,
+                       const uint8_t *blob, size_t blobLength, uint8_t *secret, size_t secretLength);
+
+#endif /* KeyHierarchy_h */
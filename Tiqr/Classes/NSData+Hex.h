@@ -28,8 +28,8 @@
  */
 
 /**
- * Category for NSData which adds a utility method for converting the
- * data object to a hexidecimal string.
+ * Category for NSData which adds utility methods for converting the
+ * data object to and from a hexidecimal string (see HexCodec.h).
  */
 @interface NSData (Hex)
 
@@ -40,4 +40,13 @@
  */
 @property (nonatomic, readonly, copy) NSString *hexStringValue;
 
+/**
+ * Decodes a hexadecimal string, upper and lower case digits are accepted.
+ *
+ * @param hexString string with an even number of hex digits
+ *
+ * @return decoded data or nil if the string contains anything but hex digits
+ */
++ (NSData *)dataWithHexString:(NSString *)hexString;
+
 @end
\ No newline at end of file
@@ -28,17 +28,52 @@
  */
 
 #import "NSData+Hex.h"
+#import "HexCodec.h"
 
 @implementation NSData (Hex)
 
 - (NSString *)hexStringValue {
-	NSMutableString *stringBuffer = [NSMutableString stringWithCapacity:([self length] * 2)];
-	const unsigned char *dataBuffer = [self bytes];
-	for (int i = 0; i < [self length]; ++i) {
-		[stringBuffer appendFormat:@"%02lX", (unsigned long)dataBuffer[i]];
+	NSUInteger length = [self length];
+	if (length == 0) {
+		return @"";
 	}
 	
-	return [stringBuffer copy];
+	char *hex = malloc(length * 2);
+	if (hex == NULL) {
+		return nil;
+	}
+	HexEncode([self bytes], length, hex, HexCaseUpper);
+	
+	return [[NSString alloc] initWithBytesNoCopy:hex length:length * 2 encoding:NSASCIIStringEncoding freeWhenDone:YES];
+}
+
++ (NSData *)dataWithHexString:(NSString *)hexString {
+	NSUInteger hexLength = [hexString length];
+	if (hexLength % 2 != 0) {
+		return nil;
+	}
+	
+	NSMutableData *data = [NSMutableData dataWithLength:hexLength / 2];
+	
+	// Most strings store ASCII directly, only copy the ones that don't
+	const char *hex = CFStringGetCStringPtr((__bridge CFStringRef)hexString, kCFStringEncodingASCII);
+	char *buffer = NULL;
+	if (hex == NULL) {
+		buffer = malloc(hexLength);
+		NSUInteger used = 0;
+		if (buffer == NULL ||
+			![hexString getBytes:buffer maxLength:hexLength usedLength:&used encoding:NSASCIIStringEncoding options:0 range:NSMakeRange(0, hexLength) remainingRange:NULL] ||
+			used != hexLength) {
+			free(buffer);
+			return hexLength == 0 ? data : nil;
+		}
+		hex = buffer;
+	}
+	
+	BOOL valid = HexDecode(hex, hexLength, [data mutableBytes]);
+	free(buffer);
+	
+	return valid ? data : nil;
 }
 
 @end
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Category for NSData which keeps the bytes in the shared secure arena (see
+ * SecureArena.h), for key material. The bytes are zeroed when the data
+ * object is deallocated. When the arena is full the bytes come from the heap
+ * instead, they are still zeroed on deallocation.
+ *
+ * Copying such a data object returns the same object, but a mutableCopy
+ * and the bytes of derived objects live on the heap like any other data.
+ */
+@interface NSData (Secure)
+
+/**
+ * Returns a zeroed secure data object to be filled in place.
+ *
+ * @param length number of bytes
+ * @param bytes  set to the writable bytes of the data object
+ *
+ * @return secure data object or nil if no memory is available
+ */
++ (NSData *)secureDataWithLength:(NSUInteger)length bytes:(uint8_t **)bytes;
+
+/**
+ * Returns a secure data object with a copy of the bytes.
+ *
+ * @param bytes  bytes to copy
+ * @param length number of bytes
+ *
+ * @return secure data object or nil if no memory is available
+ */
++ (NSData *)secureDataWithBytes:(const void *)bytes length:(NSUInteger)length;
+
+@end
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "NSData+Secure.h"
+#import "HMACKey.h"
+#import "SecureArena.h"
+
+@implementation NSData (Secure)
+
++ (NSData *)secureDataWithLength:(NSUInteger)length bytes:(uint8_t **)bytes {
+    if (length == 0) {
+        *bytes = NULL;
+        return [NSData data];
+    }
+    
+    SecureArena *arena = SecureArenaShared();
+    void *buffer = NULL;
+    if (arena != NULL && SecureArenaAllocate(arena, length, &buffer) == 0) {
+        *bytes = buffer;
+        return [[NSData alloc] initWithBytesNoCopy:buffer length:length deallocator:^(void *deallocated, NSUInteger deallocatedLength) {
+            SecureArenaRelease(arena, deallocated);
+        }];
+    }
+    
+    // The arena is full, counted as an exhaustion in its metrics
+    buffer = calloc(1, length);
+    if (buffer == NULL) {
+        return nil;
+    }
+    *bytes = buffer;
+    return [[NSData alloc] initWithBytesNoCopy:buffer length:length deallocator:^(void *deallocated, NSUInteger deallocatedLength) {
+        HMACSecureZero(deallocated, deallocatedLength);
+        free(deallocated);
+    }];
+}
+
++ (NSData *)secureDataWithBytes:(const void *)bytes length:(NSUInteger)length {
+    uint8_t *buffer = NULL;
+    NSData *data = [self secureDataWithLength:length bytes:&buffer];
+    if (data != nil && length > 0) {
+        memcpy(buffer, bytes, length);
+    }
+    return data;
+}
+
+@end
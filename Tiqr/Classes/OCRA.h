@@ -8,12 +8,14 @@
  * @license See the LICENSE file in the source distribution
  */
 #import <Foundation/Foundation.h>
+#import "OCRASuite.h"
 
 /**
  * Error codes that can occur when generating an OCRA string
  */
 enum {
-    OCRANumberOfDigitsTooLargeError = 100
+    OCRANumberOfDigitsTooLargeError = 100,
+    OCRAInvalidNumericQuestionError = 101
 };
 
 @interface OCRA : NSObject {
@@ -29,4 +31,99 @@ enum {
                           timestamp:(NSString*) timeStamp
                               error:(NSError**) error;
 
+/**
+ * Generates an OCRA response for a suite that has already been compiled,
+ * so the suite string doesn't need to be parsed again for every response.
+ */
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                                 key:(NSString*) key
+                             counter:(NSString*) counter
+                            question:(NSString*) question
+                            password:(NSString*) password
+                  sessionInformation:(NSString*) sessionInformation
+                           timestamp:(NSString*) timeStamp
+                               error:(NSError**) error;
+
+/**
+ * Generates an OCRA response from raw bytes.
+ *
+ * The secret is used as is and the data inputs are placed in the message
+ * without any conversion: the question is left aligned in its field, all
+ * other inputs are right aligned. Inputs can be nil when the suite doesn't
+ * use them.
+ */
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                              secret:(NSData*) secret
+                             counter:(NSData*) counter
+                            question:(NSData*) question
+                            password:(NSData*) password
+                  sessionInformation:(NSData*) sessionInformation
+                           timestamp:(NSData*) timeStamp
+                               error:(NSError**) error;
+
+/**
+ * Same as above, but with a precomputed key schedule (see HMACKey.h), so the
+ * key doesn't have to be hashed again for every response. Use this when
+ * computing several responses under the same secret. The key schedule must
+ * use the suite's hash algorithm.
+ */
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                             hmacKey:(const HMACKey*) hmacKey
+                             counter:(NSData*) counter
+                            question:(NSData*) question
+                            password:(NSData*) password
+                  sessionInformation:(NSData*) sessionInformation
+                           timestamp:(NSData*) timeStamp
+                               error:(NSError**) error;
+
+/**
+ * Decodes a hex string into a field of the given length, the same way the
+ * string based methods decode their inputs.
+ *
+ * @param length     field length in bytes
+ * @param hexString  hex digits, only the first 2 * length digits are used
+ * @param alignment  position of a short value within the field
+ *
+ * @return field of exactly length bytes
+ */
++ (NSData *) fieldWithLength:(size_t) length
+                   hexString:(NSString*) hexString
+                   alignment:(OCRAFieldAlignment) alignment;
+
+/**
+ * Returns the question field for a numeric (QN) question. The decimal
+ * value is converted exactly, up to OCRAMaxNumericQuestionDigits digits.
+ *
+ * @param suite     compiled suite
+ * @param question  decimal digits
+ *
+ * @return question field or nil if the question isn't a decimal number of
+ *         acceptable length
+ */
++ (NSData *) questionWithSuite:(OCRASuite*) suite
+               numericQuestion:(NSString*) question;
+
+/**
+ * Returns the 8 byte big endian counter field for the given value.
+ *
+ * @param suite    compiled suite
+ * @param counter  counter value
+ *
+ * @return counter field or nil if the suite doesn't use a counter
+ */
++ (NSData *) counterWithSuite:(OCRASuite*) suite
+                        value:(uint64_t) counter;
+
+/**
+ * Returns the timestamp field for the given date, expressed in the time
+ * steps of the suite (T1M by default).
+ *
+ * @param suite  compiled suite
+ * @param date   date, usually the server's time (see ServerClock)
+ *
+ * @return 8 byte timestamp field or nil if the suite doesn't use a timestamp
+ */
++ (NSData *) timestampWithSuite:(OCRASuite*) suite
+                           date:(NSDate*) date;
+
 @end
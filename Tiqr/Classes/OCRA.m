@@ -9,25 +9,98 @@
  */
 
 #import "OCRA.h"
-#import <CommonCrypto/CommonHMAC.h>
+#import "HMACKey.h"
+#import "SecureArena.h"
 
 @implementation OCRA
 
-static const int powers10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 1000000000 };
+/**
+ * Longest hex key that is decoded on the stack, the secrets tiqr uses are 32 bytes.
+ * Longer keys are decoded into the secure arena.
+ */
+#define OCRAMaxStackKeyLength 128
+
+/**
+ * Copies the first (at most 2 * length) hex digits of value into field.
+ */
+static void OCRADecodeField(uint8_t *field, size_t length, NSString *value, OCRAFieldAlignment alignment) {
+    if (length == 0) {
+        return;
+    }
+    
+    char hex[OCRASuiteMaxMessageLength * 2];
+    NSUInteger count = MIN(MIN([value length], length * 2), sizeof(hex));
+    NSUInteger used = 0;
+    [value getBytes:hex maxLength:sizeof(hex) usedLength:&used encoding:NSASCIIStringEncoding options:NSStringEncodingConversionAllowLossy range:NSMakeRange(0, count) remainingRange:NULL];
+    OCRAMessageSetHexField(field, length, hex, used, alignment);
+}
+
+static OCRABytes OCRABytesFromData(NSData *data) {
+    OCRABytes bytes = { [data bytes], [data length] };
+    return bytes;
+}
+
+static NSString *OCRAFormat(const OCRASuiteLayout *layout, uint32_t code) {
+    char output[11];
+    OCRAFormatCode(code, layout->digits, output);
+    return [NSString stringWithCString:output encoding:NSASCIIStringEncoding];
+}
+
+/**
+ * Computes the response for decoded inputs, everything lives on the stack.
+ */
+static NSString *OCRAGenerate(const OCRASuiteLayout *layout, const uint8_t *key, size_t keyLength, const OCRAInput *input) {
+    HMACAlgorithm algorithm;
+    OCRAHMACAlgorithm(layout->algorithm, &algorithm);
+    
+    HMACKey hmacKey;
+    HMACKeyInit(&hmacKey, algorithm, key, keyLength);
+    uint32_t code = OCRAComputeCode(layout, &hmacKey, input);
+    HMACKeyWipe(&hmacKey);
+    return OCRAFormat(layout, code);
+}
+
++ (NSData *)fieldWithLength:(size_t)length hexString:(NSString *)hexString alignment:(OCRAFieldAlignment)alignment {
+    NSMutableData *field = [NSMutableData dataWithLength:length];
+    OCRADecodeField([field mutableBytes], length, hexString, alignment);
+    return field;
+}
+
++ (NSData *)questionWithSuite:(OCRASuite *)suite numericQuestion:(NSString *)question {
+    char decimal[OCRAMaxNumericQuestionDigits];
+    NSUInteger used = 0;
+    if ([question length] > sizeof(decimal) ||
+        ![question getBytes:decimal maxLength:sizeof(decimal) usedLength:&used encoding:NSASCIIStringEncoding options:0 range:NSMakeRange(0, [question length]) remainingRange:NULL] ||
+        used != [question length]) {
+        return nil;
+    }
+    
+    NSMutableData *field = [NSMutableData dataWithLength:suite.layout->questionLength];
+    if (!OCRAMessageSetNumericField([field mutableBytes], [field length], decimal, used)) {
+        return nil;
+    }
+    return field;
+}
 
++ (NSData *)counterWithSuite:(OCRASuite *)suite value:(uint64_t)counter {
+    if (suite.layout->counterLength == 0) {
+        return nil;
+    }
+    
+    uint8_t field[8];
+    OCRAEncodeCounter(counter, field);
+    return [NSData dataWithBytes:field length:sizeof(field)];
+}
 
-+(NSData*) hexToBytes: (NSString*) str {
-    NSMutableData* data = [NSMutableData data];
-    int idx;
-    for (idx = 0; idx+2 <= [str length]; idx+=2) {
-        NSRange range = NSMakeRange(idx, 2);
-        NSString* hexStr = [str substringWithRange:range];
-        NSScanner* scanner = [NSScanner scannerWithString:hexStr];
-        unsigned int intValue;
-        [scanner scanHexInt:&intValue];
-        [data appendBytes:&intValue length:1];
++ (NSData *)timestampWithSuite:(OCRASuite *)suite date:(NSDate *)date {
+    const OCRASuiteLayout *layout = suite.layout;
+    if (layout->timestampLength == 0) {
+        return nil;
     }
-    return data;
+    
+    uint8_t field[8];
+    OCRAEncodeTimestamp(OCRATimeStepsForTime(layout, (int64_t)floor([date timeIntervalSince1970])), field);
+    return [NSData dataWithBytes:field length:sizeof(field)];
 }
 
 + (NSString *) generateOCRAForSuite:(NSString*) ocraSuite
@@ -39,201 +112,100 @@ static const int powers10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 100000
                           timestamp:(NSString*) timeStamp
                               error:(NSError**) error {
     
-    int codeDigits = 0;
-    CCHmacAlgorithm crypto;
-    NSString *result = nil;
-    NSUInteger ocraSuiteLength = [[ocraSuite dataUsingEncoding:NSASCIIStringEncoding] length];
-    
-    int counterLength = 0;
-    int questionLength = 0;
-    int passwordLength = 0;
-    
-    int sessionInformationLength = 0;
-    int timeStampLength = 0;
-    
-    int hashLength = 0;
-    NSArray *elements = [ocraSuite componentsSeparatedByString:@":"];
-    NSString *cryptoFunction = elements[1];
-    NSString *dataInput = elements[2];
-    
-    if ([cryptoFunction rangeOfString: @"sha1" options: NSCaseInsensitiveSearch].location != NSNotFound) {
-        crypto = kCCHmacAlgSHA1;
-        hashLength = CC_SHA1_DIGEST_LENGTH;
-    }
-    if ([cryptoFunction rangeOfString: @"sha256" options: NSCaseInsensitiveSearch].location != NSNotFound) {
-        crypto = kCCHmacAlgSHA256;
-        hashLength = CC_SHA256_DIGEST_LENGTH;
-    }
-    if ([cryptoFunction rangeOfString: @"sha512" options: NSCaseInsensitiveSearch].location != NSNotFound) {
-        crypto = kCCHmacAlgSHA512;
-        hashLength = CC_SHA512_DIGEST_LENGTH;
-    }
-    
-    // How many digits should we return
-    codeDigits = [[cryptoFunction substringFromIndex:[cryptoFunction rangeOfString:@"-" options:NSBackwardsSearch].location+1] intValue];
-    
-    // The number of digits can't be larger than 10, because we'll use it as an index for the powers10 const array later on
-    if (codeDigits > 10) {
-        NSString *errorTitle = NSLocalizedString(@"Error", @"Error title");
-        NSString *errorMessage = NSLocalizedString(@"The number of digits defined for the OTP can't be larger than 10.", @"Error message");
-        NSDictionary *details = @{NSLocalizedDescriptionKey: errorTitle, NSLocalizedFailureReasonErrorKey: errorMessage};
-        *error = [[NSError alloc] initWithDomain: @"org.example.ErrorDomain" code:OCRANumberOfDigitsTooLargeError userInfo:details];
+    OCRASuite *suite = [OCRASuite suiteWithString:ocraSuite dialect:OCRASuiteDialectV2 error:error];
+    if (suite == nil) {
         return nil;
     }
     
-    // The size of the byte array message to be encrypted
-    // Counter
-    if([dataInput rangeOfString:@"c" options:NSCaseInsensitiveSearch].location == 0) {
-        // Fix the length of the HEX string
-        while([counter length] < 16) {
-            counter = [@"0" stringByAppendingString:counter];
-        }
-        counterLength=8;
-    }
-    // Question
-    if(([dataInput rangeOfString:@"q" options:NSCaseInsensitiveSearch].location == 0) ||
-       ([dataInput rangeOfString:@"-q" options:NSCaseInsensitiveSearch].location != NSNotFound)) {
-        while([question length] < 256) {
-            question = [question stringByAppendingString:@"0"];
-        }
-        questionLength=128;
-    }
-    
-    // Password
-    if([dataInput rangeOfString:@"psha1" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([password length] < 40) {
-            password = [@"0" stringByAppendingString:password];
-        }
-        passwordLength=20;
-    }
-    
-    if([dataInput rangeOfString:@"psha256" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([password length] < 64) {
-            password = [@"0" stringByAppendingString:password];
-        }
-        passwordLength=32;
-    }
-    
-    if([dataInput rangeOfString:@"psha512" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([password length] < 128) {
-            password = [@"0" stringByAppendingString:password];
-        }
-        passwordLength=64;
-    }
-    
-    // sessionInformation
-    if([dataInput rangeOfString:@"s064" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([sessionInformation length] < 128) {
-            sessionInformation = [@"0" stringByAppendingString:sessionInformation];
-        }
-        sessionInformationLength=64;
-    } else if([dataInput rangeOfString:@"s128" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([sessionInformation length] < 256) {
-            sessionInformation = [@"0" stringByAppendingString:sessionInformation];
-        }
-        sessionInformationLength=128;
-    } else if([dataInput rangeOfString:@"s256" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([sessionInformation length] < 512) {
-            sessionInformation = [@"0" stringByAppendingString:sessionInformation];
-        }
-        sessionInformationLength=256;
-    } else if([dataInput rangeOfString:@"s512" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([sessionInformation length] < 1024) {
-            sessionInformation = [@"0" stringByAppendingString:sessionInformation];
-        }
-        sessionInformationLength=512;
-    } else if ([dataInput rangeOfString:@"s" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        // deviation from spec. Officially 's' without a length indicator is not in the reference implementation.
-        // RFC is ambigious. However we have supported this in Tiqr since day 1, so we continue to support it.
-        while([sessionInformation length] < 128) {
-            sessionInformation = [@"0" stringByAppendingString:sessionInformation];
-        }
-        sessionInformationLength=64;
-    }
-    
-    // TimeStamp
-    if([dataInput rangeOfString:@"-t" options:NSCaseInsensitiveSearch].location != NSNotFound) {
-        while([timeStamp length] < 16) {
-            timeStamp = [@"0" stringByAppendingString:timeStamp];
+    return [OCRA generateOCRAWithSuite:suite key:key counter:counter question:question password:password sessionInformation:sessionInformation timestamp:timeStamp error:error];
+}
+
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                                 key:(NSString*) key
+                             counter:(NSString*) counter
+                            question:(NSString*) question
+                            password:(NSString*) password
+                  sessionInformation:(NSString*) sessionInformation
+                           timestamp:(NSString*) timeStamp
+                               error:(NSError**) error {
+    
+    const OCRASuiteLayout *layout = suite.layout;
+    
+    // Decode every field into its final shape, the bytes are then copied into the message as is
+    uint8_t counterField[8], questionField[128], passwordField[64], sessionInformationField[512], timestampField[8];
+    OCRADecodeField(counterField, layout->counterLength, counter, OCRAFieldAlignmentRight);
+    OCRADecodeField(questionField, layout->questionLength, question, OCRAFieldAlignmentLeft);
+    OCRADecodeField(passwordField, layout->passwordLength, password, OCRAFieldAlignmentRight);
+    OCRADecodeField(sessionInformationField, layout->sessionInformationLength, sessionInformation, OCRAFieldAlignmentRight);
+    OCRADecodeField(timestampField, layout->timestampLength, timeStamp, OCRAFieldAlignmentRight);
+    
+    OCRAInput input = {
+        { counterField, layout->counterLength },
+        { questionField, layout->questionLength },
+        { passwordField, layout->passwordLength },
+        { sessionInformationField, layout->sessionInformationLength },
+        { timestampField, layout->timestampLength }
+    };
+    
+    // A trailing odd digit of the key is ignored
+    size_t keyLength = [key length] / 2;
+    uint8_t keyBuffer[OCRAMaxStackKeyLength];
+    SecureBuffer longKey SecureBufferScoped = { 0 };
+    NSMutableData *heapKey = nil;
+    uint8_t *keyBytes = keyBuffer;
+    if (keyLength > sizeof(keyBuffer)) {
+        SecureArena *arena = SecureArenaShared();
+        if (arena != NULL && SecureBufferAcquire(arena, keyLength, &longKey) == 0) {
+            keyBytes = longKey.bytes;
+        } else {
+            heapKey = [NSMutableData dataWithLength:keyLength];
+            keyBytes = [heapKey mutableBytes];
         }
-        timeStampLength=8;
     }
+    OCRADecodeField(keyBytes, keyLength, key, OCRAFieldAlignmentLeft);
     
-    // Remember to add "1" for the "00" byte delimiter
-    NSUInteger bufferSize = ocraSuiteLength +
-    counterLength +
-    questionLength +
-    passwordLength +
-    sessionInformationLength +
-    timeStampLength +
-    1;
-    uint8_t msg[bufferSize];
-    
-    
-    // Put the bytes of "ocraSuite" parameters into the message
-    NSData* bArray = [ocraSuite dataUsingEncoding:NSASCIIStringEncoding];
-    memcpy(msg, [bArray bytes], MIN(ocraSuiteLength, [bArray length]));
-    
-    // Delimiter
-    NSUInteger delimiterPosition = [bArray length];
-    msg[delimiterPosition] = 0x00;
-    
-    // Put the bytes of "Counter" to the message
-    // Input is HEX encoded
-    if(counterLength > 0 ) {
-        bArray = [OCRA hexToBytes:counter];
-        memcpy(msg + ocraSuiteLength + 1 , [bArray bytes], MIN(counterLength, [bArray length]));
-    }
-    
-    // Put the bytes of "question" to the message
-    // Input is text encoded
-    if(questionLength > 0 ) {
-        bArray = [OCRA hexToBytes:question];
-        memcpy(msg + ocraSuiteLength + 1 + counterLength, [bArray bytes], MIN(questionLength, [bArray length]));
-    }
-    
-    // Put the bytes of "password" to the message
-    // Input is HEX encoded
-    if(passwordLength > 0) {
-        bArray = [OCRA hexToBytes:password];
-        memcpy(msg + ocraSuiteLength + 1 + counterLength + questionLength, [bArray bytes], MIN(passwordLength, [bArray length]));
-    }
-    
-    // Put the bytes of "sessionInformation" to the message
-    // Input is text encoded
-    if(sessionInformationLength > 0 ) {
-        bArray = [OCRA hexToBytes:sessionInformation];
-        memcpy(msg + ocraSuiteLength + 1 + counterLength + questionLength + passwordLength, [bArray bytes], MIN(sessionInformationLength, [bArray length]));
-    }
-    
-    // Put the bytes of "time" to the message
-    // Input is text value of minutes
-    if(timeStampLength > 0) {
-        bArray = [OCRA hexToBytes: timeStamp];
-        memcpy(msg + ocraSuiteLength + 1 + counterLength + questionLength + passwordLength + sessionInformationLength, [bArray bytes], MIN(timeStampLength, [bArray length]));
-    }
-    
-    uint8_t hash[hashLength];
-    
-    bArray = [OCRA hexToBytes: key];
-    
-    CCHmac(crypto, [bArray bytes], [bArray length], msg, sizeof(msg), hash);
-    
-    /* Extract selected bytes to get 32 bit integer value */
-    int offset = hash[hashLength - 1] & 0x0f;
-    
-    int binary = ((hash[offset] & 0x7f) << 24)
-    | ((hash[offset + 1] & 0xff) << 16)
-    | ((hash[offset + 2] & 0xff) << 8)
-    | (hash[offset + 3] & 0xff);
-    
-    /* Generate decimal digits */
-    int decimalResult = (binary % powers10[codeDigits]);
-    result = [NSString stringWithFormat:@"%d", decimalResult];
-    
-    while ([result length] < codeDigits) {
-        result = [@"0" stringByAppendingString: result];
-    }
+    NSString *result = OCRAGenerate(layout, keyBytes, keyLength, &input);
+    HMACSecureZero(keyBytes, keyLength);
+    HMACSecureZero(passwordField, sizeof(passwordField));
     return result;
 }
+
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                              secret:(NSData*) secret
+                             counter:(NSData*) counter
+                            question:(NSData*) question
+                            password:(NSData*) password
+                  sessionInformation:(NSData*) sessionInformation
+                           timestamp:(NSData*) timeStamp
+                               error:(NSError**) error {
+    
+    OCRAInput input = {
+        OCRABytesFromData(counter),
+        OCRABytesFromData(question),
+        OCRABytesFromData(password),
+        OCRABytesFromData(sessionInformation),
+        OCRABytesFromData(timeStamp)
+    };
+    
+    return OCRAGenerate(suite.layout, [secret bytes], [secret length], &input);
+}
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                             hmacKey:(const HMACKey*) hmacKey
+                             counter:(NSData*) counter
+                            question:(NSData*) question
+                            password:(NSData*) password
+                  sessionInformation:(NSData*) sessionInformation
+                           timestamp:(NSData*) timeStamp
+                               error:(NSError**) error {
+    
+    OCRAInput input = {
+        OCRABytesFromData(counter),
+        OCRABytesFromData(question),
+        OCRABytesFromData(password),
+        OCRABytesFromData(sessionInformation),
+        OCRABytesFromData(timeStamp)
+    };
+    
+    return OCRAFormat(suite.layout, OCRAComputeCode(suite.layout, hmacKey, &input));
+}
 @end
@@ -0,0 +1,520 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OCRAMessage.h"
+#include "HMACBatch.h"
+#include "HexCodec.h"
+
+#include <string.h>
+
+static const uint32_t powers10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000, 1000000000 };
+
+/* Nibble value for every ASCII character, anything that isn't a hex digit decodes as 0 */
+static const uint8_t nibbles[256] = {
+    ['0'] = 0x0, ['1'] = 0x1, ['2'] = 0x2, ['3'] = 0x3, ['4'] = 0x4,
+    ['5'] = 0x5, ['6'] = 0x6, ['7'] = 0x7, ['8'] = 0x8, ['9'] = 0x9,
+    ['a'] = 0xa, ['b'] = 0xb, ['c'] = 0xc, ['d'] = 0xd, ['e'] = 0xe, ['f'] = 0xf,
+    ['A'] = 0xa, ['B'] = 0xb, ['C'] = 0xc, ['D'] = 0xd, ['E'] = 0xe, ['F'] = 0xf
+};
+
+/* The bodies below are shared by the generic functions and the constant folded specializations */
+#if defined(__GNUC__)
+#define OCRA_INLINE static inline __attribute__((always_inline))
+#else
+#define OCRA_INLINE static inline
+#endif
+
+OCRA_INLINE void OCRAMessagePrepareInline(const OCRASuiteLayout *layout, uint8_t *message) {
+    memcpy(message, layout->suite, layout->suiteLength + 1);
+    memset(message + layout->counterOffset, 0, layout->messageLength - layout->counterOffset);
+}
+
+OCRA_INLINE void OCRAMessageSetFieldInline(uint8_t *field, size_t fieldLength, const uint8_t *bytes, size_t length, OCRAFieldAlignment alignment) {
+    size_t count = length < fieldLength ? length : fieldLength;
+    size_t position = alignment == OCRAFieldAlignmentRight ? fieldLength - count : 0;
+
+    memset(field, 0, fieldLength);
+    if (count > 0) {
+        memcpy(field + position, bytes, count);
+    }
+}
+
+OCRA_INLINE void OCRAMessageAssembleInline(const OCRASuiteLayout *layout, const OCRAInput *input, uint8_t *message) {
+    // The fields are zeroed by OCRAMessageSetField, only the suite needs copying
+    memcpy(message, layout->suite, layout->suiteLength + 1);
+
+    // Counter, password, session information and timestamp are right aligned, the question is left aligned
+    if (layout->counterLength > 0) {
+        OCRAMessageSetFieldInline(message + layout->counterOffset, layout->counterLength, input->counter.bytes, input->counter.length, OCRAFieldAlignmentRight);
+    }
+    if (layout->questionLength > 0) {
+        OCRAMessageSetFieldInline(message + layout->questionOffset, layout->questionLength, input->question.bytes, input->question.length, OCRAFieldAlignmentLeft);
+    }
+    if (layout->passwordLength > 0) {
+        OCRAMessageSetFieldInline(message + layout->passwordOffset, layout->passwordLength, input->password.bytes, input->password.length, OCRAFieldAlignmentRight);
+    }
+    if (layout->sessionInformationLength > 0) {
+        OCRAMessageSetFieldInline(message + layout->sessionInformationOffset, layout->sessionInformationLength, input->sessionInformation.bytes, input->sessionInformation.length, OCRAFieldAlignmentRight);
+    }
+    if (layout->timestampLength > 0) {
+        OCRAMessageSetFieldInline(message + layout->timestampOffset, layout->timestampLength, input->timestamp.bytes, input->timestamp.length, OCRAFieldAlignmentRight);
+    }
+}
+
+OCRA_INLINE uint32_t OCRAComputeCodeInline(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input) {
+    uint8_t message[OCRASuiteMaxMessageLength];
+    uint8_t hash[OCRAMaxHashLength] = { 0 };
+
+    OCRAMessageAssembleInline(layout, input, message);
+    HMACKeyCompute(key, message, layout->messageLength, hash);
+    uint32_t code = OCRATruncate(hash, layout->hashLength, layout->digits);
+
+    HMACSecureZero(message, layout->messageLength);
+    HMACSecureZero(hash, sizeof(hash));
+    return code;
+}
+
+void OCRAMessagePrepare(const OCRASuiteLayout *layout, uint8_t *message) {
+    OCRAMessagePrepareInline(layout, message);
+}
+
+void OCRAMessageSetHexField(uint8_t *field, size_t fieldLength, const char *hex, size_t hexLength, OCRAFieldAlignment alignment) {
+    size_t fieldNibbles = fieldLength * 2;
+    size_t count = hexLength < fieldNibbles ? hexLength : fieldNibbles;
+
+    // A right aligned value starts count nibbles before the end of the field
+    size_t position = alignment == OCRAFieldAlignmentRight ? fieldNibbles - count : 0;
+
+    memset(field, 0, fieldLength);
+
+    const uint8_t *digits = (const uint8_t *)hex;
+    size_t i = 0;
+
+    // Odd start, fill the low nibble of the first byte
+    if ((position & 1) && i < count) {
+        field[position >> 1] |= nibbles[digits[i++]];
+        position++;
+    }
+
+    // Whole bytes, well formed input takes the vectorized decoder
+    size_t whole = (count - i) & ~(size_t)1;
+    if (whole > 0 && HexDecode(hex + i, whole, field + (position >> 1))) {
+        i += whole;
+        position += whole;
+    }
+    for (; i + 1 < count; i += 2, position += 2) {
+        field[position >> 1] = (uint8_t)(nibbles[digits[i]] << 4 | nibbles[digits[i + 1]]);
+    }
+
+    // Odd end, fill the high nibble of the last byte
+    if (i < count) {
+        field[position >> 1] = (uint8_t)(nibbles[digits[i]] << 4);
+    }
+}
+
+/* 10^64 < 2^213, so eight 32 bit limbs hold any numeric question */
+#define OCRANumericLimbs 8
+
+/* Digits per step, 10^9 is the largest power of ten that fits a limb */
+#define OCRANumericChunkDigits 9
+
+size_t OCRANumericQuestionToHex(const char *decimal, size_t length, char *hex) {
+    static const char hexDigits[] = "0123456789ABCDEF";
+
+    if (length == 0 || length > OCRAMaxNumericQuestionDigits) {
+        hex[0] = '\0';
+        return 0;
+    }
+
+    // Little endian limbs, only the first used limbs can be non zero
+    uint32_t limbs[OCRANumericLimbs] = { 0 };
+    size_t used = 0;
+
+    // The first chunk takes the odd digits so all following chunks are whole
+    size_t chunk = length % OCRANumericChunkDigits;
+    if (chunk == 0) {
+        chunk = OCRANumericChunkDigits;
+    }
+
+    for (size_t i = 0; i < length; i += chunk, chunk = OCRANumericChunkDigits) {
+        uint32_t value = 0;
+        for (size_t j = i; j < i + chunk; j++) {
+            uint32_t digit = (uint32_t)(uint8_t)decimal[j] - '0';
+            if (digit > 9) {
+                hex[0] = '\0';
+                return 0;
+            }
+            value = value * 10 + digit;
+        }
+
+        // limbs = limbs * 10^chunk + value
+        uint64_t carry = value;
+        for (size_t k = 0; k < used; k++) {
+            uint64_t product = (uint64_t)limbs[k] * powers10[chunk] + carry;
+            limbs[k] = (uint32_t)product;
+            carry = product >> 32;
+        }
+        if (carry != 0) {
+            limbs[used++] = (uint32_t)carry;
+        }
+    }
+
+    size_t count = 0;
+    for (size_t k = used; k-- > 0;) {
+        for (int shift = 28; shift >= 0; shift -= 4) {
+            uint32_t nibble = (limbs[k] >> shift) & 0x0f;
+            // Skip the leading zeros of the most significant limb
+            if (count > 0 || nibble != 0) {
+                hex[count++] = hexDigits[nibble];
+            }
+        }
+    }
+    if (count == 0) {
+        hex[count++] = '0';
+    }
+    hex[count] = '\0';
+
+    return count;
+}
+
+bool OCRAMessageSetNumericField(uint8_t *field, size_t fieldLength, const char *decimal, size_t length) {
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    size_t hexLength = OCRANumericQuestionToHex(decimal, length, hex);
+    OCRAMessageSetHexField(field, fieldLength, hex, hexLength, OCRAFieldAlignmentLeft);
+    return hexLength > 0;
+}
+
+size_t OCRAMessageSetNumericFields(uint8_t *fields, size_t fieldLength, const OCRABytes *decimals, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!OCRAMessageSetNumericField(fields + i * fieldLength, fieldLength, (const char *)decimals[i].bytes, decimals[i].length)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+void OCRAMessageSetField(uint8_t *field, size_t fieldLength, const uint8_t *bytes, size_t length, OCRAFieldAlignment alignment) {
+    OCRAMessageSetFieldInline(field, fieldLength, bytes, length, alignment);
+}
+
+void OCRAMessageAssemble(const OCRASuiteLayout *layout, const OCRAInput *input, uint8_t *message) {
+    OCRAMessageAssembleInline(layout, input, message);
+}
+
+bool OCRAHMACAlgorithm(OCRAHashAlgorithm algorithm, HMACAlgorithm *hmacAlgorithm) {
+    switch (algorithm) {
+        case OCRAHashAlgorithmSHA1:
+            *hmacAlgorithm = HMACAlgorithmSHA1;
+            return true;
+        case OCRAHashAlgorithmSHA256:
+            *hmacAlgorithm = HMACAlgorithmSHA256;
+            return true;
+        case OCRAHashAlgorithmSHA512:
+            *hmacAlgorithm = HMACAlgorithmSHA512;
+            return true;
+        case OCRAHashAlgorithmMD5:
+            *hmacAlgorithm = HMACAlgorithmMD5;
+            return true;
+    }
+    return false;
+}
+
+uint32_t OCRAComputeCode(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input) {
+    if (layout->compute != NULL) {
+        return layout->compute(key, input);
+    }
+    return OCRAComputeCodeInline(layout, key, input);
+}
+
+/* A layout known at compile time, the suite string decides all offsets */
+#define OCRA_CONSTANT_LAYOUT(string, hashAlgorithm, hashBytes, codeDigits, numeric, c, q, p, s) { \
+    .algorithm = hashAlgorithm, \
+    .hashLength = hashBytes, \
+    .digits = codeDigits, \
+    .numericQuestion = numeric, \
+    .suiteLength = sizeof(string) - 1, \
+    .counterOffset = sizeof(string), \
+    .counterLength = c, \
+    .questionOffset = sizeof(string) + c, \
+    .questionLength = q, \
+    .passwordOffset = sizeof(string) + c + q, \
+    .passwordLength = p, \
+    .sessionInformationOffset = sizeof(string) + c + q + p, \
+    .sessionInformationLength = s, \
+    .timestampOffset = sizeof(string) + c + q + p + s, \
+    .timestampLength = 0, \
+    .messageLength = sizeof(string) + c + q + p + s, \
+    .timeStep = 0, \
+    .compute = NULL, \
+    .suite = string \
+}
+
+#define OCRA_SPECIALIZATION(name, string, hashAlgorithm, hashBytes, codeDigits, numeric, c, q, p, s) \
+    static const OCRASuiteLayout OCRALayout##name = OCRA_CONSTANT_LAYOUT(string, hashAlgorithm, hashBytes, codeDigits, numeric, c, q, p, s); \
+    static uint32_t OCRACompute##name(const HMACKey *key, const OCRAInput *input) { \
+        return OCRAComputeCodeInline(&OCRALayout##name, key, input); \
+    }
+
+/* The suites tiqr servers use by default and the RFC 6287 example */
+OCRA_SPECIALIZATION(SHA1QH10S, "OCRA-1:HOTP-SHA1-6:QH10-S", OCRAHashAlgorithmSHA1, 20, 6, false, 0, 128, 0, 64)
+OCRA_SPECIALIZATION(SHA1QN10S, "OCRA-1:HOTP-SHA1-6:QN10-S", OCRAHashAlgorithmSHA1, 20, 6, true, 0, 128, 0, 64)
+OCRA_SPECIALIZATION(SHA1QN08, "OCRA-1:HOTP-SHA1-6:QN08", OCRAHashAlgorithmSHA1, 20, 6, true, 0, 128, 0, 0)
+
+static const struct {
+    const OCRASuiteLayout *layout;
+    OCRAComputeFunction compute;
+} OCRASpecializations[] = {
+    { &OCRALayoutSHA1QH10S, OCRAComputeSHA1QH10S },
+    { &OCRALayoutSHA1QN10S, OCRAComputeSHA1QN10S },
+    { &OCRALayoutSHA1QN08, OCRAComputeSHA1QN08 }
+};
+
+static bool OCRALayoutsEqual(const OCRASuiteLayout *a, const OCRASuiteLayout *b) {
+    return a->algorithm == b->algorithm && a->hashLength == b->hashLength && a->digits == b->digits
+        && a->numericQuestion == b->numericQuestion && a->suiteLength == b->suiteLength
+        && a->counterOffset == b->counterOffset && a->counterLength == b->counterLength
+        && a->questionOffset == b->questionOffset && a->questionLength == b->questionLength
+        && a->passwordOffset == b->passwordOffset && a->passwordLength == b->passwordLength
+        && a->sessionInformationOffset == b->sessionInformationOffset && a->sessionInformationLength == b->sessionInformationLength
+        && a->timestampOffset == b->timestampOffset && a->timestampLength == b->timestampLength
+        && a->messageLength == b->messageLength && a->timeStep == b->timeStep
+        && memcmp(a->suite, b->suite, a->suiteLength + 1) == 0;
+}
+
+void OCRASpecialize(OCRASuiteLayout *layout) {
+    layout->compute = NULL;
+    for (size_t i = 0; i < sizeof(OCRASpecializations) / sizeof(OCRASpecializations[0]); i++) {
+        if (OCRALayoutsEqual(layout, OCRASpecializations[i].layout)) {
+            layout->compute = OCRASpecializations[i].compute;
+            return;
+        }
+    }
+}
+
+/* Messages assembled per HMACBatchCompute call, matches the widest kernel */
+#define OCRABatchChunk 16
+
+void OCRAComputeBatch(const OCRASuiteLayout *layout, const HMACKey *const *keys, const OCRAInput *inputs, size_t count, uint32_t *codes) {
+    uint8_t messages[OCRABatchChunk][OCRASuiteMaxMessageLength];
+    const uint8_t *messagePointers[OCRABatchChunk];
+    uint8_t macs[OCRABatchChunk * OCRAMaxHashLength];
+    uint8_t hash[OCRAMaxHashLength] = { 0 };
+
+    for (size_t start = 0; start < count; start += OCRABatchChunk) {
+        size_t chunk = count - start < OCRABatchChunk ? count - start : OCRABatchChunk;
+
+        for (size_t i = 0; i < chunk; i++) {
+            OCRAMessageAssemble(layout, &inputs[start + i], messages[i]);
+            messagePointers[i] = messages[i];
+        }
+
+        HMACBatchCompute(keys + start, messagePointers, layout->messageLength, chunk, macs);
+
+        // OCRATruncate expects a zero filled buffer of OCRAMaxHashLength bytes
+        for (size_t i = 0; i < chunk; i++) {
+            memcpy(hash, macs + i * layout->hashLength, layout->hashLength);
+            codes[start + i] = OCRATruncate(hash, layout->hashLength, layout->digits);
+        }
+    }
+
+    HMACSecureZero(messages, sizeof(messages));
+    HMACSecureZero(macs, sizeof(macs));
+    HMACSecureZero(hash, sizeof(hash));
+}
+
+uint64_t OCRATimeStepsForTime(const OCRASuiteLayout *layout, int64_t unixTime) {
+    if (unixTime <= 0 || layout->timeStep == 0) {
+        return 0;
+    }
+    return (uint64_t)unixTime / layout->timeStep;
+}
+
+void OCRAEncodeTimestamp(uint64_t steps, uint8_t *field) {
+    OCRAEncodeCounter(steps, field);
+}
+
+void OCRAEncodeCounter(uint64_t counter, uint8_t *field) {
+    for (int i = 7; i >= 0; i--) {
+        field[i] = (uint8_t)(counter & 0xff);
+        counter >>= 8;
+    }
+}
+
+void OCRAAdvanceCounter(uint8_t *field, uint64_t amount) {
+    unsigned carry = 0;
+    for (int i = 7; i >= 0 && (amount != 0 || carry != 0); i--) {
+        unsigned sum = field[i] + (unsigned)(amount & 0xff) + carry;
+        field[i] = (uint8_t)sum;
+        carry = sum >> 8;
+        amount >>= 8;
+    }
+}
+
+bool OCRAVerifyTimeWindow(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t currentSteps, uint32_t window, uint32_t code, int64_t *drift) {
+    if (layout->timestampLength != 8) {
+        return false;
+    }
+
+    uint8_t message[OCRASuiteMaxMessageLength];
+    uint8_t hash[OCRAMaxHashLength] = { 0 };
+    HMACKey prefixed;
+    bool found = false;
+
+    // The timestamp is the last field, everything in front of its block is the same for every step
+    OCRAMessageAssemble(layout, input, message);
+    size_t absorbed = HMACKeyAbsorb(key, message, layout->timestampOffset, &prefixed);
+    uint8_t *timestamp = message + layout->timestampOffset;
+
+    for (uint64_t i = 0; i <= 2 * (uint64_t)window; i++) {
+        // 0, -1, +1, -2, +2, ...
+        int64_t offset = (int64_t)((i + 1) / 2);
+        if (i % 2 == 1) {
+            offset = -offset;
+        }
+        if (offset < 0 && (uint64_t)-offset > currentSteps) {
+            continue;
+        }
+
+        OCRAEncodeTimestamp(currentSteps + (uint64_t)offset, timestamp);
+        HMACKeyCompute(&prefixed, message + absorbed, layout->messageLength - absorbed, hash);
+        if (OCRATruncate(hash, layout->hashLength, layout->digits) == code) {
+            if (drift != NULL) {
+                *drift = offset;
+            }
+            found = true;
+            break;
+        }
+    }
+
+    HMACKeyWipe(&prefixed);
+    HMACSecureZero(message, layout->messageLength);
+    HMACSecureZero(hash, sizeof(hash));
+    return found;
+}
+
+uint32_t OCRATruncate(const uint8_t *hash, size_t hashLength, int digits) {
+    // The offset can point up to 3 bytes beyond a 16 byte (MD5) digest, callers
+    // always pass a zero filled buffer of OCRAMaxHashLength bytes.
+    size_t offset = hash[hashLength - 1] & 0x0f;
+
+    uint32_t binary = ((uint32_t)(hash[offset] & 0x7f) << 24)
+    | ((uint32_t)(hash[offset + 1] & 0xff) << 16)
+    | ((uint32_t)(hash[offset + 2] & 0xff) << 8)
+    | (uint32_t)(hash[offset + 3] & 0xff);
+
+    return binary % powers10[digits];
+}
+
+void OCRAFormatCode(uint32_t code, int digits, char *output) {
+    char reversed[11];
+    int length = 0;
+
+    do {
+        reversed[length++] = (char)('0' + code % 10);
+        code /= 10;
+    } while (code > 0);
+
+    while (length < digits) {
+        reversed[length++] = '0';
+    }
+
+    for (int i = 0; i < length; i++) {
+        output[i] = reversed[length - 1 - i];
+    }
+    output[length] = '\0';
+}
+
+bool OCRAVerifyCounterWindow(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t counter, uint32_t window, uint32_t code, uint64_t *matchedCounter) {
+    if (layout->counterLength != 8) {
+        return false;
+    }
+
+    // Don't wrap around at 2^64
+    uint64_t count = (uint64_t)window + 1;
+    if (count > UINT64_MAX - counter + 1 && counter != 0) {
+        count = UINT64_MAX - counter + 1;
+    }
+
+    uint8_t messages[OCRABatchChunk][OCRASuiteMaxMessageLength];
+    const uint8_t *messagePointers[OCRABatchChunk];
+    const HMACKey *keyPointers[OCRABatchChunk];
+    uint8_t macs[OCRABatchChunk * OCRAMaxHashLength];
+    uint8_t hash[OCRAMaxHashLength] = { 0 };
+    HMACKey prefixed;
+    bool found = false;
+
+    // Only the counter changes, everything in front of its block is hashed once. Each
+    // lane gets its own copy of the remainder, lane i starts at counter + i.
+    OCRAMessageAssemble(layout, input, messages[0]);
+    size_t absorbed = HMACKeyAbsorb(key, messages[0], layout->counterOffset, &prefixed);
+    size_t remaining = layout->messageLength - absorbed;
+    size_t counterOffset = layout->counterOffset - absorbed;
+    size_t lanes = count < OCRABatchChunk ? (size_t)count : OCRABatchChunk;
+
+    memmove(messages[0], messages[0] + absorbed, remaining);
+    OCRAEncodeCounter(counter, messages[0] + counterOffset);
+    for (size_t i = 0; i < lanes; i++) {
+        if (i > 0) {
+            memcpy(messages[i], messages[0], remaining);
+            OCRAAdvanceCounter(messages[i] + counterOffset, i);
+        }
+        messagePointers[i] = messages[i];
+        keyPointers[i] = &prefixed;
+    }
+
+    for (uint64_t start = 0; start < count && !found; start += OCRABatchChunk) {
+        size_t chunk = count - start < lanes ? (size_t)(count - start) : lanes;
+        if (start > 0) {
+            for (size_t i = 0; i < chunk; i++) {
+                OCRAAdvanceCounter(messages[i] + counterOffset, OCRABatchChunk);
+            }
+        }
+
+        HMACBatchCompute(keyPointers, messagePointers, remaining, chunk, macs);
+
+        for (size_t i = 0; i < chunk; i++) {
+            memcpy(hash, macs + i * layout->hashLength, layout->hashLength);
+            if (OCRATruncate(hash, layout->hashLength, layout->digits) == code) {
+                if (matchedCounter != NULL) {
+                    *matchedCounter = counter + start + i;
+                }
+                found = true;
+                break;
+            }
+        }
+    }
+
+    HMACKeyWipe(&prefixed);
+    for (size_t i = 0; i < lanes; i++) {
+        HMACSecureZero(messages[i], i == 0 ? layout->messageLength : remaining);
+    }
+    HMACSecureZero(macs, lanes * layout->hashLength);
+    HMACSecureZero(hash, sizeof(hash));
+    return found;
+}
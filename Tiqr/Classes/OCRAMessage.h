@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OCRAMessage_h
+#define OCRAMessage_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "HMACKey.h"
+
+/*
+ * Plain C core for assembling OCRA messages.
+ *
+ * The layout of a message is computed once per suite (see OCRASuite), after
+ * which the data input fields are decoded straight into a fixed size buffer.
+ * None of the functions below allocate memory.
+ */
+
+typedef enum {
+    OCRAHashAlgorithmSHA1,
+    OCRAHashAlgorithmSHA256,
+    OCRAHashAlgorithmSHA512,
+    OCRAHashAlgorithmMD5
+} OCRAHashAlgorithm;
+
+/**
+ * Maximum length of the suite string itself, keeps the message buffer bounded.
+ */
+#define OCRASuiteMaxLength 128
+
+/**
+ * Upper bound of the message size for any suite we accept
+ * (suite, delimiter, C, Q, PSHA512, S512 and T).
+ */
+#define OCRASuiteMaxMessageLength (OCRASuiteMaxLength + 1 + 8 + 128 + 64 + 512 + 8)
+
+/**
+ * Largest digest any of the supported algorithms produces (SHA-512).
+ */
+#define OCRAMaxHashLength 64
+
+struct OCRAInput;
+
+/**
+ * Computes the code for one particular suite, see OCRASuiteLayout compute.
+ */
+typedef uint32_t (*OCRAComputeFunction)(const HMACKey *key, const struct OCRAInput *input);
+
+/**
+ * Byte layout of the OCRA message for a compiled suite. The message starts
+ * with the suite string and its 0x00 delimiter, followed by the data input
+ * fields. Fields that are not part of the suite have a length of 0.
+ */
+typedef struct {
+    OCRAHashAlgorithm algorithm;
+    size_t hashLength;
+    int digits;
+    bool numericQuestion;
+
+    size_t suiteLength;
+    size_t counterOffset;
+    size_t counterLength;
+    size_t questionOffset;
+    size_t questionLength;
+    size_t passwordOffset;
+    size_t passwordLength;
+    size_t sessionInformationOffset;
+    size_t sessionInformationLength;
+    size_t timestampOffset;
+    size_t timestampLength;
+    size_t messageLength;
+
+    /* Seconds per time step, 0 when the suite has no timestamp */
+    uint32_t timeStep;
+
+    /* OCRAComputeCode with this layout folded in as constants, only set for
+       the common suites OCRASpecialize knows, NULL otherwise */
+    OCRAComputeFunction compute;
+
+    uint8_t suite[OCRASuiteMaxLength + 1];
+} OCRASuiteLayout;
+
+/**
+ * How a value that is shorter than its field is positioned. The question is
+ * left aligned (padded with trailing zeros), all other fields are right
+ * aligned (padded with leading zeros).
+ */
+typedef enum {
+    OCRAFieldAlignmentLeft,
+    OCRAFieldAlignmentRight
+} OCRAFieldAlignment;
+
+/**
+ * A borrowed span of bytes.
+ */
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+} OCRABytes;
+
+/**
+ * Already decoded data inputs. Fields the suite doesn't use are ignored,
+ * missing fields are left zero.
+ */
+typedef struct OCRAInput {
+    OCRABytes counter;
+    OCRABytes question;
+    OCRABytes password;
+    OCRABytes sessionInformation;
+    OCRABytes timestamp;
+} OCRAInput;
+
+/**
+ * Copies the suite and delimiter into the message and zeroes all fields.
+ *
+ * @param layout   compiled suite
+ * @param message  buffer of at least layout->messageLength bytes
+ */
+void OCRAMessagePrepare(const OCRASuiteLayout *layout, uint8_t *message);
+
+/**
+ * Decodes a hex string into a message field.
+ *
+ * Values longer than the field are truncated to the first 2 * fieldLength
+ * digits. Characters that aren't hex digits are decoded as 0.
+ *
+ * @param field        start of the field in the message
+ * @param fieldLength  length of the field in bytes
+ * @param hex          hex digits, doesn't need to be NUL terminated
+ * @param hexLength    number of hex digits
+ * @param alignment    position of a short value within the field
+ */
+void OCRAMessageSetHexField(uint8_t *field, size_t fieldLength, const char *hex, size_t hexLength, OCRAFieldAlignment alignment);
+
+/**
+ * Longest numeric (QN) question accepted, the RFC allows QN04 up to QN64.
+ */
+#define OCRAMaxNumericQuestionDigits 64
+
+/**
+ * Hex digits needed for the largest numeric question (10^64 - 1 < 16^54).
+ */
+#define OCRAMaxNumericQuestionHexLength 54
+
+/**
+ * Converts a numeric (QN) question into the hex digits of its value, upper
+ * case and without leading zeros ("0" for zero), like %X does for numbers
+ * that fit a machine word.
+ *
+ * Runs in time linear in the number of digits and doesn't allocate memory.
+ *
+ * @param decimal  decimal digits, doesn't need to be NUL terminated
+ * @param length   number of digits, 1 to OCRAMaxNumericQuestionDigits
+ * @param hex      output, at least OCRAMaxNumericQuestionHexLength + 1 bytes, NUL terminated
+ *
+ * @return number of hex digits written, 0 if the question isn't a decimal
+ *         number of acceptable length
+ */
+size_t OCRANumericQuestionToHex(const char *decimal, size_t length, char *hex);
+
+/**
+ * Converts a numeric (QN) question and places it in a (left aligned)
+ * question field, the same as OCRAMessageSetHexField with the result of
+ * OCRANumericQuestionToHex.
+ *
+ * @param field        start of the question field
+ * @param fieldLength  length of the field in bytes
+ * @param decimal      decimal digits, doesn't need to be NUL terminated
+ * @param length       number of digits
+ *
+ * @return false if the question isn't a decimal number of acceptable
+ *         length, the field is zeroed in that case
+ */
+bool OCRAMessageSetNumericField(uint8_t *field, size_t fieldLength, const char *decimal, size_t length);
+
+/**
+ * Batch version of OCRAMessageSetNumericField for verifiers that prepare
+ * many questions at once (see OCRAComputeBatch). Field i starts at
+ * fields + i * fieldLength.
+ *
+ * @param fields       count consecutive fields of fieldLength bytes
+ * @param fieldLength  length of one field in bytes
+ * @param decimals     the questions
+ * @param count        number of questions
+ *
+ * @return number of questions converted, less than count if question
+ *         (return value) is invalid
+ */
+size_t OCRAMessageSetNumericFields(uint8_t *fields, size_t fieldLength, const OCRABytes *decimals, size_t count);
+
+/**
+ * Copies bytes into a message field.
+ *
+ * Values longer than the field are truncated to the first fieldLength bytes.
+ *
+ * @param field        start of the field in the message
+ * @param fieldLength  length of the field in bytes
+ * @param bytes        value
+ * @param length       length of the value in bytes
+ * @param alignment    position of a short value within the field
+ */
+void OCRAMessageSetField(uint8_t *field, size_t fieldLength, const uint8_t *bytes, size_t length, OCRAFieldAlignment alignment);
+
+/**
+ * Assembles the complete message for the given input.
+ *
+ * @param layout   compiled suite
+ * @param input    decoded data inputs
+ * @param message  buffer of at least layout->messageLength bytes
+ */
+void OCRAMessageAssemble(const OCRASuiteLayout *layout, const OCRAInput *input, uint8_t *message);
+
+/**
+ * Maps the suite's hash algorithm onto an HMAC key schedule algorithm.
+ *
+ * @return false for an unknown algorithm
+ */
+bool OCRAHMACAlgorithm(OCRAHashAlgorithm algorithm, HMACAlgorithm *hmacAlgorithm);
+
+/**
+ * Assembles the message and computes the truncated code with a precomputed
+ * key schedule. Verifiers that try many inputs under one key should set up
+ * the key once and call this in their loop.
+ *
+ * @param layout  compiled suite
+ * @param key     key schedule for the suite's algorithm
+ * @param input   decoded data inputs
+ *
+ * @return code modulo 10^digits
+ */
+uint32_t OCRAComputeCode(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input);
+
+/**
+ * Batch version of OCRAComputeCode for verifiers that check many responses
+ * at once, codes[i] is computed with keys[i] and inputs[i]. The messages are
+ * hashed with the multi-buffer kernels of HMACBatch.
+ *
+ * @param layout  compiled suite, all messages share its layout
+ * @param keys    key schedules for the suite's algorithm
+ * @param inputs  decoded data inputs
+ * @param count   number of responses
+ * @param codes   output, count codes modulo 10^digits
+ */
+void OCRAComputeBatch(const OCRASuiteLayout *layout, const HMACKey *const *keys, const OCRAInput *inputs, size_t count, uint32_t *codes);
+
+/**
+ * Number of time steps since the Unix epoch for a time-based suite.
+ *
+ * @param layout    compiled suite with a timestamp
+ * @param unixTime  seconds since 1970-01-01T00:00:00Z, earlier times count as 0
+ */
+uint64_t OCRATimeStepsForTime(const OCRASuiteLayout *layout, int64_t unixTime);
+
+/**
+ * Encodes a number of time steps as the 8 byte big endian timestamp field.
+ */
+void OCRAEncodeTimestamp(uint64_t steps, uint8_t *field);
+
+/**
+ * Encodes a counter as the 8 byte big endian counter field (also the HOTP
+ * message).
+ */
+void OCRAEncodeCounter(uint64_t counter, uint8_t *field);
+
+/**
+ * Adds amount to an 8 byte big endian counter field in place, wrapping
+ * around at 2^64.
+ */
+void OCRAAdvanceCounter(uint8_t *field, uint64_t amount);
+
+/**
+ * Searches a window of time steps around currentSteps for a response.
+ *
+ * Steps are tried in order of distance (0, -1, +1, -2, +2, ...) and the
+ * search stops at the first match. The message is assembled once, the
+ * blocks in front of the timestamp are hashed once and only the timestamp
+ * is updated per step.
+ *
+ * @param layout        compiled suite with a timestamp
+ * @param key           key schedule for the suite's algorithm
+ * @param input         decoded data inputs, the timestamp is ignored
+ * @param currentSteps  time steps of the verifier's clock
+ * @param window        number of steps to accept on either side
+ * @param code          response to verify
+ * @param drift         set to the matching step minus currentSteps, may be NULL
+ *
+ * @return whether a step within the window produces the code
+ */
+bool OCRAVerifyTimeWindow(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t currentSteps, uint32_t window, uint32_t code, int64_t *drift);
+
+/**
+ * Searches the counters counter ... counter + window for a response, for
+ * resynchronising a client whose counter ran ahead of the verifier's.
+ *
+ * The message is assembled once and the blocks in front of the counter are
+ * hashed once. Candidates are computed 16 at a time through
+ * HMACBatchCompute, each with its counter field advanced in place. The
+ * lowest matching counter wins.
+ *
+ * @param layout          compiled suite with a counter
+ * @param key             key schedule for the suite's algorithm
+ * @param input           decoded data inputs, the counter is ignored
+ * @param counter         next counter the verifier expects
+ * @param window          number of counters to look ahead
+ * @param code            response to verify
+ * @param matchedCounter  set to the matching counter, may be NULL
+ *
+ * @return whether a counter within the window produces the code
+ */
+bool OCRAVerifyCounterWindow(const OCRASuiteLayout *layout, const HMACKey *key, const OCRAInput *input, uint64_t counter, uint32_t window, uint32_t code, uint64_t *matchedCounter);
+
+/**
+ * Sets layout->compute when the layout is identical to one of the built-in
+ * constant layouts (e.g. OCRA-1:HOTP-SHA1-6:QH10-S), leaves it NULL
+ * otherwise. The specialized functions share their code with
+ * OCRAComputeCode, but the compiler sees every offset and length as a
+ * constant.
+ *
+ * @param layout  fully compiled layout
+ */
+void OCRASpecialize(OCRASuiteLayout *layout);
+
+/**
+ * Dynamic truncation (RFC 4226 section 5.3) of an HMAC into a numeric code.
+ *
+ * @param hash        HMAC output
+ * @param hashLength  length of the HMAC output
+ * @param digits      number of digits, 0 to 10
+ *
+ * @return code modulo 10^digits
+ */
+uint32_t OCRATruncate(const uint8_t *hash, size_t hashLength, int digits);
+
+/**
+ * Formats a code as a zero padded decimal string.
+ *
+ * @param code    truncated code
+ * @param digits  number of digits, 0 to 10
+ * @param output  buffer of at least 11 bytes, will be NUL terminated
+ */
+void OCRAFormatCode(uint32_t code, int digits, char *output);
+
+#endif /* OCRAMessage_h */
@@ -8,6 +8,8 @@
 
 #import <Foundation/Foundation.h>
 
+@class OCRASuite;
+
 @protocol OCRAProtocol <NSObject>
 
 - (NSString *)generateOCRA:(NSString*)ocraSuite
@@ -16,4 +18,37 @@
                 sessionKey:(NSString*)sessionKey
                      error:(NSError**)error;
 
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challenge
+                         sessionKey:(NSString*)sessionKey
+                              error:(NSError**)error;
+
+/**
+ * Same as above, for the given counter and time. The counter is only used
+ * by suites with a counter (see IdentityService nextCounter:forIdentity:error:),
+ * the date only by suites with a timestamp; pass the server's time (see
+ * ServerClock) so a skewed device clock doesn't invalidate the response.
+ */
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challenge
+                         sessionKey:(NSString*)sessionKey
+                            counter:(uint64_t)counter
+                               date:(NSDate *)date
+                              error:(NSError**)error;
+
+/**
+ * Same as above, but with the data inputs already decoded. The secret is
+ * used as is, question and session information must have the exact field
+ * lengths of the compiled suite (see OCRA fieldWithLength:hexString:alignment:).
+ */
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                            counter:(NSData *)counter
+                           question:(NSData *)question
+                 sessionInformation:(NSData *)sessionInformation
+                          timestamp:(NSData *)timestamp
+                              error:(NSError**)error;
+
 @end
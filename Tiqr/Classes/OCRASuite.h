@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import "OCRAMessage.h"
+
+/**
+ * Error codes that can occur when compiling an OCRA suite.
+ *
+ * OCRANumberOfDigitsTooLargeError (see OCRA.h) and OCRAServerIncompatibleError
+ * (see OCRA_v1.h) are reused for suites that request more than 10 digits.
+ */
+enum {
+    OCRASuiteInvalidFormatError = 110,
+    OCRASuiteUnsupportedAlgorithmError = 111,
+    OCRASuiteTooLongError = 112
+};
+
+/**
+ * The suite parsing rules differ between the protocol versions; version 1
+ * challenges are parsed the way OCRA_v1 always did, newer versions follow
+ * the rules of OCRA.
+ */
+typedef NS_ENUM(NSInteger, OCRASuiteDialect) {
+    OCRASuiteDialectV1,
+    OCRASuiteDialectV2
+};
+
+/**
+ * An OCRA suite string, parsed once into an immutable message plan.
+ *
+ * Compiling the suite does all the string work up front so that generating
+ * a response only has to fill in the data input fields and compute the HMAC.
+ */
+@interface OCRASuite : NSObject
+
+/**
+ * The original suite string.
+ */
+@property (nonatomic, copy, readonly) NSString *string;
+
+/**
+ * The dialect that was used to parse the suite.
+ */
+@property (nonatomic, assign, readonly) OCRASuiteDialect dialect;
+
+@property (nonatomic, assign, readonly) OCRAHashAlgorithm algorithm;
+@property (nonatomic, assign, readonly) int digits;
+
+/**
+ * Whether the challenge question is numeric (QN) and needs to be converted
+ * to hex before it is put in the message.
+ */
+@property (nonatomic, assign, readonly) BOOL numericQuestion;
+
+/**
+ * Length of a time step in seconds for suites with a timestamp (T), 0 otherwise.
+ */
+@property (nonatomic, assign, readonly) NSTimeInterval timeStep;
+
+@property (nonatomic, assign, readonly) size_t messageLength;
+
+/**
+ * The compiled message layout, valid for the lifetime of the receiver.
+ */
+@property (nonatomic, assign, readonly) const OCRASuiteLayout *layout;
+
+/**
+ * Compiles the given suite string.
+ *
+ * @param string   OCRA suite, e.g. OCRA-1:HOTP-SHA1-6:QH10-S
+ * @param dialect  parsing rules to apply
+ * @param error    set when the suite is malformed
+ *
+ * @return compiled suite or nil
+ */
++ (instancetype)suiteWithString:(NSString *)string dialect:(OCRASuiteDialect)dialect error:(NSError **)error;
+
+@end
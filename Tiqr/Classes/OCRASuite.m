@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "OCRASuite.h"
+#import "OCRA.h"
+#import "OCRA_v1.h"
+#import "OCRASuitePolicy.h"
+
+@interface OCRASuite () {
+    OCRASuiteLayout _layout;
+}
+
+@property (nonatomic, copy) NSString *string;
+@property (nonatomic, assign) OCRASuiteDialect dialect;
+
+@end
+
+@implementation OCRASuite
+
++ (NSError *)errorWithDomain:(NSString *)domain code:(NSInteger)code title:(NSString *)title message:(NSString *)message {
+    NSDictionary *details = @{NSLocalizedDescriptionKey: title, NSLocalizedFailureReasonErrorKey: message};
+    return [NSError errorWithDomain:domain code:code userInfo:details];
+}
+
++ (NSError *)invalidSuiteError:(NSInteger)code message:(NSString *)message dialect:(OCRASuiteDialect)dialect {
+    NSString *domain = dialect == OCRASuiteDialectV1 ? @"org.example.tiqr.ErrorDomain" : @"org.example.ErrorDomain";
+    return [self errorWithDomain:domain code:code title:NSLocalizedString(@"Error", @"Error title") message:message];
+}
+
++ (NSError *)numberOfDigitsTooLargeErrorForDialect:(OCRASuiteDialect)dialect {
+    // Keep reporting the same errors the engines used to report while generating a response
+    if (dialect == OCRASuiteDialectV1) {
+        NSString *errorTitle = NSLocalizedString(@"Server incompatible", @"Server incompatible title");
+        NSString *errorMessage = NSLocalizedString(@"The server is incompatible with this version of the app.", @"Server incompatible message");
+        return [self errorWithDomain:@"org.example.tiqr.ErrorDomain" code:OCRAServerIncompatibleError title:errorTitle message:errorMessage];
+    } else {
+        NSString *errorTitle = NSLocalizedString(@"Error", @"Error title");
+        NSString *errorMessage = NSLocalizedString(@"The number of digits defined for the OTP can't be larger than 10.", @"Error message");
+        return [self errorWithDomain:@"org.example.ErrorDomain" code:OCRANumberOfDigitsTooLargeError title:errorTitle message:errorMessage];
+    }
+}
+
++ (instancetype)suiteWithString:(NSString *)string dialect:(OCRASuiteDialect)dialect error:(NSError **)error {
+    NSError *compileError = nil;
+    NSError **errorPointer = error != NULL ? error : &compileError;
+
+    NSData *suiteData = [string dataUsingEncoding:NSASCIIStringEncoding];
+    if ([suiteData length] == 0) {
+        NSString *message = NSLocalizedString(@"The OCRA suite should be a non-empty ASCII string.", @"Error message");
+        *errorPointer = [self invalidSuiteError:OCRASuiteInvalidFormatError message:message dialect:dialect];
+        return nil;
+    }
+
+    OCRASuite *suite = [[OCRASuite alloc] init];
+    suite.string = string;
+    suite.dialect = dialect;
+
+    const OCRASuitePolicy *policy = dialect == OCRASuiteDialectV1 ? &OCRASuitePolicyV1 : &OCRASuitePolicyV2;
+    OCRASuiteCompileResult result = OCRASuiteCompile([suiteData bytes], [suiteData length], policy, &suite->_layout);
+
+    NSString *message = nil;
+    switch (result) {
+        case OCRASuiteCompileSuccess:
+            return suite;
+        case OCRASuiteCompileInvalidFormat:
+            message = NSLocalizedString(@"The OCRA suite should consist of an algorithm, a crypto function and a data input definition.", @"Error message");
+            *errorPointer = [self invalidSuiteError:OCRASuiteInvalidFormatError message:message dialect:dialect];
+            break;
+        case OCRASuiteCompileUnsupportedAlgorithm:
+            message = NSLocalizedString(@"The OCRA suite uses an unsupported hash algorithm.", @"Error message");
+            *errorPointer = [self invalidSuiteError:OCRASuiteUnsupportedAlgorithmError message:message dialect:dialect];
+            break;
+        case OCRASuiteCompileMissingDigits:
+            message = NSLocalizedString(@"The OCRA suite does not define the number of digits.", @"Error message");
+            *errorPointer = [self invalidSuiteError:OCRASuiteInvalidFormatError message:message dialect:dialect];
+            break;
+        case OCRASuiteCompileInvalidTimeStep:
+            message = NSLocalizedString(@"The OCRA suite defines an invalid time step.", @"Error message");
+            *errorPointer = [self invalidSuiteError:OCRASuiteInvalidFormatError message:message dialect:dialect];
+            break;
+        case OCRASuiteCompileTooManyDigits:
+            *errorPointer = [self numberOfDigitsTooLargeErrorForDialect:dialect];
+            break;
+        case OCRASuiteCompileTooLong:
+            message = NSLocalizedString(@"The OCRA suite is too long.", @"Error message");
+            *errorPointer = [self invalidSuiteError:OCRASuiteTooLongError message:message dialect:dialect];
+            break;
+    }
+
+    return nil;
+}
+
+- (const OCRASuiteLayout *)layout {
+    return &_layout;
+}
+
+- (OCRAHashAlgorithm)algorithm {
+    return _layout.algorithm;
+}
+
+- (int)digits {
+    return _layout.digits;
+}
+
+- (BOOL)numericQuestion {
+    return _layout.numericQuestion;
+}
+
+- (NSTimeInterval)timeStep {
+    return _layout.timeStep;
+}
+
+- (size_t)messageLength {
+    return _layout.messageLength;
+}
+
+@end
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "OCRASuitePolicy.h"
+
+#include <limits.h>
+#include <string.h>
+
+#define OCRA_RULE(array, first) { array, sizeof(array) / sizeof(array[0]), first }
+
+static const OCRASuiteMarker v2Algorithms[] = {
+    { "sha1", OCRASuiteScopeCryptoFunction, false, OCRAHashAlgorithmSHA1 },
+    { "sha256", OCRASuiteScopeCryptoFunction, false, OCRAHashAlgorithmSHA256 },
+    { "sha512", OCRASuiteScopeCryptoFunction, false, OCRAHashAlgorithmSHA512 }
+};
+static const OCRASuiteMarker v2Counter[] = {
+    { "c", OCRASuiteScopeDataInput, true, 8 }
+};
+static const OCRASuiteMarker v2Question[] = {
+    { "q", OCRASuiteScopeDataInput, true, 128 },
+    { "-q", OCRASuiteScopeDataInput, false, 128 }
+};
+static const OCRASuiteMarker v2Password[] = {
+    { "psha1", OCRASuiteScopeDataInput, false, 20 },
+    { "psha256", OCRASuiteScopeDataInput, false, 32 },
+    { "psha512", OCRASuiteScopeDataInput, false, 64 }
+};
+static const OCRASuiteMarker v2SessionInformation[] = {
+    { "s064", OCRASuiteScopeDataInput, false, 64 },
+    { "s128", OCRASuiteScopeDataInput, false, 128 },
+    { "s256", OCRASuiteScopeDataInput, false, 256 },
+    { "s512", OCRASuiteScopeDataInput, false, 512 },
+    // deviation from spec. Officially 's' without a length indicator is not in the reference implementation.
+    // RFC is ambigious. However we have supported this in Tiqr since day 1, so we continue to support it.
+    { "s", OCRASuiteScopeDataInput, false, 64 }
+};
+static const OCRASuiteMarker v2Timestamp[] = {
+    { "-t", OCRASuiteScopeDataInput, false, 8 }
+};
+
+const OCRASuitePolicy OCRASuitePolicyV2 = {
+    .requireDataInput = true,
+    .hasDefaultAlgorithm = false,
+    .defaultAlgorithm = OCRAHashAlgorithmSHA1,
+    .digitsScope = OCRASuiteScopeCryptoFunction,
+    .strictTimeStep = true,
+    .algorithm = OCRA_RULE(v2Algorithms, false),
+    .counter = OCRA_RULE(v2Counter, false),
+    .question = OCRA_RULE(v2Question, false),
+    .password = OCRA_RULE(v2Password, false),
+    .sessionInformation = OCRA_RULE(v2SessionInformation, true),
+    .timestamp = OCRA_RULE(v2Timestamp, false)
+};
+
+static const OCRASuiteMarker v1Algorithms[] = {
+    { "sha256", OCRASuiteScopeSuite, false, OCRAHashAlgorithmSHA256 },
+    { "sha512", OCRASuiteScopeSuite, false, OCRAHashAlgorithmSHA512 },
+    { "md5", OCRASuiteScopeSuite, false, OCRAHashAlgorithmMD5 }
+};
+static const OCRASuiteMarker v1Counter[] = {
+    { ":c", OCRASuiteScopeSuite, false, 8 }
+};
+static const OCRASuiteMarker v1Question[] = {
+    { ":q", OCRASuiteScopeSuite, false, 128 },
+    { "-q", OCRASuiteScopeSuite, false, 128 }
+};
+static const OCRASuiteMarker v1Password[] = {
+    { ":p", OCRASuiteScopeSuite, false, 20 },
+    { "-p", OCRASuiteScopeSuite, false, 20 }
+};
+static const OCRASuiteMarker v1SessionInformation[] = {
+    { ":s", OCRASuiteScopeSuite, false, 64 },
+    { "-s", OCRASuiteScopeAfterSecondColon, false, 64 }
+};
+static const OCRASuiteMarker v1Timestamp[] = {
+    { ":t", OCRASuiteScopeSuite, false, 8 },
+    { "-t", OCRASuiteScopeSuite, false, 8 }
+};
+
+const OCRASuitePolicy OCRASuitePolicyV1 = {
+    .requireDataInput = false,
+    .hasDefaultAlgorithm = true,
+    .defaultAlgorithm = OCRAHashAlgorithmSHA1,
+    .digitsScope = OCRASuiteScopeInner,
+    .strictTimeStep = false, // the v1 engine never looked at the time step
+    .algorithm = OCRA_RULE(v1Algorithms, false),
+    .counter = OCRA_RULE(v1Counter, false),
+    .question = OCRA_RULE(v1Question, false),
+    .password = OCRA_RULE(v1Password, false),
+    .sessionInformation = OCRA_RULE(v1SessionInformation, false),
+    .timestamp = OCRA_RULE(v1Timestamp, false)
+};
+
+typedef struct {
+    const char *start;
+    size_t length;
+    bool found;
+} OCRASuiteSpan;
+
+static char OCRALowercase(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+}
+
+static bool OCRASpanHasPrefixAt(OCRASuiteSpan span, size_t position, const char *text) {
+    for (size_t i = 0; text[i] != '\0'; i++) {
+        if (position + i >= span.length || OCRALowercase(span.start[position + i]) != text[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool OCRASpanContains(OCRASuiteSpan span, const char *text, bool anchored) {
+    if (!span.found) {
+        return false;
+    }
+    size_t last = anchored ? 0 : span.length;
+    for (size_t position = 0; position <= last && position < span.length; position++) {
+        if (OCRASpanHasPrefixAt(span, position, text)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *OCRAFindByte(const char *start, const char *end, char c) {
+    const char *found = memchr(start, c, (size_t)(end - start));
+    return found != NULL ? found : end;
+}
+
+static const char *OCRAFindLastByte(const char *start, const char *end, char c) {
+    for (const char *p = end; p > start; p--) {
+        if (p[-1] == c) {
+            return p - 1;
+        }
+    }
+    return NULL;
+}
+
+static OCRASuiteSpan OCRASuiteScopeSpan(const char *suite, size_t length, OCRASuiteScope scope) {
+    const char *end = suite + length;
+    const char *firstColon = OCRAFindByte(suite, end, ':');
+    const char *secondColon = firstColon < end ? OCRAFindByte(firstColon + 1, end, ':') : end;
+    OCRASuiteSpan span = { NULL, 0, false };
+
+    switch (scope) {
+        case OCRASuiteScopeSuite:
+            span = (OCRASuiteSpan){ suite, length, true };
+            break;
+        case OCRASuiteScopeCryptoFunction:
+            if (firstColon < end) {
+                span = (OCRASuiteSpan){ firstColon + 1, (size_t)(secondColon - firstColon - 1), true };
+            }
+            break;
+        case OCRASuiteScopeDataInput:
+            if (secondColon < end) {
+                const char *thirdColon = OCRAFindByte(secondColon + 1, end, ':');
+                span = (OCRASuiteSpan){ secondColon + 1, (size_t)(thirdColon - secondColon - 1), true };
+            }
+            break;
+        case OCRASuiteScopeInner: {
+            const char *lastColon = OCRAFindLastByte(suite, end, ':');
+            if (firstColon < end && lastColon != firstColon) {
+                span = (OCRASuiteSpan){ firstColon, (size_t)(lastColon - firstColon), true };
+            }
+            break;
+        }
+        case OCRASuiteScopeAfterSecondColon:
+            if (secondColon < end) {
+                span = (OCRASuiteSpan){ secondColon + 1, (size_t)(end - secondColon - 1), true };
+            }
+            break;
+    }
+    return span;
+}
+
+static bool OCRASuiteApplyRule(const char *suite, size_t length, const OCRASuiteRule *rule, unsigned *value) {
+    bool matched = false;
+    for (size_t i = 0; i < rule->count; i++) {
+        const OCRASuiteMarker *marker = &rule->markers[i];
+        if (OCRASpanContains(OCRASuiteScopeSpan(suite, length, marker->scope), marker->text, marker->anchored)) {
+            *value = marker->value;
+            matched = true;
+            if (rule->firstMatch) {
+                break;
+            }
+        }
+    }
+    return matched;
+}
+
+/* Same result as NSString intValue: leading whitespace, an optional sign, saturating */
+static int OCRAParseInt(const char *start, const char *end) {
+    const char *p = start;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '\v' || *p == '\f')) {
+        p++;
+    }
+
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    long long value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (value <= (long long)INT_MAX + 1) {
+            value = value * 10 + (*p - '0');
+        }
+    }
+
+    if (negative) {
+        return value > (long long)INT_MAX + 1 ? INT_MIN : (int)-value;
+    }
+    return value > INT_MAX ? INT_MAX : (int)value;
+}
+
+static bool OCRAIsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool OCRAIsTimeUnit(char c) {
+    c = OCRALowercase(c);
+    return c == 's' || c == 'm' || c == 'h';
+}
+
+/* RFC 6287 time steps: T[1-59]S, T[1-59]M or T[0-48]H, one minute when not specified.
+   Finds the same match as the [:-]t([0-9]{1,2})([smh]) expression the parser used to run. */
+static bool OCRASuiteCompileTimeStep(const char *suite, size_t length, uint32_t *timeStep) {
+    *timeStep = 60;
+
+    for (size_t i = 0; i + 3 < length; i++) {
+        if ((suite[i] != ':' && suite[i] != '-') || OCRALowercase(suite[i + 1]) != 't') {
+            continue;
+        }
+
+        uint32_t value = 0;
+        char unit = 0;
+        if (i + 4 < length && OCRAIsDigit(suite[i + 2]) && OCRAIsDigit(suite[i + 3]) && OCRAIsTimeUnit(suite[i + 4])) {
+            value = (uint32_t)((suite[i + 2] - '0') * 10 + (suite[i + 3] - '0'));
+            unit = OCRALowercase(suite[i + 4]);
+        } else if (i + 3 < length && OCRAIsDigit(suite[i + 2]) && OCRAIsTimeUnit(suite[i + 3])) {
+            value = (uint32_t)(suite[i + 2] - '0');
+            unit = OCRALowercase(suite[i + 3]);
+        } else {
+            continue;
+        }
+
+        bool valid = false;
+        switch (unit) {
+            case 's':
+                valid = value >= 1 && value <= 59;
+                *timeStep = value;
+                break;
+            case 'm':
+                valid = value >= 1 && value <= 59;
+                *timeStep = value * 60;
+                break;
+            case 'h':
+                valid = value >= 1 && value <= 48;
+                *timeStep = value * 3600;
+                break;
+        }
+
+        if (!valid) {
+            *timeStep = 60;
+        }
+        return valid;
+    }
+
+    return true;
+}
+
+static size_t OCRAHashLength(OCRAHashAlgorithm algorithm) {
+    switch (algorithm) {
+        case OCRAHashAlgorithmSHA1:
+            return 20;
+        case OCRAHashAlgorithmSHA256:
+            return 32;
+        case OCRAHashAlgorithmSHA512:
+            return 64;
+        case OCRAHashAlgorithmMD5:
+            return 16;
+    }
+    return 0;
+}
+
+OCRASuiteCompileResult OCRASuiteCompile(const char *suite, size_t length, const OCRASuitePolicy *policy, OCRASuiteLayout *layout) {
+    memset(layout, 0, sizeof(OCRASuiteLayout));
+
+    if (length > OCRASuiteMaxLength) {
+        return OCRASuiteCompileTooLong;
+    }
+
+    if (policy->requireDataInput && !OCRASuiteScopeSpan(suite, length, OCRASuiteScopeDataInput).found) {
+        return OCRASuiteCompileInvalidFormat;
+    }
+
+    unsigned algorithm = policy->defaultAlgorithm;
+    if (!OCRASuiteApplyRule(suite, length, &policy->algorithm, &algorithm) && !policy->hasDefaultAlgorithm) {
+        return OCRASuiteCompileUnsupportedAlgorithm;
+    }
+    layout->algorithm = (OCRAHashAlgorithm)algorithm;
+
+    OCRASuiteSpan digitsScope = OCRASuiteScopeSpan(suite, length, policy->digitsScope);
+    const char *digitsSeparator = digitsScope.found ? OCRAFindLastByte(digitsScope.start, digitsScope.start + digitsScope.length, '-') : NULL;
+    if (digitsSeparator == NULL) {
+        return OCRASuiteCompileMissingDigits;
+    }
+    layout->digits = OCRAParseInt(digitsSeparator + 1, digitsScope.start + digitsScope.length);
+
+    unsigned value = 0;
+    if (OCRASuiteApplyRule(suite, length, &policy->counter, &value)) {
+        layout->counterLength = value;
+    }
+    if (OCRASuiteApplyRule(suite, length, &policy->question, &value)) {
+        layout->questionLength = value;
+    }
+    if (OCRASuiteApplyRule(suite, length, &policy->password, &value)) {
+        layout->passwordLength = value;
+    }
+    if (OCRASuiteApplyRule(suite, length, &policy->sessionInformation, &value)) {
+        layout->sessionInformationLength = value;
+    }
+    if (OCRASuiteApplyRule(suite, length, &policy->timestamp, &value)) {
+        layout->timestampLength = value;
+    }
+
+    if (layout->timestampLength > 0 && !OCRASuiteCompileTimeStep(suite, length, &layout->timeStep) && policy->strictTimeStep) {
+        return OCRASuiteCompileInvalidTimeStep;
+    }
+
+    // The number of digits is used as an index in the powers of ten table, so it can't be larger than 10
+    if (layout->digits > 10 || layout->digits < 0) {
+        return OCRASuiteCompileTooManyDigits;
+    }
+
+    layout->hashLength = OCRAHashLength(layout->algorithm);
+    layout->numericQuestion = OCRASpanContains(OCRASuiteScopeSpan(suite, length, OCRASuiteScopeSuite), "qn", false);
+
+    // Suite bytes followed by the "00" byte delimiter
+    layout->suiteLength = length;
+    memcpy(layout->suite, suite, length);
+    layout->suite[length] = 0x00;
+
+    layout->counterOffset = layout->suiteLength + 1;
+    layout->questionOffset = layout->counterOffset + layout->counterLength;
+    layout->passwordOffset = layout->questionOffset + layout->questionLength;
+    layout->sessionInformationOffset = layout->passwordOffset + layout->passwordLength;
+    layout->timestampOffset = layout->sessionInformationOffset + layout->sessionInformationLength;
+    layout->messageLength = layout->timestampOffset + layout->timestampLength;
+
+    OCRASpecialize(layout);
+    return OCRASuiteCompileSuccess;
+}
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OCRASuitePolicy_h
+#define OCRASuitePolicy_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "OCRAMessage.h"
+
+/*
+ * Suite parsing for both protocol dialects.
+ *
+ * The two dialects only differ in where they look for the data input
+ * markers and which markers they know (version 1 has MD5 but no PSHA256,
+ * PSHA512 or S064...S512 field sizes). Those differences are captured by a
+ * constant policy per dialect, one parser applies either of them. The
+ * policies reproduce the historic OCRA (version 2) and OCRA_v1 (version 1)
+ * parsing exactly, including their quirks.
+ */
+
+/**
+ * Part of the suite string a marker is searched in.
+ */
+typedef enum {
+    OCRASuiteScopeSuite,            /* the whole suite */
+    OCRASuiteScopeCryptoFunction,   /* second ':' separated element */
+    OCRASuiteScopeDataInput,        /* third ':' separated element */
+    OCRASuiteScopeInner,            /* from the first up to the last ':' */
+    OCRASuiteScopeAfterSecondColon  /* everything behind the second ':' */
+} OCRASuiteScope;
+
+/**
+ * A case insensitive marker that enables a field (or selects an algorithm).
+ */
+typedef struct {
+    const char *text;
+    OCRASuiteScope scope;
+    bool anchored;      /* only at the start of the scope */
+    unsigned value;     /* field length, or the OCRAHashAlgorithm */
+} OCRASuiteMarker;
+
+/**
+ * The markers for one field. Either the first marker that matches decides
+ * (an if/else chain) or every marker is tried and the last match wins.
+ */
+typedef struct {
+    const OCRASuiteMarker *markers;
+    size_t count;
+    bool firstMatch;
+} OCRASuiteRule;
+
+typedef struct {
+    bool requireDataInput;          /* at least three ':' separated elements */
+    bool hasDefaultAlgorithm;
+    OCRAHashAlgorithm defaultAlgorithm;
+    OCRASuiteScope digitsScope;     /* the digits follow the last '-' in here */
+    bool strictTimeStep;            /* reject time steps outside the RFC ranges */
+
+    OCRASuiteRule algorithm;
+    OCRASuiteRule counter;
+    OCRASuiteRule question;
+    OCRASuiteRule password;
+    OCRASuiteRule sessionInformation;
+    OCRASuiteRule timestamp;
+} OCRASuitePolicy;
+
+/**
+ * Parsing rules of protocol version 1 (the OCRA_v1 engine).
+ */
+extern const OCRASuitePolicy OCRASuitePolicyV1;
+
+/**
+ * Parsing rules of protocol version 2 and up (the OCRA engine).
+ */
+extern const OCRASuitePolicy OCRASuitePolicyV2;
+
+typedef enum {
+    OCRASuiteCompileSuccess,
+    OCRASuiteCompileInvalidFormat,
+    OCRASuiteCompileUnsupportedAlgorithm,
+    OCRASuiteCompileMissingDigits,
+    OCRASuiteCompileInvalidTimeStep,
+    OCRASuiteCompileTooManyDigits,
+    OCRASuiteCompileTooLong
+} OCRASuiteCompileResult;
+
+/**
+ * Parses a suite into its message layout.
+ *
+ * Suites that OCRASpecialize knows also get a constant
+ * folded compute function (see OCRASuiteLayout compute).
+ *
+ * @param suite   ASCII suite string, doesn't need to be NUL terminated
+ * @param length  length of the suite in bytes
+ * @param policy  parsing rules
+ * @param layout  output
+ *
+ * @return OCRASuiteCompileSuccess or the first problem found
+ */
+OCRASuiteCompileResult OCRASuiteCompile(const char *suite, size_t length, const OCRASuitePolicy *policy, OCRASuiteLayout *layout);
+
+#endif /* OCRASuitePolicy_h */
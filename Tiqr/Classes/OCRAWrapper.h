@@ -51,5 +51,22 @@
             sessionKey:(NSString*)sessionKey
                  error:(NSError**)error;
 
+/**
+ * Computes the HOTP response for the given OCRA challenge using a
+ * precompiled suite (see -[IdentityProvider compiledOcraSuiteForDialect:error:]).
+ *
+ * @param ocraSuite  compiled OCRA suite to use
+ * @param secret	 binary secret
+ * @param challenge	 numeric challenge
+ * @param sessionKey session key
+ *
+ * @return computed HOTP response
+ */
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challenge
+                         sessionKey:(NSString*)sessionKey
+                              error:(NSError**)error;
+
 @end
 
@@ -28,15 +28,18 @@
  */
 
 #import "OCRAWrapper.h"
-#import "NSData+Hex.h"
 #import "OCRA.h"
 
 @implementation OCRAWrapper
 
 - (NSString*) numStrToHex: (NSString *)str {
     
-    NSDecimalNumber *bigNumberValue = [NSDecimalNumber decimalNumberWithString:str];
-    return [NSString stringWithFormat:@"%lX", [bigNumberValue unsignedIntegerValue]];
+    const char *decimal = [str UTF8String];
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    if (decimal == NULL || OCRANumericQuestionToHex(decimal, strlen(decimal), hex) == 0) {
+        return nil;
+    }
+    return [NSString stringWithCString:hex encoding:NSASCIIStringEncoding];
 }
 
 - (NSString *)generateOCRA:(NSString*)ocraSuite
@@ -45,7 +48,46 @@
                 sessionKey:(NSString*)sessionKey 
                      error:(NSError**)error {
     
-    return [OCRA generateOCRAForSuite:ocraSuite key:[secret hexStringValue] counter:@"" question:challengeQuestion password:@"" sessionInformation:sessionKey timestamp:@"" error:error];
+    OCRASuite *suite = [OCRASuite suiteWithString:ocraSuite dialect:OCRASuiteDialectV2 error:error];
+    if (suite == nil) {
+        return nil;
+    }
+    
+    return [self generateOCRAWithSuite:suite secret:secret challenge:challengeQuestion sessionKey:sessionKey error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challengeQuestion
+                         sessionKey:(NSString*)sessionKey
+                              error:(NSError**)error {
+    
+    return [self generateOCRAWithSuite:ocraSuite secret:secret challenge:challengeQuestion sessionKey:sessionKey counter:0 date:[NSDate date] error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challengeQuestion
+                         sessionKey:(NSString*)sessionKey
+                            counter:(uint64_t)counter
+                               date:(NSDate *)date
+                              error:(NSError**)error {
+    
+    const OCRASuiteLayout *layout = ocraSuite.layout;
+    NSData *question = [OCRA fieldWithLength:layout->questionLength hexString:challengeQuestion alignment:OCRAFieldAlignmentLeft];
+    NSData *sessionInformation = [OCRA fieldWithLength:layout->sessionInformationLength hexString:sessionKey alignment:OCRAFieldAlignmentRight];
+    return [self generateOCRAWithSuite:ocraSuite secret:secret counter:[OCRA counterWithSuite:ocraSuite value:counter] question:question sessionInformation:sessionInformation timestamp:[OCRA timestampWithSuite:ocraSuite date:date] error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                            counter:(NSData *)counter
+                           question:(NSData *)question
+                 sessionInformation:(NSData *)sessionInformation
+                          timestamp:(NSData *)timestamp
+                              error:(NSError**)error {
+    
+    return [OCRA generateOCRAWithSuite:ocraSuite secret:secret counter:counter question:question password:nil sessionInformation:sessionInformation timestamp:timestamp error:error];
 }
 
 @end
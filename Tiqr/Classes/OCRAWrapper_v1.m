@@ -28,28 +28,18 @@
  */
 
 #import "OCRAWrapper_v1.h"
-#import "NSData+Hex.h"
-#import "OCRA_v1.h"
+#import "OCRA.h"
 
 @implementation OCRAWrapper_v1
 
-- (BOOL) shouldIncludeSessionData: (NSString*)ocraSuite {
-    
-    
-    if(([ocraSuite rangeOfString:@":s" options:NSCaseInsensitiveSearch].location != NSNotFound) ||
-       ([ocraSuite rangeOfString:@":.*?:.*?\\-s" options:NSCaseInsensitiveSearch|NSRegularExpressionSearch].location != NSNotFound)) {
-        
-        return YES;
-        
-    }
-
-    return NO;
-}
-
 - (NSString*) numStrToHex: (NSString *)str {
     
-    NSDecimalNumber *bigNumberValue = [NSDecimalNumber decimalNumberWithString:str];
-    return [NSString stringWithFormat:@"%lX", [bigNumberValue unsignedIntegerValue]];
+    const char *decimal = [str UTF8String];
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    if (decimal == NULL || OCRANumericQuestionToHex(decimal, strlen(decimal), hex) == 0) {
+        return nil;
+    }
+    return [NSString stringWithCString:hex encoding:NSASCIIStringEncoding];
 }
 
 - (NSString *)generateOCRA:(NSString*)ocraSuite
@@ -58,25 +48,72 @@
                 sessionKey:(NSString*)sessionKey 
                      error:(NSError**)error {
     
+    OCRASuite *suite = [OCRASuite suiteWithString:ocraSuite dialect:OCRASuiteDialectV1 error:error];
+    if (suite == nil) {
+        return nil;
+    }
+    
+    return [self generateOCRAWithSuite:suite secret:secret challenge:challengeQuestion sessionKey:sessionKey error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challengeQuestion
+                         sessionKey:(NSString*)sessionKey
+                              error:(NSError**)error {
+    
+    return [self generateOCRAWithSuite:ocraSuite secret:secret challenge:challengeQuestion sessionKey:sessionKey counter:0 date:[NSDate date] error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                          challenge:(NSString*)challengeQuestion
+                         sessionKey:(NSString*)sessionKey
+                            counter:(uint64_t)counter
+                               date:(NSDate *)date
+                              error:(NSError**)error {
+    
     // The reference implementation takes session data into account even if -S isn't specified in the suite. 
     // We therefor explicitly pass "" if -S is not in the suite.
     NSString *sessionData = @"";
     
-    if ([self shouldIncludeSessionData:ocraSuite]) {
+    if (ocraSuite.layout->sessionInformationLength > 0) {
         sessionData = sessionKey;
     }       
     
-    NSString* challenge;
-
-    if ([ocraSuite rangeOfString:@"qn" options:NSCaseInsensitiveSearch].location != NSNotFound) {
+    const OCRASuiteLayout *layout = ocraSuite.layout;
+    NSData *question = nil;
+    if (ocraSuite.numericQuestion) {
         // Using numeric challenge questions, need to convert to hex first
-        challenge = [self numStrToHex: challengeQuestion];
+        question = [OCRA questionWithSuite:ocraSuite numericQuestion:challengeQuestion];
+        if (question == nil) {
+            if (error != NULL) {
+                NSString *errorTitle = NSLocalizedString(@"Error", @"Error title");
+                NSString *errorMessage = NSLocalizedString(@"The challenge question should be a number of at most 64 digits.", @"Error message");
+                NSDictionary *details = @{NSLocalizedDescriptionKey: errorTitle, NSLocalizedFailureReasonErrorKey: errorMessage};
+                *error = [[NSError alloc] initWithDomain:@"org.example.tiqr.ErrorDomain" code:OCRAInvalidNumericQuestionError userInfo:details];
+            }
+            return nil;
+        }
     } else {
         // if qh, we're already dealing with hex
-        challenge = challengeQuestion;
+        question = [OCRA fieldWithLength:layout->questionLength hexString:challengeQuestion alignment:OCRAFieldAlignmentLeft];
     }
 
-    return [OCRA_v1 generateOCRA:ocraSuite key:[secret hexStringValue] counter:@"" question:challenge password:@"" sessionInformation:sessionData timestamp:@"" error:error];
+    NSData *sessionInformation = [OCRA fieldWithLength:layout->sessionInformationLength hexString:sessionData alignment:OCRAFieldAlignmentRight];
+    return [self generateOCRAWithSuite:ocraSuite secret:secret counter:[OCRA counterWithSuite:ocraSuite value:counter] question:question sessionInformation:sessionInformation timestamp:[OCRA timestampWithSuite:ocraSuite date:date] error:error];
+}
+
+- (NSString *)generateOCRAWithSuite:(OCRASuite *)ocraSuite
+                             secret:(NSData *)secret
+                            counter:(NSData *)counter
+                           question:(NSData *)question
+                 sessionInformation:(NSData *)sessionInformation
+                          timestamp:(NSData *)timestamp
+                              error:(NSError**)error {
+    
+    // The suite was compiled with the version 1 rules, so the layout already reflects the OCRA_v1 quirks
+    return [OCRA generateOCRAWithSuite:ocraSuite secret:secret counter:counter question:question password:nil sessionInformation:sessionInformation timestamp:timestamp error:error];
 }
 
 @end
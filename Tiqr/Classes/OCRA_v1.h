@@ -28,6 +28,7 @@
  */
 
 #import <Foundation/Foundation.h>
+#import "OCRASuite.h"
 
 enum {
     OCRAServerIncompatibleError = 206
@@ -51,4 +52,18 @@ enum {
                   timestamp:(NSString*) timeStamp
                       error:(NSError**) error;
 
+/**
+ * Generate OCRA response for a suite compiled with OCRASuiteDialectV1.
+ *
+ * @return computed response
+ */
++ (NSString *) generateOCRAWithSuite:(OCRASuite*) suite
+                                 key:(NSString*) key
+                             counter:(NSString*) counter
+                            question:(NSString*) question
+                            password:(NSString*) password
+                  sessionInformation:(NSString*) sessionInformation
+                           timestamp:(NSString*) timeStamp
+                               error:(NSError**) error;
+
 @end
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PBKDF2.h"
+#include "HMACBackend.h"
+#include "HMACKeyPrivate.h"
+
+#include <errno.h>
+#include <string.h>
+
+// Iterations between two cancellation checks, well under a millisecond
+#define PBKDF2CancellationInterval 4096
+
+// The salt plus the 4 byte block index, longer salts are rare enough to be hashed in two passes
+#define PBKDF2MaxInlineSaltLength 256
+
+static void PBKDF2DigestToWords(HMACAlgorithm algorithm, const uint8_t *digest, size_t length, HMACState *state) {
+    memset(state, 0, sizeof(*state));
+    if (algorithm == HMACAlgorithmSHA512) {
+        for (size_t i = 0; i < length / 8; i++) {
+            state->words64[i] = HMACLoad64(digest + 8 * i);
+        }
+    } else {
+        for (size_t i = 0; i < length / 4; i++) {
+            state->words32[i] = HMACLoad32(digest + 4 * i);
+        }
+    }
+}
+
+static void PBKDF2WordsToDigest(HMACAlgorithm algorithm, const HMACState *state, uint8_t *digest, size_t length) {
+    if (algorithm == HMACAlgorithmSHA512) {
+        for (size_t i = 0; i < length / 8; i++) {
+            HMACStore64(digest + 8 * i, state->words64[i]);
+        }
+    } else {
+        for (size_t i = 0; i < length / 4; i++) {
+            HMACStore32(digest + 4 * i, state->words32[i]);
+        }
+    }
+}
+
+/**
+ * Iterations for algorithms without a word based loop (MD5), one HMAC per
+ * round on top of the cached midstates.
+ */
+static void PBKDF2IterateBytes(const HMACKey *hmac, uint8_t *u, uint8_t *t, size_t count) {
+    for (size_t round = 0; round < count; round++) {
+        HMACKeyCompute(hmac, u, hmac->digestLength, u);
+        for (size_t i = 0; i < hmac->digestLength; i++) {
+            t[i] ^= u[i];
+        }
+    }
+}
+
+/**
+ * First iteration of a block: U1 = HMAC(password, salt || INT(index)).
+ */
+static void PBKDF2FirstIteration(const HMACKey *hmac, const uint8_t *salt, size_t saltLength, uint32_t index, uint8_t *u) {
+    uint8_t message[PBKDF2MaxInlineSaltLength + 4];
+    uint8_t indexBytes[4];
+    HMACStore32(indexBytes, index);
+
+    if (saltLength <= PBKDF2MaxInlineSaltLength) {
+        if (saltLength > 0) {
+            memcpy(message, salt, saltLength);
+        }
+        memcpy(message + saltLength, indexBytes, 4);
+        HMACKeyCompute(hmac, message, saltLength + 4, u);
+    } else {
+        // Absorb the whole salt blocks, then hash the rest with the index
+        HMACKey derived;
+        size_t absorbed = HMACKeyAbsorb(hmac, salt, saltLength, &derived);
+        size_t rest = saltLength - absorbed;
+        memcpy(message, salt + absorbed, rest);
+        memcpy(message + rest, indexBytes, 4);
+        HMACKeyCompute(&derived, message, rest + 4, u);
+        HMACKeyWipe(&derived);
+    }
+
+    HMACSecureZero(message, sizeof(message));
+}
+
+int PBKDF2DeriveCancellable(HMACAlgorithm algorithm, const uint8_t *password, size_t passwordLength, const uint8_t *salt, size_t saltLength, uint32_t rounds, uint8_t *key, size_t keyLength, PBKDF2CancelFunction cancelled, const void *cancelledContext) {
+    if (algorithm >= HMACAlgorithmCount || rounds == 0 || keyLength == 0) {
+        return EINVAL;
+    }
+
+    HMACKey hmac;
+    HMACKeyInit(&hmac, algorithm, password, passwordLength);
+    HMACIterateFunction iterate = HMACBackendIterateFunction(hmac.backend, algorithm);
+    size_t digestLength = hmac.digestLength;
+
+    uint8_t u[HMACMaxDigestLength], t[HMACMaxDigestLength];
+    HMACState uWords, tWords;
+    int result = 0;
+
+    for (uint32_t index = 1; (size_t)(index - 1) * digestLength < keyLength; index++) {
+        if (cancelled != NULL && cancelled(cancelledContext)) {
+            result = ECANCELED;
+            break;
+        }
+
+        PBKDF2FirstIteration(&hmac, salt, saltLength, index, u);
+        memcpy(t, u, digestLength);
+
+        if (iterate != NULL) {
+            PBKDF2DigestToWords(algorithm, u, digestLength, &uWords);
+            PBKDF2DigestToWords(algorithm, t, digestLength, &tWords);
+        }
+
+        for (uint32_t done = 1; done < rounds && result == 0; ) {
+            uint32_t count = rounds - done;
+            if (cancelled != NULL && count > PBKDF2CancellationInterval) {
+                count = PBKDF2CancellationInterval;
+                if (cancelled(cancelledContext)) {
+                    result = ECANCELED;
+                    break;
+                }
+            }
+
+            if (iterate != NULL) {
+                iterate(&hmac.inner, &hmac.outer, &uWords, &tWords, count);
+            } else {
+                PBKDF2IterateBytes(&hmac, u, t, count);
+            }
+            done += count;
+        }
+
+        if (result != 0) {
+            break;
+        }
+
+        if (iterate != NULL) {
+            PBKDF2WordsToDigest(algorithm, &tWords, t, digestLength);
+        }
+
+        size_t offset = (size_t)(index - 1) * digestLength;
+        size_t length = keyLength - offset < digestLength ? keyLength - offset : digestLength;
+        memcpy(key + offset, t, length);
+    }
+
+    if (result != 0) {
+        HMACSecureZero(key, keyLength);
+    }
+
+    HMACKeyWipe(&hmac);
+    HMACSecureZero(u, sizeof(u));
+    HMACSecureZero(t, sizeof(t));
+    HMACSecureZero(&uWords, sizeof(uWords));
+    HMACSecureZero(&tWords, sizeof(tWords));
+    return result;
+}
+
+int PBKDF2Derive(HMACAlgorithm algorithm, const uint8_t *password, size_t passwordLength, const uint8_t *salt, size_t saltLength, uint32_t rounds, uint8_t *key, size_t keyLength) {
+    return PBKDF2DeriveCancellable(algorithm, password, passwordLength, salt, saltLength, rounds, key, keyLength, NULL, NULL);
+}
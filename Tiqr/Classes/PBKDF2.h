@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PBKDF2_h
+#define PBKDF2_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "HMACKey.h"
+
+/*
+ * PBKDF2 (RFC 8018) with HMAC as the pseudorandom function, the output is
+ * identical to CCKeyDerivationPBKDF.
+ *
+ * The password's key schedule is computed once; after the first iteration of
+ * a block every iteration is an HMAC over the previous digest, which always
+ * fits one block with a constant padding. The active HMAC backend (see
+ * HMACBackend.h) runs that loop on the digest words, with the SHA
+ * instructions where the CPU has them, so an iteration costs exactly two
+ * compressions.
+ *
+ * Functions return 0 or an errno value.
+ */
+
+/**
+ * Polled during long derivations, returns whether to give up.
+ */
+typedef bool (*PBKDF2CancelFunction)(const void *context);
+
+/**
+ * Derives a key.
+ *
+ * @param algorithm       hash function of the HMAC
+ * @param password        password bytes
+ * @param passwordLength  length of the password in bytes
+ * @param salt            salt bytes
+ * @param saltLength      length of the salt in bytes
+ * @param rounds          iteration count, at least 1
+ * @param key             output buffer
+ * @param keyLength       length of the key to derive in bytes
+ *
+ * @return 0 or EINVAL
+ */
+int PBKDF2Derive(HMACAlgorithm algorithm, const uint8_t *password, size_t passwordLength, const uint8_t *salt, size_t saltLength, uint32_t rounds, uint8_t *key, size_t keyLength);
+
+/**
+ * Derives a key, asking cancelled every few thousand iterations whether to
+ * continue.
+ *
+ * @param cancelled         called on the deriving thread, NULL to never cancel
+ * @param cancelledContext  passed to cancelled
+ *
+ * @return 0, EINVAL or ECANCELED, the key is zeroed unless the result is 0
+ */
+int PBKDF2DeriveCancellable(HMACAlgorithm algorithm, const uint8_t *password, size_t passwordLength, const uint8_t *salt, size_t saltLength, uint32_t rounds, uint8_t *key, size_t keyLength, PBKDF2CancelFunction cancelled, const void *cancelledContext);
+
+#endif /* PBKDF2_h */
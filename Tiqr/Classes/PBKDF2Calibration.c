@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PBKDF2Calibration.h"
+#include "PBKDF2.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+// A sample this long is well above the clock resolution and scheduler noise
+#define PBKDF2CalibrationSampleMilliseconds 10
+#define PBKDF2CalibrationSamples 3
+
+// Round count of the first trial derivation
+#define PBKDF2CalibrationInitialRounds 1024
+
+static double PBKDF2CalibrationNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+static double PBKDF2CalibrationTime(const PBKDF2CalibrationParameters *parameters, const uint8_t *password, const uint8_t *salt, uint8_t *key, uint32_t rounds) {
+    double start = PBKDF2CalibrationNow();
+    if (PBKDF2Derive(parameters->algorithm, password, parameters->passwordLength, salt, parameters->saltLength, rounds, key, parameters->keyLength) != 0) {
+        return -1;
+    }
+    return PBKDF2CalibrationNow() - start;
+}
+
+double PBKDF2MeasureRoundsPerSecond(const PBKDF2CalibrationParameters *parameters, uint32_t sampleMilliseconds, unsigned int samples) {
+    if (parameters->keyLength == 0 || samples == 0) {
+        return 0;
+    }
+
+    // The contents don't matter, only the lengths change the work per round
+    uint8_t *buffer = calloc(1, parameters->passwordLength + parameters->saltLength + parameters->keyLength);
+    if (buffer == NULL) {
+        return 0;
+    }
+    const uint8_t *password = buffer;
+    const uint8_t *salt = buffer + parameters->passwordLength;
+    uint8_t *key = buffer + parameters->passwordLength + parameters->saltLength;
+
+    double sampleSeconds = sampleMilliseconds / 1000.0;
+    uint32_t rounds = PBKDF2CalibrationInitialRounds;
+    double best = PBKDF2CalibrationTime(parameters, password, salt, key, rounds);
+    while (best >= 0 && best < sampleSeconds && rounds <= UINT32_MAX / 2) {
+        rounds *= 2;
+        best = PBKDF2CalibrationTime(parameters, password, salt, key, rounds);
+    }
+
+    for (unsigned int sample = 1; best > 0 && sample < samples; sample++) {
+        double seconds = PBKDF2CalibrationTime(parameters, password, salt, key, rounds);
+        best = seconds < best ? seconds : best;
+    }
+
+    free(buffer);
+    return best > 0 ? rounds / best : 0;
+}
+
+uint32_t PBKDF2RoundsForDuration(double roundsPerSecond, uint32_t milliseconds, uint32_t minimumRounds, uint32_t maximumRounds) {
+    double rounds = roundsPerSecond * milliseconds / 1000.0;
+    if (!(rounds > minimumRounds)) {
+        return minimumRounds;
+    }
+    if (rounds >= maximumRounds) {
+        return maximumRounds;
+    }
+    return (uint32_t)rounds;
+}
+
+uint32_t PBKDF2CalibrateRounds(const PBKDF2CalibrationParameters *parameters, uint32_t milliseconds) {
+    double roundsPerSecond = PBKDF2MeasureRoundsPerSecond(parameters, PBKDF2CalibrationSampleMilliseconds, PBKDF2CalibrationSamples);
+    if (roundsPerSecond <= 0) {
+        return 0;
+    }
+    return PBKDF2RoundsForDuration(roundsPerSecond, milliseconds, PBKDF2CalibrationMinimumRounds, PBKDF2CalibrationMaximumRounds);
+}
+
+bool PBKDF2RoundsOffTarget(uint32_t rounds, uint32_t target) {
+    uint64_t scaled = (uint64_t)rounds * 6;
+    return scaled < (uint64_t)target * 4 || scaled > (uint64_t)target * 9;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PBKDF2Calibration_h
+#define PBKDF2Calibration_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "HMACKey.h"
+
+/*
+ * Picks the PBKDF2 iteration count that makes a derivation take a given
+ * time on the current device, the portable equivalent of CCCalibratePBKDF.
+ *
+ * The measurement runs real derivations with the active HMAC backend and
+ * keeps the fastest of a few samples, a sample that was preempted or ran on
+ * a throttled core only makes the device look slower. The arithmetic is
+ * exposed separately so it can be tested without a clock.
+ */
+
+/** Lower bound for calibrated round counts, whatever the device. */
+#define PBKDF2CalibrationMinimumRounds 10000
+
+/** Upper bound for calibrated round counts, keeps the arithmetic in range. */
+#define PBKDF2CalibrationMaximumRounds 10000000
+
+typedef struct {
+    HMACAlgorithm algorithm;
+    size_t passwordLength;
+    size_t saltLength;
+    size_t keyLength;
+} PBKDF2CalibrationParameters;
+
+/**
+ * Measures how many iterations per second a derivation with the given
+ * parameters runs at.
+ *
+ * The iteration count of a sample is doubled until a derivation takes at
+ * least sampleMilliseconds, then that count is timed samples times.
+ *
+ * @return iterations per second, or 0 when the parameters are invalid
+ */
+double PBKDF2MeasureRoundsPerSecond(const PBKDF2CalibrationParameters *parameters, uint32_t sampleMilliseconds, unsigned int samples);
+
+/**
+ * The round count that takes milliseconds at the given speed, clamped to
+ * [minimumRounds, maximumRounds].
+ */
+uint32_t PBKDF2RoundsForDuration(double roundsPerSecond, uint32_t milliseconds, uint32_t minimumRounds, uint32_t maximumRounds);
+
+/**
+ * Measures the device and returns the round count for a derivation of
+ * milliseconds, clamped to the calibration bounds.
+ *
+ * Takes about 50 ms regardless of the target, call it off the
+ * main thread and keep the result.
+ *
+ * @return round count, or 0 when the parameters are invalid
+ */
+uint32_t PBKDF2CalibrateRounds(const PBKDF2CalibrationParameters *parameters, uint32_t milliseconds);
+
+/**
+ * Whether a secret wrapped with rounds should be re-wrapped for target:
+ * when it is less than two thirds or more than one and a half times the
+ * target. The tolerance keeps measurement noise from re-wrapping on every
+ * unlock.
+ */
+bool PBKDF2RoundsOffTarget(uint32_t rounds, uint32_t target);
+
+#endif /* PBKDF2Calibration_h */
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PINUnlockQueue.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <pthread/qos.h>
+#endif
+
+struct PINCancellationToken {
+    atomic_bool cancelled;
+    atomic_int references;
+};
+
+typedef struct PINUnlockJob {
+    PINUnlockRequest request;
+    struct PINUnlockJob *next;
+} PINUnlockJob;
+
+struct PINUnlockQueue {
+    PINSecretStore store;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    PINUnlockJob *head;
+    PINUnlockJob *tail;
+    PINUnlockJob *running;
+    bool stopping;
+};
+
+PINCancellationToken *PINCancellationTokenCreate(void) {
+    PINCancellationToken *token = malloc(sizeof(PINCancellationToken));
+    if (token != NULL) {
+        atomic_init(&token->cancelled, false);
+        atomic_init(&token->references, 1);
+    }
+    return token;
+}
+
+PINCancellationToken *PINCancellationTokenRetain(PINCancellationToken *token) {
+    atomic_fetch_add_explicit(&token->references, 1, memory_order_relaxed);
+    return token;
+}
+
+void PINCancellationTokenRelease(PINCancellationToken *token) {
+    if (token != NULL && atomic_fetch_sub_explicit(&token->references, 1, memory_order_acq_rel) == 1) {
+        free(token);
+    }
+}
+
+void PINCancellationTokenCancel(PINCancellationToken *token) {
+    atomic_store_explicit(&token->cancelled, true, memory_order_release);
+}
+
+bool PINCancellationTokenIsCancelled(const PINCancellationToken *token) {
+    return atomic_load_explicit(&((PINCancellationToken *)token)->cancelled, memory_order_acquire);
+}
+
+static void PINUnlockQueueRelease(const PINSecretStore *store, void *value) {
+    if (value != NULL) {
+        store->release(store->context, value);
+    }
+}
+
+static PINUnlockStatus PINUnlockQueueRun(const PINSecretStore *store, const PINUnlockRequest *request, void **secret) {
+    PINCancellationToken *token = request->token;
+    *secret = NULL;
+
+    if (PINCancellationTokenIsCancelled(token)) {
+        return PINUnlockStatusCancelled;
+    }
+
+    // A load reads the encrypted secret first: it may carry the parameters
+    // of the derivation, and without it there is nothing to derive a key for
+    void *encryptedSecret = NULL;
+    if (request->operation == PINUnlockOperationLoad) {
+        encryptedSecret = store->load(store->context, request->item);
+        if (encryptedSecret == NULL) {
+            return PINUnlockStatusNotFound;
+        }
+    }
+
+    void *key = store->derive(store->context, request->item, token);
+    if (PINCancellationTokenIsCancelled(token)) {
+        PINUnlockQueueRelease(store, key);
+        PINUnlockQueueRelease(store, encryptedSecret);
+        return PINUnlockStatusCancelled;
+    }
+    if (key == NULL) {
+        PINUnlockQueueRelease(store, encryptedSecret);
+        return PINUnlockStatusDeriveFailed;
+    }
+
+    PINUnlockStatus status;
+    if (request->operation == PINUnlockOperationStore) {
+        status = store->store(store->context, request->item, key, request->secret) ? PINUnlockStatusSuccess : PINUnlockStatusStoreFailed;
+    } else {
+        *secret = store->decrypt(store->context, request->item, key, encryptedSecret);
+        status = *secret != NULL ? PINUnlockStatusSuccess : PINUnlockStatusDecryptFailed;
+        PINUnlockQueueRelease(store, encryptedSecret);
+    }
+
+    PINUnlockQueueRelease(store, key);
+    return status;
+}
+
+static void *PINUnlockQueueWorker(void *argument) {
+    PINUnlockQueue *queue = argument;
+
+#ifdef __APPLE__
+    // The user is waiting for the result, but it should not compete with the main thread
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INITIATED, 0);
+#endif
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        while (queue->head == NULL && !queue->stopping) {
+            pthread_cond_wait(&queue->wakeup, &queue->lock);
+        }
+        if (queue->head == NULL) {
+            break;
+        }
+
+        PINUnlockJob *job = queue->head;
+        queue->head = job->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        queue->running = job;
+        pthread_mutex_unlock(&queue->lock);
+
+        void *secret;
+        PINUnlockStatus status = PINUnlockQueueRun(&queue->store, &job->request, &secret);
+
+        pthread_mutex_lock(&queue->lock);
+        queue->running = NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        job->request.completion(job->request.completionContext, status, secret);
+        PINCancellationTokenRelease(job->request.token);
+        free(job);
+
+        pthread_mutex_lock(&queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+PINUnlockQueue *PINUnlockQueueCreate(const PINSecretStore *store) {
+    PINUnlockQueue *queue = calloc(1, sizeof(PINUnlockQueue));
+    if (queue == NULL) {
+        return NULL;
+    }
+
+    queue->store = *store;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->wakeup, NULL);
+
+    if (pthread_create(&queue->thread, NULL, PINUnlockQueueWorker, queue) != 0) {
+        pthread_cond_destroy(&queue->wakeup);
+        pthread_mutex_destroy(&queue->lock);
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void PINUnlockQueueDestroy(PINUnlockQueue *queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    pthread_mutex_unlock(&queue->lock);
+
+    // Pending requests still complete, as cancelled
+    PINUnlockQueueCancelAll(queue);
+    pthread_cond_signal(&queue->wakeup);
+    pthread_join(queue->thread, NULL);
+
+    pthread_cond_destroy(&queue->wakeup);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+bool PINUnlockQueueSubmit(PINUnlockQueue *queue, const PINUnlockRequest *request) {
+    PINUnlockJob *job = malloc(sizeof(PINUnlockJob));
+    if (job == NULL) {
+        return false;
+    }
+
+    job->request = *request;
+    job->next = NULL;
+    if (request->token != NULL) {
+        PINCancellationTokenRetain(request->token);
+    } else if ((job->request.token = PINCancellationTokenCreate()) == NULL) {
+        free(job);
+        return false;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->stopping) {
+        pthread_mutex_unlock(&queue->lock);
+        PINCancellationTokenRelease(job->request.token);
+        free(job);
+        return false;
+    }
+
+    if (request->supersedes) {
+        if (queue->running != NULL && queue->running->request.supersedes) {
+            PINCancellationTokenCancel(queue->running->request.token);
+        }
+        for (PINUnlockJob *pending = queue->head; pending != NULL; pending = pending->next) {
+            if (pending->request.supersedes) {
+                PINCancellationTokenCancel(pending->request.token);
+            }
+        }
+    }
+
+    if (queue->tail != NULL) {
+        queue->tail->next = job;
+    } else {
+        queue->head = job;
+    }
+    queue->tail = job;
+    pthread_cond_signal(&queue->wakeup);
+    pthread_mutex_unlock(&queue->lock);
+
+    return true;
+}
+
+void PINUnlockQueueCancelAll(PINUnlockQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->running != NULL) {
+        PINCancellationTokenCancel(queue->running->request.token);
+    }
+    for (PINUnlockJob *pending = queue->head; pending != NULL; pending = pending->next) {
+        PINCancellationTokenCancel(pending->request.token);
+    }
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PINUnlockQueue_h
+#define PINUnlockQueue_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Runs the PIN based secret pipeline (load -> derive key -> decrypt, or
+ * derive key -> encrypt and store) on a dedicated worker thread, so the
+ * expensive PIN key derivation never blocks the caller.
+ *
+ * The actual work is done by the stages of a PINSecretStore; values that
+ * flow between stages are opaque pointers owned by the store, which makes
+ * the queue independent of CommonCrypto and the keychain. Every request
+ * carries a cancellation token that is checked between the stages and that
+ * the derive stage should poll; a cancelled request completes with
+ * PINUnlockStatusCancelled without running its remaining stages.
+ *
+ * Every submitted request completes exactly once, on the worker thread.
+ */
+
+typedef struct PINUnlockQueue PINUnlockQueue;
+typedef struct PINCancellationToken PINCancellationToken;
+
+typedef enum {
+    PINUnlockOperationLoad,
+    PINUnlockOperationStore
+} PINUnlockOperation;
+
+typedef enum {
+    PINUnlockStatusSuccess,
+    PINUnlockStatusCancelled,
+    PINUnlockStatusDeriveFailed,
+    PINUnlockStatusNotFound,
+    PINUnlockStatusDecryptFailed,
+    PINUnlockStatusStoreFailed
+} PINUnlockStatus;
+
+/**
+ * Stages of the pipeline. Every stage gets the context of the store and
+ * the item of the request (PIN, salt, keychain account, ...).
+ */
+typedef struct {
+    void *context;
+
+    /** Derives the key for the item, returns NULL on failure or when the token is cancelled. */
+    void *(*derive)(void *context, void *item, const PINCancellationToken *token);
+
+    /**
+     * Loads the encrypted secret for the item, returns NULL if there is none.
+     * Runs before derive, so it may update the item with derivation
+     * parameters stored next to the secret.
+     */
+    void *(*load)(void *context, void *item);
+
+    /** Decrypts an encrypted secret, returns NULL on failure. */
+    void *(*decrypt)(void *context, void *item, void *key, void *encryptedSecret);
+
+    /** Encrypts and stores a secret. */
+    bool (*store)(void *context, void *item, void *key, void *secret);
+
+    /** Releases a value returned by derive, load or decrypt, wiping it if needed. */
+    void (*release)(void *context, void *value);
+} PINSecretStore;
+
+/**
+ * Called once per request, with the decrypted secret for a successful load
+ * (owned by the completion, free it with the release stage), NULL otherwise.
+ */
+typedef void (*PINUnlockCompletion)(void *completionContext, PINUnlockStatus status, void *secret);
+
+typedef struct {
+    PINUnlockOperation operation;
+    void *item;
+    void *secret;                       // PINUnlockOperationStore only, not released by the queue
+    bool supersedes;                    // cancels all earlier superseding requests that are still pending
+    PINCancellationToken *token;        // optional, retained by the queue
+    PINUnlockCompletion completion;
+    void *completionContext;
+} PINUnlockRequest;
+
+/**
+ * Creates a cancellation token with a reference count of 1.
+ */
+PINCancellationToken *PINCancellationTokenCreate(void);
+
+/**
+ * Adds a reference to the token and returns it.
+ */
+PINCancellationToken *PINCancellationTokenRetain(PINCancellationToken *token);
+
+/**
+ * Drops a reference, freeing the token after the last one.
+ */
+void PINCancellationTokenRelease(PINCancellationToken *token);
+
+/**
+ * Cancels the token. Safe to call from any thread, more than once.
+ */
+void PINCancellationTokenCancel(PINCancellationToken *token);
+
+/**
+ * Whether the token has been cancelled. Cheap enough to poll in a loop.
+ */
+bool PINCancellationTokenIsCancelled(const PINCancellationToken *token);
+
+/**
+ * Creates a queue and starts its worker thread. The store is copied.
+ *
+ * @return the queue, NULL if the thread could not be started
+ */
+PINUnlockQueue *PINUnlockQueueCreate(const PINSecretStore *store);
+
+/**
+ * Cancels all pending requests, waits until they have completed and frees
+ * the queue. Must not be called from a completion.
+ */
+void PINUnlockQueueDestroy(PINUnlockQueue *queue);
+
+/**
+ * Submits a request. The request is copied; a request without a token gets
+ * one of its own.
+ *
+ * @return false if the queue could not accept the request, the completion is not called in that case
+ */
+bool PINUnlockQueueSubmit(PINUnlockQueue *queue, const PINUnlockRequest *request);
+
+/**
+ * Cancels all pending requests, including the one that is running.
+ */
+void PINUnlockQueueCancelAll(PINUnlockQueue *queue);
+
+#endif /* PINUnlockQueue_h */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SecretCipher.h"
+
+#include <errno.h>
+
+#if defined(__APPLE__)
+
+#include <CommonCrypto/CommonCryptor.h>
+
+int SecretCipherCrypt(SecretCipherOperation operation, const uint8_t *key, const uint8_t *initializationVector, const uint8_t *input, size_t length, uint8_t *output) {
+    if (key == NULL || length % SecretCipherBlockLength != 0 || (length != 0 && (input == NULL || output == NULL))) {
+        return EINVAL;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    
+    size_t moved = 0;
+    CCCryptorStatus status = CCCrypt(operation == SecretCipherOperationEncrypt ? kCCEncrypt : kCCDecrypt,
+                                     kCCAlgorithmAES128, 0, key, kCCKeySizeAES256, initializationVector,
+                                     input, length, output, length, &moved);
+    return status == kCCSuccess && moved == length ? 0 : EIO;
+}
+
+#else
+
+#include <openssl/evp.h>
+
+int SecretCipherCrypt(SecretCipherOperation operation, const uint8_t *key, const uint8_t *initializationVector, const uint8_t *input, size_t length, uint8_t *output) {
+    if (key == NULL || length % SecretCipherBlockLength != 0 || length > INT32_MAX || (length != 0 && (input == NULL || output == NULL))) {
+        return EINVAL;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    
+    static const uint8_t zeroes[SecretCipherBlockLength];
+    EVP_CIPHER_CTX *context = EVP_CIPHER_CTX_new();
+    if (context == NULL) {
+        return ENOMEM;
+    }
+    
+    int moved = 0, finalMoved = 0;
+    int success = EVP_CipherInit_ex(context, EVP_aes_256_cbc(), NULL, key, initializationVector != NULL ? initializationVector : zeroes,
+                                    operation == SecretCipherOperationEncrypt) == 1 &&
+                  EVP_CIPHER_CTX_set_padding(context, 0) == 1 &&
+                  EVP_CipherUpdate(context, output, &moved, input, (int)length) == 1 &&
+                  EVP_CipherFinal_ex(context, output + moved, &finalMoved) == 1;
+    EVP_CIPHER_CTX_free(context);
+    return success && (size_t)(moved + finalMoved) == length ? 0 : EIO;
+}
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SecretCipher_h
+#define SecretCipher_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * AES-256 in CBC mode without padding, the cipher the PIN protected
+ * secrets are stored with. CommonCrypto does the work on Apple platforms
+ * and libcrypto elsewhere, so the formats built on it can be tested off
+ * the device.
+ *
+ * There is deliberately no padding and no MAC: decrypting with the key of
+ * a wrong PIN gives a different secret rather than an error, so a copy of
+ * the keychain can't be used to guess the PIN offline.
+ *
+ * Functions return 0 or an errno value.
+ */
+
+#define SecretCipherKeyLength 32
+#define SecretCipherBlockLength 16
+
+typedef enum {
+    SecretCipherOperationEncrypt,
+    SecretCipherOperationDecrypt
+} SecretCipherOperation;
+
+/**
+ * Encrypts or decrypts whole blocks.
+ *
+ * @param operation             encrypt or decrypt
+ * @param key                   SecretCipherKeyLength bytes
+ * @param initializationVector  SecretCipherBlockLength bytes, NULL for zeroes
+ * @param input                 input
+ * @param length                length of the input, a multiple of SecretCipherBlockLength
+ * @param output                receives length bytes, may be the input
+ *
+ * @return 0, EINVAL for a partial block, or EIO when the cipher fails
+ */
+int SecretCipherCrypt(SecretCipherOperation operation, const uint8_t *key, const uint8_t *initializationVector, const uint8_t *input, size_t length, uint8_t *output);
+
+#endif /* SecretCipher_h */
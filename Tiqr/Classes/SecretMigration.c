@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SecretMigration.h"
+#include "HexCodec.h"
+#include "HMACKey.h"
+#include "PBKDF2.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct {
+    /** Item the key was derived for, NULL when the slot is free. */
+    const SecretMigrationItem *input;
+    uint8_t key[SecretCipherKeyLength];
+} SecretMigrationKeySlot;
+
+struct SecretMigrationPool {
+    size_t length;
+    size_t batchSize;
+    size_t keyCapacity;
+    size_t nextKeySlot;
+    SecretMigrationItem **batch;
+    uint8_t (*buffers)[SecretMigrationMaxSecretLength];
+    SecretMigrationKeySlot *keys;
+};
+
+int SecretMigrationPoolCreate(size_t batchSize, size_t keyCapacity, SecretMigrationPool **pool) {
+    if (batchSize == 0 || keyCapacity == 0 || batchSize > 4096 || keyCapacity > 4096) {
+        return EINVAL;
+    }
+
+    size_t buffersOffset = sizeof(SecretMigrationPool);
+    size_t keysOffset = buffersOffset + batchSize * SecretMigrationMaxSecretLength;
+    size_t batchOffset = keysOffset + keyCapacity * sizeof(SecretMigrationKeySlot);
+    size_t length = batchOffset + batchSize * sizeof(SecretMigrationItem *);
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t pageLength = pageSize > 0 ? (size_t)pageSize : 4096;
+    length = (length + pageLength - 1) / pageLength * pageLength;
+
+    uint8_t *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (memory == MAP_FAILED) {
+        return errno;
+    }
+    if (mlock(memory, length) != 0) {
+        int error = errno;
+        munmap(memory, length);
+        return error;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(memory, length, MADV_DONTDUMP);
+#endif
+
+    SecretMigrationPool *created = (SecretMigrationPool *)memory;
+    created->length = length;
+    created->batchSize = batchSize;
+    created->keyCapacity = keyCapacity;
+    created->buffers = (uint8_t (*)[SecretMigrationMaxSecretLength])(memory + buffersOffset);
+    created->keys = (SecretMigrationKeySlot *)(memory + keysOffset);
+    created->batch = (SecretMigrationItem **)(memory + batchOffset);
+    *pool = created;
+    return 0;
+}
+
+void SecretMigrationPoolDestroy(SecretMigrationPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    size_t length = pool->length;
+    HMACSecureZero(pool, length);
+    munlock(pool, length);
+    munmap(pool, length);
+}
+
+void SecretMigrationLegacyKey(const uint8_t *key, uint8_t *legacyKey) {
+    // What getCString made of the hex string, see -[SecretService encrypt:key:initializationVector:]
+    char hex[SecretCipherKeyLength * 2];
+    HexEncode(key, SecretCipherKeyLength, hex, HexCaseLower);
+    memcpy(legacyKey, hex, SecretCipherKeyLength);
+    legacyKey[0] = 0;
+    HMACSecureZero(hex, sizeof(hex));
+}
+
+static bool SecretMigrationSameInput(const SecretMigrationItem *a, const SecretMigrationItem *b) {
+    return a->rounds == b->rounds && a->PINLength == b->PINLength && a->saltLength == b->saltLength &&
+           memcmp(a->PIN, b->PIN, a->PINLength) == 0 && memcmp(a->salt, b->salt, a->saltLength) == 0;
+}
+
+/**
+ * Finds the key derived for the same input earlier in the run, or derives
+ * it into the oldest slot.
+ */
+static int SecretMigrationKey(SecretMigrationPool *pool, const SecretMigrationItem *item, const uint8_t **key, SecretMigrationStatistics *statistics) {
+    for (size_t i = 0; i < pool->keyCapacity && pool->keys[i].input != NULL; i++) {
+        if (SecretMigrationSameInput(pool->keys[i].input, item)) {
+            *key = pool->keys[i].key;
+            return 0;
+        }
+    }
+
+    SecretMigrationKeySlot *slot = &pool->keys[pool->nextKeySlot];
+    slot->input = NULL;
+    int result = PBKDF2Derive(HMACAlgorithmSHA256, item->PIN, item->PINLength, item->salt, item->saltLength, item->rounds, slot->key, sizeof(slot->key));
+    statistics->derivations++;
+    if (result != 0) {
+        return result;
+    }
+
+    slot->input = item;
+    pool->nextKeySlot = (pool->nextKeySlot + 1) % pool->keyCapacity;
+    *key = slot->key;
+    return 0;
+}
+
+static int SecretMigrationMigrateItem(SecretMigrationPool *pool, SecretMigrationItem *item, uint8_t *buffer, SecretMigrationStatistics *statistics) {
+    if (item->PIN == NULL || item->salt == NULL || item->rounds == 0 || item->secret == NULL || item->secretLength == 0 ||
+        item->secretLength > SecretMigrationMaxSecretLength || item->secretLength % SecretCipherBlockLength != 0) {
+        return EINVAL;
+    }
+
+    const uint8_t *key;
+    int result = SecretMigrationKey(pool, item, &key, statistics);
+    if (result != 0) {
+        return result;
+    }
+
+    uint8_t legacyKey[SecretCipherKeyLength];
+    SecretMigrationLegacyKey(key, legacyKey);
+    result = SecretCipherCrypt(SecretCipherOperationDecrypt, legacyKey, item->initializationVector, item->secret, item->secretLength, buffer);
+    HMACSecureZero(legacyKey, sizeof(legacyKey));
+    if (result == 0) {
+        result = SecretCipherCrypt(SecretCipherOperationEncrypt, key, item->initializationVector, buffer, item->secretLength, item->migratedSecret);
+    }
+    return result;
+}
+
+int SecretMigrationRun(SecretMigrationPool *pool, SecretMigrationItem *items, size_t count,
+                       SecretMigrationWriteFunction write, void *context, SecretMigrationStatistics *statistics) {
+    SecretMigrationStatistics counters = { 0 };
+    int error = 0;
+    for (size_t i = 0; i < count; i++) {
+        items[i].result = ECANCELED;
+    }
+
+    for (size_t start = 0; start < count && error == 0; start += pool->batchSize) {
+        size_t batchCount = count - start < pool->batchSize ? count - start : pool->batchSize;
+        size_t migrated = 0;
+        for (size_t i = 0; i < batchCount; i++) {
+            SecretMigrationItem *item = &items[start + i];
+            item->result = SecretMigrationMigrateItem(pool, item, pool->buffers[i], &counters);
+            if (item->result == 0) {
+                pool->batch[migrated++] = item;
+            } else {
+                counters.failed++;
+            }
+        }
+        HMACSecureZero(pool->buffers, batchCount * SecretMigrationMaxSecretLength);
+
+        if (migrated > 0) {
+            error = write(context, pool->batch, migrated);
+            counters.batches++;
+            for (size_t i = 0; i < migrated; i++) {
+                if (error != 0 && pool->batch[i]->result == 0) {
+                    pool->batch[i]->result = error;
+                }
+                if (pool->batch[i]->result == 0) {
+                    counters.migrated++;
+                } else {
+                    counters.failed++;
+                }
+            }
+        }
+    }
+
+    // Keys only serve one run
+    HMACSecureZero(pool->keys, pool->keyCapacity * sizeof(SecretMigrationKeySlot));
+    pool->nextKeySlot = 0;
+    if (statistics != NULL) {
+        *statistics = counters;
+    }
+    return error;
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SecretMigration_h
+#define SecretMigration_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SecretCipher.h"
+
+/*
+ * Moves PIN protected secrets from the version 3 format to version 4.
+ *
+ * Version 3 encrypts with the lower case hex string of the PBKDF2 output:
+ * the first 32 characters, with the first one replaced by a zero byte, are
+ * used as the AES-256 key. Version 4 uses the 32 bytes of PBKDF2 output
+ * themselves. Both use SecretCipher with the initialization vector of the
+ * identity and the same salt and rounds, so migrating a secret takes one
+ * derivation, a decryption and an encryption.
+ *
+ * A run derives once per distinct PIN, salt and round count, decrypts into
+ * the locked buffers of a pool, which are zeroed after every batch, and
+ * hands the re-encrypted secrets to a write function a batch at a time so
+ * the keychain can be updated in one go.
+ *
+ * There is no way to tell whether a PIN was right: a secret migrated with
+ * a wrong PIN is lost. Only migrate secrets whose PIN was just accepted.
+ *
+ * Functions return 0 or an errno value.
+ */
+
+typedef struct SecretMigrationPool SecretMigrationPool;
+
+/**
+ * Longest secret a pool buffer holds, in bytes.
+ */
+#define SecretMigrationMaxSecretLength 64
+
+typedef struct {
+    const uint8_t *PIN;
+    size_t PINLength;
+    const uint8_t *salt;
+    size_t saltLength;
+    uint32_t rounds;
+    /** SecretCipherBlockLength bytes, NULL for zeroes. */
+    const uint8_t *initializationVector;
+    /** Version 3 secret, a multiple of SecretCipherBlockLength long. */
+    const uint8_t *secret;
+    size_t secretLength;
+    /** Receives the version 4 secret, secretLength bytes. */
+    uint8_t migratedSecret[SecretMigrationMaxSecretLength];
+    /** Set by the run: 0 once the migrated secret was written. */
+    int result;
+    /** Free for the caller, to find its identity in the write function. */
+    void *context;
+} SecretMigrationItem;
+
+typedef struct {
+    /** PBKDF2 runs. */
+    size_t derivations;
+    /** Secrets migrated and written. */
+    size_t migrated;
+    /** Secrets that couldn't be migrated or written. */
+    size_t failed;
+    /** Calls to the write function. */
+    size_t batches;
+} SecretMigrationStatistics;
+
+/**
+ * Stores a batch of migrated secrets.
+ *
+ * Set the result of an item that couldn't be stored to an error, or return
+ * an error to stop the run, which fails the whole batch.
+ *
+ * @param context  context passed to SecretMigrationRun
+ * @param items    the items of the batch that were migrated
+ * @param count    number of items
+ *
+ * @return 0, or an error that stops the run
+ */
+typedef int (*SecretMigrationWriteFunction)(void *context, SecretMigrationItem *const *items, size_t count);
+
+/**
+ * Creates a pool in locked memory.
+ *
+ * @param batchSize    number of secrets per batch
+ * @param keyCapacity  number of derived keys kept during a run, when a run
+ *                     has more distinct inputs the oldest key is dropped
+ * @param pool         set to the new pool
+ *
+ * @return 0, EINVAL, or the error of allocating or locking the memory
+ */
+int SecretMigrationPoolCreate(size_t batchSize, size_t keyCapacity, SecretMigrationPool **pool);
+
+/**
+ * Zeroes the pool and releases its memory.
+ */
+void SecretMigrationPoolDestroy(SecretMigrationPool *pool);
+
+/**
+ * Migrates the items, setting the result of each.
+ *
+ * Items that can't be migrated get EINVAL, or the error of the cipher or
+ * the derivation, and are left out of their batch. When the write
+ * function fails the items of its batch get its error and the items after
+ * it ECANCELED. A pool runs one migration at a time.
+ *
+ * @param pool        pool
+ * @param items       items
+ * @param count       number of items
+ * @param write       stores a batch
+ * @param context     passed to write
+ * @param statistics  receives the counters of the run, may be NULL
+ *
+ * @return 0, or the error of the write function that stopped the run
+ */
+int SecretMigrationRun(SecretMigrationPool *pool, SecretMigrationItem *items, size_t count,
+                       SecretMigrationWriteFunction write, void *context, SecretMigrationStatistics *statistics);
+
+/**
+ * Derives the version 3 cipher key from the PBKDF2 output.
+ *
+ * @param key        SecretCipherKeyLength bytes of PBKDF2-HMAC-SHA256 output
+ * @param legacyKey  receives SecretCipherKeyLength bytes
+ */
+void SecretMigrationLegacyKey(const uint8_t *key, uint8_t *legacyKey);
+
+#endif /* SecretMigration_h */
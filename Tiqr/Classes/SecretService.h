@@ -29,6 +29,8 @@
 
 #import <Foundation/Foundation.h>
 
+#import "SecretStoreBackend.h"
+
 typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
     SecretServiceBiometricTypeNone,
     SecretServiceBiometricTypeTouchID,
@@ -37,8 +39,40 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
 
 @class Identity;
 
+/**
+ * Handle for an asynchronous PIN operation, cancelling it aborts the key
+ * derivation and skips the remaining steps.
+ */
+@interface SecretServiceCancellationToken : NSObject
+
+/**
+ * Whether the operation has been cancelled.
+ */
+@property (nonatomic, assign, readonly, getter=isCancelled) BOOL cancelled;
+
+/**
+ * Cancels the operation, its completion handler will report it as cancelled.
+ */
+- (void)cancel;
+
+@end
+
 @interface SecretService : NSObject
 
+/**
+ * Creates a service that keeps the secrets in the keychain.
+ */
+- (instancetype)init;
+
+/**
+ * Creates a service that keeps the secrets in the given store, for example
+ * a SecretStoreFile to exercise the secret lifecycle without a keychain.
+ * Biometric secrets always use the keychain.
+ *
+ * @param secretStore  operations of the store, copied; the store must outlive the service
+ */
+- (instancetype)initWithSecretStore:(const SecretStoreBackend *)secretStore;
+
 /** 
  * Indicates if biometrics are available (Touch or ID face ID)
  *
@@ -53,6 +87,100 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
  */
 @property (nonatomic, assign, readonly) SecretServiceBiometricType biometricType;
 
+/**
+ * PBKDF2 rounds that make unlocking an identity take about 100 ms on this
+ * device.
+ *
+ * Measured once per launch on a background queue, started when the service
+ * is created. Never blocks: until the measurement is done this returns the
+ * rounds measured on an earlier launch, or the fixed legacy rounds on the
+ * first launch. Secrets wrapped with those are re-wrapped after a login.
+ */
+@property (nonatomic, assign, readonly) NSUInteger keyDerivationRounds;
+
+/**
+ * Waits for the measurement of keyDerivationRounds on a background queue,
+ * and starts it if that hasn't happened yet.
+ *
+ * @param completionHandler  called on the main queue with keyDerivationRounds,
+ *                           may be nil
+ */
+- (void)calibrateKeyDerivationRoundsWithCompletionHandler:(void (^)(NSUInteger rounds))completionHandler;
+
+/**
+ * PBKDF2 rounds the PIN protected secret of the identity is wrapped with,
+ * according to the identity.
+ *
+ * @param identity  identity
+ *
+ * @return rounds
+ */
+- (NSUInteger)keyDerivationRoundsForIdentity:(Identity *)identity;
+
+/**
+ * Whether new secrets are stored under the key hierarchy.
+ *
+ * The PIN then derives a key encryption key with a salt shared by all
+ * identities on the device, and every identity gets a random data key
+ * wrapped under it. Identities that share a PIN share the key encryption
+ * key, so together with the derived key cache one derivation unlocks all
+ * of them. Secrets stored before keep working and move over when they are
+ * wrapped again. Enabled when the Info.plist sets TIQRKeyHierarchyEnabled.
+ */
+@property (nonatomic, assign, readonly) BOOL keyHierarchyEnabled;
+
+/**
+ * PBKDF2 rounds new secrets are wrapped with: the rounds of the key
+ * encryption key under the key hierarchy, keyDerivationRounds otherwise.
+ */
+@property (nonatomic, assign, readonly) NSUInteger keyDerivationRoundsForNewSecrets;
+
+/**
+ * PBKDF2 rounds of the key encryption key, replaced by the calibrated
+ * rounds when they are well off.
+ *
+ * @param calibratedRounds  keyDerivationRounds
+ *
+ * @return rounds to wrap secrets under the key hierarchy with
+ */
+- (NSUInteger)keyEncryptionKeyRoundsForCalibratedRounds:(NSUInteger)calibratedRounds;
+
+/**
+ * Whether the stored secret of the identity is under the key hierarchy.
+ *
+ * @param identity  identity
+ *
+ * @return whether the secret is wrapped by a key encryption key
+ */
+- (BOOL)secretUsesKeyHierarchyForIdentity:(Identity *)identity;
+
+/**
+ * Counters of the derived key cache (hits, misses, insertions, evictions,
+ * expirations and wipes), nil when the cache is disabled.
+ *
+ * The cache keeps PIN derived keys in locked memory for a few seconds, so
+ * back-to-back logins don't derive the key twice. It is disabled unless the
+ * Info.plist sets TIQRDerivedKeyCacheTimeToLive (seconds), and optionally
+ * TIQRDerivedKeyCacheMaximumUses.
+ */
+@property (nonatomic, copy, readonly) NSDictionary *derivedKeyCacheMetrics;
+
+/**
+ * Counters of the secure arena that holds derived keys and decrypted
+ * secrets (capacity, inUse, peakInUse, allocations, releases and
+ * exhaustions, see SecureArena.h), nil when it could not be locked.
+ *
+ * Exhaustions count the allocations that fell back to the heap; a login
+ * needs none.
+ */
+@property (nonatomic, copy, readonly) NSDictionary *secureArenaMetrics;
+
+/**
+ * Forgets all cached PIN derived keys, call this when the app goes to the
+ * background or a response is rejected.
+ */
+- (void)wipeDerivedKeys;
+
 /**
  * Generate a new random secret.
  *
@@ -61,7 +189,8 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
 - (NSData *)generateSecret;
 
 /**
- * Deletes the secret for the supplied identity from the Keychain.
+ * Deletes the secret for the supplied identity from the secret store and
+ * its biometric secret from the keychain.
  *
  * @param identityIdentifier identity identifier
  * @param providerIdentifier provider identifier
@@ -70,6 +199,16 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
  */
 - (BOOL)deleteSecretForIdentityIdentifier:(NSString *)identityIdentifier providerIdentifier:(NSString *)providerIdentifier;
 
+/**
+ * Deletes the secrets and biometric secrets of all identities of a
+ * provider, in one store operation instead of two per identity.
+ *
+ * @param providerIdentifier provider identifier
+ *
+ * @return whether deleting the secrets was successful or not
+ */
+- (BOOL)deleteSecretsForProviderIdentifier:(NSString *)providerIdentifier;
+
 /**
  * Sets the secret, encrypted with the given PIN.
  *
@@ -96,6 +235,76 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
  */
 - (BOOL)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN;
 
+/**
+ * Sets the secret, encrypted with the given PIN, without blocking the caller.
+ *
+ * The PIN key derivation runs on a background queue. Uses the salt and
+ * initializationVector from the supplied Identity.
+ *
+ * @param secret    secret
+ * @param identity  identity
+ * @param PIN       PIN
+ * @param completionHandler  called on the main queue when the operation is completed
+ *
+ * @return token to cancel the operation
+ */
+- (SecretServiceCancellationToken *)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN completionHandler:(void (^)(BOOL success, BOOL cancelled))completionHandler;
+
+/**
+ * Sets the secret, encrypted with the given PIN, salt and initializationVector,
+ * without blocking the caller.
+ *
+ * For secrets that move to a new salt, e.g. when upgrading an identity. Only
+ * store the salt and initializationVector in the identity when this succeeds.
+ *
+ * @param secret    secret
+ * @param identity  identity
+ * @param PIN       PIN
+ * @param salt      salt
+ * @param initializationVector  initializationVector
+ * @param completionHandler  called on the main queue when the operation is completed
+ *
+ * @return token to cancel the operation
+ */
+- (SecretServiceCancellationToken *)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector completionHandler:(void (^)(BOOL success, BOOL cancelled))completionHandler;
+
+/**
+ * Wraps the secret again with a different number of PBKDF2 rounds, without
+ * blocking the caller. The salt and initializationVector stay the same.
+ *
+ * The keychain item records the rounds along with the secret, so the
+ * secret stays readable if the app quits before the identity is saved;
+ * store the rounds in the identity when this succeeds. The PIN is not
+ * verified, only call this after it was accepted by the server.
+ *
+ * When the key hierarchy is enabled the secret is wrapped under it instead,
+ * with the rounds of the key encryption key.
+ *
+ * @param identity  identity
+ * @param PIN       PIN
+ * @param rounds    new number of rounds
+ * @param completionHandler  called on the main queue when the operation is completed
+ *
+ * @return token to cancel the operation
+ */
+- (SecretServiceCancellationToken *)rewrapSecretForIdentity:(Identity *)identity withPIN:(NSString *)PIN rounds:(NSUInteger)rounds completionHandler:(void (^)(BOOL success))completionHandler;
+
+/**
+ * Re-encrypts version 3 secrets with the binary PBKDF2 output instead of
+ * its hex string (version 4), in the background.
+ *
+ * Derives once per distinct PIN and salt and writes the keychain in
+ * batches. The keychain item records the format along with the secret, so
+ * secrets that are already version 4 count as migrated without deriving.
+ * There is no way to tell whether a PIN is right and a secret migrated
+ * with a wrong PIN is lost, only pass PINs the server just accepted.
+ *
+ * @param identities  identities of version 3
+ * @param PINs        the PIN of each identity
+ * @param completionHandler  called on the main queue with the identities whose secret is version 4 now
+ */
+- (void)migrateSecretsOfIdentities:(NSArray *)identities PINs:(NSArray *)PINs completionHandler:(void (^)(NSArray *migratedIdentities))completionHandler;
+
 /**
  * Attempts to store the secret on the Secure Enclave of the device using TouchID
  *
@@ -131,6 +340,36 @@ typedef NS_ENUM(NSInteger, SecretServiceBiometricType) {
  */
 - (NSData *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN;
 
+/**
+ * Decrypts the secret with the given PIN without blocking the caller.
+ *
+ * The PIN key derivation, loading and decryption run on a background queue.
+ * A new request cancels earlier decryption requests that are still pending,
+ * so only the most recent PIN is derived.
+ *
+ * @param identity  identity
+ * @param PIN       PIN
+ * @param salt      salt
+ * @param initializationVector  initializationVector
+ * @param completionHandler  called on the main queue with the decrypted secret (nil on failure)
+ *
+ * @return token to cancel the operation
+ */
+- (SecretServiceCancellationToken *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector completionHandler:(void (^)(NSData *secret, BOOL cancelled))completionHandler;
+
+/**
+ * Decrypts the secret with the given PIN without blocking the caller.
+ *
+ * Uses the salt and initializationVector from the supplied Identity
+ *
+ * @param identity  identity
+ * @param PIN       PIN
+ * @param completionHandler  called on the main queue with the decrypted secret (nil on failure)
+ *
+ * @return token to cancel the operation
+ */
+- (SecretServiceCancellationToken *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN completionHandler:(void (^)(NSData *secret, BOOL cancelled))completionHandler;
+
 /**
  * Attempts to use TouchID to fetch the secret for an identity
  *
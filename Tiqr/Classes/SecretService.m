@@ -30,18 +30,355 @@
 #import <Security/Security.h>
 #import <CommonCrypto/CommonCryptor.h>
 #import <CommonCrypto/CommonHMAC.h>
-#import <CommonCrypto/CommonKeyDerivation.h>
 #import <LocalAuthentication/LocalAuthentication.h>
 
 #import "SecretService.h"
 #import "Identity.h"
 #import "IdentityProvider.h"
+#import "HexCodec.h"
+#import "NSData+Secure.h"
+#import "SecureArena.h"
+#import "PINUnlockQueue.h"
+#import "PBKDF2.h"
+#import "PBKDF2Calibration.h"
+#import "DerivedKeyCache.h"
+#import "KeyHierarchy.h"
+#import "SecretMigration.h"
+#import "SecretStoreKeychain.h"
 
 #define kChosenCipherKeySize kCCKeySizeAES256
 
+// Unlocking an identity should take about this long on any device
+#define kKeyDerivationMilliseconds 100
+
+// Calculated once using: CCCalibratePBKDF(kCCPBKDF2, PINData.length, saltData.length, kCCPRFHmacAlgSHA256, 32, 100);
+// used for identities that predate the per device calibration
+#define kLegacyKeyDerivationRounds 32894
+
+// Rounds measured on an earlier launch, used until this launch's measurement is done
+#define kKeyDerivationRoundsDefaultsKey @"TIQRKeyDerivationRounds"
+
+// Keychain item with the salt of the key encryption key, its generic
+// attribute holds the rounds like it does for secrets
+#define kKeyHierarchyService @"tiqr.key-hierarchy"
+#define kKeyHierarchyDeviceSaltAccount @"device-salt"
+
+// Item type of secrets encrypted with the PBKDF2 output itself (identity
+// version 4), secrets encrypted with its hex string (version 3) have none
+#define kBinaryKeyItemType 4
+
+// Secrets migrated to version 4 per batch of keychain writes
+#define kMigrationBatchSize 16
+
+@interface SecretServiceCancellationToken ()
+
+@property (nonatomic, assign, readonly) PINCancellationToken *token;
+
+@end
+
+@implementation SecretServiceCancellationToken
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _token = PINCancellationTokenCreate();
+        if (_token == NULL) {
+            return nil;
+        }
+    }
+    
+    return self;
+}
+
+- (void)dealloc {
+    PINCancellationTokenRelease(_token);
+}
+
+- (BOOL)isCancelled {
+    return PINCancellationTokenIsCancelled(self.token);
+}
+
+- (void)cancel {
+    PINCancellationTokenCancel(self.token);
+}
+
+@end
+
+/**
+ * Everything a PIN operation needs, captured on the calling thread so the
+ * background queue never touches the (managed) Identity.
+ */
+@interface SecretServicePINRequest : NSObject
+
+@property (nonatomic, copy) NSString *PIN;
+@property (nonatomic, copy) NSData *salt;
+@property (nonatomic, copy) NSData *initializationVector;
+@property (nonatomic, copy) NSString *service;
+@property (nonatomic, copy) NSString *account;
+@property (nonatomic, copy) NSData *secret;
+@property (nonatomic, assign) NSUInteger rounds;
+@property (nonatomic, assign) BOOL wrapped;
+@property (nonatomic, assign) BOOL binaryKey;
+@property (nonatomic, copy) NSData *deviceSalt;
+@property (nonatomic, copy) void (^completionHandler)(PINUnlockStatus status, NSData *secret);
+
+@end
+
+@implementation SecretServicePINRequest
+
+@end
+
+/**
+ * The version 3 secrets of a migration and where they are stored,
+ * captured on the calling thread like a PIN request.
+ */
+@interface SecretServiceMigration : NSObject
+
+@property (nonatomic, strong) SecretService *secretService;
+@property (nonatomic, strong) NSMutableArray *services;
+@property (nonatomic, strong) NSMutableArray *accounts;
+@property (nonatomic, strong) NSMutableArray *PINs;
+@property (nonatomic, strong) NSMutableArray *salts;
+@property (nonatomic, strong) NSMutableArray *initializationVectors;
+@property (nonatomic, strong) NSMutableArray *rounds;
+
+@end
+
+@implementation SecretServiceMigration
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        _services = [NSMutableArray array];
+        _accounts = [NSMutableArray array];
+        _PINs = [NSMutableArray array];
+        _salts = [NSMutableArray array];
+        _initializationVectors = [NSMutableArray array];
+        _rounds = [NSMutableArray array];
+    }
+    
+    return self;
+}
+
+@end
+
+@interface SecretService ()
+
+@property (nonatomic, assign) SecretStoreBackend store;
+@property (nonatomic, assign) BOOL keychainStore;
+@property (nonatomic, assign) PINUnlockQueue *unlockQueue;
+@property (nonatomic, assign) DerivedKeyCache *derivedKeyCache;
+@property (nonatomic, assign) uint32_t derivedKeyCacheTimeToLive;
+@property (nonatomic, assign, readwrite) BOOL keyHierarchyEnabled;
+@property (nonatomic, copy) NSData *deviceSalt;
+@property (nonatomic, assign) NSUInteger deviceKeyDerivationRounds;
+@property (atomic, assign) NSUInteger calibratedKeyDerivationRounds;
+@property (nonatomic, strong) dispatch_queue_t calibrationQueue;
+@property (nonatomic, assign) BOOL calibrated;
+
+- (NSData *)deviceSaltCreatingIfNeeded:(BOOL)create rounds:(NSUInteger *)rounds;
+- (NSData *)keyEncryptionKeyForPIN:(NSString *)PIN deviceSalt:(NSData *)deviceSalt rounds:(NSUInteger)rounds cancellationToken:(const PINCancellationToken *)token;
+- (NSData *)generateKey;
+- (NSData *)secureDataForPIN:(NSString *)PIN;
+- (NSData *)keyForPIN:(NSString *)PIN salt:(NSData *)salt rounds:(NSUInteger)rounds service:(NSString *)service account:(NSString *)account cancellationToken:(const PINCancellationToken *)token;
+- (NSData *)binaryKeyForPIN:(NSString *)PIN salt:(NSData *)salt rounds:(NSUInteger)rounds service:(NSString *)service account:(NSString *)account cancellationToken:(const PINCancellationToken *)token;
+- (NSData *)encrypt:(NSData *)data key:(NSData *)key initializationVector:(NSData *)initializationVector;
+- (NSData *)decrypt:(NSData *)data key:(NSData *)key initializationVector:(NSData *)initializationVector;
+- (NSData *)encrypt:(NSData *)data binaryKey:(NSData *)key initializationVector:(NSData *)initializationVector;
+- (NSData *)decrypt:(NSData *)data binaryKey:(NSData *)key initializationVector:(NSData *)initializationVector;
+- (NSData *)wrapSecret:(NSData *)secret keyEncryptionKey:(NSData *)keyEncryptionKey initializationVector:(NSData *)initializationVector;
+- (NSData *)unwrapSecret:(NSData *)wrappedSecret keyEncryptionKey:(NSData *)keyEncryptionKey initializationVector:(NSData *)initializationVector;
+- (NSData *)loadSecretForService:(NSString *)service account:(NSString *)account rounds:(NSUInteger *)rounds binaryKey:(BOOL *)binaryKey;
+- (BOOL)updateSecret:(NSData *)secret rounds:(NSUInteger)rounds binaryKey:(BOOL)binaryKey service:(NSString *)service account:(NSString *)account;
+- (BOOL)updateOrStoreSecret:(NSData *)secret rounds:(NSUInteger)rounds binaryKey:(BOOL)binaryKey service:(NSString *)service account:(NSString *)account;
+
+@end
+
+#pragma mark - PIN unlock queue stages
+
+static bool SecretServiceDerivationCancelled(const void *context) {
+    return PINCancellationTokenIsCancelled(context);
+}
+
+static void *SecretServiceDeriveKey(void *context, void *item, const PINCancellationToken *token) {
+    SecretService *secretService = (__bridge SecretService *)context;
+    SecretServicePINRequest *request = (__bridge SecretServicePINRequest *)item;
+    if (request.wrapped) {
+        return (void *)CFBridgingRetain([secretService keyEncryptionKeyForPIN:request.PIN deviceSalt:request.deviceSalt rounds:request.rounds cancellationToken:token]);
+    } else if (request.binaryKey) {
+        return (void *)CFBridgingRetain([secretService binaryKeyForPIN:request.PIN salt:request.salt rounds:request.rounds service:request.service account:request.account cancellationToken:token]);
+    }
+    return (void *)CFBridgingRetain([secretService keyForPIN:request.PIN salt:request.salt rounds:request.rounds service:request.service account:request.account cancellationToken:token]);
+}
+
+static void *SecretServiceLoadSecret(void *context, void *item) {
+    SecretService *secretService = (__bridge SecretService *)context;
+    SecretServicePINRequest *request = (__bridge SecretServicePINRequest *)item;
+    NSUInteger rounds = request.rounds;
+    BOOL binaryKey = NO;
+    NSData *encryptedSecret = [secretService loadSecretForService:request.service account:request.account rounds:&rounds binaryKey:&binaryKey];
+    request.rounds = rounds;
+    request.binaryKey = binaryKey;
+    
+    // The stored secret decides which key to derive, whatever new secrets use
+    request.wrapped = KeyHierarchyIsWrapped(encryptedSecret.bytes, encryptedSecret.length);
+    if (request.wrapped) {
+        request.deviceSalt = [secretService deviceSaltCreatingIfNeeded:NO rounds:NULL];
+    }
+    return (void *)CFBridgingRetain(encryptedSecret);
+}
+
+static void *SecretServiceDecryptSecret(void *context, void *item, void *key, void *encryptedSecret) {
+    SecretService *secretService = (__bridge SecretService *)context;
+    SecretServicePINRequest *request = (__bridge SecretServicePINRequest *)item;
+    if (request.wrapped) {
+        return (void *)CFBridgingRetain([secretService unwrapSecret:(__bridge NSData *)encryptedSecret keyEncryptionKey:(__bridge NSData *)key initializationVector:request.initializationVector]);
+    } else if (request.binaryKey) {
+        return (void *)CFBridgingRetain([secretService decrypt:(__bridge NSData *)encryptedSecret binaryKey:(__bridge NSData *)key initializationVector:request.initializationVector]);
+    }
+    return (void *)CFBridgingRetain([secretService decrypt:(__bridge NSData *)encryptedSecret key:(__bridge NSData *)key initializationVector:request.initializationVector]);
+}
+
+static bool SecretServiceStoreSecret(void *context, void *item, void *key, void *secret) {
+    SecretService *secretService = (__bridge SecretService *)context;
+    SecretServicePINRequest *request = (__bridge SecretServicePINRequest *)item;
+    NSData *encryptedSecret;
+    if (request.wrapped) {
+        encryptedSecret = [secretService wrapSecret:(__bridge NSData *)secret keyEncryptionKey:(__bridge NSData *)key initializationVector:request.initializationVector];
+    } else if (request.binaryKey) {
+        encryptedSecret = [secretService encrypt:(__bridge NSData *)secret binaryKey:(__bridge NSData *)key initializationVector:request.initializationVector];
+    } else {
+        encryptedSecret = [secretService encrypt:(__bridge NSData *)secret key:(__bridge NSData *)key initializationVector:request.initializationVector];
+    }
+    return encryptedSecret != nil && [secretService updateOrStoreSecret:encryptedSecret rounds:request.rounds binaryKey:request.binaryKey service:request.service account:request.account];
+}
+
+static void SecretServiceReleaseValue(void *context, void *value) {
+    CFRelease(value);
+}
+
+static void SecretServiceCompleteRequest(void *completionContext, PINUnlockStatus status, void *secret) {
+    SecretServicePINRequest *request = CFBridgingRelease(completionContext);
+    NSData *result = CFBridgingRelease(secret);
+    dispatch_async(dispatch_get_main_queue(), ^{
+        request.completionHandler(status, result);
+    });
+}
+
+static int SecretServiceWriteMigratedSecrets(void *context, SecretMigrationItem *const *items, size_t count) {
+    SecretServiceMigration *migration = (__bridge SecretServiceMigration *)context;
+    for (size_t i = 0; i < count; i++) {
+        NSUInteger index = (NSUInteger)(uintptr_t)items[i]->context;
+        NSData *secret = [NSData dataWithBytes:items[i]->migratedSecret length:items[i]->secretLength];
+        if (![migration.secretService updateSecret:secret rounds:[migration.rounds[index] unsignedIntegerValue] binaryKey:YES
+                                           service:migration.services[index] account:migration.accounts[index]]) {
+            items[i]->result = EIO;
+        }
+    }
+    return 0;
+}
 
 @implementation SecretService
 
+- (instancetype)init {
+    SecretStoreBackend keychain;
+    SecretStoreKeychainGetBackend(&keychain);
+    self = [self initWithSecretStore:&keychain];
+    if (self != nil) {
+        _keychainStore = YES;
+    }
+    
+    return self;
+}
+
+- (instancetype)initWithSecretStore:(const SecretStoreBackend *)secretStore {
+    self = [super init];
+    if (self != nil) {
+        _store = *secretStore;
+        PINSecretStore store = {
+            .context = (__bridge void *)self,
+            .derive = SecretServiceDeriveKey,
+            .load = SecretServiceLoadSecret,
+            .decrypt = SecretServiceDecryptSecret,
+            .store = SecretServiceStoreSecret,
+            .release = SecretServiceReleaseValue
+        };
+        _unlockQueue = PINUnlockQueueCreate(&store);
+        
+        // Keys and secrets live in the secure arena, set it up before the first login
+        if (SecureArenaShared() == NULL) {
+            NSLog(@"Could not lock the secure arena, key material uses the heap");
+        }
+        
+        // Opt-in, the keys stay in memory for the configured number of seconds
+        NSNumber *timeToLive = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"TIQRDerivedKeyCacheTimeToLive"];
+        NSNumber *maximumUses = [[NSBundle mainBundle] objectForInfoDictionaryKey:@"TIQRDerivedKeyCacheMaximumUses"];
+        if (timeToLive.doubleValue > 0) {
+            DerivedKeyCachePolicy policy = {
+                .timeToLive = (uint32_t)MIN(timeToLive.doubleValue * 1000, UINT32_MAX),
+                .maximumUses = maximumUses.unsignedIntValue
+            };
+            _derivedKeyCacheTimeToLive = policy.timeToLive;
+            int error = DerivedKeyCacheCreate(&policy, &_derivedKeyCache);
+            if (error != 0) {
+                NSLog(@"Error %d creating the derived key cache", error);
+            }
+        }
+        
+        // Opt-in, secrets stored from now on share a key encryption key
+        _keyHierarchyEnabled = [[[NSBundle mainBundle] objectForInfoDictionaryKey:@"TIQRKeyHierarchyEnabled"] boolValue];
+        
+        // Measured at launch, so enrolling or unlocking never waits for it
+        _calibratedKeyDerivationRounds = (NSUInteger)MAX([[NSUserDefaults standardUserDefaults] integerForKey:kKeyDerivationRoundsDefaultsKey], 0);
+        _calibrationQueue = dispatch_queue_create("org.tiqr.key-derivation-calibration", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0));
+        [self calibrateKeyDerivationRoundsWithCompletionHandler:nil];
+    }
+    
+    return self;
+}
+
+- (void)dealloc {
+    PINUnlockQueueDestroy(_unlockQueue);
+    DerivedKeyCacheDestroy(_derivedKeyCache);
+}
+
+- (void)wipeDerivedKeys {
+    if (self.derivedKeyCache != NULL) {
+        DerivedKeyCacheWipe(self.derivedKeyCache);
+    }
+}
+
+- (NSDictionary *)derivedKeyCacheMetrics {
+    if (self.derivedKeyCache == NULL) {
+        return nil;
+    }
+    
+    DerivedKeyCacheMetrics metrics;
+    DerivedKeyCacheGetMetrics(self.derivedKeyCache, &metrics);
+    return @{@"hits": @(metrics.hits),
+             @"misses": @(metrics.misses),
+             @"insertions": @(metrics.insertions),
+             @"evictions": @(metrics.evictions),
+             @"expirations": @(metrics.expirations),
+             @"wipes": @(metrics.wipes)};
+}
+
+- (NSDictionary *)secureArenaMetrics {
+    SecureArena *arena = SecureArenaShared();
+    if (arena == NULL) {
+        return nil;
+    }
+    
+    SecureArenaMetrics metrics;
+    SecureArenaGetMetrics(arena, &metrics);
+    return @{@"capacity": @(metrics.capacity),
+             @"inUse": @(metrics.inUse),
+             @"peakInUse": @(metrics.peakInUse),
+             @"allocations": @(metrics.allocations),
+             @"releases": @(metrics.releases),
+             @"exhaustions": @(metrics.exhaustions)};
+}
+
 - (SecretServiceBiometricType)biometricType {
     if (!NSClassFromString(@"LAContext")) {
         return SecretServiceBiometricTypeNone;
@@ -86,54 +423,57 @@
     }
 }
 
-- (NSData *)loadSecretForIdentity:(Identity *)identity {
-    NSMutableDictionary *query = [[NSMutableDictionary alloc] init];
-    query[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
-    query[(__bridge id)kSecAttrService] = identity.identityProvider.identifier;
-    query[(__bridge id)kSecAttrAccount] = identity.identifier;
-    query[(__bridge id)kSecMatchLimit] = (__bridge id)kSecMatchLimitOne;
-    query[(__bridge id)kSecReturnData] = (id)kCFBooleanTrue;
-    query[(__bridge id)kSecReturnAttributes] = (id)kCFBooleanTrue;
-    
-    CFDictionaryRef result;
-    if (SecItemCopyMatching((__bridge CFDictionaryRef)query, (CFTypeRef *)&result) == noErr) {
-        return (NSData *)((__bridge NSDictionary*)result)[(__bridge id)kSecValueData];
-    } else {
+/**
+ * The rounds a secret was wrapped with are kept in the attributes of its
+ * store item, so replacing the secret and its rounds is a single update
+ * that can't be torn by a crash before the identity is saved.
+ */
+- (NSData *)loadSecretForService:(NSString *)service account:(NSString *)account {
+    return [self loadSecretForService:service account:account rounds:NULL binaryKey:NULL];
+}
+
+- (NSData *)loadSecretForService:(NSString *)service account:(NSString *)account rounds:(NSUInteger *)rounds binaryKey:(BOOL *)binaryKey {
+    uint8_t buffer[SecretStoreMaxSecretLength];
+    size_t length = 0;
+    SecretStoreAttributes attributes;
+    if (self.store.load(self.store.context, service.UTF8String, account.UTF8String, buffer, sizeof(buffer), &length, &attributes) != 0) {
         return nil;
     }
+    
+    if (rounds != NULL && attributes.rounds != 0) {
+        *rounds = attributes.rounds;
+    }
+    if (binaryKey != NULL) {
+        *binaryKey = attributes.type == kBinaryKeyItemType;
+    }
+    NSData *secret = [NSData dataWithBytes:buffer length:length];
+    HMACSecureZero(buffer, length);
+    return secret;
 }
 
-- (BOOL)storeSecret:(NSData *)secret forIdentity:(Identity *)identity {
-    NSMutableDictionary *data = [[NSMutableDictionary alloc] init];
-    data[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
-    data[(__bridge id)kSecAttrService] = identity.identityProvider.identifier;
-    data[(__bridge id)kSecAttrAccount] = identity.identifier;
-    data[(__bridge id)kSecValueData] = secret;
-    data[(__bridge id)kSecAttrAccessible] = (__bridge id)kSecAttrAccessibleWhenUnlocked;
-    
-    CFDictionaryRef result;
-    OSStatus status = SecItemAdd((__bridge CFDictionaryRef)data, (CFTypeRef *)&result);
-    return status == noErr;
+- (BOOL)storeSecret:(NSData *)secret rounds:(NSUInteger)rounds binaryKey:(BOOL)binaryKey service:(NSString *)service account:(NSString *)account {
+    SecretStoreAttributes attributes = {
+        .rounds = (uint32_t)MIN(rounds, UINT32_MAX),
+        .type = binaryKey ? kBinaryKeyItemType : 0
+    };
+    return self.store.add(self.store.context, service.UTF8String, account.UTF8String, secret.bytes, secret.length, &attributes) == 0;
 }
 
-- (BOOL)updateSecret:(NSData *)secret forIdentity:(Identity *)identity  {
-    NSMutableDictionary *query = [[NSMutableDictionary alloc] init];
-    query[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
-    query[(__bridge id)kSecAttrService] = identity.identityProvider.identifier;
-    query[(__bridge id)kSecAttrAccount] = identity.identifier;
-    
-    NSMutableDictionary *data = [[NSMutableDictionary alloc] init];
-    data[(__bridge id)kSecValueData] = secret;
-    
-    return SecItemUpdate((__bridge CFDictionaryRef)query, (__bridge CFDictionaryRef)data) == noErr;
+- (BOOL)updateSecret:(NSData *)secret rounds:(NSUInteger)rounds binaryKey:(BOOL)binaryKey service:(NSString *)service account:(NSString *)account {
+    // The type goes together with the data, so the format always matches the secret
+    SecretStoreAttributes attributes = {
+        .rounds = (uint32_t)MIN(rounds, UINT32_MAX),
+        .type = binaryKey ? kBinaryKeyItemType : 0
+    };
+    return self.store.update(self.store.context, service.UTF8String, account.UTF8String, secret.bytes, secret.length, &attributes) == 0;
 }
 
-- (BOOL)updateOrStoreSecret:(NSData *)secret forIdentity:(Identity *)identity {
-    if ([self loadSecretForIdentity:identity] == nil) {
-        return [self storeSecret:secret forIdentity:identity];
-    } else {
-        return [self updateSecret:secret forIdentity:identity];
-    }
+- (BOOL)updateOrStoreSecret:(NSData *)secret rounds:(NSUInteger)rounds binaryKey:(BOOL)binaryKey service:(NSString *)service account:(NSString *)account {
+    SecretStoreAttributes attributes = {
+        .rounds = (uint32_t)MIN(rounds, UINT32_MAX),
+        .type = binaryKey ? kBinaryKeyItemType : 0
+    };
+    return SecretStoreUpsert(&_store, service.UTF8String, account.UTF8String, secret.bytes, secret.length, &attributes) == 0;
 }
 
 - (BOOL)deleteSecretForIdentityIdentifier:(NSString *)identityIdentifier providerIdentifier:(NSString *)providerIdentifier; {
@@ -141,69 +481,264 @@
     BOOL success = NO;
     
     // normal secret
+    success = self.store.remove(self.store.context, providerIdentifier.UTF8String, identityIdentifier.UTF8String) == 0;
+    
+    // biometric secret, always in the keychain, so a second round trip
     {
         NSMutableDictionary *query = [[NSMutableDictionary alloc] init];
         query[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
         query[(__bridge id)kSecAttrService] = providerIdentifier;
-        query[(__bridge id)kSecAttrAccount] = identityIdentifier;
+        query[(__bridge id)kSecAttrAccount] = [self biometricAccountValueForIdentifier: identityIdentifier];
         
         OSStatus status = SecItemDelete((__bridge CFDictionaryRef)query);
-        success = status == noErr;
+        success = success || status == noErr;
     }
     
-    // biometric secret
-    {
+    return success;
+}
+
+- (BOOL)deleteSecretsForProviderIdentifier:(NSString *)providerIdentifier {
+    BOOL success = self.store.removeAll(self.store.context, providerIdentifier.UTF8String) == 0;
+    
+    // The keychain store removed the biometric secrets along with the others
+    if (!self.keychainStore) {
         NSMutableDictionary *query = [[NSMutableDictionary alloc] init];
         query[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
         query[(__bridge id)kSecAttrService] = providerIdentifier;
-        query[(__bridge id)kSecAttrAccount] = [self biometricAccountValueForIdentifier: identityIdentifier];
         
         OSStatus status = SecItemDelete((__bridge CFDictionaryRef)query);
-        success = success || status == noErr;
+        success = success && (status == noErr || status == errSecItemNotFound);
     }
     
     return success;
 }
 
 - (NSData *)generateSecret {
-    uint8_t *bytes = malloc(kChosenCipherKeySize * sizeof(uint8_t));
-    memset((void *)bytes, 0x0, kChosenCipherKeySize);
-    OSStatus sanityCheck = SecRandomCopyBytes(kSecRandomDefault, kChosenCipherKeySize, bytes);
-    if (sanityCheck == noErr) {
-        NSData *secret = [[NSData alloc] initWithBytes:(const void *)bytes length:kChosenCipherKeySize];
-        return secret;
-    } else {
+    NSMutableData *secret = [NSMutableData dataWithLength:kChosenCipherKeySize];
+    OSStatus sanityCheck = SecRandomCopyBytes(kSecRandomDefault, kChosenCipherKeySize, secret.mutableBytes);
+    return sanityCheck == noErr ? secret : nil;
+}
+
+- (NSData *)generateKey {
+    uint8_t *bytes = NULL;
+    NSData *key = [NSData secureDataWithLength:kChosenCipherKeySize bytes:&bytes];
+    return key != nil && SecRandomCopyBytes(kSecRandomDefault, kChosenCipherKeySize, bytes) == noErr ? key : nil;
+}
+
+- (NSUInteger)keyDerivationRounds {
+    NSUInteger rounds = self.calibratedKeyDerivationRounds;
+    return rounds != 0 ? rounds : kLegacyKeyDerivationRounds;
+}
+
+- (void)calibrateKeyDerivationRoundsWithCompletionHandler:(void (^)(NSUInteger rounds))completionHandler {
+    dispatch_async(self.calibrationQueue, ^{
+        if (!self.calibrated) {
+            // A 4 digit PIN and a salt from generateSecret
+            PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, kChosenCipherKeySize, 32 };
+            uint32_t rounds = PBKDF2CalibrateRounds(&parameters, kKeyDerivationMilliseconds);
+            if (rounds != 0) {
+                self.calibratedKeyDerivationRounds = rounds;
+                [[NSUserDefaults standardUserDefaults] setInteger:rounds forKey:kKeyDerivationRoundsDefaultsKey];
+            }
+            self.calibrated = YES;
+        }
+        
+        if (completionHandler != nil) {
+            NSUInteger rounds = self.keyDerivationRounds;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completionHandler(rounds);
+            });
+        }
+    });
+}
+
+- (NSUInteger)keyDerivationRoundsForIdentity:(Identity *)identity {
+    NSUInteger rounds = identity.kdfRounds.unsignedIntegerValue;
+    return rounds != 0 ? rounds : kLegacyKeyDerivationRounds;
+}
+
+/**
+ * Wipes a cached key as soon as it expires, not only on the next lookup.
+ */
+- (void)scheduleDerivedKeyCachePurge {
+    __weak SecretService *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)self.derivedKeyCacheTimeToLive * NSEC_PER_MSEC), dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        SecretService *strongSelf = weakSelf;
+        if (strongSelf != nil && strongSelf.derivedKeyCache != NULL) {
+            DerivedKeyCachePurge(strongSelf.derivedKeyCache, DerivedKeyCacheNow());
+        }
+    });
+}
+
+/**
+ * Runs PBKDF2-HMAC-SHA256, or takes the key from the derived key cache.
+ * The cache identity tells apart keys that were derived for different
+ * purposes from the same input.
+ */
+- (NSData *)derivedKeyForPIN:(NSString *)PIN salt:(NSData *)salt rounds:(NSUInteger)rounds cacheIdentity:(NSString *)cacheIdentity cancellationToken:(const PINCancellationToken *)token {
+    NSData *PINData = [self secureDataForPIN:PIN];
+    if (PINData == nil || salt == nil || rounds == 0 || rounds > UINT32_MAX) {
+        return nil;
+    }
+    
+    NSData *identityData = [cacheIdentity dataUsingEncoding:NSUTF8StringEncoding];
+    DerivedKeyCacheInput input = {
+        identityData.bytes, identityData.length,
+        salt.bytes, salt.length,
+        PINData.bytes, PINData.length,
+        (uint32_t)rounds
+    };
+    
+    // Same output as CCKeyDerivationPBKDF(kCCPBKDF2, ..., kCCPRFHmacAlgSHA256, ...), see PBKDF2.h
+    uint8_t *key = NULL;
+    NSData *derivedKey = [NSData secureDataWithLength:32 bytes:&key];
+    if (derivedKey == nil) {
         return nil;
     }
+    if (self.derivedKeyCache == NULL || !DerivedKeyCacheLookup(self.derivedKeyCache, &input, DerivedKeyCacheNow(), key, derivedKey.length)) {
+        int result = PBKDF2DeriveCancellable(HMACAlgorithmSHA256, PINData.bytes, PINData.length, salt.bytes, salt.length, (uint32_t)rounds, key, derivedKey.length,
+                                             token != NULL ? SecretServiceDerivationCancelled : NULL, token);
+        if (result != 0) {
+            if (result != ECANCELED) {
+                NSLog(@"Error %d deriving key", result);
+            }
+            return nil;
+        }
+        
+        if (self.derivedKeyCache != NULL && DerivedKeyCacheInsert(self.derivedKeyCache, &input, DerivedKeyCacheNow(), key, derivedKey.length) == 0) {
+            [self scheduleDerivedKeyCachePurge];
+        }
+    }
+    
+    return derivedKey;
 }
 
-- (NSString *)keyForPIN:(NSString *)PIN salt:(NSData *)salt {
+- (NSData *)secureDataForPIN:(NSString *)PIN {
+    NSUInteger length = [PIN lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    uint8_t *bytes = NULL;
+    NSData *PINData = PIN != nil ? [NSData secureDataWithLength:length bytes:&bytes] : nil;
+    if (PINData != nil && length > 0) {
+        [PIN getBytes:bytes maxLength:length usedLength:NULL encoding:NSUTF8StringEncoding options:0 range:NSMakeRange(0, PIN.length) remainingRange:NULL];
+    }
+    return PINData;
+}
+
+- (NSData *)keyForPIN:(NSString *)PIN salt:(NSData *)salt rounds:(NSUInteger)rounds service:(NSString *)service account:(NSString *)account cancellationToken:(const PINCancellationToken *)token {
     // For backwards compatability
     if (!salt) {
-        return PIN;
+        return [self secureDataForPIN:PIN];
     }
     
-    NSData *PINData = [PIN dataUsingEncoding:NSUTF8StringEncoding];
+    NSData *key = [self derivedKeyForPIN:PIN salt:salt rounds:rounds cacheIdentity:[NSString stringWithFormat:@"%@\n%@", service, account] cancellationToken:token];
+    if (key == nil) {
+        return nil;
+    }
     
-    // How many rounds to use so that it takes 0.1s ?
-    int rounds = 32894; // Calculated using: CCCalibratePBKDF(kCCPBKDF2, PINData.length, saltData.length, kCCPRFHmacAlgSHA256, 32, 100);
+    // The characters of the hex string are the key, see encrypt:key:initializationVector:
+    uint8_t *keyHex = NULL;
+    NSData *hexKey = [NSData secureDataWithLength:key.length * 2 bytes:&keyHex];
+    if (hexKey != nil) {
+        HexEncode(key.bytes, key.length, (char *)keyHex, HexCaseLower);
+    }
+    return hexKey;
+}
+
+- (NSData *)binaryKeyForPIN:(NSString *)PIN salt:(NSData *)salt rounds:(NSUInteger)rounds service:(NSString *)service account:(NSString *)account cancellationToken:(const PINCancellationToken *)token {
+    // Same cache entry as the hex key, both come from the same derivation
+    return [self derivedKeyForPIN:PIN salt:salt rounds:rounds cacheIdentity:[NSString stringWithFormat:@"%@\n%@", service, account] cancellationToken:token];
+}
+
+- (NSData *)keyEncryptionKeyForPIN:(NSString *)PIN deviceSalt:(NSData *)deviceSalt rounds:(NSUInteger)rounds cancellationToken:(const PINCancellationToken *)token {
+    // One key for every identity, so the cache serves all of them
+    return [self derivedKeyForPIN:PIN salt:deviceSalt rounds:rounds cacheIdentity:kKeyHierarchyService cancellationToken:token];
+}
+
+- (NSData *)deviceSaltCreatingIfNeeded:(BOOL)create rounds:(NSUInteger *)rounds {
+    // Called from the unlock queue as well
+    @synchronized (self) {
+        if (self.deviceSalt == nil) {
+            NSUInteger storedRounds = 0;
+            NSData *salt = [self loadSecretForService:kKeyHierarchyService account:kKeyHierarchyDeviceSaltAccount rounds:&storedRounds binaryKey:NULL];
+            if (salt == nil && create) {
+                salt = [self generateSecret];
+                storedRounds = self.keyDerivationRounds;
+                if (salt == nil || ![self storeSecret:salt rounds:storedRounds binaryKey:NO service:kKeyHierarchyService account:kKeyHierarchyDeviceSaltAccount]) {
+                    return nil;
+                }
+            }
+            
+            self.deviceSalt = salt;
+            self.deviceKeyDerivationRounds = storedRounds != 0 ? storedRounds : kLegacyKeyDerivationRounds;
+        }
+        
+        if (rounds != NULL) {
+            *rounds = self.deviceKeyDerivationRounds;
+        }
+        return self.deviceSalt;
+    }
+}
+
+- (NSUInteger)keyDerivationRoundsForNewSecrets {
+    NSUInteger rounds = 0;
+    if (self.keyHierarchyEnabled && [self deviceSaltCreatingIfNeeded:YES rounds:&rounds] != nil) {
+        return rounds;
+    }
     
-    // Open CommonKeyDerivation.h for help
-    unsigned char key[32];
-    int result = CCKeyDerivationPBKDF(kCCPBKDF2, PINData.bytes, PINData.length, salt.bytes, salt.length, kCCPRFHmacAlgSHA256, rounds, key, 32);
-    if (result == kCCParamError) {
-        NSLog(@"Error %d deriving key", result);
+    return self.keyDerivationRounds;
+}
+
+- (NSUInteger)keyEncryptionKeyRoundsForCalibratedRounds:(NSUInteger)calibratedRounds {
+    @synchronized (self) {
+        NSUInteger rounds = 0;
+        NSData *salt = [self deviceSaltCreatingIfNeeded:YES rounds:&rounds];
+        if (salt == nil || !PBKDF2RoundsOffTarget((uint32_t)rounds, (uint32_t)calibratedRounds)) {
+            return rounds;
+        }
+        
+        // Secrets wrapped with the old rounds keep them in their own item
+        if ([self updateSecret:salt rounds:calibratedRounds binaryKey:NO service:kKeyHierarchyService account:kKeyHierarchyDeviceSaltAccount]) {
+            self.deviceKeyDerivationRounds = calibratedRounds;
+        }
+        return self.deviceKeyDerivationRounds;
+    }
+}
+
+- (BOOL)secretUsesKeyHierarchyForIdentity:(Identity *)identity {
+    NSData *storedSecret = [self loadSecretForService:identity.identityProvider.identifier account:identity.identifier];
+    return KeyHierarchyIsWrapped(storedSecret.bytes, storedSecret.length);
+}
+
+- (NSData *)wrapSecret:(NSData *)secret keyEncryptionKey:(NSData *)keyEncryptionKey initializationVector:(NSData *)initializationVector {
+    NSData *dataKey = [self generateKey];
+    if (secret == nil || dataKey == nil || keyEncryptionKey.length != KeyHierarchyKeyLength) {
         return nil;
     }
     
-    NSMutableString *keyString = [[NSMutableString alloc] init];
-    for (int i = 0; i < 32; ++i) {
-        [keyString appendFormat:@"%02x", key[i]];
+    NSMutableData *wrappedSecret = [NSMutableData dataWithLength:KeyHierarchyWrappedLength(secret.length)];
+    int result = KeyHierarchyWrap(keyEncryptionKey.bytes, dataKey.bytes,
+                                  initializationVector.length >= kCCBlockSizeAES128 ? initializationVector.bytes : NULL,
+                                  secret.bytes, secret.length, wrappedSecret.mutableBytes, wrappedSecret.length);
+    return result == 0 ? wrappedSecret : nil;
+}
+
+- (NSData *)unwrapSecret:(NSData *)wrappedSecret keyEncryptionKey:(NSData *)keyEncryptionKey initializationVector:(NSData *)initializationVector {
+    if (keyEncryptionKey.length != KeyHierarchyKeyLength || !KeyHierarchyIsWrapped(wrappedSecret.bytes, wrappedSecret.length)) {
+        return nil;
     }
-    return keyString;
+    
+    uint8_t *bytes = NULL;
+    NSData *secret = [NSData secureDataWithLength:wrappedSecret.length - KeyHierarchyHeaderLength bytes:&bytes];
+    int result = secret == nil ? ENOMEM : KeyHierarchyUnwrap(keyEncryptionKey.bytes,
+                                                             initializationVector.length >= kCCBlockSizeAES128 ? initializationVector.bytes : NULL,
+                                                             wrappedSecret.bytes, wrappedSecret.length, bytes, secret.length);
+    return result == 0 ? secret : nil;
 }
 
-- (NSData *)encrypt:(NSData *)data key:(NSString *)key initializationVector:(NSData *)initializationVector {
+/**
+ * The AES key of secrets of version 3 and older: the characters of the hex
+ * string of the PBKDF2 output, or of the PIN for secrets without a salt.
+ */
+static void SecretServiceLegacyKey(NSData *key, char *keyBuffer, size_t keyBufferLength) {
     // 'key' should be 32 bytes for AES256, will be null-padded otherwise
     
     // There was an error in the conversion of the input key to a C-string using getCString; the buffer supplied was too small;
@@ -212,24 +747,25 @@
     
     // Note: there is another error here; the input key is an ASCII string with a hexadecimal representation of the key;
     // That should be converted to a byte array (unsigned char[]) before being used as input to CCCrypt, but the doesn't happen.
-    // A separate issue for fixing this is still open because this is more complicated to fix since it requires migration of existing identities
-    char keyBuffer[kChosenCipherKeySize * 2 + 1]; // room for terminator (unused)
-    bzero(keyBuffer, sizeof(keyBuffer)); // fill with zeros (for padding)
+    // Only secrets of version 3 and older use this, see encrypt:binaryKey:initializationVector: and migrateSecretsOfIdentities:PINs:completionHandler:
+    bzero(keyBuffer, keyBufferLength); // fill with zeros (for padding)
     
-    // fetch key data
-    [key getCString:keyBuffer maxLength:sizeof(keyBuffer) encoding:NSASCIIStringEncoding];
+    // fetch key data, like getCString did, a key without room for its terminator fails and leaves the buffer empty
+    if (key.length < keyBufferLength) {
+        memcpy(keyBuffer, key.bytes, key.length);
+    }
     
     // iOS getCString truncates keyBuffer to maxLength. and replaces the first character with a 0
     // To ensure upgrading from iOS6 to 7 works. Do the same.
     keyBuffer[0] = 0;
+}
+
+- (NSData *)encrypt:(NSData *)data key:(NSData *)key initializationVector:(NSData *)initializationVector {
+    char keyBuffer[kChosenCipherKeySize * 2 + 1]; // room for terminator (unused)
+    SecretServiceLegacyKey(key, keyBuffer, sizeof(keyBuffer));
     
-    // For block ciphers, the output size will always be less than or
-    // equal to the input size plus the size of one block.
-    // That's why we need to add the size of one block here.
-    size_t bufferSize = [data length] + kCCBlockSizeAES128;
-    void *buffer = malloc(bufferSize);
-    
-    // encrypt
+    // No padding, so the output is as long as the input
+    NSMutableData *encrypted = [NSMutableData dataWithLength:data.length];
     size_t numBytesEncrypted = 0;
     
     // check initialization vector length
@@ -245,45 +781,21 @@
                                      initializationVector ? [initializationVector bytes] : NULL, // initialization vector (optional)
                                      [data bytes], // input
                                      [data length],
-                                     buffer, // output
-                                     bufferSize,
+                                     encrypted.mutableBytes, // output
+                                     encrypted.length,
                                      &numBytesEncrypted);
+    HMACSecureZero(keyBuffer, sizeof(keyBuffer));
     
-    if (result == kCCSuccess) {
-        // the returned NSData takes ownership of the buffer and will free it on deallocation
-        return [NSData dataWithBytesNoCopy:buffer length:numBytesEncrypted];
-    }
-    
-    free(buffer);
-    return nil;
+    return result == kCCSuccess && numBytesEncrypted == encrypted.length ? encrypted : nil;
 }
 
-- (NSData *)decrypt:(NSData *)data key:(NSString *)key initializationVector:(NSData *)initializationVector {
-    // 'key' should be 32 bytes for AES256, will be null-padded otherwise
-    // There was an error in the conversion of the input key to a C-string using getCString; the buffer supplied was too small;
-    // in iOS6 this resulted in truncation of the string during conversion so in the end it worked; in iOS7 the behaviour of getCString changed, so it now returns an error if the buffer supplied is too small.
-    // The net result of this was that the same key was always used for encryption/decryption and the PIN was not used at all.
-    
-    // Note: there is another error here; the input key is an ASCII string with a hexadecimal representation of the key;
-    // That should be converted to a byte array (unsigned char[]) before being used as input to CCCrypt, but the doesn't happen.
-    // A separate issue for fixing this is still open because this is more complicated to fix since it requires migration of existing identities
+- (NSData *)decrypt:(NSData *)data key:(NSData *)key initializationVector:(NSData *)initializationVector {
     char keyBuffer[kChosenCipherKeySize * 2 + 1]; // room for terminator (unused)
-    bzero(keyBuffer, sizeof(keyBuffer)); // fill with zeros (for padding)
+    SecretServiceLegacyKey(key, keyBuffer, sizeof(keyBuffer));
     
-    // fetch key data
-    [key getCString:keyBuffer maxLength:sizeof(keyBuffer) encoding:NSUTF8StringEncoding];
-    
-    // iOS getCString truncates keyBuffer to maxLength. and replaces the first character with a 0
-    // To ensure upgrading from iOS6 to 7 works. Do the same.
-    keyBuffer[0] = 0;
-    
-    // For block ciphers, the output size will always be less than or
-    // equal to the input size plus the size of one block.
-    // That's why we need to add the size of one block here.
-    size_t bufferSize = [data length] + kCCBlockSizeAES128;
-    void *buffer = malloc(bufferSize);
-    
-    // decrypt
+    // No padding, so the output is as long as the input; it's the secret, so it goes to the secure arena
+    uint8_t *buffer = NULL;
+    NSData *decrypted = [NSData secureDataWithLength:data.length bytes:&buffer];
     size_t numBytesDecrypted = 0;
     
     // check initialization vector length
@@ -291,38 +803,259 @@
         initializationVector = nil;
     }
     
-    CCCryptorStatus result = CCCrypt(kCCDecrypt,
-                                     kCCAlgorithmAES128,
-                                     0,
-                                     keyBuffer,
-                                     kChosenCipherKeySize,
-                                     initializationVector ? [initializationVector bytes] : NULL, // initialization vector (optional)
-                                     [data bytes], // input
-                                     [data length],
-                                     buffer, // output
-                                     bufferSize,
-                                     &numBytesDecrypted);
+    CCCryptorStatus result = decrypted == nil ? kCCMemoryFailure : CCCrypt(kCCDecrypt,
+                                                                           kCCAlgorithmAES128,
+                                                                           0,
+                                                                           keyBuffer,
+                                                                           kChosenCipherKeySize,
+                                                                           initializationVector ? [initializationVector bytes] : NULL, // initialization vector (optional)
+                                                                           [data bytes], // input
+                                                                           [data length],
+                                                                           buffer, // output
+                                                                           decrypted.length,
+                                                                           &numBytesDecrypted);
+    HMACSecureZero(keyBuffer, sizeof(keyBuffer));
     
-    if (result == kCCSuccess) {
-        // the returned NSData takes ownership of the buffer and will free it on deallocation
-        return [NSData dataWithBytesNoCopy:buffer length:numBytesDecrypted];
+    return result == kCCSuccess && numBytesDecrypted == decrypted.length ? decrypted : nil;
+}
+
+- (NSData *)encrypt:(NSData *)data binaryKey:(NSData *)key initializationVector:(NSData *)initializationVector {
+    if (key.length != SecretCipherKeyLength) {
+        return nil;
     }
     
-    free(buffer);
-    return nil;
+    NSMutableData *encrypted = [NSMutableData dataWithLength:data.length];
+    int result = SecretCipherCrypt(SecretCipherOperationEncrypt, key.bytes,
+                                   initializationVector.length >= kCCBlockSizeAES128 ? initializationVector.bytes : NULL,
+                                   data.bytes, data.length, encrypted.mutableBytes);
+    return result == 0 ? encrypted : nil;
 }
 
-- (BOOL)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
-    NSString *key = [self keyForPIN:PIN salt:salt];
-    NSData *encryptedSecret = [self encrypt:secret key:key initializationVector:initializationVector];
+- (NSData *)decrypt:(NSData *)data binaryKey:(NSData *)key initializationVector:(NSData *)initializationVector {
+    if (key.length != SecretCipherKeyLength) {
+        return nil;
+    }
     
-    return [self updateOrStoreSecret:encryptedSecret forIdentity:identity];
+    uint8_t *bytes = NULL;
+    NSData *decrypted = [NSData secureDataWithLength:data.length bytes:&bytes];
+    int result = decrypted == nil ? ENOMEM : SecretCipherCrypt(SecretCipherOperationDecrypt, key.bytes,
+                                                               initializationVector.length >= kCCBlockSizeAES128 ? initializationVector.bytes : NULL,
+                                                               data.bytes, data.length, bytes);
+    return result == 0 ? decrypted : nil;
+}
+
+- (NSData *)encryptSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector rounds:(NSUInteger *)rounds {
+    // Without a salt the PIN is the key, there are no rounds to record
+    *rounds = salt != nil ? [self keyDerivationRoundsForIdentity:identity] : 0;
+    NSData *deviceSalt = self.keyHierarchyEnabled && salt != nil ? [self deviceSaltCreatingIfNeeded:YES rounds:rounds] : nil;
+    if (deviceSalt != nil) {
+        NSData *keyEncryptionKey = [self keyEncryptionKeyForPIN:PIN deviceSalt:deviceSalt rounds:*rounds cancellationToken:NULL];
+        return [self wrapSecret:secret keyEncryptionKey:keyEncryptionKey initializationVector:initializationVector];
+    } else if (salt != nil) {
+        NSData *key = [self binaryKeyForPIN:PIN salt:salt rounds:*rounds service:identity.identityProvider.identifier account:identity.identifier cancellationToken:NULL];
+        return [self encrypt:secret binaryKey:key initializationVector:initializationVector];
+    } else {
+        return [self encrypt:secret key:[self secureDataForPIN:PIN] initializationVector:initializationVector];
+    }
+}
+
+- (BOOL)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
+    NSUInteger rounds;
+    NSData *encryptedSecret = [self encryptSecret:secret forIdentity:identity withPIN:PIN salt:salt initializationVector:initializationVector rounds:&rounds];
+    return encryptedSecret != nil && [self updateOrStoreSecret:encryptedSecret rounds:rounds binaryKey:salt != nil service:identity.identityProvider.identifier account:identity.identifier];
 }
 
 - (BOOL)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN {
     return [self setSecret:secret forIdentity:identity withPIN:PIN salt:identity.salt initializationVector:identity.initializationVector];
 }
 
+- (SecretServicePINRequest *)PINRequestForIdentity:(Identity *)identity PIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
+    SecretServicePINRequest *request = [[SecretServicePINRequest alloc] init];
+    request.PIN = PIN;
+    request.salt = salt;
+    request.initializationVector = initializationVector;
+    request.service = identity.identityProvider.identifier;
+    request.account = identity.identifier;
+    request.rounds = salt != nil ? [self keyDerivationRoundsForIdentity:identity] : 0;
+    // What stores use, loads find out from the stored secret
+    request.binaryKey = salt != nil;
+    return request;
+}
+
+/**
+ * Stores go under the key hierarchy when it is enabled, always with the
+ * rounds of the device key. Loads find out from the stored secret.
+ */
+- (void)prepareStoreRequest:(SecretServicePINRequest *)request {
+    NSUInteger rounds = 0;
+    NSData *deviceSalt = self.keyHierarchyEnabled && request.salt != nil ? [self deviceSaltCreatingIfNeeded:YES rounds:&rounds] : nil;
+    if (deviceSalt != nil) {
+        request.wrapped = YES;
+        request.deviceSalt = deviceSalt;
+        request.rounds = rounds;
+    }
+}
+
+- (SecretServiceCancellationToken *)submitPINRequest:(SecretServicePINRequest *)request operation:(PINUnlockOperation)operation {
+    SecretServiceCancellationToken *token = [[SecretServiceCancellationToken alloc] init];
+    [self submitPINRequest:request operation:operation supersedes:operation == PINUnlockOperationLoad token:token];
+    return token;
+}
+
+- (void)submitPINRequest:(SecretServicePINRequest *)request operation:(PINUnlockOperation)operation supersedes:(BOOL)supersedes token:(SecretServiceCancellationToken *)token {
+    PINUnlockRequest unlockRequest = {
+        .operation = operation,
+        .item = (void *)CFBridgingRetain(request),
+        .secret = (__bridge void *)request.secret,
+        .supersedes = supersedes,
+        .token = token.token,
+        .completion = SecretServiceCompleteRequest
+    };
+    unlockRequest.completionContext = unlockRequest.item;
+    
+    if (token == nil || self.unlockQueue == NULL || !PINUnlockQueueSubmit(self.unlockQueue, &unlockRequest)) {
+        CFRelease(unlockRequest.item);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            request.completionHandler(PINUnlockStatusDeriveFailed, nil);
+        });
+    }
+}
+
+- (SecretServiceCancellationToken *)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN completionHandler:(void (^)(BOOL success, BOOL cancelled))completionHandler {
+    return [self setSecret:secret forIdentity:identity withPIN:PIN salt:identity.salt initializationVector:identity.initializationVector completionHandler:completionHandler];
+}
+
+- (SecretServiceCancellationToken *)setSecret:(NSData *)secret forIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector completionHandler:(void (^)(BOOL success, BOOL cancelled))completionHandler {
+    SecretServicePINRequest *request = [self PINRequestForIdentity:identity PIN:PIN salt:salt initializationVector:initializationVector];
+    request.secret = secret;
+    request.completionHandler = ^(PINUnlockStatus status, NSData *result) {
+        completionHandler(status == PINUnlockStatusSuccess, status == PINUnlockStatusCancelled);
+    };
+    [self prepareStoreRequest:request];
+    
+    return [self submitPINRequest:request operation:PINUnlockOperationStore];
+}
+
+- (SecretServiceCancellationToken *)rewrapSecretForIdentity:(Identity *)identity withPIN:(NSString *)PIN rounds:(NSUInteger)rounds completionHandler:(void (^)(BOOL success))completionHandler {
+    SecretServiceCancellationToken *token = [[SecretServiceCancellationToken alloc] init];
+    SecretServicePINRequest *loadRequest = [self PINRequestForIdentity:identity PIN:PIN salt:identity.salt initializationVector:identity.initializationVector];
+    SecretServicePINRequest *storeRequest = [self PINRequestForIdentity:identity PIN:PIN salt:identity.salt initializationVector:identity.initializationVector];
+    storeRequest.rounds = rounds;
+    [self prepareStoreRequest:storeRequest];
+    storeRequest.completionHandler = ^(PINUnlockStatus status, NSData *result) {
+        completionHandler(status == PINUnlockStatusSuccess);
+    };
+    
+    // Neither step supersedes, a PIN entered meanwhile must not cancel the
+    // re-wrap halfway and the re-wrap must not cancel the user's unlock
+    loadRequest.completionHandler = ^(PINUnlockStatus status, NSData *secret) {
+        // Don't bring back the keychain item of an identity deleted meanwhile
+        if (status != PINUnlockStatusSuccess || token == nil || token.isCancelled || identity.isDeleted || identity.managedObjectContext == nil) {
+            completionHandler(NO);
+            return;
+        }
+        
+        storeRequest.secret = secret;
+        [self submitPINRequest:storeRequest operation:PINUnlockOperationStore supersedes:NO token:token];
+    };
+    
+    [self submitPINRequest:loadRequest operation:PINUnlockOperationLoad supersedes:NO token:token];
+    return token;
+}
+
+- (NSIndexSet *)runMigration:(SecretServiceMigration *)migration {
+    NSMutableIndexSet *migrated = [NSMutableIndexSet indexSet];
+    NSMutableArray *storedSecrets = [NSMutableArray array];
+    SecretMigrationItem *items = calloc(MAX(migration.services.count, 1), sizeof(SecretMigrationItem));
+    if (items == NULL) {
+        return migrated;
+    }
+    
+    size_t count = 0;
+    for (NSUInteger i = 0; i < migration.services.count; i++) {
+        NSUInteger rounds = [migration.rounds[i] unsignedIntegerValue];
+        BOOL binaryKey = NO;
+        NSData *storedSecret = [self loadSecretForService:migration.services[i] account:migration.accounts[i] rounds:&rounds binaryKey:&binaryKey];
+        if (storedSecret == nil || rounds > UINT32_MAX) {
+            continue;
+        }
+        
+        // Already version 4, perhaps migrated before the identity was saved
+        if (binaryKey || KeyHierarchyIsWrapped(storedSecret.bytes, storedSecret.length)) {
+            [migrated addIndex:i];
+            continue;
+        }
+        
+        migration.rounds[i] = @(rounds);
+        [storedSecrets addObject:storedSecret];
+        NSData *PIN = migration.PINs[i];
+        NSData *salt = migration.salts[i];
+        NSData *initializationVector = migration.initializationVectors[i];
+        SecretMigrationItem *item = &items[count++];
+        item->PIN = PIN.bytes;
+        item->PINLength = PIN.length;
+        item->salt = salt.bytes;
+        item->saltLength = salt.length;
+        item->rounds = (uint32_t)rounds;
+        item->initializationVector = initializationVector.length >= kCCBlockSizeAES128 ? initializationVector.bytes : NULL;
+        item->secret = storedSecret.bytes;
+        item->secretLength = storedSecret.length;
+        item->context = (void *)(uintptr_t)i;
+    }
+    
+    SecretMigrationPool *pool = NULL;
+    int error = count > 0 ? SecretMigrationPoolCreate(kMigrationBatchSize, kMigrationBatchSize, &pool) : 0;
+    if (error == 0 && count > 0) {
+        SecretMigrationStatistics statistics;
+        error = SecretMigrationRun(pool, items, count, SecretServiceWriteMigratedSecrets, (__bridge void *)migration, &statistics);
+        for (size_t i = 0; i < count; i++) {
+            if (items[i].result == 0) {
+                [migrated addIndex:(NSUInteger)(uintptr_t)items[i].context];
+            }
+        }
+        if (statistics.failed > 0) {
+            NSLog(@"Failed to migrate %lu of %lu secrets", (unsigned long)statistics.failed, (unsigned long)count);
+        }
+    }
+    if (error != 0) {
+        NSLog(@"Error %d migrating secrets", error);
+    }
+    
+    SecretMigrationPoolDestroy(pool);
+    HMACSecureZero(items, MAX(migration.services.count, 1) * sizeof(SecretMigrationItem));
+    free(items);
+    return migrated;
+}
+
+- (void)migrateSecretsOfIdentities:(NSArray *)identities PINs:(NSArray *)PINs completionHandler:(void (^)(NSArray *migratedIdentities))completionHandler {
+    SecretServiceMigration *migration = [[SecretServiceMigration alloc] init];
+    migration.secretService = self;
+    NSMutableArray *candidates = [NSMutableArray array];
+    for (NSUInteger i = 0; i < MIN(identities.count, PINs.count); i++) {
+        Identity *identity = identities[i];
+        NSData *PINData = [PINs[i] dataUsingEncoding:NSUTF8StringEncoding];
+        // Version 1 secrets have no salt, upgradeIdentity:withPIN: handles them
+        if (identity.salt == nil || PINData == nil || identity.identityProvider.identifier == nil || identity.identifier == nil) {
+            continue;
+        }
+        
+        [candidates addObject:identity];
+        [migration.services addObject:identity.identityProvider.identifier];
+        [migration.accounts addObject:identity.identifier];
+        [migration.PINs addObject:PINData];
+        [migration.salts addObject:identity.salt];
+        [migration.initializationVectors addObject:identity.initializationVector ?: [NSData data]];
+        [migration.rounds addObject:@([self keyDerivationRoundsForIdentity:identity])];
+    }
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+        NSIndexSet *migrated = [self runMigration:migration];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completionHandler([candidates objectsAtIndexes:migrated]);
+        });
+    });
+}
+
 - (NSString *)biometricAccountValueForIdentifier:(NSString *)identifier {
     return [NSString stringWithFormat:@"%@-biometric", identifier];
 }
@@ -377,26 +1110,44 @@
     }];
 }
 
-- (NSData *)secretForIdentity:(Identity *)identity withKey:(NSString *)key salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
-    NSData *storedEncryptedSecret = [self loadSecretForIdentity:identity];
+- (NSData *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
+    NSUInteger rounds = [self keyDerivationRoundsForIdentity:identity];
+    BOOL binaryKey = NO;
+    NSData *storedEncryptedSecret = [self loadSecretForService:identity.identityProvider.identifier account:identity.identifier rounds:&rounds binaryKey:&binaryKey];
     if (storedEncryptedSecret == nil) {
         return nil;
     }
     
-    NSData *result = [self decrypt:storedEncryptedSecret key:key initializationVector:initializationVector];
-    return result;
-}
-
-- (NSData *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector {
+    if (KeyHierarchyIsWrapped(storedEncryptedSecret.bytes, storedEncryptedSecret.length)) {
+        NSData *deviceSalt = [self deviceSaltCreatingIfNeeded:NO rounds:NULL];
+        NSData *keyEncryptionKey = [self keyEncryptionKeyForPIN:PIN deviceSalt:deviceSalt rounds:rounds cancellationToken:NULL];
+        return [self unwrapSecret:storedEncryptedSecret keyEncryptionKey:keyEncryptionKey initializationVector:initializationVector];
+    } else if (binaryKey && salt != nil) {
+        NSData *key = [self binaryKeyForPIN:PIN salt:salt rounds:rounds service:identity.identityProvider.identifier account:identity.identifier cancellationToken:NULL];
+        return [self decrypt:storedEncryptedSecret binaryKey:key initializationVector:initializationVector];
+    }
     
-    NSString *key = [self keyForPIN:PIN salt:salt];
-    return [self secretForIdentity:identity withKey:key salt:salt initializationVector:initializationVector];
+    NSData *key = [self keyForPIN:PIN salt:salt rounds:rounds service:identity.identityProvider.identifier account:identity.identifier cancellationToken:NULL];
+    return [self decrypt:storedEncryptedSecret key:key initializationVector:initializationVector];
 }
 
 - (NSData *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN {
     return [self secretForIdentity:identity withPIN:PIN salt:identity.salt initializationVector:identity.initializationVector];
 }
 
+- (SecretServiceCancellationToken *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN salt:(NSData *)salt initializationVector:(NSData *)initializationVector completionHandler:(void (^)(NSData *secret, BOOL cancelled))completionHandler {
+    SecretServicePINRequest *request = [self PINRequestForIdentity:identity PIN:PIN salt:salt initializationVector:initializationVector];
+    request.completionHandler = ^(PINUnlockStatus status, NSData *secret) {
+        completionHandler(secret, status == PINUnlockStatusCancelled);
+    };
+    
+    return [self submitPINRequest:request operation:PINUnlockOperationLoad];
+}
+
+- (SecretServiceCancellationToken *)secretForIdentity:(Identity *)identity withPIN:(NSString *)PIN completionHandler:(void (^)(NSData *secret, BOOL cancelled))completionHandler {
+    return [self secretForIdentity:identity withPIN:PIN salt:identity.salt initializationVector:identity.initializationVector completionHandler:completionHandler];
+}
+
 - (void)secretForIdentity:(Identity *)identity touchIDPrompt:(NSString *)prompt withSuccessHandler:(void (^)(NSData *secret))successHandler failureHandler:(void (^)(BOOL cancelled))failureHandler {
     
     if (!self.biometricIDAvailable || !identity.usesBiometrics) {
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SecretStoreBackend.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    char **accounts;
+    size_t count;
+    size_t capacity;
+    int result;
+} SecretStoreAccountList;
+
+static void SecretStoreCollectAccount(void *context, const char *account, const SecretStoreAttributes *attributes) {
+    (void)attributes;
+    SecretStoreAccountList *list = context;
+    if (list->result != 0) {
+        return;
+    }
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        char **accounts = realloc(list->accounts, capacity * sizeof(char *));
+        if (accounts == NULL) {
+            list->result = ENOMEM;
+            return;
+        }
+        list->accounts = accounts;
+        list->capacity = capacity;
+    }
+    list->accounts[list->count] = strdup(account);
+    if (list->accounts[list->count] == NULL) {
+        list->result = ENOMEM;
+        return;
+    }
+    list->count++;
+}
+
+static int SecretStoreCompareAccounts(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int SecretStoreUpsert(const SecretStoreBackend *backend, const char *service, const char *account,
+                      const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    int result = backend->add(backend->context, service, account, secret, length, attributes);
+    if (result == EEXIST) {
+        result = backend->update(backend->context, service, account, secret, length, attributes);
+    }
+    return result;
+}
+
+int SecretStoreStoreAll(const SecretStoreBackend *backend, const char *service, SecretStoreItem *items, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        items[i].result = ECANCELED;
+    }
+
+    SecretStoreAccountList list = { NULL, 0, 0, 0 };
+    int result = backend->list(backend->context, service, SecretStoreCollectAccount, &list);
+    if (result == 0) {
+        result = list.result;
+    }
+    if (result == 0) {
+        if (list.count > 1) {
+            qsort(list.accounts, list.count, sizeof(char *), SecretStoreCompareAccounts);
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            SecretStoreItem *item = &items[i];
+            bool exists = list.count > 0 && bsearch(&item->account, list.accounts, list.count, sizeof(char *), SecretStoreCompareAccounts) != NULL;
+            if (exists) {
+                item->result = backend->update(backend->context, service, item->account, item->secret, item->length, &item->attributes);
+            } else {
+                item->result = backend->add(backend->context, service, item->account, item->secret, item->length, &item->attributes);
+            }
+            // Changed since the listing
+            if (item->result == ENOENT || item->result == EEXIST) {
+                item->result = SecretStoreUpsert(backend, service, item->account, item->secret, item->length, &item->attributes);
+            }
+            if (item->result != 0 && result == 0) {
+                result = item->result;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.accounts[i]);
+    }
+    free(list.accounts);
+    return result;
+}
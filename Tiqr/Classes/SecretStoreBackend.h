@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SecretStoreBackend_h
+#define SecretStoreBackend_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Where the encrypted secrets live: one item per service (the identity
+ * provider) and account (the identity), holding the encrypted secret and
+ * the attributes needed to decrypt it.
+ *
+ * The app stores its items in the keychain (SecretStoreKeychain), the
+ * same operations on an encrypted file (SecretStoreFile) let the secret
+ * lifecycle run and be measured off-device.
+ *
+ * Every operation is a single round trip to the keychain, the helpers
+ * below combine them so that storing or deleting many items takes as few
+ * as possible.
+ *
+ * Names are NUL terminated UTF-8. Operations return 0 or an errno value:
+ * ENOENT for a missing item, EEXIST when adding one that exists, ERANGE
+ * when a secret doesn't fit the buffer and EIO when the store fails.
+ * Backends are thread safe.
+ */
+
+/**
+ * Longest service or account name in bytes.
+ */
+#define SecretStoreMaxNameLength 512
+
+/**
+ * Longest secret in bytes.
+ */
+#define SecretStoreMaxSecretLength 1024
+
+typedef struct {
+    /** PBKDF2 rounds of the PIN key, 0 for none. */
+    uint32_t rounds;
+    /** Format of the secret, 0 for the original one. */
+    uint32_t type;
+} SecretStoreAttributes;
+
+/**
+ * Called by list for every item of the service.
+ */
+typedef void (*SecretStoreListFunction)(void *context, const char *account, const SecretStoreAttributes *attributes);
+
+typedef struct {
+    void *context;
+
+    /**
+     * Loads an item. Sets length to the length of the secret, also when
+     * the buffer is too small. Attributes may be NULL.
+     */
+    int (*load)(void *context, const char *service, const char *account, uint8_t *secret, size_t capacity, size_t *length, SecretStoreAttributes *attributes);
+
+    /** Adds an item that doesn't exist yet. */
+    int (*add)(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes);
+
+    /**
+     * Replaces the secret and type of an existing item. Rounds of 0 keep
+     * the stored rounds.
+     */
+    int (*update)(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes);
+
+    /** Removes an item. */
+    int (*remove)(void *context, const char *service, const char *account);
+
+    /** Whether an item exists, without reading its secret. Attributes may be NULL. */
+    int (*probe)(void *context, const char *service, const char *account, SecretStoreAttributes *attributes);
+
+    /**
+     * Calls found for every item of the service, 0 for a service without
+     * items. Found must not call back into the store.
+     */
+    int (*list)(void *context, const char *service, SecretStoreListFunction found, void *foundContext);
+
+    /** Removes every item of the service, 0 for a service without items. */
+    int (*removeAll)(void *context, const char *service);
+} SecretStoreBackend;
+
+typedef struct {
+    const char *account;
+    const uint8_t *secret;
+    size_t length;
+    SecretStoreAttributes attributes;
+    /** Set by SecretStoreStoreAll. */
+    int result;
+} SecretStoreItem;
+
+/**
+ * Adds an item, or updates it if it exists: one round trip for a new item
+ * and two for an existing one, instead of a load followed by either.
+ *
+ * @return 0 or the error of the add or update
+ */
+int SecretStoreUpsert(const SecretStoreBackend *backend, const char *service, const char *account,
+                      const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes);
+
+/**
+ * Adds or updates items of one service. Lists the service once to find the
+ * items that exist, then adds or updates each item in a single round trip.
+ *
+ * @param backend  store
+ * @param service  service of all items
+ * @param items    items, their results are set, to ECANCELED if the
+ *                 listing failed
+ * @param count    number of items
+ *
+ * @return 0 when every item was stored, the error of the listing, or the
+ *         error of the first item that failed
+ */
+int SecretStoreStoreAll(const SecretStoreBackend *backend, const char *service, SecretStoreItem *items, size_t count);
+
+#endif /* SecretStoreBackend_h */
@@ -0,0 +1,916 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SecretStoreFile.h"
+#include "HMACKey.h"
+#include "SecretCipher.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * File layout, all integers big endian:
+ *
+ *   header     "TQSS", uint32 version, HMAC of the magic and version
+ *   record     uint8 type, uint8 reserved, uint16 ciphertext length,
+ *              initialization vector, ciphertext, HMAC of everything in
+ *              front of it
+ *   plaintext  uint16 service length, uint16 account length, uint16 secret
+ *              length, uint16 reserved, uint32 rounds, uint32 type,
+ *              service, account, secret, zeroes up to a whole block
+ *
+ * The HMAC in the header tells a wrong key from a damaged record.
+ */
+
+static const uint8_t SecretStoreFileMagic[4] = { 'T', 'Q', 'S', 'S' };
+static const uint32_t SecretStoreFileVersion = 1;
+
+#define SecretStoreFileMACLength 32
+#define SecretStoreFileHeaderLength (4 + 4 + SecretStoreFileMACLength)
+#define SecretStoreFileRecordHeaderLength (1 + 1 + 2 + SecretCipherBlockLength)
+#define SecretStoreFileRecordOverhead (SecretStoreFileRecordHeaderLength + SecretStoreFileMACLength)
+#define SecretStoreFilePlaintextHeaderLength 16
+#define SecretStoreFileMaxPlaintextLength (SecretStoreFilePlaintextHeaderLength + 2 * SecretStoreMaxNameLength + SecretStoreMaxSecretLength)
+#define SecretStoreFileMaxRecordLength (SecretStoreFileRecordOverhead + SecretStoreFileMaxPlaintextLength)
+
+// Address space mapped at a time, appends within it need no new mapping
+#define SecretStoreFileMapGranularity (1024 * 1024)
+
+// Compact once there are this many records and most of them are superseded
+#define SecretStoreFileCompactionThreshold 256
+
+enum {
+    SecretStoreFileRecordSet = 1,
+    SecretStoreFileRecordRemove = 2
+};
+
+typedef struct {
+    /** Service and account, each NUL terminated, in one allocation; NULL for a free slot. */
+    char *name;
+    size_t serviceLength;
+    size_t accountLength;
+    uint64_t hash;
+    off_t offset;
+    size_t recordLength;
+    SecretStoreAttributes attributes;
+} SecretStoreFileEntry;
+
+struct SecretStoreFile {
+    pthread_mutex_t lock;
+    char *path;
+    int fd;
+    off_t size;
+    const uint8_t *map;
+    size_t mapLength;
+    size_t recordCount;
+    uint8_t encryptionKey[SecretCipherKeyLength];
+    HMACKey MACKey;
+    // Open addressing with linear probing, capacity is a power of two
+    SecretStoreFileEntry *entries;
+    size_t entryCount;
+    size_t entryCapacity;
+};
+
+static void SecretStoreFileStore16(uint8_t *bytes, uint16_t value) {
+    bytes[0] = (uint8_t)(value >> 8);
+    bytes[1] = (uint8_t)value;
+}
+
+static uint16_t SecretStoreFileLoad16(const uint8_t *bytes) {
+    return (uint16_t)(((uint16_t)bytes[0] << 8) | bytes[1]);
+}
+
+static void SecretStoreFileStore32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = (uint8_t)(value >> 24);
+    bytes[1] = (uint8_t)(value >> 16);
+    bytes[2] = (uint8_t)(value >> 8);
+    bytes[3] = (uint8_t)value;
+}
+
+static uint32_t SecretStoreFileLoad32(const uint8_t *bytes) {
+    return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+}
+
+static int SecretStoreFileRandom(uint8_t *buffer, size_t length) {
+#ifdef __APPLE__
+    arc4random_buf(buffer, length);
+    return 0;
+#else
+    return getentropy(buffer, length) == 0 ? 0 : errno;
+#endif
+}
+
+static bool SecretStoreFileMACsEqual(const uint8_t *a, const uint8_t *b) {
+    uint8_t difference = 0;
+    for (size_t i = 0; i < SecretStoreFileMACLength; i++) {
+        difference |= a[i] ^ b[i];
+    }
+    return difference == 0;
+}
+
+// Writes and orders the record before anything that follows, see CounterJournal
+static int SecretStoreFileSync(int fd) {
+#if defined(F_BARRIERFSYNC)
+    if (fcntl(fd, F_BARRIERFSYNC) == 0) {
+        return 0;
+    }
+#endif
+#if defined(__linux__)
+    return fdatasync(fd) == 0 ? 0 : errno;
+#else
+    return fsync(fd) == 0 ? 0 : errno;
+#endif
+}
+
+static int SecretStoreFileWriteAll(int fd, const uint8_t *bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        bytes += written;
+        length -= (size_t)written;
+    }
+    return 0;
+}
+
+static void SecretStoreFileEncodeHeader(const SecretStoreFile *store, uint8_t *header) {
+    memcpy(header, SecretStoreFileMagic, sizeof(SecretStoreFileMagic));
+    SecretStoreFileStore32(header + 4, SecretStoreFileVersion);
+    HMACKeyCompute(&store->MACKey, header, 8, header + 8);
+}
+
+static void SecretStoreFileUnmap(SecretStoreFile *store) {
+    if (store->map != NULL) {
+        munmap((void *)store->map, store->mapLength);
+        store->map = NULL;
+        store->mapLength = 0;
+    }
+}
+
+/**
+ * Makes sure the first length bytes of the file are mapped. The mapping
+ * reaches past the end of the file so appends show up in it without
+ * mapping again; only bytes that were written are ever read.
+ */
+static int SecretStoreFileMap(SecretStoreFile *store, size_t length) {
+    if (store->map != NULL && store->mapLength >= length) {
+        return 0;
+    }
+    SecretStoreFileUnmap(store);
+
+    size_t mapLength = (length + SecretStoreFileMapGranularity - 1) / SecretStoreFileMapGranularity * SecretStoreFileMapGranularity;
+    void *map = mmap(NULL, mapLength, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (map == MAP_FAILED) {
+        return errno;
+    }
+    store->map = map;
+    store->mapLength = mapLength;
+    return 0;
+}
+
+static uint64_t SecretStoreFileHash(const char *service, size_t serviceLength, const char *account, size_t accountLength) {
+    // FNV-1a over service, NUL, account
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i <= serviceLength; i++) {
+        hash = (hash ^ (uint8_t)(i < serviceLength ? service[i] : 0)) * 0x100000001b3;
+    }
+    for (size_t i = 0; i < accountLength; i++) {
+        hash = (hash ^ (uint8_t)account[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * Returns the slot of the item, or the free slot it would go in.
+ */
+static SecretStoreFileEntry *SecretStoreFileFind(const SecretStoreFile *store, const char *service, size_t serviceLength,
+                                                 const char *account, size_t accountLength, uint64_t hash) {
+    size_t mask = store->entryCapacity - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        SecretStoreFileEntry *entry = &store->entries[i];
+        if (entry->name == NULL) {
+            return entry;
+        }
+        if (entry->hash == hash && entry->serviceLength == serviceLength && entry->accountLength == accountLength &&
+            memcmp(entry->name, service, serviceLength) == 0 && memcmp(entry->name + serviceLength + 1, account, accountLength) == 0) {
+            return entry;
+        }
+    }
+}
+
+/**
+ * Makes room for one more entry, keeping the table at most half full.
+ */
+static int SecretStoreFileReserve(SecretStoreFile *store) {
+    if (store->entryCapacity != 0 && 2 * (store->entryCount + 1) <= store->entryCapacity) {
+        return 0;
+    }
+
+    size_t capacity = store->entryCapacity == 0 ? 64 : store->entryCapacity * 2;
+    SecretStoreFileEntry *entries = calloc(capacity, sizeof(SecretStoreFileEntry));
+    if (entries == NULL) {
+        return ENOMEM;
+    }
+
+    SecretStoreFileEntry *oldEntries = store->entries;
+    size_t oldCapacity = store->entryCapacity;
+    store->entries = entries;
+    store->entryCapacity = capacity;
+    for (size_t i = 0; i < oldCapacity; i++) {
+        const SecretStoreFileEntry *entry = &oldEntries[i];
+        if (entry->name != NULL) {
+            *SecretStoreFileFind(store, entry->name, entry->serviceLength, entry->name + entry->serviceLength + 1, entry->accountLength, entry->hash) = *entry;
+        }
+    }
+    free(oldEntries);
+    return 0;
+}
+
+/**
+ * Frees the slot and moves later entries of its probe run back, so
+ * lookups never need tombstones.
+ */
+static void SecretStoreFileDeleteEntry(SecretStoreFile *store, SecretStoreFileEntry *entry) {
+    size_t mask = store->entryCapacity - 1;
+    size_t hole = (size_t)(entry - store->entries);
+    free(entry->name);
+    memset(entry, 0, sizeof(*entry));
+    store->entryCount--;
+
+    for (size_t i = (hole + 1) & mask; store->entries[i].name != NULL; i = (i + 1) & mask) {
+        size_t home = (size_t)store->entries[i].hash & mask;
+        // Move the entry if the hole lies between its home slot and its slot
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            store->entries[hole] = store->entries[i];
+            memset(&store->entries[i], 0, sizeof(SecretStoreFileEntry));
+            hole = i;
+        }
+    }
+}
+
+static char *SecretStoreFileCopyName(const char *service, size_t serviceLength, const char *account, size_t accountLength) {
+    char *name = malloc(serviceLength + accountLength + 2);
+    if (name != NULL) {
+        memcpy(name, service, serviceLength);
+        name[serviceLength] = '\0';
+        memcpy(name + serviceLength + 1, account, accountLength);
+        name[serviceLength + 1 + accountLength] = '\0';
+    }
+    return name;
+}
+
+/**
+ * Verifies and decrypts the record at the start of bytes.
+ *
+ * @return the length of the record, 0 if it is cut short, damaged or not a record
+ */
+static size_t SecretStoreFileOpenRecord(const SecretStoreFile *store, const uint8_t *bytes, size_t available, int *type, uint8_t *plaintext, size_t *plaintextLength) {
+    if (available < SecretStoreFileRecordOverhead) {
+        return 0;
+    }
+    size_t ciphertextLength = SecretStoreFileLoad16(bytes + 2);
+    size_t recordLength = SecretStoreFileRecordOverhead + ciphertextLength;
+    if ((bytes[0] != SecretStoreFileRecordSet && bytes[0] != SecretStoreFileRecordRemove) || bytes[1] != 0 ||
+        ciphertextLength < SecretStoreFilePlaintextHeaderLength || ciphertextLength > SecretStoreFileMaxPlaintextLength ||
+        ciphertextLength % SecretCipherBlockLength != 0 || available < recordLength) {
+        return 0;
+    }
+
+    uint8_t mac[SecretStoreFileMACLength];
+    HMACKeyCompute(&store->MACKey, bytes, recordLength - SecretStoreFileMACLength, mac);
+    bool authentic = SecretStoreFileMACsEqual(mac, bytes + recordLength - SecretStoreFileMACLength);
+    if (!authentic || SecretCipherCrypt(SecretCipherOperationDecrypt, store->encryptionKey, bytes + 4,
+                                        bytes + SecretStoreFileRecordHeaderLength, ciphertextLength, plaintext) != 0) {
+        return 0;
+    }
+
+    size_t contentLength = SecretStoreFilePlaintextHeaderLength + SecretStoreFileLoad16(plaintext) + SecretStoreFileLoad16(plaintext + 2) + SecretStoreFileLoad16(plaintext + 4);
+    if (contentLength > ciphertextLength) {
+        HMACSecureZero(plaintext, ciphertextLength);
+        return 0;
+    }
+
+    *type = bytes[0];
+    *plaintextLength = ciphertextLength;
+    return recordLength;
+}
+
+static int SecretStoreFileApply(SecretStoreFile *store, int type, const char *service, size_t serviceLength, const char *account, size_t accountLength,
+                                const SecretStoreAttributes *attributes, off_t offset, size_t recordLength) {
+    uint64_t hash = SecretStoreFileHash(service, serviceLength, account, accountLength);
+    SecretStoreFileEntry *entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+    if (type == SecretStoreFileRecordRemove) {
+        if (entry->name != NULL) {
+            SecretStoreFileDeleteEntry(store, entry);
+        }
+        return 0;
+    }
+
+    if (entry->name == NULL) {
+        int result = SecretStoreFileReserve(store);
+        if (result != 0) {
+            return result;
+        }
+        entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+        entry->name = SecretStoreFileCopyName(service, serviceLength, account, accountLength);
+        if (entry->name == NULL) {
+            return ENOMEM;
+        }
+        entry->serviceLength = serviceLength;
+        entry->accountLength = accountLength;
+        entry->hash = hash;
+        store->entryCount++;
+    }
+
+    entry->offset = offset;
+    entry->recordLength = recordLength;
+    entry->attributes = *attributes;
+    return 0;
+}
+
+static int SecretStoreFileApplyPlaintext(SecretStoreFile *store, int type, const uint8_t *plaintext, off_t offset, size_t recordLength) {
+    size_t serviceLength = SecretStoreFileLoad16(plaintext);
+    size_t accountLength = SecretStoreFileLoad16(plaintext + 2);
+    const char *service = (const char *)plaintext + SecretStoreFilePlaintextHeaderLength;
+    SecretStoreAttributes attributes = {
+        .rounds = SecretStoreFileLoad32(plaintext + 8),
+        .type = SecretStoreFileLoad32(plaintext + 12)
+    };
+    return SecretStoreFileApply(store, type, service, serviceLength, service + serviceLength, accountLength, &attributes, offset, recordLength);
+}
+
+static int SecretStoreFileLoad(SecretStoreFile *store) {
+    struct stat status;
+    if (fstat(store->fd, &status) != 0) {
+        return errno;
+    }
+
+    uint8_t header[SecretStoreFileHeaderLength];
+    SecretStoreFileEncodeHeader(store, header);
+
+    // A new file, or one that crashed before its header made it to disk
+    if (status.st_size < SecretStoreFileHeaderLength) {
+        if (ftruncate(store->fd, 0) != 0) {
+            return errno;
+        }
+        int result = SecretStoreFileWriteAll(store->fd, header, sizeof(header));
+        if (result == 0) {
+            result = SecretStoreFileSync(store->fd);
+        }
+        store->size = sizeof(header);
+        return result == 0 ? SecretStoreFileMap(store, (size_t)store->size) : result;
+    }
+
+    store->size = status.st_size;
+    int result = SecretStoreFileMap(store, (size_t)store->size);
+    if (result != 0) {
+        return result;
+    }
+
+    // Not a store, a newer version or another key, don't touch it
+    if (memcmp(store->map, header, 8) != 0) {
+        return EINVAL;
+    }
+    if (!SecretStoreFileMACsEqual(store->map + 8, header + 8)) {
+        return EBADMSG;
+    }
+
+    uint8_t plaintext[SecretStoreFileMaxPlaintextLength];
+    size_t offset = SecretStoreFileHeaderLength;
+    size_t length = (size_t)store->size;
+    while (offset < length) {
+        int type;
+        size_t plaintextLength;
+        size_t recordLength = SecretStoreFileOpenRecord(store, store->map + offset, length - offset, &type, plaintext, &plaintextLength);
+        if (recordLength == 0) {
+            break;
+        }
+        result = SecretStoreFileApplyPlaintext(store, type, plaintext, (off_t)offset, recordLength);
+        HMACSecureZero(plaintext, plaintextLength);
+        if (result != 0) {
+            return result;
+        }
+        store->recordCount++;
+        offset += recordLength;
+    }
+
+    // Drop a torn tail so new records are appended right behind the last valid one
+    if (offset < length) {
+        if (ftruncate(store->fd, (off_t)offset) != 0) {
+            return errno;
+        }
+        store->size = (off_t)offset;
+        return SecretStoreFileSync(store->fd);
+    }
+    return 0;
+}
+
+int SecretStoreFileOpen(const char *path, const uint8_t *key, SecretStoreFile **store) {
+    SecretStoreFile *result = calloc(1, sizeof(SecretStoreFile));
+    if (result == NULL) {
+        return ENOMEM;
+    }
+    if (pthread_mutex_init(&result->lock, NULL) != 0) {
+        free(result);
+        return ENOMEM;
+    }
+
+    // Separate keys for encryption and authentication
+    HMACKey masterKey;
+    HMACKeyInit(&masterKey, HMACAlgorithmSHA256, key, SecretStoreFileKeyLength);
+    uint8_t MACKey[SecretStoreFileMACLength];
+    HMACKeyCompute(&masterKey, (const uint8_t *)"TQSS encryption", 15, result->encryptionKey);
+    HMACKeyCompute(&masterKey, (const uint8_t *)"TQSS authentication", 19, MACKey);
+    HMACKeyInit(&result->MACKey, HMACAlgorithmSHA256, MACKey, sizeof(MACKey));
+    HMACKeyWipe(&masterKey);
+    HMACSecureZero(MACKey, sizeof(MACKey));
+
+    result->path = strdup(path);
+    result->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (result->path == NULL || result->fd < 0) {
+        int error = result->path == NULL ? ENOMEM : errno;
+        SecretStoreFileClose(result);
+        return error;
+    }
+
+    int error = SecretStoreFileReserve(result);
+    if (error == 0) {
+        error = SecretStoreFileLoad(result);
+    }
+    if (error != 0) {
+        SecretStoreFileClose(result);
+        return error;
+    }
+
+    *store = result;
+    return 0;
+}
+
+void SecretStoreFileClose(SecretStoreFile *store) {
+    if (store == NULL) {
+        return;
+    }
+    SecretStoreFileUnmap(store);
+    if (store->fd >= 0) {
+        close(store->fd);
+    }
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        free(store->entries[i].name);
+    }
+    free(store->entries);
+    free(store->path);
+    pthread_mutex_destroy(&store->lock);
+    HMACSecureZero(store, sizeof(*store));
+    free(store);
+}
+
+static bool SecretStoreFileValidNames(const char *service, const char *account, size_t *serviceLength, size_t *accountLength) {
+    *serviceLength = strlen(service);
+    *accountLength = strlen(account);
+    return *serviceLength > 0 && *serviceLength <= SecretStoreMaxNameLength && *accountLength > 0 && *accountLength <= SecretStoreMaxNameLength;
+}
+
+static int SecretStoreFileCompactLocked(SecretStoreFile *store);
+
+static size_t SecretStoreFileRecordLength(size_t serviceLength, size_t accountLength, size_t secretLength) {
+    size_t contentLength = SecretStoreFilePlaintextHeaderLength + serviceLength + accountLength + secretLength;
+    return SecretStoreFileRecordOverhead + (contentLength + SecretCipherBlockLength - 1) / SecretCipherBlockLength * SecretCipherBlockLength;
+}
+
+/**
+ * Encrypts a record into SecretStoreFileRecordLength bytes of record.
+ */
+static int SecretStoreFileEncode(const SecretStoreFile *store, int type, const char *service, size_t serviceLength, const char *account, size_t accountLength,
+                                 const uint8_t *secret, size_t secretLength, const SecretStoreAttributes *attributes, uint8_t *record) {
+    size_t recordLength = SecretStoreFileRecordLength(serviceLength, accountLength, secretLength);
+    size_t plaintextLength = recordLength - SecretStoreFileRecordOverhead;
+    uint8_t *plaintext = record + SecretStoreFileRecordHeaderLength;
+    memset(plaintext, 0, plaintextLength);
+    SecretStoreFileStore16(plaintext, (uint16_t)serviceLength);
+    SecretStoreFileStore16(plaintext + 2, (uint16_t)accountLength);
+    SecretStoreFileStore16(plaintext + 4, (uint16_t)secretLength);
+    SecretStoreFileStore32(plaintext + 8, attributes->rounds);
+    SecretStoreFileStore32(plaintext + 12, attributes->type);
+    memcpy(plaintext + SecretStoreFilePlaintextHeaderLength, service, serviceLength);
+    memcpy(plaintext + SecretStoreFilePlaintextHeaderLength + serviceLength, account, accountLength);
+    if (secretLength > 0) {
+        memcpy(plaintext + SecretStoreFilePlaintextHeaderLength + serviceLength + accountLength, secret, secretLength);
+    }
+
+    record[0] = (uint8_t)type;
+    record[1] = 0;
+    SecretStoreFileStore16(record + 2, (uint16_t)plaintextLength);
+    int result = SecretStoreFileRandom(record + 4, SecretCipherBlockLength);
+    if (result == 0) {
+        result = SecretCipherCrypt(SecretCipherOperationEncrypt, store->encryptionKey, record + 4, plaintext, plaintextLength, plaintext);
+    }
+    if (result != 0) {
+        HMACSecureZero(record, recordLength);
+        return result;
+    }
+    HMACKeyCompute(&store->MACKey, record, recordLength - SecretStoreFileMACLength, record + recordLength - SecretStoreFileMACLength);
+    return 0;
+}
+
+/**
+ * Appends and syncs records, on failure the file is left as it was.
+ */
+static int SecretStoreFileWriteRecords(SecretStoreFile *store, const uint8_t *records, size_t length) {
+    if (store->fd < 0) {
+        return EIO;
+    }
+
+    int result = SecretStoreFileWriteAll(store->fd, records, length);
+    if (result == 0) {
+        result = SecretStoreFileSync(store->fd);
+    }
+    if (result != 0) {
+        // Don't leave a partial record in front of later ones, stop writing if that fails too
+        if (ftruncate(store->fd, store->size) != 0) {
+            close(store->fd);
+            store->fd = -1;
+        }
+    }
+    return result;
+}
+
+static void SecretStoreFileCompactIfNeeded(SecretStoreFile *store) {
+    if (store->recordCount >= SecretStoreFileCompactionThreshold && store->recordCount > 4 * store->entryCount) {
+        // The records are durable already, a failed compaction only postpones the cleanup
+        SecretStoreFileCompactLocked(store);
+    }
+}
+
+/**
+ * Encrypts, appends and syncs a record, then applies it to the index.
+ * Called with the lock held.
+ */
+static int SecretStoreFileAppend(SecretStoreFile *store, int type, const char *service, size_t serviceLength, const char *account, size_t accountLength,
+                                 const uint8_t *secret, size_t secretLength, const SecretStoreAttributes *attributes) {
+    // Everything a new item needs up front, so a durable record is always applied
+    int result = SecretStoreFileReserve(store);
+    if (result != 0) {
+        return result;
+    }
+
+    uint8_t record[SecretStoreFileMaxRecordLength];
+    size_t recordLength = SecretStoreFileRecordLength(serviceLength, accountLength, secretLength);
+    result = SecretStoreFileEncode(store, type, service, serviceLength, account, accountLength, secret, secretLength, attributes, record);
+    if (result == 0) {
+        result = SecretStoreFileWriteRecords(store, record, recordLength);
+    }
+    if (result != 0) {
+        return result;
+    }
+
+    off_t offset = store->size;
+    store->size += (off_t)recordLength;
+    store->recordCount++;
+    result = SecretStoreFileApply(store, type, service, serviceLength, account, accountLength, attributes, offset, recordLength);
+    if (result == 0) {
+        SecretStoreFileCompactIfNeeded(store);
+    }
+    return result;
+}
+
+static int SecretStoreFileLoadItem(void *context, const char *service, const char *account, uint8_t *secret, size_t capacity, size_t *length, SecretStoreAttributes *attributes) {
+    SecretStoreFile *store = context;
+    size_t serviceLength, accountLength;
+    if (!SecretStoreFileValidNames(service, account, &serviceLength, &accountLength)) {
+        return EINVAL;
+    }
+    uint64_t hash = SecretStoreFileHash(service, serviceLength, account, accountLength);
+
+    pthread_mutex_lock(&store->lock);
+    const SecretStoreFileEntry *entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+    int result = entry->name == NULL ? ENOENT : SecretStoreFileMap(store, (size_t)entry->offset + entry->recordLength);
+    if (result == 0) {
+        uint8_t plaintext[SecretStoreFileMaxPlaintextLength];
+        size_t plaintextLength;
+        int type;
+        if (SecretStoreFileOpenRecord(store, store->map + entry->offset, entry->recordLength, &type, plaintext, &plaintextLength) != entry->recordLength ||
+            SecretStoreFileLoad16(plaintext) != serviceLength || SecretStoreFileLoad16(plaintext + 2) != accountLength) {
+            // Changed on disk since it was indexed
+            result = EBADMSG;
+        } else {
+            size_t secretLength = SecretStoreFileLoad16(plaintext + 4);
+            *length = secretLength;
+            if (secretLength > capacity) {
+                result = ERANGE;
+            } else {
+                memcpy(secret, plaintext + SecretStoreFilePlaintextHeaderLength + serviceLength + accountLength, secretLength);
+                if (attributes != NULL) {
+                    *attributes = entry->attributes;
+                }
+            }
+            HMACSecureZero(plaintext, plaintextLength);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+static int SecretStoreFileWriteItem(SecretStoreFile *store, bool exists, const char *service, const char *account,
+                                    const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    size_t serviceLength, accountLength;
+    if (!SecretStoreFileValidNames(service, account, &serviceLength, &accountLength) || length == 0 || length > SecretStoreMaxSecretLength) {
+        return EINVAL;
+    }
+    uint64_t hash = SecretStoreFileHash(service, serviceLength, account, accountLength);
+
+    pthread_mutex_lock(&store->lock);
+    const SecretStoreFileEntry *entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+    int result = 0;
+    if ((entry->name != NULL) != exists) {
+        result = exists ? ENOENT : EEXIST;
+    } else {
+        SecretStoreAttributes written = *attributes;
+        if (exists && written.rounds == 0) {
+            written.rounds = entry->attributes.rounds;
+        }
+        result = SecretStoreFileAppend(store, SecretStoreFileRecordSet, service, serviceLength, account, accountLength, secret, length, &written);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+static int SecretStoreFileAddItem(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    return SecretStoreFileWriteItem(context, false, service, account, secret, length, attributes);
+}
+
+static int SecretStoreFileUpdateItem(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    return SecretStoreFileWriteItem(context, true, service, account, secret, length, attributes);
+}
+
+static int SecretStoreFileRemoveItem(void *context, const char *service, const char *account) {
+    SecretStoreFile *store = context;
+    size_t serviceLength, accountLength;
+    if (!SecretStoreFileValidNames(service, account, &serviceLength, &accountLength)) {
+        return EINVAL;
+    }
+    uint64_t hash = SecretStoreFileHash(service, serviceLength, account, accountLength);
+
+    pthread_mutex_lock(&store->lock);
+    const SecretStoreFileEntry *entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+    int result = ENOENT;
+    if (entry->name != NULL) {
+        SecretStoreAttributes none = { 0, 0 };
+        result = SecretStoreFileAppend(store, SecretStoreFileRecordRemove, service, serviceLength, account, accountLength, NULL, 0, &none);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+static int SecretStoreFileProbeItem(void *context, const char *service, const char *account, SecretStoreAttributes *attributes) {
+    SecretStoreFile *store = context;
+    size_t serviceLength, accountLength;
+    if (!SecretStoreFileValidNames(service, account, &serviceLength, &accountLength)) {
+        return EINVAL;
+    }
+    uint64_t hash = SecretStoreFileHash(service, serviceLength, account, accountLength);
+
+    pthread_mutex_lock(&store->lock);
+    const SecretStoreFileEntry *entry = SecretStoreFileFind(store, service, serviceLength, account, accountLength, hash);
+    int result = entry->name == NULL ? ENOENT : 0;
+    if (result == 0 && attributes != NULL) {
+        *attributes = entry->attributes;
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+static bool SecretStoreFileEntryHasService(const SecretStoreFileEntry *entry, const char *service, size_t serviceLength) {
+    return entry->name != NULL && entry->serviceLength == serviceLength && memcmp(entry->name, service, serviceLength) == 0;
+}
+
+static int SecretStoreFileListItems(void *context, const char *service, SecretStoreListFunction found, void *foundContext) {
+    SecretStoreFile *store = context;
+    size_t serviceLength = strlen(service);
+    if (serviceLength == 0 || serviceLength > SecretStoreMaxNameLength) {
+        return EINVAL;
+    }
+
+    // found runs with the lock held, like the keychain it gets a snapshot
+    pthread_mutex_lock(&store->lock);
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        const SecretStoreFileEntry *entry = &store->entries[i];
+        if (SecretStoreFileEntryHasService(entry, service, serviceLength)) {
+            found(foundContext, entry->name + serviceLength + 1, &entry->attributes);
+        }
+    }
+    pthread_mutex_unlock(&store->lock);
+    return 0;
+}
+
+/**
+ * Appends the removals of all items of the service with one write and one
+ * sync, the way the keychain removes them with one query.
+ */
+static int SecretStoreFileRemoveAllItems(void *context, const char *service) {
+    SecretStoreFile *store = context;
+    size_t serviceLength = strlen(service);
+    if (serviceLength == 0 || serviceLength > SecretStoreMaxNameLength) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    size_t count = 0;
+    size_t length = 0;
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        const SecretStoreFileEntry *entry = &store->entries[i];
+        if (SecretStoreFileEntryHasService(entry, service, serviceLength)) {
+            count++;
+            length += SecretStoreFileRecordLength(serviceLength, entry->accountLength, 0);
+        }
+    }
+
+    uint8_t *records = count > 0 ? malloc(length) : NULL;
+    char **accounts = count > 0 ? calloc(count, sizeof(char *)) : NULL;
+    int result = count > 0 && (records == NULL || accounts == NULL) ? ENOMEM : 0;
+    SecretStoreAttributes none = { 0, 0 };
+    size_t offset = 0;
+    for (size_t i = 0, j = 0; i < store->entryCapacity && result == 0 && j < count; i++) {
+        const SecretStoreFileEntry *entry = &store->entries[i];
+        if (SecretStoreFileEntryHasService(entry, service, serviceLength)) {
+            accounts[j] = strdup(entry->name + serviceLength + 1);
+            result = accounts[j] == NULL ? ENOMEM : SecretStoreFileEncode(store, SecretStoreFileRecordRemove, service, serviceLength,
+                                                                          accounts[j], entry->accountLength, NULL, 0, &none, records + offset);
+            offset += SecretStoreFileRecordLength(serviceLength, entry->accountLength, 0);
+            j++;
+        }
+    }
+    if (result == 0 && count > 0) {
+        result = SecretStoreFileWriteRecords(store, records, length);
+    }
+
+    if (result == 0 && count > 0) {
+        off_t recordOffset = store->size;
+        for (size_t j = 0; j < count; j++) {
+            size_t recordLength = SecretStoreFileRecordLength(serviceLength, strlen(accounts[j]), 0);
+            SecretStoreFileApply(store, SecretStoreFileRecordRemove, service, serviceLength, accounts[j], strlen(accounts[j]), &none, recordOffset, recordLength);
+            recordOffset += (off_t)recordLength;
+        }
+        store->size += (off_t)length;
+        store->recordCount += count;
+        SecretStoreFileCompactIfNeeded(store);
+    }
+    pthread_mutex_unlock(&store->lock);
+
+    for (size_t j = 0; accounts != NULL && j < count; j++) {
+        free(accounts[j]);
+    }
+    free(accounts);
+    free(records);
+    return result;
+}
+
+void SecretStoreFileGetBackend(SecretStoreFile *store, SecretStoreBackend *backend) {
+    backend->context = store;
+    backend->load = SecretStoreFileLoadItem;
+    backend->add = SecretStoreFileAddItem;
+    backend->update = SecretStoreFileUpdateItem;
+    backend->remove = SecretStoreFileRemoveItem;
+    backend->probe = SecretStoreFileProbeItem;
+    backend->list = SecretStoreFileListItems;
+    backend->removeAll = SecretStoreFileRemoveAllItems;
+}
+
+static int SecretStoreFileCompactLocked(SecretStoreFile *store) {
+    if (store->fd < 0) {
+        return EIO;
+    }
+    int result = SecretStoreFileMap(store, (size_t)store->size);
+    if (result != 0) {
+        return result;
+    }
+
+    // The current records are copied as they are, they don't need to be decrypted
+    size_t length = SecretStoreFileHeaderLength;
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        if (store->entries[i].name != NULL) {
+            length += store->entries[i].recordLength;
+        }
+    }
+
+    uint8_t *buffer = malloc(length);
+    off_t *offsets = malloc(store->entryCapacity * sizeof(off_t));
+    size_t pathLength = strlen(store->path);
+    char *temporaryPath = malloc(pathLength + 5);
+    if (buffer == NULL || offsets == NULL || temporaryPath == NULL) {
+        free(buffer);
+        free(offsets);
+        free(temporaryPath);
+        return ENOMEM;
+    }
+
+    memcpy(buffer, store->map, SecretStoreFileHeaderLength);
+    size_t offset = SecretStoreFileHeaderLength;
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        const SecretStoreFileEntry *entry = &store->entries[i];
+        if (entry->name != NULL) {
+            memcpy(buffer + offset, store->map + entry->offset, entry->recordLength);
+            offsets[i] = (off_t)offset;
+            offset += entry->recordLength;
+        }
+    }
+
+    // Write a complete new file next to the old one and swap it in with rename, a
+    // crash leaves either the old or the new file in place
+    memcpy(temporaryPath, store->path, pathLength);
+    memcpy(temporaryPath + pathLength, ".tmp", 5);
+    int fd = open(temporaryPath, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0) {
+        result = errno;
+    } else {
+        result = SecretStoreFileWriteAll(fd, buffer, length);
+        if (result == 0 && fsync(fd) != 0) {
+            result = errno;
+        }
+        if (result == 0 && rename(temporaryPath, store->path) != 0) {
+            result = errno;
+        }
+        if (result != 0) {
+            close(fd);
+            unlink(temporaryPath);
+        }
+    }
+
+    free(buffer);
+    free(temporaryPath);
+    if (result != 0) {
+        free(offsets);
+        return result;
+    }
+
+    for (size_t i = 0; i < store->entryCapacity; i++) {
+        if (store->entries[i].name != NULL) {
+            store->entries[i].offset = offsets[i];
+        }
+    }
+    free(offsets);
+    SecretStoreFileUnmap(store);
+    close(store->fd);
+    store->fd = fd;
+    store->size = (off_t)length;
+    store->recordCount = store->entryCount;
+    return SecretStoreFileMap(store, length);
+}
+
+int SecretStoreFileCompact(SecretStoreFile *store) {
+    pthread_mutex_lock(&store->lock);
+    int result = SecretStoreFileCompactLocked(store);
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+size_t SecretStoreFileItemCount(SecretStoreFile *store) {
+    pthread_mutex_lock(&store->lock);
+    size_t count = store->entryCount;
+    pthread_mutex_unlock(&store->lock);
+    return count;
+}
+
+size_t SecretStoreFileRecordCount(SecretStoreFile *store) {
+    pthread_mutex_lock(&store->lock);
+    size_t count = store->recordCount;
+    pthread_mutex_unlock(&store->lock);
+    return count;
+}
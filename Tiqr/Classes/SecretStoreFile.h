@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SecretStoreFile_h
+#define SecretStoreFile_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SecretStoreBackend.h"
+
+/*
+ * Secret store in an encrypted, append-only file.
+ *
+ * Every add, update and removal appends one record and syncs it, the way
+ * CounterJournal does. A record is encrypted with AES-256-CBC under a
+ * random initialization vector and authenticated with HMAC-SHA256 over
+ * all of it, both keys derived from the key of the store. Opening the
+ * file verifies and replays the records into an in-memory index of the
+ * names, attributes and offsets of the current items; a record cut short
+ * by a crash fails its MAC and is dropped with anything after it.
+ *
+ * Loads read the record through a read-only mapping of the file and check
+ * its MAC again, so only the index lives on the heap. Once most records are
+ * superseded the file is rewritten with the current ones.
+ *
+ * Functions return 0 or an errno value, EBADMSG for a file that doesn't
+ * authenticate with the key. A store is thread safe.
+ */
+
+typedef struct SecretStoreFile SecretStoreFile;
+
+/**
+ * Length of the key of a store in bytes.
+ */
+#define SecretStoreFileKeyLength 32
+
+/**
+ * Opens (or creates) the store at path and replays it.
+ *
+ * @param path   file path
+ * @param key    SecretStoreFileKeyLength bytes
+ * @param store  set to the opened store
+ *
+ * @return 0, EBADMSG for a key that doesn't match the file, or an errno value
+ */
+int SecretStoreFileOpen(const char *path, const uint8_t *key, SecretStoreFile **store);
+
+/**
+ * Closes the store, zeroes its keys and frees it.
+ */
+void SecretStoreFileClose(SecretStoreFile *store);
+
+/**
+ * Fills in the operations of the store, valid until it is closed.
+ */
+void SecretStoreFileGetBackend(SecretStoreFile *store, SecretStoreBackend *backend);
+
+/**
+ * Rewrites the file with one record per item. Happens automatically once
+ * most records are superseded.
+ *
+ * @return 0 or an errno value
+ */
+int SecretStoreFileCompact(SecretStoreFile *store);
+
+/**
+ * Number of current items.
+ */
+size_t SecretStoreFileItemCount(SecretStoreFile *store);
+
+/**
+ * Number of records in the file, including superseded ones.
+ */
+size_t SecretStoreFileRecordCount(SecretStoreFile *store);
+
+#endif /* SecretStoreFile_h */
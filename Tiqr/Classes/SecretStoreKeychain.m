@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <Security/Security.h>
+#include <errno.h>
+
+#import "SecretStoreKeychain.h"
+
+static int SecretStoreKeychainError(OSStatus status) {
+    switch (status) {
+        case errSecSuccess:
+            return 0;
+        case errSecItemNotFound:
+            return ENOENT;
+        case errSecDuplicateItem:
+            return EEXIST;
+        default:
+            return EIO;
+    }
+}
+
+static NSData *SecretStoreKeychainRoundsAttribute(uint32_t rounds) {
+    return [[NSString stringWithFormat:@"%u", rounds] dataUsingEncoding:NSASCIIStringEncoding];
+}
+
+static uint32_t SecretStoreKeychainRoundsFromAttribute(NSData *attribute) {
+    NSString *string = [[NSString alloc] initWithData:attribute encoding:NSASCIIStringEncoding];
+    long long rounds = string.longLongValue;
+    return rounds > 0 && rounds <= UINT32_MAX ? (uint32_t)rounds : 0;
+}
+
+/**
+ * Query for the item of the account, or all items of the service when
+ * account is NULL.
+ */
+static NSMutableDictionary *SecretStoreKeychainQuery(const char *service, const char *account) {
+    NSString *serviceString = [NSString stringWithUTF8String:service];
+    NSString *accountString = account != NULL ? [NSString stringWithUTF8String:account] : nil;
+    if (serviceString == nil || (account != NULL && accountString == nil)) {
+        return nil;
+    }
+    
+    NSMutableDictionary *query = [[NSMutableDictionary alloc] init];
+    query[(__bridge id)kSecClass] = (__bridge id)kSecClassGenericPassword;
+    query[(__bridge id)kSecAttrService] = serviceString;
+    if (accountString != nil) {
+        query[(__bridge id)kSecAttrAccount] = accountString;
+    }
+    return query;
+}
+
+static void SecretStoreKeychainGetAttributes(NSDictionary *item, SecretStoreAttributes *attributes) {
+    attributes->rounds = SecretStoreKeychainRoundsFromAttribute(item[(__bridge id)kSecAttrGeneric]);
+    attributes->type = [item[(__bridge id)kSecAttrType] unsignedIntValue];
+}
+
+static int SecretStoreKeychainLoad(void *context, const char *service, const char *account, uint8_t *secret, size_t capacity, size_t *length, SecretStoreAttributes *attributes) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, account);
+        if (query == nil) {
+            return EINVAL;
+        }
+        query[(__bridge id)kSecMatchLimit] = (__bridge id)kSecMatchLimitOne;
+        query[(__bridge id)kSecReturnData] = (id)kCFBooleanTrue;
+        query[(__bridge id)kSecReturnAttributes] = (id)kCFBooleanTrue;
+        
+        CFDictionaryRef result;
+        int error = SecretStoreKeychainError(SecItemCopyMatching((__bridge CFDictionaryRef)query, (CFTypeRef *)&result));
+        if (error != 0) {
+            return error;
+        }
+        
+        NSDictionary *item = CFBridgingRelease(result);
+        NSData *data = item[(__bridge id)kSecValueData];
+        *length = data.length;
+        if (data.length > capacity) {
+            return ERANGE;
+        }
+        [data getBytes:secret length:data.length];
+        if (attributes != NULL) {
+            SecretStoreKeychainGetAttributes(item, attributes);
+        }
+        return 0;
+    }
+}
+
+static int SecretStoreKeychainAdd(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    @autoreleasepool {
+        NSMutableDictionary *data = SecretStoreKeychainQuery(service, account);
+        if (data == nil) {
+            return EINVAL;
+        }
+        data[(__bridge id)kSecValueData] = [NSData dataWithBytes:secret length:length];
+        data[(__bridge id)kSecAttrAccessible] = (__bridge id)kSecAttrAccessibleWhenUnlocked;
+        if (attributes->rounds != 0) {
+            data[(__bridge id)kSecAttrGeneric] = SecretStoreKeychainRoundsAttribute(attributes->rounds);
+        }
+        if (attributes->type != 0) {
+            data[(__bridge id)kSecAttrType] = @(attributes->type);
+        }
+        
+        return SecretStoreKeychainError(SecItemAdd((__bridge CFDictionaryRef)data, NULL));
+    }
+}
+
+static int SecretStoreKeychainUpdate(void *context, const char *service, const char *account, const uint8_t *secret, size_t length, const SecretStoreAttributes *attributes) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, account);
+        if (query == nil) {
+            return EINVAL;
+        }
+        
+        NSMutableDictionary *data = [[NSMutableDictionary alloc] init];
+        data[(__bridge id)kSecValueData] = [NSData dataWithBytes:secret length:length];
+        if (attributes->rounds != 0) {
+            data[(__bridge id)kSecAttrGeneric] = SecretStoreKeychainRoundsAttribute(attributes->rounds);
+        }
+        // Together with the data, so the type always matches the secret
+        data[(__bridge id)kSecAttrType] = @(attributes->type);
+        
+        return SecretStoreKeychainError(SecItemUpdate((__bridge CFDictionaryRef)query, (__bridge CFDictionaryRef)data));
+    }
+}
+
+static int SecretStoreKeychainRemove(void *context, const char *service, const char *account) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, account);
+        if (query == nil) {
+            return EINVAL;
+        }
+        return SecretStoreKeychainError(SecItemDelete((__bridge CFDictionaryRef)query));
+    }
+}
+
+static int SecretStoreKeychainProbe(void *context, const char *service, const char *account, SecretStoreAttributes *attributes) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, account);
+        if (query == nil) {
+            return EINVAL;
+        }
+        // Attributes only, the secret never leaves the keychain
+        query[(__bridge id)kSecMatchLimit] = (__bridge id)kSecMatchLimitOne;
+        query[(__bridge id)kSecReturnAttributes] = (id)kCFBooleanTrue;
+        
+        CFDictionaryRef result;
+        int error = SecretStoreKeychainError(SecItemCopyMatching((__bridge CFDictionaryRef)query, (CFTypeRef *)&result));
+        if (error != 0) {
+            return error;
+        }
+        
+        NSDictionary *item = CFBridgingRelease(result);
+        if (attributes != NULL) {
+            SecretStoreKeychainGetAttributes(item, attributes);
+        }
+        return 0;
+    }
+}
+
+static int SecretStoreKeychainList(void *context, const char *service, SecretStoreListFunction found, void *foundContext) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, NULL);
+        if (query == nil) {
+            return EINVAL;
+        }
+        query[(__bridge id)kSecMatchLimit] = (__bridge id)kSecMatchLimitAll;
+        query[(__bridge id)kSecReturnAttributes] = (id)kCFBooleanTrue;
+        // Biometric items can't be listed without authentication, they aren't secret store items anyway
+        query[(__bridge id)kSecUseAuthenticationUI] = (__bridge id)kSecUseAuthenticationUISkip;
+        
+        CFArrayRef result;
+        OSStatus status = SecItemCopyMatching((__bridge CFDictionaryRef)query, (CFTypeRef *)&result);
+        if (status == errSecItemNotFound) {
+            return 0;
+        }
+        int error = SecretStoreKeychainError(status);
+        if (error != 0) {
+            return error;
+        }
+        
+        NSArray *items = CFBridgingRelease(result);
+        for (NSDictionary *item in items) {
+            NSString *account = item[(__bridge id)kSecAttrAccount];
+            if (account != nil) {
+                SecretStoreAttributes attributes;
+                SecretStoreKeychainGetAttributes(item, &attributes);
+                found(foundContext, account.UTF8String, &attributes);
+            }
+        }
+        return 0;
+    }
+}
+
+static int SecretStoreKeychainRemoveAll(void *context, const char *service) {
+    @autoreleasepool {
+        NSMutableDictionary *query = SecretStoreKeychainQuery(service, NULL);
+        if (query == nil) {
+            return EINVAL;
+        }
+        OSStatus status = SecItemDelete((__bridge CFDictionaryRef)query);
+        return status == errSecItemNotFound ? 0 : SecretStoreKeychainError(status);
+    }
+}
+
+void SecretStoreKeychainGetBackend(SecretStoreBackend *backend) {
+    backend->context = NULL;
+    backend->load = SecretStoreKeychainLoad;
+    backend->add = SecretStoreKeychainAdd;
+    backend->update = SecretStoreKeychainUpdate;
+    backend->remove = SecretStoreKeychainRemove;
+    backend->probe = SecretStoreKeychainProbe;
+    backend->list = SecretStoreKeychainList;
+    backend->removeAll = SecretStoreKeychainRemoveAll;
+}
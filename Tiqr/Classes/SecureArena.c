@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SecureArena.h"
+#include "HMACKey.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define SecureArenaMaxChunks UINT16_MAX
+
+struct SecureArena {
+    pthread_mutex_t lock;
+    size_t mappedLength;
+    size_t chunkCount;
+    SecureArenaMetrics metrics;
+    /** Chunks in the run that starts at each chunk, 0 for none. */
+    uint16_t *runs;
+    uint8_t *chunks;
+};
+
+static size_t SecureArenaRoundUp(size_t length, size_t multiple) {
+    return (length + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * First fit: walk the runs, skipping the ones in use, until enough free
+ * chunks follow each other.
+ */
+static bool SecureArenaFindRun(const SecureArena *arena, size_t needed, size_t *start) {
+    size_t freeStart = 0;
+    size_t freeCount = 0;
+    for (size_t i = 0; i < arena->chunkCount; ) {
+        if (arena->runs[i] != 0) {
+            i += arena->runs[i];
+            freeStart = i;
+            freeCount = 0;
+            continue;
+        }
+        if (++freeCount == needed) {
+            *start = freeStart;
+            return true;
+        }
+        i++;
+    }
+    return false;
+}
+
+int SecureArenaCreate(size_t capacity, SecureArena **arena) {
+    size_t chunkCount = SecureArenaRoundUp(capacity, SecureArenaChunkLength) / SecureArenaChunkLength;
+    if (chunkCount == 0 || chunkCount > SecureArenaMaxChunks) {
+        return EINVAL;
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t pageLength = pageSize > 0 ? (size_t)pageSize : 4096;
+    size_t headerLength = SecureArenaRoundUp(sizeof(SecureArena), SecureArenaChunkLength);
+    size_t runsLength = SecureArenaRoundUp(chunkCount * sizeof(uint16_t), SecureArenaChunkLength);
+    size_t mappedLength = SecureArenaRoundUp(headerLength + runsLength + chunkCount * SecureArenaChunkLength, pageLength);
+
+    void *region = mmap(NULL, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (region == MAP_FAILED) {
+        return errno;
+    }
+    if (mlock(region, mappedLength) != 0) {
+        int error = errno;
+        munmap(region, mappedLength);
+        return error;
+    }
+#ifdef MADV_DONTDUMP
+    madvise(region, mappedLength, MADV_DONTDUMP);
+#endif
+
+    SecureArena *created = region;
+    created->mappedLength = mappedLength;
+    created->chunkCount = chunkCount;
+    created->metrics.capacity = chunkCount * SecureArenaChunkLength;
+    created->runs = (uint16_t *)((uint8_t *)region + headerLength);
+    created->chunks = (uint8_t *)region + headerLength + runsLength;
+
+    int error = pthread_mutex_init(&created->lock, NULL);
+    if (error != 0) {
+        munlock(region, mappedLength);
+        munmap(region, mappedLength);
+        return error;
+    }
+
+    *arena = created;
+    return 0;
+}
+
+void SecureArenaDestroy(SecureArena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&arena->lock);
+    size_t mappedLength = arena->mappedLength;
+    HMACSecureZero(arena, mappedLength);
+    munlock(arena, mappedLength);
+    munmap(arena, mappedLength);
+}
+
+static SecureArena *SecureArenaSharedInstance;
+static pthread_once_t SecureArenaSharedOnce = PTHREAD_ONCE_INIT;
+
+static void SecureArenaCreateShared(void) {
+    if (SecureArenaCreate(SecureArenaSharedCapacity, &SecureArenaSharedInstance) != 0) {
+        SecureArenaSharedInstance = NULL;
+    }
+}
+
+SecureArena *SecureArenaShared(void) {
+    pthread_once(&SecureArenaSharedOnce, SecureArenaCreateShared);
+    return SecureArenaSharedInstance;
+}
+
+int SecureArenaAllocate(SecureArena *arena, size_t length, void **bytes) {
+    if (length == 0) {
+        return EINVAL;
+    }
+    size_t needed = length / SecureArenaChunkLength + (length % SecureArenaChunkLength != 0);
+
+    pthread_mutex_lock(&arena->lock);
+    size_t start = 0;
+    bool found = needed <= arena->chunkCount && SecureArenaFindRun(arena, needed, &start);
+    if (found) {
+        arena->runs[start] = (uint16_t)needed;
+        arena->metrics.allocations++;
+        arena->metrics.inUse += needed * SecureArenaChunkLength;
+        if (arena->metrics.inUse > arena->metrics.peakInUse) {
+            arena->metrics.peakInUse = arena->metrics.inUse;
+        }
+    } else {
+        arena->metrics.exhaustions++;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    if (!found) {
+        return ENOMEM;
+    }
+    // Released chunks are zero already
+    *bytes = arena->chunks + start * SecureArenaChunkLength;
+    return 0;
+}
+
+void SecureArenaRelease(SecureArena *arena, void *bytes) {
+    if (bytes == NULL || !SecureArenaContains(arena, bytes)) {
+        return;
+    }
+
+    size_t offset = (size_t)((uint8_t *)bytes - arena->chunks);
+    size_t start = offset / SecureArenaChunkLength;
+    pthread_mutex_lock(&arena->lock);
+    size_t count = arena->runs[start];
+    if (offset % SecureArenaChunkLength == 0 && count != 0) {
+        HMACSecureZero(bytes, count * SecureArenaChunkLength);
+        arena->runs[start] = 0;
+        arena->metrics.releases++;
+        arena->metrics.inUse -= count * SecureArenaChunkLength;
+    }
+    pthread_mutex_unlock(&arena->lock);
+}
+
+bool SecureArenaContains(const SecureArena *arena, const void *bytes) {
+    const uint8_t *pointer = bytes;
+    return pointer >= arena->chunks && pointer < arena->chunks + arena->chunkCount * SecureArenaChunkLength;
+}
+
+void SecureArenaGetMetrics(SecureArena *arena, SecureArenaMetrics *metrics) {
+    pthread_mutex_lock(&arena->lock);
+    *metrics = arena->metrics;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+int SecureBufferAcquire(SecureArena *arena, size_t length, SecureBuffer *buffer) {
+    void *bytes = NULL;
+    int result = SecureArenaAllocate(arena, length, &bytes);
+    if (result != 0) {
+        buffer->arena = NULL;
+        buffer->bytes = NULL;
+        buffer->length = 0;
+        return result;
+    }
+
+    buffer->arena = arena;
+    buffer->bytes = bytes;
+    buffer->length = length;
+    return 0;
+}
+
+void SecureBufferRelease(SecureBuffer *buffer) {
+    if (buffer->arena != NULL) {
+        SecureArenaRelease(buffer->arena, buffer->bytes);
+    }
+    buffer->arena = NULL;
+    buffer->bytes = NULL;
+    buffer->length = 0;
+}
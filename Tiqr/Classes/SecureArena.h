@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SecureArena_h
+#define SecureArena_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocator for key material: PIN derived keys, decrypted secrets and the
+ * buffers the OCRA engines build from them.
+ *
+ * An arena is a single region, allocated once, that is locked into memory
+ * (never written to swap) and excluded from core dumps where the platform
+ * allows it. Allocations are runs of SecureArenaChunkLength byte chunks,
+ * handed out first fit; releasing one zeroes it, and destroying the arena
+ * zeroes all of it. Once the arena exists, allocating and releasing key
+ * material never touches the heap, so a login has a fixed footprint.
+ *
+ * An arena is thread safe. Functions return 0 or an errno value.
+ */
+
+typedef struct SecureArena SecureArena;
+
+/**
+ * Allocation granularity and alignment, in bytes.
+ */
+#define SecureArenaChunkLength 64
+
+/**
+ * Capacity of the shared arena, room for the buffers of a few logins at
+ * the same time; each one needs less than 512 bytes.
+ */
+#define SecureArenaSharedCapacity (16 * 1024)
+
+typedef struct {
+    /** Bytes the arena can hand out. */
+    size_t capacity;
+    /** Bytes handed out now, in whole chunks. */
+    size_t inUse;
+    /** Most bytes handed out at the same time. */
+    size_t peakInUse;
+    uint64_t allocations;
+    uint64_t releases;
+    /** Allocations that did not fit. */
+    uint64_t exhaustions;
+} SecureArenaMetrics;
+
+/**
+ * Creates an empty arena.
+ *
+ * @param capacity  bytes the arena can hand out, rounded up to whole chunks;
+ *                  at most 65535 chunks
+ * @param arena     set to the new arena
+ *
+ * @return 0, EINVAL, or the error of allocating or locking the memory
+ */
+int SecureArenaCreate(size_t capacity, SecureArena **arena);
+
+/**
+ * Zeroes the arena and releases its memory. Every allocation must have
+ * been released.
+ */
+void SecureArenaDestroy(SecureArena *arena);
+
+/**
+ * The arena of the process, created on first use with
+ * SecureArenaSharedCapacity.
+ *
+ * @return the arena, or NULL when it could not be created
+ */
+SecureArena *SecureArenaShared(void);
+
+/**
+ * Allocates zeroed bytes.
+ *
+ * @param arena   arena
+ * @param length  number of bytes, not 0
+ * @param bytes   set to the allocation, aligned to SecureArenaChunkLength
+ *
+ * @return 0, EINVAL, or ENOMEM when there is no run of free chunks that fits
+ */
+int SecureArenaAllocate(SecureArena *arena, size_t length, void **bytes);
+
+/**
+ * Zeroes an allocation and returns it to the arena. Ignores NULL.
+ */
+void SecureArenaRelease(SecureArena *arena, void *bytes);
+
+/**
+ * Whether the bytes lie in the arena.
+ */
+bool SecureArenaContains(const SecureArena *arena, const void *bytes);
+
+/**
+ * Copies the counters.
+ */
+void SecureArenaGetMetrics(SecureArena *arena, SecureArenaMetrics *metrics);
+
+/**
+ * An allocation released at the end of the scope of its variable:
+ *
+ *     SecureBuffer key SecureBufferScoped = { 0 };
+ *     if (SecureBufferAcquire(arena, 32, &key) == 0) { ... }
+ */
+typedef struct {
+    SecureArena *arena;
+    uint8_t *bytes;
+    size_t length;
+} SecureBuffer;
+
+#define SecureBufferScoped __attribute__((cleanup(SecureBufferRelease)))
+
+/**
+ * Allocates the bytes of a buffer from the arena.
+ *
+ * @return 0 or the error of SecureArenaAllocate, the buffer is left empty
+ */
+int SecureBufferAcquire(SecureArena *arena, size_t length, SecureBuffer *buffer);
+
+/**
+ * Zeroes and releases the bytes of a buffer and empties it. Releasing an
+ * empty buffer does nothing.
+ */
+void SecureBufferRelease(SecureBuffer *buffer);
+
+#endif /* SecureArena_h */
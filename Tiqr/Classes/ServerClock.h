@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Singleton that keeps track of the clock offset between this device and
+ * the servers it talks to.
+ *
+ * Time based OCRA suites need a timestamp that is close to the server's
+ * clock. The offset is estimated from the Date header of HTTP responses:
+ * the server's time is assumed to have been taken halfway between sending
+ * the request and receiving the response. Per host a few samples are kept
+ * and the one with the smallest uncertainty (half the round trip) is used.
+ */
+@interface ServerClock : NSObject
+
+/**
+ * Returns the singleton instance of this class.
+ *
+ * @return singleton instance
+ */
++ (ServerClock *)sharedInstance;
+
+/**
+ * Records a clock sample from an HTTP response. Responses without a
+ * (valid) Date header are ignored.
+ *
+ * @param response     the response, should be an NSHTTPURLResponse
+ * @param requestDate  local time at which the request was sent
+ * @param responseDate local time at which the response was received
+ */
+- (void)recordResponse:(NSURLResponse *)response requestDate:(NSDate *)requestDate responseDate:(NSDate *)responseDate;
+
+/**
+ * Returns the estimated offset of the server's clock relative to the local
+ * clock. If no samples were recorded for the host of the given URL the best
+ * estimate of all hosts is returned, and 0 if there are no samples at all.
+ *
+ * @param url server URL
+ *
+ * @return offset in seconds (server time - local time)
+ */
+- (NSTimeInterval)offsetForURL:(NSURL *)url;
+
+/**
+ * Returns the current time according to the server's clock.
+ *
+ * @param url server URL
+ *
+ * @return estimated server time
+ */
+- (NSDate *)serverDateForURL:(NSURL *)url;
+
+/**
+ * Parses an HTTP date (RFC 7231 section 7.1.1.1), accepting the preferred
+ * IMF-fixdate format as well as the obsolete RFC 850 and asctime formats.
+ *
+ * @param string date header value
+ *
+ * @return date or nil if the string couldn't be parsed
+ */
++ (NSDate *)dateFromHTTPDateString:(NSString *)string;
+
+@end
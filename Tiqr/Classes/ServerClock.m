@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#import "ServerClock.h"
+
+// Number of samples kept per host
+static const NSUInteger ServerClockMaximumSamples = 8;
+
+// Date headers have a resolution of one second
+static const NSTimeInterval ServerClockDateResolution = 1.0;
+
+// Assumed drift of the local clock relative to the server, in seconds per second
+static const NSTimeInterval ServerClockDriftRate = 0.0001;
+
+static ServerClock *sharedInstance = nil;
+
+@interface ServerClockSample : NSObject
+
+@property (nonatomic, assign) NSTimeInterval offset;
+@property (nonatomic, assign) NSTimeInterval roundTripTime;
+@property (nonatomic, strong) NSDate *date;
+
+@end
+
+@implementation ServerClockSample
+
+- (NSTimeInterval)uncertaintyAtDate:(NSDate *)date {
+    NSTimeInterval age = fabs([date timeIntervalSinceDate:self.date]);
+    return self.roundTripTime / 2.0 + ServerClockDateResolution / 2.0 + age * ServerClockDriftRate;
+}
+
+@end
+
+@interface ServerClock ()
+
+@property (nonatomic, strong) NSMutableDictionary *samples;
+
+@end
+
+@implementation ServerClock
+
+- (instancetype)init {
+    self = [super init];
+    if (self != nil) {
+        self.samples = [NSMutableDictionary dictionary];
+    }
+    
+    return self;
+}
+
+- (void)recordResponse:(NSURLResponse *)response requestDate:(NSDate *)requestDate responseDate:(NSDate *)responseDate {
+    if (![response isKindOfClass:[NSHTTPURLResponse class]] || requestDate == nil || responseDate == nil) {
+        return;
+    }
+    
+    NSString *host = [response.URL.host lowercaseString];
+    NSDate *serverDate = [ServerClock dateFromHTTPDateString:[(NSHTTPURLResponse *)response allHeaderFields][@"Date"]];
+    NSTimeInterval roundTripTime = [responseDate timeIntervalSinceDate:requestDate];
+    if (host == nil || serverDate == nil || roundTripTime < 0) {
+        return;
+    }
+    
+    // The header is truncated to whole seconds, so on average the server was half a second further
+    NSDate *midpoint = [requestDate dateByAddingTimeInterval:roundTripTime / 2.0];
+    ServerClockSample *sample = [[ServerClockSample alloc] init];
+    sample.offset = [serverDate timeIntervalSinceDate:midpoint] + ServerClockDateResolution / 2.0;
+    sample.roundTripTime = roundTripTime;
+    sample.date = responseDate;
+    
+    @synchronized(self) {
+        NSMutableArray *samples = self.samples[host];
+        if (samples == nil) {
+            samples = [NSMutableArray array];
+            self.samples[host] = samples;
+        }
+        
+        [samples addObject:sample];
+        if ([samples count] > ServerClockMaximumSamples) {
+            [samples removeObjectAtIndex:0];
+        }
+    }
+}
+
+- (ServerClockSample *)bestSampleInArray:(NSArray *)samples atDate:(NSDate *)date {
+    ServerClockSample *best = nil;
+    for (ServerClockSample *sample in samples) {
+        if (best == nil || [sample uncertaintyAtDate:date] < [best uncertaintyAtDate:date]) {
+            best = sample;
+        }
+    }
+    
+    return best;
+}
+
+- (NSTimeInterval)offsetForURL:(NSURL *)url {
+    NSDate *now = [NSDate date];
+    NSString *host = [url.host lowercaseString];
+    
+    @synchronized(self) {
+        ServerClockSample *sample = nil;
+        if (host != nil) {
+            sample = [self bestSampleInArray:self.samples[host] atDate:now];
+        }
+        
+        if (sample == nil) {
+            NSMutableArray *candidates = [NSMutableArray array];
+            for (NSArray *samples in [self.samples allValues]) {
+                [candidates addObjectsFromArray:samples];
+            }
+            
+            sample = [self bestSampleInArray:candidates atDate:now];
+        }
+        
+        return sample != nil ? sample.offset : 0;
+    }
+}
+
+- (NSDate *)serverDateForURL:(NSURL *)url {
+    return [NSDate dateWithTimeIntervalSinceNow:[self offsetForURL:url]];
+}
+
++ (NSDate *)dateFromHTTPDateString:(NSString *)string {
+    static NSArray *formatters = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSArray *formats = @[@"EEE',' dd MMM yyyy HH':'mm':'ss 'GMT'",  // IMF-fixdate
+                             @"EEEE',' dd'-'MMM'-'yy HH':'mm':'ss 'GMT'", // RFC 850
+                             @"EEE MMM d HH':'mm':'ss yyyy"];             // asctime
+        NSMutableArray *result = [NSMutableArray array];
+        for (NSString *format in formats) {
+            NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+            formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+            formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+            formatter.dateFormat = format;
+            [result addObject:formatter];
+        }
+        
+        formatters = result;
+    });
+    
+    if (![string isKindOfClass:[NSString class]]) {
+        return nil;
+    }
+    
+    // asctime pads the day with a space, collapse it so a single pattern matches
+    NSString *value = [[string stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]] stringByReplacingOccurrencesOfString:@"  " withString:@" "];
+    
+    // NSDateFormatter isn't thread safe before iOS 7
+    @synchronized(formatters) {
+        for (NSDateFormatter *formatter in formatters) {
+            NSDate *date = [formatter dateFromString:value];
+            if (date != nil) {
+                return date;
+            }
+        }
+    }
+    
+    return nil;
+}
+
+#pragma mark -
+#pragma mark Singleton methods
+
++ (ServerClock *)sharedInstance {
+    @synchronized(self) {
+        if (sharedInstance == nil) {
+            sharedInstance = [[ServerClock alloc] init];
+        }
+    }
+    
+    return sharedInstance;
+}
+
+@end
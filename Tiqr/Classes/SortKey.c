@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SortKey.h"
+
+#include <errno.h>
+
+static bool SortKeyInBounds(int64_t key) {
+    return key > -SortKeyLimit && key < SortKeyLimit;
+}
+
+int SortKeyAppend(int64_t last, bool hasLast, int64_t *key) {
+    if (!hasLast) {
+        *key = SortKeyGap;
+        return 0;
+    }
+    if (!SortKeyInBounds(last + SortKeyGap)) {
+        return EOVERFLOW;
+    }
+    
+    *key = last + SortKeyGap;
+    return 0;
+}
+
+int SortKeyBetween(const int64_t *lower, const int64_t *upper, int64_t *key) {
+    if (lower != NULL && upper != NULL) {
+        if (!SortKeyInBounds(*lower) || !SortKeyInBounds(*upper)) {
+            return EOVERFLOW;
+        }
+        if (*upper - *lower < 2) {
+            return ENOSPC;
+        }
+        *key = *lower + (*upper - *lower) / 2;
+        return 0;
+    }
+    
+    if (upper != NULL) {
+        if (!SortKeyInBounds(*upper - SortKeyGap)) {
+            return ENOSPC;
+        }
+        *key = *upper - SortKeyGap;
+        return 0;
+    }
+    
+    return SortKeyAppend(lower != NULL ? *lower : 0, lower != NULL, key);
+}
+
+int SortKeyPlace(int64_t *keys, size_t count, size_t position, int64_t *key, size_t *first, size_t *last) {
+    if (position > count) {
+        return EINVAL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!SortKeyInBounds(keys[i])) {
+            return EOVERFLOW;
+        }
+    }
+    
+    *first = position;
+    *last = position;
+    int error = SortKeyBetween(position > 0 ? &keys[position - 1] : NULL, position < count ? &keys[position] : NULL, key);
+    if (error != ENOSPC) {
+        return error;
+    }
+    
+    // Widen the window around position until its items and the placed one fit
+    for (size_t radius = 1; ; radius *= 2) {
+        size_t lo = position > radius ? position - radius : 0;
+        size_t hi = count - position > radius ? position + radius : count;
+        int64_t slots = (int64_t)(hi - lo) + 1;
+        
+        // Past either end there is all the room needed
+        int64_t lower = lo > 0 ? keys[lo - 1] : keys[lo] - (slots + 1) * SortKeyGap;
+        int64_t upper = hi < count ? keys[hi] : keys[hi - 1] + (slots + 1) * SortKeyGap;
+        int64_t spacing = (upper - lower) / (slots + 1);
+        if (!SortKeyInBounds(lower) || !SortKeyInBounds(upper)) {
+            return EOVERFLOW;
+        }
+        if (spacing < SortKeyMinimumSpacing && (lo > 0 || hi < count)) {
+            continue;
+        }
+        
+        int64_t next = lower;
+        for (size_t i = lo; i < hi; i++) {
+            if (i == position) {
+                next += spacing;
+                *key = next;
+            }
+            next += spacing;
+            keys[i] = next;
+        }
+        
+        *first = lo;
+        *last = hi;
+        return 0;
+    }
+}
+
+void SortKeySpread(int64_t *keys, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = (int64_t)(i + 1) * SortKeyGap;
+    }
+}
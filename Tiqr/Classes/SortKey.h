@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2010-2011 SURFnet bv
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of SURFnet bv nor the names of its contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE
+ * GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER
+ * IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SortKey_h
+#define SortKey_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Gap based ordering keys for the identity list.
+ *
+ * Items are ordered by a 64-bit key and consecutive items are SortKeyGap
+ * apart, so an item can be moved by giving it a key halfway between its new
+ * neighbours without touching any other item. Only when the neighbours are
+ * too close together is a small window of keys around the position spread
+ * out again; the window doubles until its keys are no closer than
+ * SortKeyMinimumSpacing, so a move changes O(log n) keys amortized and
+ * usually exactly one.
+ */
+
+/** Distance between the keys of items that are appended or spread out. */
+#define SortKeyGap ((int64_t)1 << 20)
+
+/** Closest spacing a spread out window may leave between its keys. */
+#define SortKeyMinimumSpacing ((int64_t)1 << 10)
+
+/** Keys are kept within +/- this bound, far from overflowing. */
+#define SortKeyLimit ((int64_t)1 << 61)
+
+/**
+ * The key for an item appended after the item with key last, or for the
+ * first item when there is no last item.
+ *
+ * @return 0, or EOVERFLOW when last is out of bounds
+ */
+int SortKeyAppend(int64_t last, bool hasLast, int64_t *key);
+
+/**
+ * The key for an item placed between the items with keys lower and upper,
+ * either of which is NULL at the ends of the list. Only needs the
+ * neighbours, which is all a move takes as long as there is room.
+ *
+ * @return 0, or ENOSPC when there is no room and SortKeyPlace has to spread
+ *         out keys around the position
+ */
+int SortKeyBetween(const int64_t *lower, const int64_t *upper, int64_t *key);
+
+/**
+ * Picks the key for an item placed at position among count items with the
+ * ascending keys, which don't include the item itself.
+ *
+ * When the neighbours leave no room, the keys of the items in
+ * [*first, *last) are spread out in place and have to be stored together
+ * with the key of the placed item; otherwise *first equals *last.
+ *
+ * @return 0, EINVAL when position is past count, or EOVERFLOW when keys are
+ *         out of bounds and everything has to be spread with SortKeySpread
+ */
+int SortKeyPlace(int64_t *keys, size_t count, size_t position, int64_t *key, size_t *first, size_t *last);
+
+/**
+ * Gives count items the keys SortKeyGap, 2 * SortKeyGap and so on.
+ */
+void SortKeySpread(int64_t *keys, size_t count);
+
+#endif /* SortKey_h */
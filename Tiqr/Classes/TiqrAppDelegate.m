@@ -102,7 +102,8 @@
 }
 
 - (void)applicationDidEnterBackground:(UIApplication *)application {
-    [ServiceContainer.sharedInstance.identityService saveIdentities];
+    [ServiceContainer.sharedInstance.secretService wipeDerivedKeys];
+    [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
 }
 
 - (void)applicationWillEnterForeground:(UIApplication *)application {
@@ -110,7 +111,7 @@
 }
 
 - (void)applicationWillTerminate:(UIApplication *)application {
-    [ServiceContainer.sharedInstance.identityService saveIdentities];
+    [ServiceContainer.sharedInstance.identityService saveIdentitiesDurably];
 }
 
 #pragma mark -
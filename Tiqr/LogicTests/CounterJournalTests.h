@@ -0,0 +1,12 @@
+//
+//  CounterJournalTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface CounterJournalTests : SenTestCase {
+
+}
+
+@end
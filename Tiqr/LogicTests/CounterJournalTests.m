@@ -0,0 +1,148 @@
+//
+//  CounterJournalTests.m
+//  LogicTests
+//
+
+#import "CounterJournalTests.h"
+#import "CounterJournal.h"
+
+#import <fcntl.h>
+#import <unistd.h>
+
+@interface CounterJournalTests ()
+
+@property (nonatomic, copy) NSString *path;
+
+@end
+
+@implementation CounterJournalTests
+
+- (void)setUp {
+    [super setUp];
+    self.path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:[self.path stringByAppendingString:@".tmp"] error:NULL];
+    [super tearDown];
+}
+
+- (unsigned long long)fileSize {
+    return [[[NSFileManager defaultManager] attributesOfItemAtPath:self.path error:NULL] fileSize];
+}
+
+- (CounterJournal *)openJournal {
+    CounterJournal *journal = NULL;
+    STAssertEquals(CounterJournalOpen([self.path fileSystemRepresentation], &journal), 0, @"Journal should open");
+    return journal;
+}
+
+- (void)testNextAndReopen {
+    CounterJournal *journal = [self openJournal];
+    uint64_t counter = 0;
+    STAssertFalse(CounterJournalGet(journal, "a", &counter), @"New journal is empty");
+    for (uint64_t i = 0; i < 100; i++) {
+        STAssertEquals(CounterJournalNext(journal, "a", &counter), 0, @"Next should succeed");
+        STAssertEquals(counter, i, @"Counters are handed out in order");
+    }
+    STAssertEquals(CounterJournalSet(journal, "b", 42), 0, @"Set should succeed");
+    CounterJournalClose(journal);
+    
+    journal = [self openJournal];
+    STAssertTrue(CounterJournalGet(journal, "a", &counter) && counter == 100, @"Counter a survives a reopen");
+    STAssertTrue(CounterJournalGet(journal, "b", &counter) && counter == 42, @"Counter b survives a reopen");
+    STAssertEquals(CounterJournalRemove(journal, "b"), 0, @"Remove should succeed");
+    CounterJournalClose(journal);
+    
+    journal = [self openJournal];
+    STAssertFalse(CounterJournalGet(journal, "b", NULL), @"Removed counter stays removed");
+    CounterJournalClose(journal);
+}
+
+- (void)testTornRecordIsDropped {
+    CounterJournal *journal = [self openJournal];
+    CounterJournalSet(journal, "a", 100);
+    unsigned long long validSize = [self fileSize];
+    CounterJournalSet(journal, "b", 42);
+    CounterJournalClose(journal);
+    
+    unsigned long long fullSize = [self fileSize];
+    NSData *original = [NSData dataWithContentsOfFile:self.path];
+    
+    // A crash can cut the last record anywhere
+    for (unsigned long long size = validSize + 1; size < fullSize; size++) {
+        [original writeToFile:self.path atomically:NO];
+        truncate([self.path fileSystemRepresentation], (off_t)size);
+        
+        journal = [self openJournal];
+        uint64_t counter = 0;
+        STAssertTrue(CounterJournalGet(journal, "a", &counter) && counter == 100, @"Complete records survive");
+        STAssertFalse(CounterJournalGet(journal, "b", NULL), @"Torn record is dropped");
+        STAssertEquals([self fileSize], validSize, @"Torn record is truncated away");
+        
+        STAssertEquals(CounterJournalSet(journal, "c", 7), 0, @"Journal is writable after recovery");
+        CounterJournalClose(journal);
+        journal = [self openJournal];
+        STAssertTrue(CounterJournalGet(journal, "c", &counter) && counter == 7, @"Record written after recovery survives");
+        CounterJournalClose(journal);
+    }
+}
+
+- (void)testCorruptRecordIsDropped {
+    CounterJournal *journal = [self openJournal];
+    CounterJournalSet(journal, "a", 100);
+    CounterJournalSet(journal, "b", 42);
+    CounterJournalClose(journal);
+    
+    // Flip a bit in the counter of the last record
+    NSMutableData *data = [NSMutableData dataWithContentsOfFile:self.path];
+    ((uint8_t *)[data mutableBytes])[[data length] - 6] ^= 0x01;
+    [data appendBytes:"garbage" length:7];
+    [data writeToFile:self.path atomically:NO];
+    
+    journal = [self openJournal];
+    uint64_t counter = 0;
+    STAssertTrue(CounterJournalGet(journal, "a", &counter) && counter == 100, @"Records in front of the corruption survive");
+    STAssertFalse(CounterJournalGet(journal, "b", NULL), @"Record failing its checksum is dropped");
+    CounterJournalClose(journal);
+    
+    // Anything else than a journal is left alone
+    [@"SQLite format 3" writeToFile:self.path atomically:NO encoding:NSASCIIStringEncoding error:NULL];
+    STAssertEquals(CounterJournalOpen([self.path fileSystemRepresentation], &journal), EINVAL, @"Foreign file should be rejected");
+}
+
+- (void)testCompaction {
+    CounterJournal *journal = [self openJournal];
+    uint64_t counter = 0;
+    for (int i = 0; i < 1000; i++) {
+        CounterJournalNext(journal, [[NSString stringWithFormat:@"identity%d", i % 3] UTF8String], &counter);
+    }
+    STAssertTrue(CounterJournalRecordCount(journal) < 256, @"Superseded records should be compacted");
+    CounterJournalClose(journal);
+    
+    // A compaction that crashed before its rename leaves a stray temporary file
+    [@"junk" writeToFile:[self.path stringByAppendingString:@".tmp"] atomically:NO encoding:NSASCIIStringEncoding error:NULL];
+    
+    journal = [self openJournal];
+    STAssertTrue(CounterJournalGet(journal, "identity0", &counter) && counter == 334, @"Counter survives compaction");
+    STAssertTrue(CounterJournalGet(journal, "identity2", &counter) && counter == 333, @"Counter survives compaction");
+    CounterJournalClose(journal);
+}
+
+- (void)testIncrementPerformance {
+    CounterJournal *journal = [self openJournal];
+    const int iterations = 1000;
+    uint64_t counter = 0;
+    
+    NSDate *start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        CounterJournalNext(journal, "nl.surfnet\njohn.doe@example.org", &counter);
+    }
+    NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+    CounterJournalClose(journal);
+    
+    NSLog(@"Counter journal: %.1f us per durable increment", elapsed / iterations * 1e6);
+}
+
+@end
@@ -0,0 +1,12 @@
+//
+//  DerivedKeyCacheTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface DerivedKeyCacheTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,146 @@
+//
+//  DerivedKeyCacheTests.m
+//  LogicTests
+//
+
+#import "DerivedKeyCacheTests.h"
+#import "DerivedKeyCache.h"
+
+static const uint8_t DerivedKeyCacheTestsSalt[32] = { 1, 2, 3 };
+
+static DerivedKeyCacheInput DerivedKeyCacheTestsInput(const char *identity, const char *PIN, uint32_t rounds) {
+    DerivedKeyCacheInput input = {
+        (const uint8_t *)identity, strlen(identity),
+        DerivedKeyCacheTestsSalt, sizeof(DerivedKeyCacheTestsSalt),
+        (const uint8_t *)PIN, strlen(PIN),
+        rounds
+    };
+    return input;
+}
+
+@interface DerivedKeyCacheTests ()
+
+@property (nonatomic, assign) DerivedKeyCache *cache;
+
+@end
+
+@implementation DerivedKeyCacheTests
+
+- (void)setUp {
+    [super setUp];
+    DerivedKeyCachePolicy policy = { 1000, 0 };
+    DerivedKeyCache *cache = NULL;
+    STAssertEquals(DerivedKeyCacheCreate(&policy, &cache), 0, @"Cache should be created");
+    self.cache = cache;
+}
+
+- (void)tearDown {
+    DerivedKeyCacheDestroy(self.cache);
+    [super tearDown];
+}
+
+- (void)testInvalidPolicy {
+    DerivedKeyCachePolicy policy = { 0, 0 };
+    DerivedKeyCache *cache = NULL;
+    STAssertEquals(DerivedKeyCacheCreate(&policy, &cache), EINVAL, @"A cache without expiry is refused");
+}
+
+- (void)testOnlyTheSameInputHits {
+    uint8_t key[32], found[32];
+    for (int i = 0; i < 32; i++) {
+        key[i] = (uint8_t)i;
+    }
+    DerivedKeyCacheInput input = DerivedKeyCacheTestsInput("provider\nalice", "1234", 10000);
+    DerivedKeyCacheInput otherPIN = DerivedKeyCacheTestsInput("provider\nalice", "1235", 10000);
+    DerivedKeyCacheInput otherIdentity = DerivedKeyCacheTestsInput("provider\nbob", "1234", 10000);
+    DerivedKeyCacheInput otherRounds = DerivedKeyCacheTestsInput("provider\nalice", "1234", 20000);
+    
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &input, 0, found, sizeof(found)), @"Empty cache");
+    STAssertEquals(DerivedKeyCacheInsert(self.cache, &input, 0, key, sizeof(key)), 0, @"Insert should succeed");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &otherPIN, 1, found, sizeof(found)), @"A different PIN never hits");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &otherIdentity, 1, found, sizeof(found)), @"Different identity");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &otherRounds, 1, found, sizeof(found)), @"Different rounds");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &input, 1, found, 16), @"Different key length");
+    STAssertTrue(DerivedKeyCacheLookup(self.cache, &input, 1, found, sizeof(found)), @"Same input hits");
+    STAssertTrue(memcmp(found, key, sizeof(key)) == 0, @"Cached key");
+    
+    DerivedKeyCacheMetrics metrics;
+    DerivedKeyCacheGetMetrics(self.cache, &metrics);
+    STAssertEquals(metrics.hits, 1ULL, @"One hit");
+    STAssertEquals(metrics.misses, 5ULL, @"Five misses");
+    STAssertEquals(metrics.insertions, 1ULL, @"One insertion");
+}
+
+- (void)testExpiry {
+    uint8_t key[32] = { 1 }, found[32];
+    DerivedKeyCacheInput input = DerivedKeyCacheTestsInput("alice", "1234", 10000);
+    
+    DerivedKeyCacheInsert(self.cache, &input, 10, key, sizeof(key));
+    STAssertEquals(DerivedKeyCachePurge(self.cache, 1009), (size_t)1, @"Not expired yet");
+    STAssertTrue(DerivedKeyCacheLookup(self.cache, &input, 1009, found, sizeof(found)), @"Still cached");
+    STAssertEquals(DerivedKeyCachePurge(self.cache, 1010), (size_t)0, @"Expired after the time to live");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &input, 1010, found, sizeof(found)), @"Gone");
+    
+    DerivedKeyCacheMetrics metrics;
+    DerivedKeyCacheGetMetrics(self.cache, &metrics);
+    STAssertEquals(metrics.expirations, 1ULL, @"One expiration");
+}
+
+- (void)testMaximumUses {
+    DerivedKeyCacheDestroy(self.cache);
+    DerivedKeyCachePolicy policy = { 1000, 2 };
+    DerivedKeyCache *cache = NULL;
+    DerivedKeyCacheCreate(&policy, &cache);
+    self.cache = cache;
+    
+    uint8_t key[32] = { 1 }, found[32];
+    DerivedKeyCacheInput input = DerivedKeyCacheTestsInput("alice", "1234", 10000);
+    DerivedKeyCacheInsert(self.cache, &input, 0, key, sizeof(key));
+    STAssertTrue(DerivedKeyCacheLookup(self.cache, &input, 1, found, sizeof(found)), @"First use");
+    STAssertTrue(DerivedKeyCacheLookup(self.cache, &input, 2, found, sizeof(found)), @"Second use");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &input, 3, found, sizeof(found)), @"Used up");
+}
+
+- (void)testWipe {
+    uint8_t key[32] = { 1 }, found[32];
+    DerivedKeyCacheInput input = DerivedKeyCacheTestsInput("alice", "1234", 10000);
+    DerivedKeyCacheInsert(self.cache, &input, 0, key, sizeof(key));
+    DerivedKeyCacheWipe(self.cache);
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &input, 1, found, sizeof(found)), @"Wiped");
+    
+    DerivedKeyCacheMetrics metrics;
+    DerivedKeyCacheGetMetrics(self.cache, &metrics);
+    STAssertEquals(metrics.wipes, 1ULL, @"One wipe");
+}
+
+- (void)testEvictsTheOldestKey {
+    uint8_t key[32] = { 1 }, found[32];
+    char identities[DerivedKeyCacheCapacity + 1][16];
+    for (int i = 0; i <= DerivedKeyCacheCapacity; i++) {
+        snprintf(identities[i], sizeof(identities[i]), "identity%d", i);
+        DerivedKeyCacheInput input = DerivedKeyCacheTestsInput(identities[i], "1234", 10000);
+        STAssertEquals(DerivedKeyCacheInsert(self.cache, &input, 100 + i, key, sizeof(key)), 0, @"Insert should succeed");
+    }
+    
+    DerivedKeyCacheInput oldest = DerivedKeyCacheTestsInput(identities[0], "1234", 10000);
+    DerivedKeyCacheInput newest = DerivedKeyCacheTestsInput(identities[DerivedKeyCacheCapacity], "1234", 10000);
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &oldest, 200, found, sizeof(found)), @"Oldest key was evicted");
+    STAssertTrue(DerivedKeyCacheLookup(self.cache, &newest, 200, found, sizeof(found)), @"Newest key is cached");
+    
+    DerivedKeyCacheMetrics metrics;
+    DerivedKeyCacheGetMetrics(self.cache, &metrics);
+    STAssertEquals(metrics.evictions, 1ULL, @"One eviction");
+}
+
+- (void)testRefusesOversizedInput {
+    uint8_t key[DerivedKeyCacheMaxKeyLength + 1] = { 0 }, found[32];
+    DerivedKeyCacheInput input = DerivedKeyCacheTestsInput("alice", "1234", 10000);
+    STAssertEquals(DerivedKeyCacheInsert(self.cache, &input, 0, key, sizeof(key)), EINVAL, @"Key too long");
+    
+    static uint8_t identity[DerivedKeyCacheMaxInputLength + 1];
+    DerivedKeyCacheInput longInput = { identity, sizeof(identity), NULL, 0, NULL, 0, 1 };
+    STAssertEquals(DerivedKeyCacheInsert(self.cache, &longInput, 0, found, sizeof(found)), EINVAL, @"Input too long");
+    STAssertFalse(DerivedKeyCacheLookup(self.cache, &longInput, 0, found, sizeof(found)), @"Never cached");
+}
+
+@end
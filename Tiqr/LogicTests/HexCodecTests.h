@@ -0,0 +1,12 @@
+//
+//  HexCodecTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface HexCodecTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,106 @@
+//
+//  HexCodecTests.m
+//  LogicTests
+//
+
+#import "HexCodecTests.h"
+#import "HexCodec.h"
+#import "NSData+Hex.h"
+
+@implementation HexCodecTests
+
+- (void)testCategoryRoundTrip {
+    const uint8_t bytes[] = { 0x00, 0x01, 0x7f, 0x80, 0xab, 0xcd, 0xef, 0xff };
+    NSData *data = [NSData dataWithBytes:bytes length:sizeof(bytes)];
+    
+    STAssertEqualObjects([data hexStringValue], @"00017F80ABCDEFFF", @"Upper case, two digits per byte");
+    STAssertEqualObjects([[NSData data] hexStringValue], @"", @"Empty data");
+    STAssertEqualObjects([NSData dataWithHexString:@"00017F80ABCDEFFF"], data, @"Upper case digits");
+    STAssertEqualObjects([NSData dataWithHexString:@"00017f80abcdefff"], data, @"Lower case digits");
+    STAssertEqualObjects([NSData dataWithHexString:@""], [NSData data], @"Empty string");
+    
+    STAssertNil([NSData dataWithHexString:@"0"], @"Odd number of digits");
+    STAssertNil([NSData dataWithHexString:@"0G"], @"Not a hex digit");
+    STAssertNil([NSData dataWithHexString:@"0x00"], @"Prefixes aren't hex digits");
+    STAssertNil([NSData dataWithHexString:@"00 0"], @"Spaces aren't hex digits");
+    STAssertNil([NSData dataWithHexString:@"0é"], @"Non ASCII");
+}
+
+- (void)testKernelsMatchScalarCode {
+    uint8_t bytes[300];
+    uint8_t decoded[300];
+    uint8_t scalarDecoded[300];
+    char hex[600];
+    char scalarHex[600];
+    
+    srandom(16);
+    for (int iteration = 0; iteration < 10000; iteration++) {
+        size_t length = random() % sizeof(bytes);
+        for (size_t i = 0; i < length; i++) {
+            bytes[i] = (uint8_t)random();
+        }
+        HexCase hexCase = iteration & 1 ? HexCaseLower : HexCaseUpper;
+        
+        HexEncode(bytes, length, hex, hexCase);
+        HexCodecSetScalar(true);
+        HexEncode(bytes, length, scalarHex, hexCase);
+        HexCodecSetScalar(false);
+        STAssertTrue(memcmp(hex, scalarHex, 2 * length) == 0, @"%s and scalar encoding should agree", HexCodecKernelName());
+        
+        // Every other round has one invalid digit somewhere
+        BOOL corrupt = length > 0 && iteration % 4 < 2;
+        if (corrupt) {
+            hex[random() % (2 * length)] = "gG/:@`\x80 "[random() % 8];
+        }
+        BOOL valid = HexDecode(hex, 2 * length, decoded);
+        HexCodecSetScalar(true);
+        BOOL scalarValid = HexDecode(hex, 2 * length, scalarDecoded);
+        HexCodecSetScalar(false);
+        
+        STAssertEquals(valid, (BOOL)!corrupt, @"Only well formed input should decode");
+        STAssertEquals(scalarValid, (BOOL)!corrupt, @"Only well formed input should decode");
+        if (!corrupt) {
+            STAssertTrue(memcmp(decoded, bytes, length) == 0 && memcmp(scalarDecoded, bytes, length) == 0, @"Decoding should undo encoding");
+        }
+    }
+}
+
+- (void)testPerformance {
+    NSMutableData *data = [NSMutableData dataWithLength:4096];
+    arc4random_buf([data mutableBytes], [data length]);
+    const int iterations = 1000;
+    
+    NSDate *start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            NSMutableString *stringBuffer = [NSMutableString stringWithCapacity:([data length] * 2)];
+            const unsigned char *dataBuffer = [data bytes];
+            for (int j = 0; j < [data length]; ++j) {
+                [stringBuffer appendFormat:@"%02lX", (unsigned long)dataBuffer[j]];
+            }
+        }
+    }
+    NSTimeInterval formatElapsed = -[start timeIntervalSinceNow];
+    
+    NSString *hexString = nil;
+    start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            hexString = [data hexStringValue];
+        }
+    }
+    NSTimeInterval encodeElapsed = -[start timeIntervalSinceNow];
+    
+    start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            [NSData dataWithHexString:hexString];
+        }
+    }
+    NSTimeInterval decodeElapsed = -[start timeIntervalSinceNow];
+    
+    double megabytes = [data length] * (double)iterations / 1e6;
+    NSLog(@"Hex 4 KB: appendFormat %.1f MB/s, hexStringValue (%s) %.1f MB/s, dataWithHexString %.1f MB/s", megabytes / formatElapsed, HexCodecKernelName(), megabytes / encodeElapsed, megabytes / decodeElapsed);
+}
+
+@end
@@ -0,0 +1,12 @@
+//
+//  IdentityIndexTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface IdentityIndexTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,419 @@
+//
+//  IdentityIndexTests.m
+//  LogicTests
+//
+
+#import "IdentityIndexTests.h"
+#import "IdentityIndex.h"
+#import "Identity.h"
+#import "IdentityProvider.h"
+
+@interface IdentityIndexTests ()
+
+@property (nonatomic, strong) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, strong) IdentityIndex *index;
+@property (nonatomic, copy) NSString *storePath;
+
+@end
+
+@implementation IdentityIndexTests
+
+- (NSManagedObjectContext *)managedObjectContextWithStoreType:(NSString *)storeType URL:(NSURL *)storeURL {
+    NSArray *bundles = @[[NSBundle bundleForClass:[self class]]];
+    NSManagedObjectModel *managedObjectModel = [NSManagedObjectModel mergedModelFromBundles:bundles];
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:managedObjectModel];
+    NSError *error = nil;
+    STAssertNotNil([persistentStoreCoordinator addPersistentStoreWithType:storeType configuration:nil URL:storeURL options:nil error:&error], @"Store should open");
+    
+    NSManagedObjectContext *managedObjectContext = [[NSManagedObjectContext alloc] init];
+    [managedObjectContext setPersistentStoreCoordinator:persistentStoreCoordinator];
+    return managedObjectContext;
+}
+
+- (void)setUp {
+    [super setUp];
+    self.managedObjectContext = [self managedObjectContextWithStoreType:NSInMemoryStoreType URL:nil];
+    self.index = [[IdentityIndex alloc] initWithManagedObjectContext:self.managedObjectContext];
+}
+
+- (void)tearDown {
+    self.index = nil;
+    self.managedObjectContext = nil;
+    if (self.storePath != nil) {
+        for (NSString *suffix in @[@"", @"-wal", @"-shm"]) {
+            [[NSFileManager defaultManager] removeItemAtPath:[self.storePath stringByAppendingString:suffix] error:NULL];
+        }
+    }
+    [super tearDown];
+}
+
+- (IdentityProvider *)insertIdentityProviderWithIdentifier:(NSString *)identifier inContext:(NSManagedObjectContext *)managedObjectContext {
+    IdentityProvider *identityProvider = [NSEntityDescription insertNewObjectForEntityForName:@"IdentityProvider" inManagedObjectContext:managedObjectContext];
+    identityProvider.identifier = identifier;
+    identityProvider.displayName = identifier;
+    identityProvider.authenticationUrl = [NSString stringWithFormat:@"https://%@/auth/", identifier];
+    identityProvider.infoUrl = [NSString stringWithFormat:@"https://%@/", identifier];
+    return identityProvider;
+}
+
+- (Identity *)insertIdentityWithIdentifier:(NSString *)identifier forIdentityProvider:(IdentityProvider *)identityProvider {
+    Identity *identity = [NSEntityDescription insertNewObjectForEntityForName:@"Identity" inManagedObjectContext:identityProvider.managedObjectContext];
+    identity.identityProvider = identityProvider;
+    identity.identifier = identifier;
+    identity.displayName = identifier;
+    return identity;
+}
+
+- (void)testLookup {
+    IdentityProvider *one = [self insertIdentityProviderWithIdentifier:@"one.example.org" inContext:self.managedObjectContext];
+    IdentityProvider *two = [self insertIdentityProviderWithIdentifier:@"two.example.org" inContext:self.managedObjectContext];
+    Identity *johnAtOne = [self insertIdentityWithIdentifier:@"john.doe" forIdentityProvider:one];
+    Identity *janeAtOne = [self insertIdentityWithIdentifier:@"jane.doe" forIdentityProvider:one];
+    Identity *johnAtTwo = [self insertIdentityWithIdentifier:@"john.doe" forIdentityProvider:two];
+    
+    // Unsaved objects are found, the same as with a fetch
+    STAssertEqualObjects([self.index identityProviderWithIdentifier:@"one.example.org"], one, @"Provider should be found");
+    STAssertEqualObjects([self.index identityProviderWithIdentifier:@"two.example.org"], two, @"Provider should be found");
+    STAssertNil([self.index identityProviderWithIdentifier:@"three.example.org"], @"Unknown provider");
+    STAssertNil([self.index identityProviderWithIdentifier:nil], @"No identifier");
+    
+    STAssertEqualObjects([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:one], johnAtOne, @"Identity should be found");
+    STAssertEqualObjects([self.index identityWithIdentifier:@"jane.doe" forIdentityProvider:one], janeAtOne, @"Identity should be found");
+    STAssertEqualObjects([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:two], johnAtTwo, @"Identity should be found");
+    STAssertNil([self.index identityWithIdentifier:@"jane.doe" forIdentityProvider:two], @"Identity belongs to another provider");
+    STAssertNil([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:nil], @"Identity belongs to a provider");
+    
+    NSError *error = nil;
+    STAssertTrue([self.managedObjectContext save:&error], @"Save should succeed");
+    STAssertEqualObjects([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:two], johnAtTwo, @"Saved identity should be found");
+    STAssertEquals(self.index.loadCount, (NSUInteger)1, @"Index should be loaded once");
+}
+
+- (void)testChanges {
+    IdentityProvider *one = [self insertIdentityProviderWithIdentifier:@"one.example.org" inContext:self.managedObjectContext];
+    IdentityProvider *two = [self insertIdentityProviderWithIdentifier:@"two.example.org" inContext:self.managedObjectContext];
+    Identity *john = [self insertIdentityWithIdentifier:@"john.doe" forIdentityProvider:one];
+    [self.managedObjectContext save:NULL];
+    STAssertEqualObjects([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:one], john, @"Identity should be found");
+    
+    john.identifier = @"j.doe";
+    STAssertNil([self.index identityWithIdentifier:@"john.doe" forIdentityProvider:one], @"Old identifier is gone");
+    STAssertEqualObjects([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:one], john, @"New identifier is found");
+    
+    john.identityProvider = two;
+    STAssertNil([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:one], @"Identity moved away");
+    STAssertEqualObjects([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:two], john, @"Identity moved here");
+    
+    one.identifier = @"uno.example.org";
+    STAssertNil([self.index identityProviderWithIdentifier:@"one.example.org"], @"Old provider identifier is gone");
+    STAssertEqualObjects([self.index identityProviderWithIdentifier:@"uno.example.org"], one, @"New provider identifier is found");
+    
+    // Duplicates aren't returned, the same as with a fetch
+    Identity *duplicate = [self insertIdentityWithIdentifier:@"j.doe" forIdentityProvider:two];
+    STAssertNil([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:two], @"Ambiguous identity");
+    duplicate.identifier = @"jane.doe";
+    STAssertEqualObjects([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:two], john, @"Identity is unique again");
+    
+    [self.managedObjectContext deleteObject:john];
+    STAssertNil([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:two], @"Deleted identity is gone");
+    [self.managedObjectContext save:NULL];
+    STAssertNil([self.index identityWithIdentifier:@"j.doe" forIdentityProvider:two], @"Deleted identity stays gone");
+    STAssertEquals(self.index.loadCount, (NSUInteger)1, @"Changes shouldn't reload the index");
+    
+    [self insertIdentityWithIdentifier:@"jane.doe" forIdentityProvider:one];
+    [self.managedObjectContext rollback];
+    [self.index invalidate];
+    STAssertNil([self.index identityWithIdentifier:@"jane.doe" forIdentityProvider:one], @"Rolled back identity is gone");
+    STAssertEqualObjects([self.index identityProviderWithIdentifier:@"uno.example.org"], one, @"Saved provider is still found");
+    STAssertEquals(self.index.loadCount, (NSUInteger)2, @"Invalidate should reload the index");
+    
+    [self.managedObjectContext reset];
+    IdentityProvider *refetched = [self.index identityProviderWithIdentifier:@"uno.example.org"];
+    STAssertNotNil(refetched, @"Provider should be found after a reset");
+    STAssertTrue(refetched != one, @"Reset context hands out new objects");
+    STAssertEquals(self.index.loadCount, (NSUInteger)3, @"Reset should reload the index");
+}
+
+- (void)testAggregates {
+    STAssertEquals([self.index identityCount], (NSUInteger)0, @"No identities");
+    STAssertNil([self.index maxSortKey], @"No identities");
+    STAssertFalse([self.index allIdentitiesBlocked], @"No identities aren't all blocked");
+    
+    IdentityProvider *one = [self insertIdentityProviderWithIdentifier:@"one.example.org" inContext:self.managedObjectContext];
+    Identity *john = [self insertIdentityWithIdentifier:@"john.doe" forIdentityProvider:one];
+    Identity *jane = [self insertIdentityWithIdentifier:@"jane.doe" forIdentityProvider:one];
+    Identity *nameless = [self insertIdentityWithIdentifier:nil forIdentityProvider:one];
+    john.sortKey = @3;
+    jane.sortKey = @7;
+    nameless.sortKey = @7;
+    STAssertEquals([self.index identityCount], (NSUInteger)3, @"Identities without identifier count too");
+    STAssertEqualObjects([self.index maxSortKey], @7, @"Maximum sort key");
+    
+    [self.managedObjectContext deleteObject:nameless];
+    STAssertEqualObjects([self.index maxSortKey], @7, @"Another identity still has the maximum");
+    jane.sortKey = @-1;
+    STAssertEqualObjects([self.index maxSortKey], @3, @"Maximum moves down");
+    
+    john.blocked = @YES;
+    STAssertFalse([self.index allIdentitiesBlocked], @"Jane isn't blocked");
+    jane.blocked = @YES;
+    STAssertTrue([self.index allIdentitiesBlocked], @"Both are blocked");
+    [self.managedObjectContext deleteObject:jane];
+    [self.managedObjectContext deleteObject:john];
+    STAssertEquals([self.index identityCount], (NSUInteger)0, @"All identities deleted");
+    STAssertFalse([self.index allIdentitiesBlocked], @"No identities aren't all blocked");
+    STAssertEquals(self.index.loadCount, (NSUInteger)1, @"Changes shouldn't reload the index");
+}
+
+- (void)assertAggregatesMatchFetchAfter:(NSString *)step {
+    NSError *error = nil;
+    NSArray *identities = [self.managedObjectContext executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"Identity"] error:&error];
+    STAssertNotNil(identities, @"Fetch should succeed");
+    
+    NSUInteger unblocked = 0;
+    NSNumber *maxSortKey = nil;
+    for (Identity *identity in identities) {
+        if (identity.blocked != nil && ![identity.blocked boolValue]) {
+            unblocked++;
+        }
+        if (identity.sortKey != nil && (maxSortKey == nil || [identity.sortKey longLongValue] > [maxSortKey longLongValue])) {
+            maxSortKey = identity.sortKey;
+        }
+    }
+    
+    STAssertEquals([self.index identityCount], [identities count], @"Count after %@", step);
+    STAssertEqualObjects([self.index maxSortKey], maxSortKey, @"Maximum sort key after %@", step);
+    STAssertEquals([self.index allIdentitiesBlocked], (BOOL)([identities count] > 0 && unblocked == 0), @"All blocked after %@", step);
+}
+
+- (void)testRandomMutations {
+    NSArray *blockedValues = @[@YES, @NO, [NSNull null]];
+    
+    srandom(20161017);
+    for (NSUInteger i = 0; i < 2000; i++) {
+        // Deleting an identity cascades to its provider, so providers come and go too
+        NSMutableArray *identityProviders = [[self.managedObjectContext executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"IdentityProvider"] error:NULL] mutableCopy];
+        while ([identityProviders count] < 2) {
+            [identityProviders addObject:[self insertIdentityProviderWithIdentifier:[NSString stringWithFormat:@"idp%lu-%lu.example.org", (unsigned long)i, (unsigned long)[identityProviders count]] inContext:self.managedObjectContext]];
+        }
+        NSArray *identities = [self.managedObjectContext executeFetchRequest:[NSFetchRequest fetchRequestWithEntityName:@"Identity"] error:NULL];
+        Identity *identity = [identities count] > 0 ? identities[random() % [identities count]] : nil;
+        NSString *step = nil;
+        
+        switch (identity == nil ? 0 : random() % 8) {
+            case 0:
+            case 1:
+                identity = [self insertIdentityWithIdentifier:[NSString stringWithFormat:@"user%ld", random() % 50] forIdentityProvider:identityProviders[random() % 2]];
+                identity.sortKey = random() % 4 == 0 ? nil : @(random() % 20 - 5);
+                step = @"insert";
+                break;
+            case 2:
+                [self.managedObjectContext deleteObject:identity];
+                step = @"delete";
+                break;
+            case 3: {
+                id blocked = blockedValues[random() % 3];
+                identity.blocked = blocked == [NSNull null] ? nil : blocked;
+                step = @"block";
+                break;
+            }
+            case 4:
+                identity.sortKey = random() % 4 == 0 ? nil : @(random() % 20 - 5);
+                step = @"sort";
+                break;
+            case 5:
+                identity.identityProvider = identityProviders[random() % 2];
+                step = @"move";
+                break;
+            case 6:
+                STAssertTrue([self.managedObjectContext save:NULL], @"Save should succeed");
+                step = @"save";
+                break;
+            case 7:
+                [self.managedObjectContext rollback];
+                [self.index invalidate];
+                step = @"rollback";
+                break;
+        }
+        
+        // Reading right away and after more changes both have to match
+        if (random() % 2 == 0) {
+            [self assertAggregatesMatchFetchAfter:step];
+        }
+    }
+    [self assertAggregatesMatchFetchAfter:@"all steps"];
+}
+
+- (void)testBatchUpdate {
+    // Batch updates need a SQLite store
+    self.storePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *storeURL = [NSURL fileURLWithPath:self.storePath];
+    self.managedObjectContext = [self managedObjectContextWithStoreType:NSSQLiteStoreType URL:storeURL];
+    self.index = [[IdentityIndex alloc] initWithManagedObjectContext:self.managedObjectContext];
+    
+    IdentityProvider *one = [self insertIdentityProviderWithIdentifier:@"one.example.org" inContext:self.managedObjectContext];
+    IdentityProvider *two = [self insertIdentityProviderWithIdentifier:@"two.example.org" inContext:self.managedObjectContext];
+    for (NSUInteger i = 0; i < 3; i++) {
+        [self insertIdentityWithIdentifier:[NSString stringWithFormat:@"user%lu", (unsigned long)i] forIdentityProvider:one];
+        [self insertIdentityWithIdentifier:[NSString stringWithFormat:@"user%lu", (unsigned long)i] forIdentityProvider:two];
+    }
+    STAssertTrue([self.managedObjectContext save:NULL], @"Save should succeed");
+    
+    Identity *unsaved = [self insertIdentityWithIdentifier:@"unsaved" forIdentityProvider:one];
+    Identity *changed = [self.index identityWithIdentifier:@"user0" forIdentityProvider:one];
+    changed.displayName = @"Changed";
+    Identity *other = [self.index identityWithIdentifier:@"user0" forIdentityProvider:two];
+    
+    NSError *error = nil;
+    STAssertTrue([self.index updateIdentitiesWithValues:@{@"blocked": @YES} forIdentityProvider:one error:&error], @"Update should succeed: %@", error);
+    STAssertTrue([unsaved.blocked boolValue], @"Unsaved identity is blocked in memory");
+    STAssertTrue([changed.blocked boolValue], @"Changed identity is blocked");
+    STAssertEqualObjects(changed.displayName, @"Changed", @"Unsaved change survives the refresh");
+    STAssertTrue([[self.index identityWithIdentifier:@"user1" forIdentityProvider:one].blocked boolValue], @"Registered identity sees the update");
+    STAssertFalse([other.blocked boolValue], @"Other provider is left alone");
+    STAssertFalse([self.index allIdentitiesBlocked], @"Identities of two aren't blocked");
+    
+    STAssertTrue([self.index updateIdentitiesWithValues:@{@"blocked": @YES} forIdentityProvider:nil error:&error], @"Update should succeed: %@", error);
+    STAssertTrue([other.blocked boolValue], @"All identities are blocked");
+    STAssertTrue([self.index allIdentitiesBlocked], @"All identities are blocked");
+    STAssertEquals([self.index identityCount], (NSUInteger)7, @"Count is unchanged");
+    STAssertEquals(self.index.loadCount, (NSUInteger)1, @"Batch updates shouldn't reload the index");
+    
+    STAssertTrue([self.index updateIdentitiesWithValues:@{@"biometricIDEnabled": @YES} forIdentityProvider:two error:&error], @"Update should succeed: %@", error);
+    STAssertTrue([other.biometricIDEnabled boolValue], @"Biometric flag is set");
+    STAssertFalse([changed.biometricIDEnabled boolValue], @"Other provider is left alone");
+    STAssertTrue([self.managedObjectContext save:&error], @"Save after a batch update should succeed: %@", error);
+    
+    // What's in the store
+    NSManagedObjectContext *managedObjectContext = [self managedObjectContextWithStoreType:NSSQLiteStoreType URL:storeURL];
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [request setPredicate:[NSPredicate predicateWithFormat:@"blocked = NO"]];
+    STAssertEquals([managedObjectContext countForFetchRequest:request error:NULL], (NSUInteger)0, @"Every identity is blocked in the store");
+    [request setPredicate:[NSPredicate predicateWithFormat:@"biometricIDEnabled = YES"]];
+    STAssertEquals([managedObjectContext countForFetchRequest:request error:NULL], (NSUInteger)3, @"Only identities of two have the flag");
+    
+    STAssertTrue([self.index updateIdentitiesWithValues:@{@"blocked": @NO} forIdentityProvider:two error:&error], @"Update should succeed: %@", error);
+    STAssertFalse([self.index allIdentitiesBlocked], @"Identities of two are unblocked");
+    [self.index invalidate];
+    STAssertFalse([self.index allIdentitiesBlocked], @"Reloaded counters agree");
+}
+
+- (void)testBatchUpdateWithParentContext {
+    self.storePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    NSURL *storeURL = [NSURL fileURLWithPath:self.storePath];
+    NSManagedObjectContext *writerContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+    [writerContext setPersistentStoreCoordinator:[[self managedObjectContextWithStoreType:NSSQLiteStoreType URL:storeURL] persistentStoreCoordinator]];
+    self.managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+    [self.managedObjectContext setParentContext:writerContext];
+    self.index = [[IdentityIndex alloc] initWithManagedObjectContext:self.managedObjectContext];
+    
+    // Saved into the writer only, like IdentityService does between writes
+    IdentityProvider *one = [self insertIdentityProviderWithIdentifier:@"one.example.org" inContext:self.managedObjectContext];
+    Identity *identity = [self insertIdentityWithIdentifier:@"user0" forIdentityProvider:one];
+    identity.blocked = @NO;
+    NSError *error = nil;
+    STAssertTrue([self.managedObjectContext obtainPermanentIDsForObjects:@[one, identity] error:&error], @"Permanent IDs: %@", error);
+    STAssertTrue([self.managedObjectContext save:&error], @"Save should succeed: %@", error);
+    __block BOOL writerHasChanges = NO;
+    [writerContext performBlockAndWait:^{
+        writerHasChanges = [writerContext hasChanges];
+    }];
+    STAssertTrue(writerHasChanges, @"Writer holds the changes");
+    
+    STAssertTrue([self.index updateIdentitiesWithValues:@{@"blocked": @YES} forIdentityProvider:one error:&error], @"Update should succeed: %@", error);
+    [writerContext performBlockAndWait:^{
+        writerHasChanges = [writerContext hasChanges];
+    }];
+    STAssertFalse(writerHasChanges, @"Pending changes were written first");
+    STAssertTrue([identity.blocked boolValue], @"Identity is blocked");
+    STAssertTrue([self.index allIdentitiesBlocked], @"Counters follow the update");
+    
+    // A later write of the writer must not bring the old value back
+    identity.displayName = @"Changed";
+    STAssertTrue([self.managedObjectContext save:&error], @"Save should succeed: %@", error);
+    __block BOOL written = NO;
+    [writerContext performBlockAndWait:^{
+        written = [writerContext save:NULL];
+    }];
+    STAssertTrue(written, @"Write after a batch update should succeed");
+    
+    NSManagedObjectContext *managedObjectContext = [self managedObjectContextWithStoreType:NSSQLiteStoreType URL:storeURL];
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [request setPredicate:[NSPredicate predicateWithFormat:@"blocked = YES AND displayName = %@", @"Changed"]];
+    STAssertEquals([managedObjectContext countForFetchRequest:request error:NULL], (NSUInteger)1, @"Store has both changes");
+}
+
+- (void)testLookupPerformance {
+    const NSUInteger lookups = 1000;
+    
+    for (NSNumber *count in @[@10, @100, @1000, @10000, @50000]) {
+        self.storePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+        NSManagedObjectContext *managedObjectContext = [self managedObjectContextWithStoreType:NSSQLiteStoreType URL:[NSURL fileURLWithPath:self.storePath]];
+        
+        // Ten identities per provider, like a handful of accounts at many institutions
+        NSUInteger providerCount = MAX([count unsignedIntegerValue] / 10, 1);
+        NSMutableArray *identityProviders = [NSMutableArray arrayWithCapacity:providerCount];
+        for (NSUInteger i = 0; i < providerCount; i++) {
+            [identityProviders addObject:[self insertIdentityProviderWithIdentifier:[NSString stringWithFormat:@"idp%lu.example.org", (unsigned long)i] inContext:managedObjectContext]];
+        }
+        for (NSUInteger i = 0; i < [count unsignedIntegerValue]; i++) {
+            [self insertIdentityWithIdentifier:[NSString stringWithFormat:@"user%lu", (unsigned long)i] forIdentityProvider:identityProviders[i % providerCount]];
+        }
+        STAssertTrue([managedObjectContext save:NULL], @"Save should succeed");
+        [managedObjectContext reset];
+        
+        NSEntityDescription *identityProviderEntity = [NSEntityDescription entityForName:@"IdentityProvider" inManagedObjectContext:managedObjectContext];
+        NSEntityDescription *identityEntity = [NSEntityDescription entityForName:@"Identity" inManagedObjectContext:managedObjectContext];
+        NSDate *start = [NSDate date];
+        for (NSUInteger i = 0; i < lookups; i++) {
+            NSUInteger n = (i * 7919) % [count unsignedIntegerValue];
+            NSFetchRequest *request = [[NSFetchRequest alloc] init];
+            [request setEntity:identityProviderEntity];
+            [request setPredicate:[NSPredicate predicateWithFormat:@"identifier = %@", [NSString stringWithFormat:@"idp%lu.example.org", (unsigned long)(n % providerCount)]]];
+            IdentityProvider *identityProvider = [[managedObjectContext executeFetchRequest:request error:NULL] lastObject];
+            
+            request = [[NSFetchRequest alloc] init];
+            [request setEntity:identityEntity];
+            [request setPredicate:[NSPredicate predicateWithFormat:@"identifier = %@ AND identityProvider = %@", [NSString stringWithFormat:@"user%lu", (unsigned long)n], identityProvider]];
+            STAssertNotNil([[managedObjectContext executeFetchRequest:request error:NULL] lastObject], @"Fetch should find the identity");
+        }
+        NSTimeInterval fetchElapsed = -[start timeIntervalSinceNow];
+        
+        IdentityIndex *index = [[IdentityIndex alloc] initWithManagedObjectContext:managedObjectContext];
+        start = [NSDate date];
+        [index identityProviderWithIdentifier:@"idp0.example.org"];
+        NSTimeInterval loadElapsed = -[start timeIntervalSinceNow];
+        
+        start = [NSDate date];
+        for (NSUInteger i = 0; i < lookups; i++) {
+            NSUInteger n = (i * 7919) % [count unsignedIntegerValue];
+            IdentityProvider *identityProvider = [index identityProviderWithIdentifier:[NSString stringWithFormat:@"idp%lu.example.org", (unsigned long)(n % providerCount)]];
+            STAssertNotNil([index identityWithIdentifier:[NSString stringWithFormat:@"user%lu", (unsigned long)n] forIdentityProvider:identityProvider], @"Index should find the identity");
+        }
+        NSTimeInterval indexElapsed = -[start timeIntervalSinceNow];
+        
+        // A rename is refiled through the change notification before the next lookup
+        start = [NSDate date];
+        for (NSUInteger i = 0; i < lookups; i++) {
+            NSUInteger n = (i * 7919) % [count unsignedIntegerValue];
+            IdentityProvider *identityProvider = [index identityProviderWithIdentifier:[NSString stringWithFormat:@"idp%lu.example.org", (unsigned long)(n % providerCount)]];
+            Identity *identity = [index identityWithIdentifier:[NSString stringWithFormat:@"user%lu", (unsigned long)n] forIdentityProvider:identityProvider];
+            NSString *identifier = [NSString stringWithFormat:@"renamed%lu", (unsigned long)i];
+            identity.identifier = identifier;
+            STAssertEquals([index identityWithIdentifier:identifier forIdentityProvider:identityProvider], identity, @"Index should follow the rename");
+            identity.identifier = [NSString stringWithFormat:@"user%lu", (unsigned long)n];
+        }
+        NSTimeInterval changeElapsed = -[start timeIntervalSinceNow];
+        STAssertEquals(index.loadCount, (NSUInteger)1, @"Changes shouldn't reload the index");
+        
+        NSLog(@"Identity lookup, %@ identities: fetch %.1f us, index %.2f us, rename and lookup %.2f us, index load %.1f ms", count, fetchElapsed / lookups * 1e6, indexElapsed / lookups * 1e6, changeElapsed / lookups * 1e6, loadElapsed * 1e3);
+        
+        index = nil;
+        managedObjectContext = nil;
+        for (NSString *suffix in @[@"", @"-wal", @"-shm"]) {
+            [[NSFileManager defaultManager] removeItemAtPath:[self.storePath stringByAppendingString:suffix] error:NULL];
+        }
+    }
+}
+
+@end
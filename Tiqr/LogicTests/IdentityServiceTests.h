@@ -0,0 +1,12 @@
+//
+//  IdentityServiceTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface IdentityServiceTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,210 @@
+//
+//  IdentityServiceTests.m
+//  LogicTests
+//
+
+#import "IdentityServiceTests.h"
+#import "IdentityService.h"
+#import "Identity.h"
+#import "IdentityProvider.h"
+
+#import <CoreData/CoreData.h>
+
+#define IdentityServiceTestsIdentities 100
+#define IdentityServiceTestsBursts 50
+#define IdentityServiceTestsSavesPerBurst 4
+
+@interface IdentityServiceTests ()
+
+@property (nonatomic, copy) NSString *storePath;
+@property (nonatomic, assign) NSUInteger storeWrites;
+
+@end
+
+@implementation IdentityServiceTests
+
+- (void)setUp {
+    [super setUp];
+    self.storePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    self.storeWrites = 0;
+    [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(contextDidSave:) name:NSManagedObjectContextDidSaveNotification object:nil];
+}
+
+- (void)tearDown {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self removeStoreAtPath:self.storePath];
+    [super tearDown];
+}
+
+- (void)removeStoreAtPath:(NSString *)storePath {
+    for (NSString *suffix in @[@"", @"-wal", @"-shm"]) {
+        [[NSFileManager defaultManager] removeItemAtPath:[storePath stringByAppendingString:suffix] error:NULL];
+    }
+}
+
+- (void)contextDidSave:(NSNotification *)notification {
+    // Only saves of a context without a parent reach the store, they are posted on the writer's queue
+    if ([[notification object] parentContext] == nil) {
+        @synchronized (self) {
+            self.storeWrites++;
+        }
+    }
+}
+
+- (NSUInteger)currentStoreWrites {
+    @synchronized (self) {
+        return self.storeWrites;
+    }
+}
+
+- (NSManagedObjectContext *)storeContext {
+    NSManagedObjectModel *managedObjectModel = [NSManagedObjectModel mergedModelFromBundles:@[[NSBundle bundleForClass:[self class]]]];
+    NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:managedObjectModel];
+    NSError *error = nil;
+    STAssertNotNil([persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:[NSURL fileURLWithPath:self.storePath] options:nil error:&error], @"Store should open: %@", error);
+    
+    NSManagedObjectContext *managedObjectContext = [[NSManagedObjectContext alloc] init];
+    [managedObjectContext setPersistentStoreCoordinator:persistentStoreCoordinator];
+    return managedObjectContext;
+}
+
+- (NSUInteger)countInStoreWithPredicate:(NSPredicate *)predicate {
+    NSFetchRequest *request = [NSFetchRequest fetchRequestWithEntityName:@"Identity"];
+    [request setPredicate:predicate];
+    return [[self storeContext] countForFetchRequest:request error:NULL];
+}
+
+- (NSArray *)insertIdentitiesIntoIdentityService:(IdentityService *)identityService {
+    IdentityProvider *identityProvider = [identityService createIdentityProvider];
+    identityProvider.identifier = @"one.example.org";
+    identityProvider.displayName = @"one.example.org";
+    identityProvider.authenticationUrl = @"https://one.example.org/auth/";
+    identityProvider.infoUrl = @"https://one.example.org/";
+    
+    for (NSUInteger i = 0; i < IdentityServiceTestsIdentities; i++) {
+        Identity *identity = [identityService createIdentity];
+        identity.identityProvider = identityProvider;
+        identity.identifier = [NSString stringWithFormat:@"user%lu", (unsigned long)i];
+        identity.displayName = identity.identifier;
+        identity.blocked = @NO;
+        identity.sortKey = [identityService nextSortKey];
+    }
+    STAssertTrue([identityService saveIdentitiesDurably], @"Save should succeed");
+    
+    return [identityService findIdentitiesForIdentityProvider:identityProvider];
+}
+
+- (void)testCoalescedSaves {
+    IdentityService *identityService = [[IdentityService alloc] initWithSecretService:nil storeURL:[NSURL fileURLWithPath:self.storePath]];
+    NSArray *identities = [self insertIdentitiesIntoIdentityService:identityService];
+    STAssertEquals([identities count], (NSUInteger)IdentityServiceTestsIdentities, @"All identities are saved");
+    STAssertEquals([self currentStoreWrites], (NSUInteger)1, @"A durable save writes at once");
+    
+    Identity *identity = identities[0];
+    for (NSUInteger i = 0; i < 5; i++) {
+        identity.displayName = [NSString stringWithFormat:@"Name %lu", (unsigned long)i];
+        STAssertTrue([identityService saveIdentities], @"Save should succeed");
+    }
+    STAssertEquals([self currentStoreWrites], (NSUInteger)1, @"Saves are written later");
+    
+    [NSThread sleepForTimeInterval:1.0];
+    STAssertEquals([self currentStoreWrites], (NSUInteger)2, @"The saves are written together");
+    STAssertEquals([self countInStoreWithPredicate:[NSPredicate predicateWithFormat:@"displayName = %@", @"Name 4"]], (NSUInteger)1, @"The last change is in the store");
+    
+    identity.blocked = @YES;
+    STAssertTrue([identityService saveIdentitiesDurably], @"Durable save should succeed");
+    STAssertEquals([self currentStoreWrites], (NSUInteger)3, @"A durable save doesn't wait for the delay");
+    STAssertEquals([self countInStoreWithPredicate:[NSPredicate predicateWithFormat:@"blocked = YES"]], (NSUInteger)1, @"Blocked identity is in the store");
+}
+
+- (NSString *)describeLatencies:(NSMutableArray *)latencies {
+    [latencies sortUsingSelector:@selector(compare:)];
+    double total = 0;
+    for (NSNumber *latency in latencies) {
+        total += [latency doubleValue];
+    }
+    
+    NSUInteger count = [latencies count];
+    return [NSString stringWithFormat:@"mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us", total / count,
+            [latencies[count / 2] doubleValue], [latencies[count * 99 / 100] doubleValue], [[latencies lastObject] doubleValue]];
+}
+
+/**
+ * Bursts of single identity changes with idle time in between, like the
+ * state flips of an enrollment, an authentication or a reorder. Compares the
+ * time saveIdentities takes on the calling thread with saving a context on
+ * the coordinator directly, the arrangement before the writer context.
+ */
+- (void)testSaveLatency {
+    const NSTimeInterval saveInterval = 0.002;
+    const NSTimeInterval idleInterval = 0.1;
+    
+    // Directly on the store
+    NSManagedObjectContext *managedObjectContext = [self storeContext];
+    IdentityProvider *identityProvider = [NSEntityDescription insertNewObjectForEntityForName:@"IdentityProvider" inManagedObjectContext:managedObjectContext];
+    identityProvider.identifier = @"one.example.org";
+    identityProvider.displayName = @"one.example.org";
+    identityProvider.authenticationUrl = @"https://one.example.org/auth/";
+    identityProvider.infoUrl = @"https://one.example.org/";
+    NSMutableArray *identities = [NSMutableArray arrayWithCapacity:IdentityServiceTestsIdentities];
+    for (NSUInteger i = 0; i < IdentityServiceTestsIdentities; i++) {
+        Identity *identity = [NSEntityDescription insertNewObjectForEntityForName:@"Identity" inManagedObjectContext:managedObjectContext];
+        identity.identityProvider = identityProvider;
+        identity.identifier = [NSString stringWithFormat:@"user%lu", (unsigned long)i];
+        identity.displayName = identity.identifier;
+        identity.blocked = @NO;
+        identity.sortKey = @(i + 1);
+        [identities addObject:identity];
+    }
+    STAssertTrue([managedObjectContext save:NULL], @"Save should succeed");
+    
+    NSUInteger writesBefore = [self currentStoreWrites];
+    NSMutableArray *direct = [NSMutableArray array];
+    for (NSUInteger burst = 0; burst < IdentityServiceTestsBursts; burst++) {
+        for (NSUInteger save = 0; save < IdentityServiceTestsSavesPerBurst; save++) {
+            Identity *identity = identities[(burst * 37 + save * 7) % IdentityServiceTestsIdentities];
+            identity.blocked = @(![identity.blocked boolValue]);
+            NSDate *start = [NSDate date];
+            STAssertTrue([managedObjectContext save:NULL], @"Save should succeed");
+            [direct addObject:@(-[start timeIntervalSinceNow] * 1e6)];
+            [NSThread sleepForTimeInterval:saveInterval];
+        }
+        [NSThread sleepForTimeInterval:idleInterval];
+    }
+    NSUInteger directWrites = [self currentStoreWrites] - writesBefore;
+    managedObjectContext = nil;
+    [self removeStoreAtPath:self.storePath];
+    
+    // Through the writer context, every fifth burst ends with a durable save
+    IdentityService *identityService = [[IdentityService alloc] initWithSecretService:nil storeURL:[NSURL fileURLWithPath:self.storePath]];
+    NSArray *serviceIdentities = [self insertIdentitiesIntoIdentityService:identityService];
+    writesBefore = [self currentStoreWrites];
+    NSMutableArray *coalesced = [NSMutableArray array];
+    NSMutableArray *durable = [NSMutableArray array];
+    for (NSUInteger burst = 0; burst < IdentityServiceTestsBursts; burst++) {
+        for (NSUInteger save = 0; save < IdentityServiceTestsSavesPerBurst; save++) {
+            Identity *identity = serviceIdentities[(burst * 37 + save * 7) % IdentityServiceTestsIdentities];
+            identity.blocked = @(![identity.blocked boolValue]);
+            BOOL isDurable = burst % 5 == 0 && save == IdentityServiceTestsSavesPerBurst - 1;
+            NSDate *start = [NSDate date];
+            STAssertTrue(isDurable ? [identityService saveIdentitiesDurably] : [identityService saveIdentities], @"Save should succeed");
+            NSNumber *latency = @(-[start timeIntervalSinceNow] * 1e6);
+            if (isDurable) {
+                [durable addObject:latency];
+            } else {
+                [coalesced addObject:latency];
+            }
+            [NSThread sleepForTimeInterval:saveInterval];
+        }
+        [NSThread sleepForTimeInterval:idleInterval];
+    }
+    STAssertTrue([identityService saveIdentitiesDurably], @"Save should succeed");
+    NSUInteger coalescedWrites = [self currentStoreWrites] - writesBefore;
+    
+    NSLog(@"Identity save, direct: %@, %lu store writes", [self describeLatencies:direct], (unsigned long)directWrites);
+    NSLog(@"Identity save, writer: %@, %lu store writes", [self describeLatencies:coalesced], (unsigned long)coalescedWrites);
+    NSLog(@"Identity save, durable: %@", [self describeLatencies:durable]);
+    STAssertTrue(coalescedWrites < directWrites, @"Saves through the writer are coalesced");
+}
+
+@end
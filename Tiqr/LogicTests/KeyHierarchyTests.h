@@ -0,0 +1,12 @@
+//
+//  KeyHierarchyTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface KeyHierarchyTests : SenTestCase {
+
+}
+
+@end
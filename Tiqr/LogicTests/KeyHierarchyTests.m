@@ -0,0 +1,66 @@
+//
+//  KeyHierarchyTests.m
+//  LogicTests
+//
+
+#import "KeyHierarchyTests.h"
+#import "KeyHierarchy.h"
+#import "NSData+Hex.h"
+
+@implementation KeyHierarchyTests
+
+- (void)testCipherMatchesAESVectors {
+    // NIST SP 800-38A, F.2.5 CBC-AES256.Encrypt
+    NSData *key = [NSData dataWithHexString:@"603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4"];
+    NSData *initializationVector = [NSData dataWithHexString:@"000102030405060708090a0b0c0d0e0f"];
+    NSData *plaintext = [NSData dataWithHexString:@"6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"];
+    NSData *ciphertext = [NSData dataWithHexString:@"f58c4c04d6e5f1ba779eabfb5f7bfbd69cfc4e967edb808d679f777bc6702c7d"];
+    
+    uint8_t output[32];
+    STAssertEquals(SecretCipherCrypt(SecretCipherOperationEncrypt, key.bytes, initializationVector.bytes, plaintext.bytes, plaintext.length, output), 0, @"Encrypt should succeed");
+    STAssertEqualObjects([NSData dataWithBytes:output length:sizeof(output)], ciphertext, @"Ciphertext");
+    STAssertEquals(SecretCipherCrypt(SecretCipherOperationDecrypt, key.bytes, initializationVector.bytes, output, sizeof(output), output), 0, @"Decrypt in place should succeed");
+    STAssertEqualObjects([NSData dataWithBytes:output length:sizeof(output)], plaintext, @"Plaintext");
+    STAssertEquals(SecretCipherCrypt(SecretCipherOperationEncrypt, key.bytes, NULL, plaintext.bytes, 15, output), EINVAL, @"No padding");
+}
+
+- (void)testWrapAndUnwrap {
+    uint8_t keyEncryptionKey[KeyHierarchyKeyLength], dataKey[KeyHierarchyKeyLength], initializationVector[SecretCipherBlockLength], secret[32];
+    memset(keyEncryptionKey, 0x11, sizeof(keyEncryptionKey));
+    memset(dataKey, 0x22, sizeof(dataKey));
+    memset(initializationVector, 0x33, sizeof(initializationVector));
+    memset(secret, 0x44, sizeof(secret));
+    
+    uint8_t blob[KeyHierarchyHeaderLength + sizeof(secret)];
+    STAssertEquals(KeyHierarchyWrappedLength(sizeof(secret)), sizeof(blob), @"Wrapped length");
+    STAssertEquals(KeyHierarchyWrap(keyEncryptionKey, dataKey, initializationVector, secret, sizeof(secret), blob, sizeof(blob)), 0, @"Wrap should succeed");
+    STAssertTrue(KeyHierarchyIsWrapped(blob, sizeof(blob)), @"Wrapped");
+    
+    uint8_t unwrapped[sizeof(secret)];
+    STAssertEquals(KeyHierarchyUnwrap(keyEncryptionKey, initializationVector, blob, sizeof(blob), unwrapped, sizeof(unwrapped)), 0, @"Unwrap should succeed");
+    STAssertTrue(memcmp(unwrapped, secret, sizeof(secret)) == 0, @"Secret");
+}
+
+- (void)testWrongKeyGivesAnotherSecret {
+    uint8_t keyEncryptionKey[KeyHierarchyKeyLength] = { 1 }, wrongKey[KeyHierarchyKeyLength] = { 2 }, dataKey[KeyHierarchyKeyLength] = { 3 }, secret[32] = { 4 };
+    uint8_t blob[KeyHierarchyHeaderLength + sizeof(secret)], unwrapped[sizeof(secret)];
+    KeyHierarchyWrap(keyEncryptionKey, dataKey, NULL, secret, sizeof(secret), blob, sizeof(blob));
+    
+    // Like the per identity format there is nothing to check a PIN against
+    STAssertEquals(KeyHierarchyUnwrap(wrongKey, NULL, blob, sizeof(blob), unwrapped, sizeof(unwrapped)), 0, @"Unwrap doesn't tell");
+    STAssertFalse(memcmp(unwrapped, secret, sizeof(secret)) == 0, @"Another secret");
+}
+
+- (void)testTellsFormatsApart {
+    uint8_t legacy[32] = { 'T', 'Q', 'K', 0x01 };
+    STAssertFalse(KeyHierarchyIsWrapped(legacy, sizeof(legacy)), @"Secrets in the per identity format are one secret long");
+    STAssertFalse(KeyHierarchyIsWrapped(NULL, 0), @"Nothing stored");
+    
+    uint8_t secret[32] = { 0 }, blob[KeyHierarchyHeaderLength + sizeof(secret)], unwrapped[sizeof(secret)];
+    STAssertEquals(KeyHierarchyUnwrap(secret, NULL, legacy, sizeof(legacy), unwrapped, 0), EINVAL, @"Not wrapped");
+    STAssertEquals(KeyHierarchyWrap(secret, secret, NULL, secret, 31, blob, sizeof(blob) - 1), EINVAL, @"Partial block");
+    STAssertEquals(KeyHierarchyWrap(secret, secret, NULL, secret, sizeof(secret), blob, sizeof(blob)), 0, @"Wrap should succeed");
+    STAssertEquals(KeyHierarchyUnwrap(secret, NULL, blob, sizeof(blob), unwrapped, 16), EINVAL, @"Secret length must match");
+}
+
+@end
@@ -0,0 +1,37 @@
+//
+//  OCRALegacy.h
+//  LogicTests
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * The string based OCRA engines as they were before suites got compiled
+ * (OCRASuite, OCRAMessage), kept verbatim as the reference for the
+ * differential tests. Not part of the app.
+ */
+@interface OCRALegacy : NSObject
+
++ (NSString *) generateOCRAForSuite:(NSString*) ocraSuite
+                                key:(NSString*) key
+                            counter:(NSString*) counter
+                           question:(NSString*) question
+                           password:(NSString*) password
+                 sessionInformation:(NSString*) sessionInformation
+                          timestamp:(NSString*) timeStamp
+                              error:(NSError**) error;
+
+@end
+
+@interface OCRALegacy_v1 : NSObject
+
++ (NSString *) generateOCRA:(NSString*) ocraSuite
+                        key:(NSString*) key
+                    counter:(NSString*) counter
+                   question:(NSString*) question
+                   password:(NSString*) password
+         sessionInformation:(NSString*) sessionInformation
+                  timestamp:(NSString*) timeStamp
+                      error:(NSError**) error;
+
+@end
@@ -9,10 +9,660 @@
 #import "OcraTests.h"
 
 #import "OCRAWrapper.h"
+#import "OCRAWrapper_v1.h"
 #import "OCRA.h"
+#import "OCRA_v1.h"
+#import "OCRASuite.h"
+#import "OCRAMessage.h"
+#import "HMACKey.h"
+#import "HMACBatch.h"
+#import "HMACBackend.h"
+#import "ServerClock.h"
+#import "HOTP.h"
+#import "OCRALegacy.h"
+
+#import <CommonCrypto/CommonHMAC.h>
+#import <pthread.h>
+
+// Hook used by malloc stack logging, called for every allocation in every zone
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern malloc_logger_t *malloc_logger;
+
+#define MALLOC_LOG_TYPE_ALLOCATE 2
+
+static pthread_t countedThread;
+static NSUInteger allocationCount = 0;
+
+static void countAllocations(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip) {
+    if ((type & MALLOC_LOG_TYPE_ALLOCATE) && pthread_equal(pthread_self(), countedThread)) {
+        allocationCount++;
+    }
+}
+
+static NSString *const sessionInformation = @"ABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEFABCDEF";
 
 @implementation OcraTests
 
+/**
+ * Assembles the message and computes the code for the given suite the way OCRA does, without the NSString conversions.
+ */
+- (uint32_t)computeCodeForLayout:(const OCRASuiteLayout *)layout key:(const uint8_t *)key keyLength:(size_t)keyLength question:(const char *)question session:(const char *)session {
+    uint8_t message[OCRASuiteMaxMessageLength];
+    uint8_t hash[OCRAMaxHashLength] = { 0 };
+    
+    OCRAMessagePrepare(layout, message);
+    OCRAMessageSetHexField(message + layout->questionOffset, layout->questionLength, question, strlen(question), OCRAFieldAlignmentLeft);
+    OCRAMessageSetHexField(message + layout->sessionInformationOffset, layout->sessionInformationLength, session, strlen(session), OCRAFieldAlignmentRight);
+    CCHmac(kCCHmacAlgSHA1, key, keyLength, message, layout->messageLength, hash);
+    return OCRATruncate(hash, layout->hashLength, layout->digits);
+}
+
+- (void)testMessageAssemblyDoesNotAllocate {
+    NSArray *suites = @[@"OCRA-1:HOTP-SHA1-6:QH10-S064", @"OCRA-1:HOTP-SHA1-6:QH10-S128", @"OCRA-1:HOTP-SHA1-6:QH10-S256", @"OCRA-1:HOTP-SHA1-6:QH10-S512"];
+    const uint8_t key[20] = "12345678901234567890";
+    const char *session = [sessionInformation UTF8String];
+    
+    for (NSString *string in suites) {
+        OCRASuite *suite = [OCRASuite suiteWithString:string dialect:OCRASuiteDialectV2 error:NULL];
+        const OCRASuiteLayout *layout = suite.layout;
+        char code[11];
+        
+        countedThread = pthread_self();
+        allocationCount = 0;
+        malloc_logger = countAllocations;
+        for (int i = 0; i < 1000; i++) {
+            OCRAFormatCode([self computeCodeForLayout:layout key:key keyLength:sizeof(key) question:"4A2369" session:session], layout->digits, code);
+        }
+        malloc_logger = NULL;
+        
+        STAssertEquals(allocationCount, (NSUInteger)0, @"Computing a response for %@ should not allocate", string);
+    }
+}
+
+- (void)testMessageAssemblyPerformance {
+    NSArray *suites = @[@"OCRA-1:HOTP-SHA1-6:QH10-S064", @"OCRA-1:HOTP-SHA1-6:QH10-S128", @"OCRA-1:HOTP-SHA1-6:QH10-S256", @"OCRA-1:HOTP-SHA1-6:QH10-S512"];
+    NSString *key = @"3132333435363738393031323334353637383930";
+    const int iterations = 10000;
+    
+    for (NSString *string in suites) {
+        OCRASuite *suite = [OCRASuite suiteWithString:string dialect:OCRASuiteDialectV2 error:NULL];
+        
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        for (int i = 0; i < iterations; i++) {
+            @autoreleasepool {
+                [OCRA generateOCRAWithSuite:suite key:key counter:@"" question:@"4A2369" password:@"" sessionInformation:sessionInformation timestamp:@"" error:NULL];
+            }
+        }
+        CFAbsoluteTime elapsed = CFAbsoluteTimeGetCurrent() - start;
+        
+        NSLog(@"%@: %.2f us per response", string, elapsed * 1000000.0 / iterations);
+    }
+}
+
+- (void)testFieldAlignment {
+    uint8_t field[4];
+    
+    OCRAMessageSetHexField(field, sizeof(field), "ABC", 3, OCRAFieldAlignmentRight);
+    STAssertTrue(field[0] == 0x00 && field[1] == 0x00 && field[2] == 0x0A && field[3] == 0xBC, @"Short values should be right aligned");
+    
+    OCRAMessageSetHexField(field, sizeof(field), "ABC", 3, OCRAFieldAlignmentLeft);
+    STAssertTrue(field[0] == 0xAB && field[1] == 0xC0 && field[2] == 0x00 && field[3] == 0x00, @"Short values should be left aligned");
+    
+    OCRAMessageSetHexField(field, sizeof(field), "0123456789", 10, OCRAFieldAlignmentRight);
+    STAssertTrue(field[0] == 0x01 && field[1] == 0x23 && field[2] == 0x45 && field[3] == 0x67, @"Long values should be truncated");
+}
+
+- (void)testSuiteCompilation {
+    NSError *error = nil;
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA256-8:C-QN08-PSHA1" dialect:OCRASuiteDialectV2 error:&error];
+    STAssertNotNil(suite, @"Suite should compile");
+    STAssertNil(error, @"Should be nil");
+    STAssertEquals(suite.algorithm, OCRAHashAlgorithmSHA256, @"Algorithm should be SHA256");
+    STAssertEquals(suite.digits, 8, @"Digits should be 8");
+    STAssertEquals(suite.layout->counterOffset, (size_t)33, @"Counter follows the suite and the delimiter");
+    STAssertEquals(suite.layout->counterLength, (size_t)8, @"Counter length should be 8");
+    STAssertEquals(suite.layout->questionLength, (size_t)128, @"Question length should be 128");
+    STAssertEquals(suite.layout->passwordLength, (size_t)20, @"Password length should be 20");
+    STAssertEquals(suite.messageLength, (size_t)(33 + 8 + 128 + 20 + 64), @"PSHA1 implies session information in the v2 dialect");
+    
+    suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08-S512" dialect:OCRASuiteDialectV2 error:&error];
+    STAssertEquals(suite.layout->sessionInformationLength, (size_t)512, @"Session information length should be 512");
+    STAssertTrue(suite.numericQuestion, @"Question should be numeric");
+    
+    suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QH10-S" dialect:OCRASuiteDialectV1 error:&error];
+    STAssertEquals(suite.layout->sessionInformationLength, (size_t)64, @"Session information length should be 64");
+    STAssertFalse(suite.numericQuestion, @"Question should be hex");
+}
+
+- (void)testInvalidSuiteCompilation {
+    NSError *error = nil;
+    STAssertNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6" dialect:OCRASuiteDialectV2 error:&error], @"Suite without data input should not compile");
+    STAssertEquals([error code], (NSInteger)OCRASuiteInvalidFormatError, @"Should be a format error");
+    
+    error = nil;
+    STAssertNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-MD5-6:QN08" dialect:OCRASuiteDialectV2 error:&error], @"MD5 is only supported in the v1 dialect");
+    STAssertEquals([error code], (NSInteger)OCRASuiteUnsupportedAlgorithmError, @"Should be an algorithm error");
+    STAssertNotNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-MD5-6:QN08" dialect:OCRASuiteDialectV1 error:NULL], @"MD5 is supported in the v1 dialect");
+    
+    error = nil;
+    STAssertNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-12:QN08" dialect:OCRASuiteDialectV2 error:&error], @"Suite with 12 digits should not compile");
+    STAssertEquals([error code], (NSInteger)OCRANumberOfDigitsTooLargeError, @"Should be a digits error");
+    
+    error = nil;
+    STAssertNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-12:QN08" dialect:OCRASuiteDialectV1 error:&error], @"Suite with 12 digits should not compile");
+    STAssertEquals([error code], (NSInteger)OCRAServerIncompatibleError, @"Should be a server incompatible error");
+}
+
+- (void)testRFC6287Vectors {
+    NSString *key20 = @"3132333435363738393031323334353637383930";
+    NSString *key64 = @"31323334353637383930313233343536373839303132333435363738393031323334353637383930313233343536373839303132333435363738393031323334";
+    NSError *error = nil;
+    
+    STAssertEqualObjects([OCRA generateOCRAForSuite:@"OCRA-1:HOTP-SHA1-6:QN08" key:key20 counter:@"" question:@"0" password:@"" sessionInformation:@"" timestamp:@"" error:&error], @"237653", @"Ocra test");
+    STAssertEqualObjects([OCRA generateOCRAForSuite:@"OCRA-1:HOTP-SHA1-6:QN08" key:key20 counter:@"" question:@"A98AC7" password:@"" sessionInformation:@"" timestamp:@"" error:&error], @"243178", @"Ocra test");
+    STAssertEqualObjects([OCRA generateOCRAForSuite:@"OCRA-1:HOTP-SHA512-8:C-QN08" key:key64 counter:@"0" question:@"0" password:@"" sessionInformation:@"" timestamp:@"" error:&error], @"07016083", @"Ocra test");
+    STAssertEqualObjects([OCRA generateOCRAForSuite:@"OCRA-1:HOTP-SHA512-8:QN08-T1M" key:key64 counter:@"" question:@"0" password:@"" sessionInformation:@"" timestamp:@"132d0b6" error:&error], @"95209754", @"Ocra test");
+    STAssertEqualObjects([OCRA_v1 generateOCRA:@"OCRA-1:HOTP-SHA1-6:QN08" key:key20 counter:@"" question:@"A98AC7" password:@"" sessionInformation:@"" timestamp:@"" error:&error], @"243178", @"Ocra test");
+}
+
+- (void)testHMACKeyMatchesCommonCrypto {
+    const HMACAlgorithm algorithms[] = { HMACAlgorithmSHA1, HMACAlgorithmSHA256, HMACAlgorithmSHA512, HMACAlgorithmMD5 };
+    const CCHmacAlgorithm ccAlgorithms[] = { kCCHmacAlgSHA1, kCCHmacAlgSHA256, kCCHmacAlgSHA512, kCCHmacAlgMD5 };
+    uint8_t secret[200], message[300], expected[HMACMaxDigestLength], mac[HMACMaxDigestLength];
+    
+    for (size_t i = 0; i < sizeof(secret); i++) {
+        secret[i] = (uint8_t)(i * 7);
+    }
+    for (size_t i = 0; i < sizeof(message); i++) {
+        message[i] = (uint8_t)(i * 13);
+    }
+    
+    // Every supported backend, key and message lengths around the block and padding boundaries
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if (!(*backend)->supported()) {
+            continue;
+        }
+        HMACBackendSetActive(*backend);
+        for (int a = 0; a < 4; a++) {
+            for (size_t keyLength = 0; keyLength <= sizeof(secret); keyLength += 9) {
+                HMACKey key;
+                HMACKeyInit(&key, algorithms[a], secret, keyLength);
+                for (size_t length = 0; length <= sizeof(message); length += 7) {
+                    CCHmac(ccAlgorithms[a], secret, keyLength, message, length, expected);
+                    HMACKeyCompute(&key, message, length, mac);
+                    STAssertTrue(memcmp(expected, mac, key.digestLength) == 0, @"%s HMAC mismatch for key length %zu and message length %zu", (*backend)->name, keyLength, length);
+                }
+                HMACKeyWipe(&key);
+            }
+        }
+    }
+    HMACBackendSetActive(NULL);
+}
+
+- (void)testHMACKeyPerformance {
+    uint8_t secret[32] = { 1 }, message[8] = { 0 }, mac[CC_SHA1_DIGEST_LENGTH];
+    const int iterations = 100000;
+    
+    NSDate *start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        message[7] = (uint8_t)i;
+        CCHmac(kCCHmacAlgSHA1, secret, sizeof(secret), message, sizeof(message), mac);
+    }
+    NSTimeInterval oneShot = -[start timeIntervalSinceNow];
+    
+    HMACKey key;
+    HMACKeyInit(&key, HMACAlgorithmSHA1, secret, sizeof(secret));
+    start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        message[7] = (uint8_t)i;
+        HMACKeyCompute(&key, message, sizeof(message), mac);
+    }
+    NSTimeInterval cached = -[start timeIntervalSinceNow];
+    HMACKeyWipe(&key);
+    
+    NSLog(@"HMAC-SHA1 of a counter: one-shot %.0f ns, cached key schedule %.0f ns", oneShot / iterations * 1e9, cached / iterations * 1e9);
+}
+
+- (void)testHashBackendPerformance {
+    NSArray *suites = @[@"OCRA-1:HOTP-SHA1-6:QH10-S", @"OCRA-1:HOTP-SHA256-8:QN08-S064", @"OCRA-1:HOTP-SHA512-8:C-QN08"];
+    uint8_t secret[32] = { 1 }, question[10] = { 0 }, session[64] = { 0 }, counter[8] = { 0 };
+    const int iterations = 20000;
+    
+    for (NSString *suiteString in suites) {
+        const OCRASuiteLayout *layout = [OCRASuite suiteWithString:suiteString dialect:OCRASuiteDialectV2 error:NULL].layout;
+        HMACAlgorithm algorithm;
+        OCRAHMACAlgorithm(layout->algorithm, &algorithm);
+        OCRAInput input = { { counter, sizeof(counter) }, { question, sizeof(question) }, { NULL, 0 }, { session, sizeof(session) }, { NULL, 0 } };
+        
+        for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+            if (!(*backend)->supported()) {
+                continue;
+            }
+            HMACBackendSetActive(*backend);
+            
+            // Latency with a fresh key per response, as the app computes it, and with a reused key
+            NSDate *start = [NSDate date];
+            for (int i = 0; i < iterations; i++) {
+                question[0] = (uint8_t)i;
+                HMACKey key;
+                HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+                OCRAComputeCode(layout, &key, &input);
+                HMACKeyWipe(&key);
+            }
+            NSTimeInterval fresh = -[start timeIntervalSinceNow];
+            
+            HMACKey key;
+            HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+            start = [NSDate date];
+            for (int i = 0; i < iterations; i++) {
+                question[0] = (uint8_t)i;
+                OCRAComputeCode(layout, &key, &input);
+            }
+            NSTimeInterval cached = -[start timeIntervalSinceNow];
+            HMACKeyWipe(&key);
+            
+            NSLog(@"%@ %s: new key %.0f ns, cached key %.0f ns", suiteString, (*backend)->name, fresh / iterations * 1e9, cached / iterations * 1e9);
+        }
+    }
+    HMACBackendSetActive(NULL);
+}
+
+- (void)testBatchMatchesSingleComputation {
+    NSError *error = nil;
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA256-8:QH10-S064" dialect:OCRASuiteDialectV2 error:&error];
+    const OCRASuiteLayout *layout = suite.layout;
+    
+    enum { count = 37 };
+    HMACKey keys[count];
+    const HMACKey *keyPointers[count];
+    OCRAInput inputs[count];
+    uint8_t questions[count][10], sessions[count][64];
+    uint32_t codes[count];
+    
+    for (int i = 0; i < count; i++) {
+        uint8_t secret[32];
+        for (int j = 0; j < 32; j++) {
+            secret[j] = (uint8_t)(i * 31 + j);
+        }
+        for (int j = 0; j < 10; j++) {
+            questions[i][j] = (uint8_t)(i + j);
+        }
+        memset(sessions[i], i, sizeof(sessions[i]));
+        HMACKeyInit(&keys[i], HMACAlgorithmSHA256, secret, sizeof(secret));
+        keyPointers[i] = &keys[i];
+        memset(&inputs[i], 0, sizeof(inputs[i]));
+        inputs[i].question = (OCRABytes){ questions[i], sizeof(questions[i]) };
+        inputs[i].sessionInformation = (OCRABytes){ sessions[i], sizeof(sessions[i]) };
+    }
+    
+    // Every kernel width, including the scalar fallback
+    const size_t widths[] = { 0, 16, 8, 4, 1 };
+    for (int w = 0; w < 5; w++) {
+        HMACBatchSetMaximumLaneWidth(widths[w]);
+        OCRAComputeBatch(layout, keyPointers, inputs, count, codes);
+        for (int i = 0; i < count; i++) {
+            STAssertEquals(codes[i], OCRAComputeCode(layout, &keys[i], &inputs[i]), @"Batch code %d differs with %zu lanes", i, HMACBatchLaneWidth());
+        }
+    }
+    HMACBatchSetMaximumLaneWidth(0);
+    
+    for (int i = 0; i < count; i++) {
+        HMACKeyWipe(&keys[i]);
+    }
+}
+
+- (void)testBytesMatchStringAPI {
+    const uint8_t secretBytes[] = { 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x30 };
+    NSData *secret = [NSData dataWithBytes:secretBytes length:sizeof(secretBytes)];
+    NSError *error = nil;
+    
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QH10-S" dialect:OCRASuiteDialectV2 error:&error];
+    NSData *question = [OCRA fieldWithLength:suite.layout->questionLength hexString:@"A98AC7" alignment:OCRAFieldAlignmentLeft];
+    NSData *session = [OCRA fieldWithLength:suite.layout->sessionInformationLength hexString:sessionInformation alignment:OCRAFieldAlignmentRight];
+    
+    NSString *expected = [OCRA generateOCRAWithSuite:suite key:@"3132333435363738393031323334353637383930" counter:@"" question:@"A98AC7" password:@"" sessionInformation:sessionInformation timestamp:@"" error:&error];
+    NSString *result = [OCRA generateOCRAWithSuite:suite secret:secret counter:nil question:question password:nil sessionInformation:session timestamp:nil error:&error];
+    STAssertEqualObjects(result, expected, @"Bytes and string API should agree");
+    
+    OCRAWrapper *wrapper = [[OCRAWrapper alloc] init];
+    result = [wrapper generateOCRAWithSuite:suite secret:secret counter:nil question:question sessionInformation:session timestamp:nil error:&error];
+    STAssertEqualObjects(result, expected, @"Wrapper bytes and string API should agree");
+    STAssertEqualObjects([wrapper generateOCRA:suite.string secret:secret challenge:@"A98AC7" sessionKey:sessionInformation error:&error], expected, @"Wrapper bytes and string API should agree");
+}
+
+- (void)testTimeStepParsing {
+    NSError *error = nil;
+    STAssertEquals([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08-T1M" dialect:OCRASuiteDialectV2 error:NULL].timeStep, (NSTimeInterval)60, @"T1M is one minute");
+    STAssertEquals([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08-T30S" dialect:OCRASuiteDialectV2 error:NULL].timeStep, (NSTimeInterval)30, @"T30S is 30 seconds");
+    STAssertEquals([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08-PSHA1-T2H" dialect:OCRASuiteDialectV2 error:NULL].timeStep, (NSTimeInterval)7200, @"T2H is two hours");
+    STAssertNil([OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08-T60M" dialect:OCRASuiteDialectV2 error:&error], @"T60M is not a valid time step");
+    STAssertEquals([error code], (NSInteger)OCRASuiteInvalidFormatError, @"Should be a format error");
+    
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA512-8:QN08-T1M" dialect:OCRASuiteDialectV2 error:NULL];
+    const uint8_t expected[] = { 0x00, 0x00, 0x00, 0x00, 0x01, 0x32, 0xd0, 0xb6 };
+    NSDate *date = [NSDate dateWithTimeIntervalSince1970:0x132d0b6 * 60 + 59];
+    STAssertEqualObjects([OCRA timestampWithSuite:suite date:date], [NSData dataWithBytes:expected length:sizeof(expected)], @"Timestamp should count whole time steps");
+    STAssertNil([OCRA timestampWithSuite:[OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08" dialect:OCRASuiteDialectV2 error:NULL] date:date], @"Suite without timestamp");
+}
+
+- (void)testTimeWindowVerification {
+    uint8_t secret[64];
+    for (int i = 0; i < 64; i++) {
+        secret[i] = '0' + (i + 1) % 10;
+    }
+    
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA512-8:QN08-T1M" dialect:OCRASuiteDialectV2 error:NULL];
+    const OCRASuiteLayout *layout = suite.layout;
+    HMACAlgorithm algorithm;
+    OCRAHMACAlgorithm(layout->algorithm, &algorithm);
+    HMACKey key;
+    HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+    
+    uint8_t question[128] = { 0 }, timestamp[8];
+    OCRAInput input = { .question = { question, layout->questionLength } };
+    int64_t drift = 0;
+    STAssertTrue(OCRAVerifyTimeWindow(layout, &key, &input, 0x132d0b6, 0, 95209754, &drift), @"RFC 6287 time based vector");
+    STAssertEquals(drift, (int64_t)0, @"No drift");
+    
+    for (int offset = -3; offset <= 3; offset++) {
+        OCRAEncodeTimestamp(0x132d0b6 + offset, timestamp);
+        input.timestamp = (OCRABytes){ timestamp, sizeof(timestamp) };
+        uint32_t code = OCRAComputeCode(layout, &key, &input);
+        STAssertTrue(OCRAVerifyTimeWindow(layout, &key, &input, 0x132d0b6, 3, code, &drift), @"Response %d steps off should be accepted", offset);
+        STAssertEquals(drift, (int64_t)offset, @"Drift should be reported");
+        if (offset != 0) {
+            STAssertFalse(OCRAVerifyTimeWindow(layout, &key, &input, 0x132d0b6 - 4 * offset, 3, code, &drift), @"Response outside the window should be rejected");
+        }
+    }
+    
+    const int iterations = 1000;
+    for (uint32_t window = 1; window <= 100; window *= 10) {
+        NSDate *start = [NSDate date];
+        for (int i = 0; i < iterations; i++) {
+            OCRAVerifyTimeWindow(layout, &key, &input, 0x132d0b6 + (uint64_t)i * 1000, window, 0, &drift);
+        }
+        NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+        NSLog(@"Time window +/-%u, no match: %.2f us per verification", window, elapsed / iterations * 1e6);
+    }
+    
+    HMACKeyWipe(&key);
+}
+
+/**
+ * Random hex string of at most maxLength digits, always an even number of digits.
+ */
+- (NSString *)randomHexWithMaxLength:(NSUInteger)maxLength {
+    NSUInteger length = (random() % (maxLength / 2 + 1)) * 2;
+    NSMutableString *hex = [NSMutableString stringWithCapacity:length];
+    for (NSUInteger i = 0; i < length; i++) {
+        [hex appendFormat:@"%X", (unsigned)(random() % 16)];
+    }
+    return hex;
+}
+
+/**
+ * Deterministic corpus of suites covering every algorithm, digit count and data input combination the dialect knows.
+ */
+- (NSArray *)suiteCorpusForDialect:(OCRASuiteDialect)dialect {
+    // No MD5: the legacy v1 engine reads up to 3 bytes past the 16 byte digest during truncation
+    NSArray *algorithms = @[@"SHA1", @"SHA256", @"SHA512"];
+    NSArray *counters = @[@"", @"C-"];
+    NSArray *questions = @[@"QN08", @"QH10", @"QA20", @"qn64"];
+    NSArray *passwords = @[@"", @"-PSHA1", @"-PSHA256", @"-PSHA512"];
+    NSArray *sessions = dialect == OCRASuiteDialectV1 ? @[@"", @"-S"] : @[@"", @"-S", @"-S064", @"-S128", @"-S256", @"-S512"];
+    NSArray *timestamps = @[@"", @"-T1M", @"-T30S", @"-T2H"];
+    
+    NSMutableArray *corpus = [NSMutableArray array];
+    for (NSString *algorithm in algorithms) {
+        for (int digits = 4; digits <= 10; digits++) {
+            for (NSString *counter in counters) {
+                for (NSString *question in questions) {
+                    for (NSString *password in passwords) {
+                        for (NSString *session in sessions) {
+                            for (NSString *timestamp in timestamps) {
+                                [corpus addObject:[NSString stringWithFormat:@"OCRA-1:HOTP-%@-%d:%@%@%@%@%@", algorithm, digits, counter, question, password, session, timestamp]];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return corpus;
+}
+
+- (void)testEnginesMatchLegacyEngines {
+    srandom(6287);
+    NSUInteger compared = 0;
+    
+    for (NSNumber *dialectNumber in @[@(OCRASuiteDialectV1), @(OCRASuiteDialectV2)]) {
+        OCRASuiteDialect dialect = [dialectNumber intValue];
+        for (NSString *string in [self suiteCorpusForDialect:dialect]) {
+            NSError *error = nil;
+            OCRASuite *suite = [OCRASuite suiteWithString:string dialect:dialect error:&error];
+            STAssertNotNil(suite, @"%@ should compile: %@", string, error);
+            
+            const OCRASuiteLayout *layout = suite.layout;
+            NSString *key = [self randomHexWithMaxLength:layout->hashLength * 2];
+            NSString *counter = [self randomHexWithMaxLength:layout->counterLength * 2];
+            NSString *question = [self randomHexWithMaxLength:layout->questionLength * 2];
+            NSString *password = [self randomHexWithMaxLength:layout->passwordLength * 2];
+            NSString *session = [self randomHexWithMaxLength:layout->sessionInformationLength * 2];
+            NSString *timestamp = [self randomHexWithMaxLength:layout->timestampLength * 2];
+            
+            NSString *expected = nil;
+            NSString *result = nil;
+            if (dialect == OCRASuiteDialectV1) {
+                expected = [OCRALegacy_v1 generateOCRA:string key:key counter:counter question:question password:password sessionInformation:session timestamp:timestamp error:&error];
+                result = [OCRA_v1 generateOCRA:string key:key counter:counter question:question password:password sessionInformation:session timestamp:timestamp error:&error];
+            } else {
+                expected = [OCRALegacy generateOCRAForSuite:string key:key counter:counter question:question password:password sessionInformation:session timestamp:timestamp error:&error];
+                result = [OCRA generateOCRAForSuite:string key:key counter:counter question:question password:password sessionInformation:session timestamp:timestamp error:&error];
+            }
+            STAssertEqualObjects(result, expected, @"%@ should match the legacy engine", string);
+            
+            NSData *secret = [OCRA fieldWithLength:[key length] / 2 hexString:key alignment:OCRAFieldAlignmentLeft];
+            result = [OCRA generateOCRAWithSuite:suite
+                                          secret:secret
+                                         counter:[OCRA fieldWithLength:layout->counterLength hexString:counter alignment:OCRAFieldAlignmentRight]
+                                        question:[OCRA fieldWithLength:layout->questionLength hexString:question alignment:OCRAFieldAlignmentLeft]
+                                        password:[OCRA fieldWithLength:layout->passwordLength hexString:password alignment:OCRAFieldAlignmentRight]
+                              sessionInformation:[OCRA fieldWithLength:layout->sessionInformationLength hexString:session alignment:OCRAFieldAlignmentRight]
+                                       timestamp:[OCRA fieldWithLength:layout->timestampLength hexString:timestamp alignment:OCRAFieldAlignmentRight]
+                                           error:&error];
+            STAssertEqualObjects(result, expected, @"%@ bytes API should match the legacy engine", string);
+            compared++;
+        }
+    }
+    
+    NSLog(@"Compared %lu suites against the legacy engines", (unsigned long)compared);
+}
+
+- (void)testSpecializedSuites {
+    const uint8_t secret[20] = "12345678901234567890";
+    NSArray *suites = @[@"OCRA-1:HOTP-SHA1-6:QH10-S", @"OCRA-1:HOTP-SHA1-6:QN10-S", @"OCRA-1:HOTP-SHA1-6:QN08"];
+    const int iterations = 10000;
+    
+    for (NSString *string in suites) {
+        OCRASuite *suite = [OCRASuite suiteWithString:string dialect:OCRASuiteDialectV2 error:NULL];
+        STAssertTrue(suite.layout->compute != NULL, @"%@ should be specialized", string);
+        
+        OCRASuiteLayout generic = *suite.layout;
+        generic.compute = NULL;
+        
+        HMACAlgorithm algorithm;
+        OCRAHMACAlgorithm(generic.algorithm, &algorithm);
+        HMACKey key;
+        HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+        
+        uint8_t question[128] = { 0 };
+        uint8_t session[64] = { 0 };
+        OCRAInput input = { .question = { question, sizeof(question) }, .sessionInformation = { session, sizeof(session) } };
+        for (int i = 0; i < 100; i++) {
+            question[i % sizeof(question)] = (uint8_t)random();
+            session[i % sizeof(session)] = (uint8_t)random();
+            STAssertEquals(OCRAComputeCode(suite.layout, &key, &input), OCRAComputeCode(&generic, &key, &input), @"%@ specialization should match the generic engine", string);
+        }
+        
+        NSDate *start = [NSDate date];
+        for (int i = 0; i < iterations; i++) {
+            OCRAComputeCode(&generic, &key, &input);
+        }
+        NSTimeInterval genericElapsed = -[start timeIntervalSinceNow];
+        start = [NSDate date];
+        for (int i = 0; i < iterations; i++) {
+            OCRAComputeCode(suite.layout, &key, &input);
+        }
+        NSTimeInterval specializedElapsed = -[start timeIntervalSinceNow];
+        NSLog(@"%@: %.2f us generic, %.2f us specialized", string, genericElapsed / iterations * 1e6, specializedElapsed / iterations * 1e6);
+        
+        HMACKeyWipe(&key);
+    }
+    
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QH10-S" dialect:OCRASuiteDialectV1 error:NULL];
+    STAssertTrue(suite.layout->compute != NULL, @"The dialect doesn't matter once the layout is the same");
+    suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA256-6:QH10-S" dialect:OCRASuiteDialectV2 error:NULL];
+    STAssertTrue(suite.layout->compute == NULL, @"Other suites use the generic engine");
+}
+
+- (void)testNumericQuestionConversion {
+    char hex[OCRAMaxNumericQuestionHexLength + 1];
+    STAssertEquals(OCRANumericQuestionToHex("00000000", 8, hex), (size_t)1, @"Zero is a single digit");
+    STAssertEquals(strcmp(hex, "0"), 0, @"Zero");
+    OCRANumericQuestionToHex("11111111", 8, hex);
+    STAssertEquals(strcmp(hex, "A98AC7"), 0, @"RFC 6287 question 11111111");
+    OCRANumericQuestionToHex("18446744073709551616", 20, hex);
+    STAssertEquals(strcmp(hex, "10000000000000000"), 0, @"2^64 doesn't fit a machine word");
+    
+    const char *largest = "9999999999999999999999999999999999999999999999999999999999999999";
+    STAssertEquals(OCRANumericQuestionToHex(largest, 64, hex), (size_t)OCRAMaxNumericQuestionHexLength, @"10^64 - 1 needs 54 hex digits");
+    STAssertEquals(strcmp(hex, "184F03E93FF9F4DAA797ED6E38ED64BF6A1F00FFFFFFFFFFFFFFFF"), 0, @"10^64 - 1");
+    
+    STAssertEquals(OCRANumericQuestionToHex("", 0, hex), (size_t)0, @"Empty question");
+    STAssertEquals(OCRANumericQuestionToHex("12A4", 4, hex), (size_t)0, @"Not a decimal number");
+    STAssertEquals(OCRANumericQuestionToHex("-1", 2, hex), (size_t)0, @"Not a decimal number");
+    char tooLong[65];
+    memset(tooLong, '1', sizeof(tooLong));
+    STAssertEquals(OCRANumericQuestionToHex(tooLong, sizeof(tooLong), hex), (size_t)0, @"More than 64 digits");
+    
+    // RFC 6287 OCRA-1:HOTP-SHA1-6:QN08, Q = 00000000...99999999
+    NSArray *expected = @[@"237653", @"243178", @"653583", @"740991", @"608993", @"388898", @"816933", @"224598", @"750600", @"294470"];
+    NSData *secret = [@"12345678901234567890" dataUsingEncoding:NSASCIIStringEncoding];
+    OCRAWrapper_v1 *wrapper = [[OCRAWrapper_v1 alloc] init];
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA1-6:QN08" dialect:OCRASuiteDialectV1 error:NULL];
+    NSError *error = nil;
+    for (int q = 0; q < 10; q++) {
+        NSString *question = [NSString stringWithFormat:@"%08d", q * 11111111];
+        STAssertEqualObjects([wrapper generateOCRAWithSuite:suite secret:secret challenge:question sessionKey:@"" error:&error], expected[q], @"RFC 6287 QN08 vector");
+    }
+    STAssertNil([wrapper generateOCRAWithSuite:suite secret:secret challenge:@"12AB" sessionKey:@"" error:&error], @"Hex question for a QN suite");
+    STAssertEquals([error code], (NSInteger)OCRAInvalidNumericQuestionError, @"Should be a numeric question error");
+    
+    // The batch fills the same fields
+    const char *questions[] = { "0", "11111111", "18446744073709551616", largest };
+    OCRABytes decimals[4];
+    for (int i = 0; i < 4; i++) {
+        decimals[i] = (OCRABytes){ (const uint8_t *)questions[i], strlen(questions[i]) };
+    }
+    uint8_t fields[4 * 128];
+    uint8_t field[128];
+    STAssertEquals(OCRAMessageSetNumericFields(fields, 128, decimals, 4), (size_t)4, @"All questions are valid");
+    for (int i = 0; i < 4; i++) {
+        OCRAMessageSetNumericField(field, sizeof(field), questions[i], strlen(questions[i]));
+        STAssertTrue(memcmp(fields + i * 128, field, sizeof(field)) == 0, @"Batch and single conversion should agree");
+    }
+    decimals[2] = (OCRABytes){ (const uint8_t *)"1X", 2 };
+    STAssertEquals(OCRAMessageSetNumericFields(fields, 128, decimals, 4), (size_t)2, @"The third question is invalid");
+    
+    const int iterations = 100000;
+    NSDate *start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        @autoreleasepool {
+            NSDecimalNumber *number = [NSDecimalNumber decimalNumberWithString:@"3493848238484898"];
+            [NSString stringWithFormat:@"%lX", [number unsignedIntegerValue]];
+        }
+    }
+    NSTimeInterval decimalNumberElapsed = -[start timeIntervalSinceNow];
+    start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        OCRANumericQuestionToHex("3493848238484898", 16, hex);
+    }
+    NSTimeInterval kernelElapsed = -[start timeIntervalSinceNow];
+    start = [NSDate date];
+    for (int i = 0; i < iterations; i++) {
+        OCRANumericQuestionToHex(largest, 64, hex);
+    }
+    NSLog(@"QN16: %.2f us NSDecimalNumber, %.3f us kernel; QN64: %.3f us kernel", decimalNumberElapsed / iterations * 1e6, kernelElapsed / iterations * 1e6, -[start timeIntervalSinceNow] / iterations * 1e6);
+}
+
+- (void)testCounterLookAhead {
+    uint8_t secret[64];
+    for (int i = 0; i < 64; i++) {
+        secret[i] = '0' + (i + 1) % 10;
+    }
+    
+    // RFC 6287 OCRA-1:HOTP-SHA512-8:C-QN08, C = 0...9 with Q = 00000000...99999999
+    const uint32_t expected[] = { 7016083, 63947962, 70123924, 25341727, 33203315, 34205738, 44343969, 51946085, 20403879, 31409299 };
+    OCRASuite *suite = [OCRASuite suiteWithString:@"OCRA-1:HOTP-SHA512-8:C-QN08" dialect:OCRASuiteDialectV2 error:NULL];
+    const OCRASuiteLayout *layout = suite.layout;
+    HMACAlgorithm algorithm;
+    OCRAHMACAlgorithm(layout->algorithm, &algorithm);
+    HMACKey key;
+    HMACKeyInit(&key, algorithm, secret, sizeof(secret));
+    
+    uint8_t question[128];
+    OCRAInput input = { .question = { question, layout->questionLength } };
+    for (int c = 0; c < 10; c++) {
+        char hex[16];
+        snprintf(hex, sizeof(hex), "%X", c * 11111111);
+        OCRAMessageSetHexField(question, layout->questionLength, hex, strlen(hex), OCRAFieldAlignmentLeft);
+        
+        uint64_t matched = 0;
+        STAssertTrue(OCRAVerifyCounterWindow(layout, &key, &input, 0, 20, expected[c], &matched), @"Counter %d should be found", c);
+        STAssertEquals(matched, (uint64_t)c, @"Lowest matching counter should be reported");
+        STAssertFalse(OCRAVerifyCounterWindow(layout, &key, &input, c + 1, 20, expected[c], &matched), @"Counters behind the verifier are never accepted");
+    }
+    
+    memset(question, 0, sizeof(question));
+    const int iterations = 100;
+    for (uint32_t window = 10; window <= 1000; window *= 10) {
+        NSDate *start = [NSDate date];
+        for (int i = 0; i < iterations; i++) {
+            OCRAVerifyCounterWindow(layout, &key, &input, (uint64_t)i * 10000, window, 0, NULL);
+        }
+        NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+        NSLog(@"Counter look-ahead %u, no match: %.2f us per verification (%zu lanes)", window, elapsed / iterations * 1e6, HMACBatchLaneWidth());
+    }
+    
+    HMACKeyWipe(&key);
+}
+
+- (void)testHOTPLookAhead {
+    // RFC 4226 appendix D
+    NSData *secret = [@"12345678901234567890" dataUsingEncoding:NSASCIIStringEncoding];
+    NSArray *expected = @[@"755224", @"287082", @"359152", @"969429", @"338314", @"254676", @"287922", @"162583", @"399871", @"520489"];
+    
+    HOTP *hotp = [HOTP hotpWithKey:secret counter:0 numDigits:6];
+    for (NSUInteger c = 0; c < [expected count]; c++) {
+        hotp.counter = c;
+        [hotp computePassword];
+        STAssertEqualObjects(hotp.dec, expected[c], @"HOTP test vector");
+        STAssertEquals(hotp.counter, c, @"Computing a password should leave the counter alone");
+    }
+    
+    hotp.counter = 2;
+    STAssertEquals([hotp lookAheadForPassword:@"520489" window:10], (NSUInteger)7, @"Counter 9 is 7 ahead of 2");
+    STAssertEquals([hotp lookAheadForPassword:@"520489" window:6], (NSUInteger)NSNotFound, @"Counter 9 is outside the window");
+    STAssertEquals([hotp lookAheadForPassword:@"755224" window:100], (NSUInteger)NSNotFound, @"Counter 0 is behind");
+}
+
+- (void)testHTTPDateParsing {
+    NSDate *expected = [NSDate dateWithTimeIntervalSince1970:784111777];
+    STAssertEqualObjects([ServerClock dateFromHTTPDateString:@"Sun, 06 Nov 1994 08:49:37 GMT"], expected, @"IMF-fixdate");
+    STAssertEqualObjects([ServerClock dateFromHTTPDateString:@"Sunday, 06-Nov-94 08:49:37 GMT"], expected, @"RFC 850");
+    STAssertEqualObjects([ServerClock dateFromHTTPDateString:@"Sun Nov  6 08:49:37 1994"], expected, @"asctime");
+    STAssertNil([ServerClock dateFromHTTPDateString:@"yesterday"], @"Invalid date");
+}
 
 //- (void)testSuiteParsing {
 //    
@@ -0,0 +1,12 @@
+//
+//  PBKDF2CalibrationTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface PBKDF2CalibrationTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,62 @@
+//
+//  PBKDF2CalibrationTests.m
+//  LogicTests
+//
+
+#import "PBKDF2CalibrationTests.h"
+#import "PBKDF2Calibration.h"
+#import "PBKDF2.h"
+
+#import <CommonCrypto/CommonKeyDerivation.h>
+
+@implementation PBKDF2CalibrationTests
+
+- (void)testRoundsForDuration {
+    STAssertEquals(PBKDF2RoundsForDuration(1000000, 100, 1000, 10000000), (uint32_t)100000, @"100 ms at a million rounds per second");
+    STAssertEquals(PBKDF2RoundsForDuration(1000000, 250, 1000, 10000000), (uint32_t)250000, @"Scales with the duration");
+    STAssertEquals(PBKDF2RoundsForDuration(5000, 100, 1000, 10000000), (uint32_t)1000, @"Clamped to the minimum");
+    STAssertEquals(PBKDF2RoundsForDuration(1e12, 100, 1000, 10000000), (uint32_t)10000000, @"Clamped to the maximum");
+    STAssertEquals(PBKDF2RoundsForDuration(0, 100, 1000, 10000000), (uint32_t)1000, @"No measurement gives the minimum");
+}
+
+- (void)testOffTarget {
+    STAssertFalse(PBKDF2RoundsOffTarget(100000, 100000), @"On target");
+    STAssertFalse(PBKDF2RoundsOffTarget(70000, 100000), @"Within tolerance below");
+    STAssertFalse(PBKDF2RoundsOffTarget(140000, 100000), @"Within tolerance above");
+    STAssertTrue(PBKDF2RoundsOffTarget(60000, 100000), @"Too cheap");
+    STAssertTrue(PBKDF2RoundsOffTarget(160000, 100000), @"Too slow");
+    STAssertTrue(PBKDF2RoundsOffTarget(32894, 1000000), @"Legacy rounds on a fast device");
+    STAssertFalse(PBKDF2RoundsOffTarget(UINT32_MAX, UINT32_MAX), @"No overflow");
+}
+
+- (void)testInvalidParameters {
+    PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, 32, 0 };
+    STAssertEquals(PBKDF2MeasureRoundsPerSecond(&parameters, 10, 3), 0.0, @"No key to derive");
+    STAssertEquals(PBKDF2CalibrateRounds(&parameters, 100), (uint32_t)0, @"No key to derive");
+}
+
+- (void)testCalibrationMatchesCommonCrypto {
+    PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, 32, 32 };
+    uint32_t rounds = PBKDF2CalibrateRounds(&parameters, 100);
+    STAssertTrue(rounds >= PBKDF2CalibrationMinimumRounds && rounds <= PBKDF2CalibrationMaximumRounds, @"Within bounds");
+    
+    // Our derivation is at least as fast as CommonCrypto's, and not wildly faster
+    uint32_t reference = CCCalibratePBKDF(kCCPBKDF2, 4, 32, kCCPRFHmacAlgSHA256, 32, 100);
+    STAssertTrue(rounds * 3 >= reference * 2, @"Calibrated %u rounds, CommonCrypto %u", rounds, reference);
+    STAssertTrue(rounds <= reference * 4, @"Calibrated %u rounds, CommonCrypto %u", rounds, reference);
+}
+
+- (void)testCalibratedRoundsTakeTheTarget {
+    PBKDF2CalibrationParameters parameters = { HMACAlgorithmSHA256, 4, 32, 32 };
+    uint32_t rounds = PBKDF2CalibrateRounds(&parameters, 50);
+    
+    uint8_t salt[32] = { 0 }, key[32];
+    NSDate *start = [NSDate date];
+    STAssertEquals(PBKDF2Derive(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, salt, sizeof(salt), rounds, key, sizeof(key)), 0, @"Derivation should succeed");
+    NSTimeInterval elapsed = -[start timeIntervalSinceNow];
+    
+    // Generous bounds, the simulator shares the machine with everything else
+    STAssertTrue(elapsed > 0.02 && elapsed < 0.5, @"Took %.0f ms", elapsed * 1000);
+}
+
+@end
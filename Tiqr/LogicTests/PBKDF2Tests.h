@@ -0,0 +1,12 @@
+//
+//  PBKDF2Tests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface PBKDF2Tests : SenTestCase {
+
+}
+
+@end
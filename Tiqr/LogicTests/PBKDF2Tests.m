@@ -0,0 +1,77 @@
+//
+//  PBKDF2Tests.m
+//  LogicTests
+//
+
+#import "PBKDF2Tests.h"
+#import "PBKDF2.h"
+#import "HMACBackend.h"
+
+#import <CommonCrypto/CommonKeyDerivation.h>
+
+static bool PBKDF2TestsCancelAfter(const void *context) {
+    int *remaining = (int *)context;
+    return (*remaining)-- <= 0;
+}
+
+@implementation PBKDF2Tests
+
+- (void)tearDown {
+    HMACBackendSetActive(NULL);
+    [super tearDown];
+}
+
+- (void)testRFC6070Vectors {
+    uint8_t key[25];
+    STAssertEquals(PBKDF2Derive(HMACAlgorithmSHA1, (const uint8_t *)"password", 8, (const uint8_t *)"salt", 4, 4096, key, 20), 0, @"Derivation should succeed");
+    STAssertEqualObjects([NSData dataWithBytes:key length:20], [NSData dataWithBytes:"\x4b\x00\x79\x01\xb7\x65\x48\x9a\xbe\xad\x49\xd9\x26\xf7\x21\xd0\x65\xa4\x29\xc1" length:20], @"RFC 6070 vector");
+    
+    PBKDF2Derive(HMACAlgorithmSHA1, (const uint8_t *)"passwordPASSWORDpassword", 24, (const uint8_t *)"saltSALTsaltSALTsaltSALTsaltSALTsalt", 36, 4096, key, 25);
+    STAssertEqualObjects([NSData dataWithBytes:key length:25], [NSData dataWithBytes:"\x3d\x2e\xec\x4f\xe4\x1c\x84\x9b\x80\xc8\xd8\x36\x62\xc0\xe4\x4a\x8b\x29\x1a\x96\x4c\xf2\xf0\x70\x38" length:25], @"RFC 6070 vector");
+}
+
+- (void)testMatchesCommonCrypto {
+    static const CCPseudoRandomAlgorithm prfs[] = { kCCPRFHmacAlgSHA1, kCCPRFHmacAlgSHA256, kCCPRFHmacAlgSHA512 };
+    static const HMACAlgorithm algorithms[] = { HMACAlgorithmSHA1, HMACAlgorithmSHA256, HMACAlgorithmSHA512 };
+    
+    for (const HMACBackend *const *backend = HMACBackends; *backend != NULL; backend++) {
+        if (!(*backend)->supported()) {
+            continue;
+        }
+        HMACBackendSetActive(*backend);
+        
+        for (int i = 0; i < 200; i++) {
+            uint8_t password[130], salt[300], expected[100], key[100];
+            size_t passwordLength = arc4random_uniform(sizeof(password));
+            size_t saltLength = arc4random_uniform(sizeof(salt));
+            size_t keyLength = 1 + arc4random_uniform(sizeof(key));
+            uint32_t rounds = 1 + arc4random_uniform(5000);
+            int algorithm = i % 3;
+            arc4random_buf(password, sizeof(password));
+            arc4random_buf(salt, sizeof(salt));
+            
+            CCKeyDerivationPBKDF(kCCPBKDF2, (const char *)password, passwordLength, salt, saltLength, prfs[algorithm], rounds, expected, keyLength);
+            STAssertEquals(PBKDF2Derive(algorithms[algorithm], password, passwordLength, salt, saltLength, rounds, key, keyLength), 0, @"Derivation should succeed");
+            STAssertTrue(memcmp(key, expected, keyLength) == 0, @"%s: PBKDF2 differs from CommonCrypto for %d rounds", (*backend)->name, rounds);
+        }
+    }
+}
+
+- (void)testCancellation {
+    uint8_t key[32];
+    int remaining = 0;
+    STAssertEquals(PBKDF2DeriveCancellable(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, NULL, 0, 1000000, key, sizeof(key), PBKDF2TestsCancelAfter, &remaining), ECANCELED, @"Cancelled derivation stops");
+    for (size_t i = 0; i < sizeof(key); i++) {
+        STAssertEquals(key[i], (uint8_t)0, @"Key of a cancelled derivation is wiped");
+    }
+    
+    uint8_t expected[32];
+    remaining = 1000;
+    PBKDF2Derive(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, NULL, 0, 10000, expected, sizeof(expected));
+    STAssertEquals(PBKDF2DeriveCancellable(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, NULL, 0, 10000, key, sizeof(key), PBKDF2TestsCancelAfter, &remaining), 0, @"Uncancelled derivation completes");
+    STAssertTrue(memcmp(key, expected, sizeof(key)) == 0, @"Polling doesn't change the result");
+    
+    STAssertEquals(PBKDF2Derive(HMACAlgorithmSHA256, (const uint8_t *)"1234", 4, NULL, 0, 0, key, sizeof(key)), EINVAL, @"At least one round");
+}
+
+@end
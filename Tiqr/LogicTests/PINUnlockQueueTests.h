@@ -0,0 +1,12 @@
+//
+//  PINUnlockQueueTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface PINUnlockQueueTests : SenTestCase {
+
+}
+
+@end
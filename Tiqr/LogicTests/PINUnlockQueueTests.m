@@ -0,0 +1,228 @@
+//
+//  PINUnlockQueueTests.m
+//  LogicTests
+//
+
+#import "PINUnlockQueueTests.h"
+#import "PINUnlockQueue.h"
+#import "HMACKey.h"
+
+// Stand-in for the keychain backed store: the key is an iterated HMAC of
+// the PIN, the secret is stored XOR-ed with the key.
+
+typedef struct {
+    const char *PIN;
+    unsigned int rounds;
+} TestItem;
+
+typedef struct {
+    uint8_t bytes[32];
+} TestValue;
+
+typedef struct {
+    dispatch_semaphore_t done;
+    PINUnlockStatus status;
+    TestValue secret;
+    BOOL hasSecret;
+} TestResult;
+
+static uint8_t storedSecret[32];
+static BOOL hasStoredSecret;
+static int abortedDerivations;
+
+static void *TestDerive(void *context, void *item, const PINCancellationToken *token) {
+    TestItem *testItem = item;
+    TestValue *key = calloc(1, sizeof(TestValue));
+    HMACKey hmac;
+    HMACKeyInit(&hmac, HMACAlgorithmSHA256, (const uint8_t *)testItem->PIN, strlen(testItem->PIN));
+    for (unsigned int i = 0; i < testItem->rounds; i++) {
+        if (i % 1024 == 0 && PINCancellationTokenIsCancelled(token)) {
+            abortedDerivations++;
+            free(key);
+            key = NULL;
+            break;
+        }
+        HMACKeyCompute(&hmac, key->bytes, sizeof(key->bytes), key->bytes);
+    }
+    HMACKeyWipe(&hmac);
+    return key;
+}
+
+static void *TestLoad(void *context, void *item) {
+    if (!hasStoredSecret) {
+        return NULL;
+    }
+    TestValue *encryptedSecret = malloc(sizeof(TestValue));
+    memcpy(encryptedSecret->bytes, storedSecret, sizeof(storedSecret));
+    return encryptedSecret;
+}
+
+static void *TestDecrypt(void *context, void *item, void *key, void *encryptedSecret) {
+    TestValue *secret = malloc(sizeof(TestValue));
+    for (size_t i = 0; i < sizeof(secret->bytes); i++) {
+        secret->bytes[i] = ((TestValue *)key)->bytes[i] ^ ((TestValue *)encryptedSecret)->bytes[i];
+    }
+    return secret;
+}
+
+static bool TestStore(void *context, void *item, void *key, void *secret) {
+    for (size_t i = 0; i < sizeof(storedSecret); i++) {
+        storedSecret[i] = ((TestValue *)key)->bytes[i] ^ ((uint8_t *)secret)[i];
+    }
+    hasStoredSecret = YES;
+    return true;
+}
+
+static void TestRelease(void *context, void *value) {
+    HMACSecureZero(value, sizeof(TestValue));
+    free(value);
+}
+
+static void TestComplete(void *completionContext, PINUnlockStatus status, void *secret) {
+    TestResult *result = completionContext;
+    result->status = status;
+    if (secret != NULL) {
+        result->secret = *(TestValue *)secret;
+        result->hasSecret = YES;
+        TestRelease(NULL, secret);
+    }
+    dispatch_semaphore_signal(result->done);
+}
+
+@interface PINUnlockQueueTests ()
+
+@property (nonatomic, assign) PINUnlockQueue *queue;
+
+@end
+
+@implementation PINUnlockQueueTests
+
+- (void)setUp {
+    [super setUp];
+    hasStoredSecret = NO;
+    abortedDerivations = 0;
+    PINSecretStore store = { NULL, TestDerive, TestLoad, TestDecrypt, TestStore, TestRelease };
+    self.queue = PINUnlockQueueCreate(&store);
+}
+
+- (void)tearDown {
+    PINUnlockQueueDestroy(self.queue);
+    [super tearDown];
+}
+
+- (void)submit:(PINUnlockOperation)operation item:(TestItem *)item secret:(uint8_t *)secret token:(PINCancellationToken *)token result:(TestResult *)result {
+    result->done = dispatch_semaphore_create(0);
+    PINUnlockRequest request = { operation, item, secret, operation == PINUnlockOperationLoad, token, TestComplete, result };
+    STAssertTrue(PINUnlockQueueSubmit(self.queue, &request), @"Request should be accepted");
+}
+
+- (void)wait:(TestResult *)result {
+    STAssertEquals(dispatch_semaphore_wait(result->done, dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_SEC)), 0L, @"Request should complete");
+}
+
+- (void)testStoreAndLoad {
+    uint8_t secret[32];
+    for (int i = 0; i < 32; i++) {
+        secret[i] = (uint8_t)(i * 7);
+    }
+    TestItem item = { "1234", 10000 };
+    TestItem wrongPIN = { "9999", 10000 };
+    TestResult result;
+    
+    [self submit:PINUnlockOperationLoad item:&item secret:NULL token:NULL result:&result];
+    [self wait:&result];
+    STAssertEquals(result.status, PINUnlockStatusNotFound, @"Nothing is stored yet");
+    
+    [self submit:PINUnlockOperationStore item:&item secret:secret token:NULL result:&result];
+    [self wait:&result];
+    STAssertEquals(result.status, PINUnlockStatusSuccess, @"Store should succeed");
+    
+    memset(&result, 0, sizeof(result));
+    [self submit:PINUnlockOperationLoad item:&item secret:NULL token:NULL result:&result];
+    [self wait:&result];
+    STAssertEquals(result.status, PINUnlockStatusSuccess, @"Load should succeed");
+    STAssertTrue(result.hasSecret && memcmp(result.secret.bytes, secret, 32) == 0, @"Secret should round trip");
+    
+    memset(&result, 0, sizeof(result));
+    [self submit:PINUnlockOperationLoad item:&wrongPIN secret:NULL token:NULL result:&result];
+    [self wait:&result];
+    STAssertTrue(result.hasSecret && memcmp(result.secret.bytes, secret, 32) != 0, @"A wrong PIN gives a wrong secret");
+}
+
+- (void)testNewerRequestSupersedesDerivation {
+    TestItem slow = { "1234", 100000000 };
+    TestItem fast = { "1234", 10 };
+    TestResult first, second, last;
+    memset(&last, 0, sizeof(last));
+    hasStoredSecret = YES;
+    
+    [self submit:PINUnlockOperationLoad item:&slow secret:NULL token:NULL result:&first];
+    usleep(20000);
+    [self submit:PINUnlockOperationLoad item:&slow secret:NULL token:NULL result:&second];
+    [self submit:PINUnlockOperationLoad item:&fast secret:NULL token:NULL result:&last];
+    
+    [self wait:&first];
+    [self wait:&second];
+    [self wait:&last];
+    STAssertEquals(first.status, PINUnlockStatusCancelled, @"Running derivation is aborted");
+    STAssertEquals(second.status, PINUnlockStatusCancelled, @"Pending request is skipped");
+    STAssertEquals(last.status, PINUnlockStatusSuccess, @"Newest request runs");
+    STAssertEquals(abortedDerivations, 1, @"Skipped request never starts deriving");
+}
+
+- (void)testCancellationToken {
+    TestItem slow = { "1234", 100000000 };
+    TestResult result;
+    PINCancellationToken *token = PINCancellationTokenCreate();
+    hasStoredSecret = YES;
+    
+    [self submit:PINUnlockOperationLoad item:&slow secret:NULL token:token result:&result];
+    usleep(10000);
+    PINCancellationTokenCancel(token);
+    STAssertTrue(PINCancellationTokenIsCancelled(token), @"Token is cancelled");
+    [self wait:&result];
+    STAssertEquals(result.status, PINUnlockStatusCancelled, @"Cancelled request completes as cancelled");
+    PINCancellationTokenRelease(token);
+}
+
+- (void)testLoadWithoutSecretSkipsDerivation {
+    TestItem slow = { "1234", 100000000 };
+    TestResult result;
+    memset(&result, 0, sizeof(result));
+    
+    [self submit:PINUnlockOperationLoad item:&slow secret:NULL token:NULL result:&result];
+    [self wait:&result];
+    STAssertEquals(result.status, PINUnlockStatusNotFound, @"Nothing is stored");
+    STAssertFalse(result.hasSecret, @"No secret without a stored secret");
+}
+
+- (void)testStoreIsNotSuperseded {
+    uint8_t secret[32] = { 1, 2, 3 };
+    TestItem item = { "1234", 10000 };
+    TestResult store, load;
+    memset(&load, 0, sizeof(load));
+    
+    [self submit:PINUnlockOperationStore item:&item secret:secret token:NULL result:&store];
+    [self submit:PINUnlockOperationLoad item:&item secret:NULL token:NULL result:&load];
+    [self wait:&store];
+    [self wait:&load];
+    STAssertEquals(store.status, PINUnlockStatusSuccess, @"Store is not cancelled by a later load");
+    STAssertTrue(load.hasSecret && memcmp(load.secret.bytes, secret, 32) == 0, @"Load sees the stored secret");
+}
+
+- (void)testDestroyCompletesPendingRequests {
+    TestItem slow = { "1234", 100000000 };
+    TestResult results[4];
+    for (int i = 0; i < 4; i++) {
+        [self submit:PINUnlockOperationStore item:&slow secret:NULL token:NULL result:&results[i]];
+    }
+    
+    PINUnlockQueueDestroy(self.queue);
+    self.queue = NULL;
+    for (int i = 0; i < 4; i++) {
+        [self wait:&results[i]];
+        STAssertEquals(results[i].status, PINUnlockStatusCancelled, @"Pending requests complete as cancelled");
+    }
+}
+
+@end
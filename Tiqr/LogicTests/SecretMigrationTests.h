@@ -0,0 +1,12 @@
+//
+//  SecretMigrationTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SecretMigrationTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,131 @@
+//
+//  SecretMigrationTests.m
+//  LogicTests
+//
+
+#import "SecretMigrationTests.h"
+#import "SecretMigration.h"
+#import "NSData+Hex.h"
+
+static NSData *SecretMigrationTestsCountingBytes(uint8_t start, NSUInteger length) {
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    uint8_t *bytes = data.mutableBytes;
+    for (NSUInteger i = 0; i < length; i++) {
+        bytes[i] = (uint8_t)(start + i);
+    }
+    return data;
+}
+
+static int SecretMigrationTestsWrite(void *context, SecretMigrationItem *const *items, size_t count) {
+    NSMutableArray *batches = (__bridge NSMutableArray *)context;
+    [batches addObject:@(count)];
+    return 0;
+}
+
+static int SecretMigrationTestsFailingWrite(void *context, SecretMigrationItem *const *items, size_t count) {
+    return EACCES;
+}
+
+@interface SecretMigrationTests ()
+
+@property (nonatomic, strong) NSData *sharedSalt;
+@property (nonatomic, strong) NSData *otherSalt;
+@property (nonatomic, strong) NSArray *initializationVectors;
+@property (nonatomic, strong) NSArray *version3Secrets;
+@property (nonatomic, strong) NSArray *version4Secrets;
+
+@end
+
+@implementation SecretMigrationTests
+
+- (void)setUp {
+    [super setUp];
+    
+    // Recorded with Python's hashlib.pbkdf2_hmac and openssl enc -aes-256-cbc -nopad,
+    // the secrets count up from 0x40, 0x80 and 0xc0
+    self.sharedSalt = SecretMigrationTestsCountingBytes(0x00, 32);
+    self.otherSalt = SecretMigrationTestsCountingBytes(0xa0, 32);
+    self.initializationVectors = @[SecretMigrationTestsCountingBytes(0x20, 32), SecretMigrationTestsCountingBytes(0x60, 32)];
+    self.version3Secrets = @[[NSData dataWithHexString:@"780e512713efec5e397795e840f8c4577eeece9b54ce7ea58c83f1abd720d839"],
+                             [NSData dataWithHexString:@"30d989d6dab1da0e52a763a0958d85b88d322eef15c3745a6901f997c96c9c6a"],
+                             [NSData dataWithHexString:@"2cf38d38e124434b7a009be9fcb0529b62a8d2f526d61bd2de5a85fca61ffa25"]];
+    self.version4Secrets = @[[NSData dataWithHexString:@"35af5add16df4fe08d7ce5faf05aef9e67d269f189f46ea2e4ff429429023036"],
+                             [NSData dataWithHexString:@"c80e5d62994e4648459cabe698fa1f972576f3f190a4c75bd78ddcbc2db3e239"],
+                             [NSData dataWithHexString:@"fa82f071ecbfb990a8f5206a82ad0edb4408016bfb8f4714f174ff3495ff05bb"]];
+}
+
+- (void)fillItems:(SecretMigrationItem *)items {
+    memset(items, 0, 3 * sizeof(SecretMigrationItem));
+    for (int i = 0; i < 3; i++) {
+        NSData *secret = self.version3Secrets[i];
+        items[i].secret = secret.bytes;
+        items[i].secretLength = secret.length;
+    }
+    
+    // Identities 0 and 1 share PIN and salt, identity 2 has no initialization vector
+    for (int i = 0; i < 2; i++) {
+        items[i].PIN = (const uint8_t *)"1234";
+        items[i].PINLength = 4;
+        items[i].salt = self.sharedSalt.bytes;
+        items[i].saltLength = self.sharedSalt.length;
+        items[i].rounds = 32894;
+        items[i].initializationVector = [self.initializationVectors[i] bytes];
+    }
+    items[2].PIN = (const uint8_t *)"98765";
+    items[2].PINLength = 5;
+    items[2].salt = self.otherSalt.bytes;
+    items[2].saltLength = self.otherSalt.length;
+    items[2].rounds = 10000;
+}
+
+- (void)testMigratesRecordedSecrets {
+    SecretMigrationItem items[3];
+    [self fillItems:items];
+    
+    SecretMigrationPool *pool = NULL;
+    STAssertEquals(SecretMigrationPoolCreate(2, 4, &pool), 0, @"Pool should be created");
+    NSMutableArray *batches = [NSMutableArray array];
+    SecretMigrationStatistics statistics;
+    STAssertEquals(SecretMigrationRun(pool, items, 3, SecretMigrationTestsWrite, (__bridge void *)batches, &statistics), 0, @"Run should succeed");
+    SecretMigrationPoolDestroy(pool);
+    
+    for (int i = 0; i < 3; i++) {
+        STAssertEquals(items[i].result, 0, @"Migrated");
+        STAssertEqualObjects([NSData dataWithBytes:items[i].migratedSecret length:items[i].secretLength], self.version4Secrets[i], @"Version 4 secret");
+    }
+    STAssertEquals(statistics.derivations, (size_t)2, @"One derivation per distinct PIN and salt");
+    STAssertEquals(statistics.migrated, (size_t)3, @"Migrated");
+    STAssertEqualObjects(batches, (@[@2, @1]), @"Written in batches");
+}
+
+- (void)testLegacyKey {
+    NSData *key = [NSData dataWithHexString:@"67de699f0db877da5e1ee1e0a79151bdc76dad79197ec7db32981dc0672a6d73"];
+    uint8_t legacyKey[SecretCipherKeyLength];
+    SecretMigrationLegacyKey(key.bytes, legacyKey);
+    
+    uint8_t expected[SecretCipherKeyLength] = { 0 };
+    memcpy(expected + 1, "7de699f0db877da5e1ee1e0a79151bd", SecretCipherKeyLength - 1);
+    STAssertTrue(memcmp(legacyKey, expected, sizeof(expected)) == 0, @"First half of the hex string, first character zeroed");
+}
+
+- (void)testFailures {
+    SecretMigrationItem items[3];
+    [self fillItems:items];
+    items[1].secretLength = 31;
+    
+    SecretMigrationPool *pool = NULL;
+    SecretMigrationPoolCreate(2, 1, &pool);
+    SecretMigrationStatistics statistics;
+    STAssertEquals(SecretMigrationRun(pool, items, 3, SecretMigrationTestsFailingWrite, NULL, &statistics), EACCES, @"The write stopped the run");
+    STAssertEquals(statistics.batches, (size_t)1, @"One batch written");
+    SecretMigrationPoolDestroy(pool);
+    
+    STAssertEquals(items[0].result, EACCES, @"Write failed");
+    STAssertEquals(items[1].result, EINVAL, @"Partial block");
+    STAssertEquals(items[2].result, ECANCELED, @"Not reached");
+    STAssertEquals(statistics.failed, (size_t)2, @"Failed");
+    
+    STAssertEquals(SecretMigrationPoolCreate(0, 1, &pool), EINVAL, @"Empty batches");
+}
+
+@end
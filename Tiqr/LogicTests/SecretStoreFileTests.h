@@ -0,0 +1,12 @@
+//
+//  SecretStoreFileTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SecretStoreFileTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,255 @@
+//
+//  SecretStoreFileTests.m
+//  LogicTests
+//
+
+#import "SecretStoreFileTests.h"
+#import "SecretStoreFile.h"
+
+#import <errno.h>
+#import <unistd.h>
+
+@interface SecretStoreFileTests ()
+
+@property (nonatomic, copy) NSString *path;
+
+@end
+
+static void SecretStoreFileTestsCollect(void *context, const char *account, const SecretStoreAttributes *attributes) {
+    [(__bridge NSMutableSet *)context addObject:@(account)];
+}
+
+@implementation SecretStoreFileTests {
+    uint8_t key[SecretStoreFileKeyLength];
+}
+
+- (void)setUp {
+    [super setUp];
+    self.path = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+    for (size_t i = 0; i < sizeof(key); i++) {
+        key[i] = (uint8_t)i;
+    }
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:NULL];
+    [[NSFileManager defaultManager] removeItemAtPath:[self.path stringByAppendingString:@".tmp"] error:NULL];
+    [super tearDown];
+}
+
+- (unsigned long long)fileSize {
+    return [[[NSFileManager defaultManager] attributesOfItemAtPath:self.path error:NULL] fileSize];
+}
+
+- (SecretStoreFile *)openStoreWithBackend:(SecretStoreBackend *)backend {
+    SecretStoreFile *store = NULL;
+    STAssertEquals(SecretStoreFileOpen([self.path fileSystemRepresentation], key, &store), 0, @"Store should open");
+    SecretStoreFileGetBackend(store, backend);
+    return store;
+}
+
+- (NSData *)loadFrom:(SecretStoreBackend *)backend account:(const char *)account attributes:(SecretStoreAttributes *)attributes {
+    uint8_t secret[SecretStoreMaxSecretLength];
+    size_t length = 0;
+    if (backend->load(backend->context, "nl.surfnet", account, secret, sizeof(secret), &length, attributes) != 0) {
+        return nil;
+    }
+    return [NSData dataWithBytes:secret length:length];
+}
+
+- (void)testLifecycle {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    NSData *secret = [@"0123456789abcdef0123456789abcdef" dataUsingEncoding:NSASCIIStringEncoding];
+    NSData *otherSecret = [@"fedcba9876543210fedcba9876543210" dataUsingEncoding:NSASCIIStringEncoding];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    
+    STAssertEquals(backend.update(backend.context, "nl.surfnet", "john", secret.bytes, secret.length, &attributes), ENOENT, @"Update needs an item");
+    STAssertEquals(backend.add(backend.context, "nl.surfnet", "john", secret.bytes, secret.length, &attributes), 0, @"Add should succeed");
+    STAssertEquals(backend.add(backend.context, "nl.surfnet", "john", secret.bytes, secret.length, &attributes), EEXIST, @"Add needs a new item");
+    
+    SecretStoreAttributes loaded;
+    STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:&loaded], secret, @"Loads the secret");
+    STAssertEquals(loaded.rounds, (uint32_t)10000, @"Loads the rounds");
+    STAssertEquals(loaded.type, (uint32_t)4, @"Loads the type");
+    
+    uint8_t small[4];
+    size_t length = 0;
+    STAssertEquals(backend.load(backend.context, "nl.surfnet", "john", small, sizeof(small), &length, NULL), ERANGE, @"Buffer too small");
+    STAssertEquals(length, secret.length, @"Reports the length anyway");
+    
+    // Rounds of 0 keep the stored ones
+    SecretStoreAttributes update = { .rounds = 0, .type = 0 };
+    STAssertEquals(backend.update(backend.context, "nl.surfnet", "john", otherSecret.bytes, otherSecret.length, &update), 0, @"Update should succeed");
+    STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:&loaded], otherSecret, @"Loads the new secret");
+    STAssertEquals(loaded.rounds, (uint32_t)10000, @"Keeps the rounds");
+    STAssertEquals(loaded.type, (uint32_t)0, @"Replaces the type");
+    
+    STAssertEquals(backend.add(backend.context, "nl.surfnet", "jane", secret.bytes, secret.length, &attributes), 0, @"Add should succeed");
+    STAssertEquals(backend.remove(backend.context, "nl.surfnet", "jane"), 0, @"Remove should succeed");
+    STAssertEquals(backend.remove(backend.context, "nl.surfnet", "jane"), ENOENT, @"Remove needs an item");
+    STAssertNil([self loadFrom:&backend account:"jane" attributes:NULL], @"Removed item is gone");
+    SecretStoreFileClose(store);
+    
+    store = [self openStoreWithBackend:&backend];
+    STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:&loaded], otherSecret, @"Secret survives a reopen");
+    STAssertEquals(loaded.rounds, (uint32_t)10000, @"Rounds survive a reopen");
+    STAssertNil([self loadFrom:&backend account:"jane" attributes:NULL], @"Removed item stays removed");
+    STAssertEquals(SecretStoreFileItemCount(store), (size_t)1, @"One item left");
+    SecretStoreFileClose(store);
+    
+    // Neither names nor secrets are readable in the file
+    NSData *contents = [NSData dataWithContentsOfFile:self.path];
+    STAssertEquals([contents rangeOfData:[@"john" dataUsingEncoding:NSASCIIStringEncoding] options:0 range:NSMakeRange(0, contents.length)].location, (NSUInteger)NSNotFound, @"Names are encrypted");
+    STAssertEquals([contents rangeOfData:otherSecret options:0 range:NSMakeRange(0, contents.length)].location, (NSUInteger)NSNotFound, @"Secrets are encrypted");
+}
+
+- (void)testTornRecordIsDropped {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    NSData *secret = [@"0123456789abcdef0123456789abcdef" dataUsingEncoding:NSASCIIStringEncoding];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    backend.add(backend.context, "nl.surfnet", "john", secret.bytes, secret.length, &attributes);
+    unsigned long long validSize = [self fileSize];
+    backend.add(backend.context, "nl.surfnet", "jane", secret.bytes, secret.length, &attributes);
+    SecretStoreFileClose(store);
+    
+    unsigned long long fullSize = [self fileSize];
+    NSData *original = [NSData dataWithContentsOfFile:self.path];
+    
+    // A crash can cut the last record anywhere
+    for (unsigned long long size = validSize + 1; size < fullSize; size++) {
+        [original writeToFile:self.path atomically:NO];
+        truncate([self.path fileSystemRepresentation], (off_t)size);
+        
+        store = [self openStoreWithBackend:&backend];
+        STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:NULL], secret, @"Complete records survive");
+        STAssertNil([self loadFrom:&backend account:"jane" attributes:NULL], @"Torn record is dropped");
+        STAssertEquals([self fileSize], validSize, @"Torn record is truncated away");
+        STAssertEquals(backend.add(backend.context, "nl.surfnet", "jane", secret.bytes, secret.length, &attributes), 0, @"Store is writable after recovery");
+        SecretStoreFileClose(store);
+    }
+}
+
+- (void)testTamperingAndWrongKey {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    NSData *secret = [@"0123456789abcdef0123456789abcdef" dataUsingEncoding:NSASCIIStringEncoding];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    backend.add(backend.context, "nl.surfnet", "john", secret.bytes, secret.length, &attributes);
+    backend.add(backend.context, "nl.surfnet", "jane", secret.bytes, secret.length, &attributes);
+    SecretStoreFileClose(store);
+    
+    // Flip a bit in the ciphertext of the last record
+    NSMutableData *data = [NSMutableData dataWithContentsOfFile:self.path];
+    ((uint8_t *)[data mutableBytes])[[data length] - 40] ^= 0x01;
+    [data writeToFile:self.path atomically:NO];
+    
+    store = [self openStoreWithBackend:&backend];
+    STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:NULL], secret, @"Records in front of the damage survive");
+    STAssertNil([self loadFrom:&backend account:"jane" attributes:NULL], @"Record failing its MAC is dropped");
+    SecretStoreFileClose(store);
+    
+    uint8_t otherKey[SecretStoreFileKeyLength] = { 1 };
+    STAssertEquals(SecretStoreFileOpen([self.path fileSystemRepresentation], otherKey, &store), EBADMSG, @"Another key should be rejected");
+    
+    [@"SQLite format 3" writeToFile:self.path atomically:NO encoding:NSASCIIStringEncoding error:NULL];
+    STAssertEquals(SecretStoreFileOpen([self.path fileSystemRepresentation], key, &store), EINVAL, @"Foreign file should be rejected");
+}
+
+- (void)testCompaction {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    uint8_t secret[32] = { 0 };
+    for (int i = 0; i < 1000; i++) {
+        NSString *account = [NSString stringWithFormat:@"identity%d", i % 3];
+        secret[0] = (uint8_t)i;
+        if (backend.update(backend.context, "nl.surfnet", account.UTF8String, secret, sizeof(secret), &attributes) == ENOENT) {
+            backend.add(backend.context, "nl.surfnet", account.UTF8String, secret, sizeof(secret), &attributes);
+        }
+    }
+    STAssertTrue(SecretStoreFileRecordCount(store) < 256, @"Superseded records should be compacted");
+    SecretStoreFileClose(store);
+    
+    store = [self openStoreWithBackend:&backend];
+    NSData *loaded = [self loadFrom:&backend account:"identity0" attributes:NULL];
+    STAssertEquals(((const uint8_t *)loaded.bytes)[0], (uint8_t)(999 & 0xff), @"Latest secret survives compaction");
+    STAssertEquals(SecretStoreFileItemCount(store), (size_t)3, @"Items survive compaction");
+    SecretStoreFileClose(store);
+}
+
+- (void)testUpsertAndProbe {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    NSData *secret = [@"0123456789abcdef0123456789abcdef" dataUsingEncoding:NSASCIIStringEncoding];
+    NSData *otherSecret = [@"fedcba9876543210fedcba9876543210" dataUsingEncoding:NSASCIIStringEncoding];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    
+    STAssertEquals(backend.probe(backend.context, "nl.surfnet", "john", NULL), ENOENT, @"Nothing to probe yet");
+    STAssertEquals(SecretStoreUpsert(&backend, "nl.surfnet", "john", secret.bytes, secret.length, &attributes), 0, @"Upsert adds");
+    STAssertEquals(SecretStoreUpsert(&backend, "nl.surfnet", "john", otherSecret.bytes, otherSecret.length, &attributes), 0, @"Upsert updates");
+    STAssertEqualObjects([self loadFrom:&backend account:"john" attributes:NULL], otherSecret, @"Loads the upserted secret");
+    
+    SecretStoreAttributes probed = { 0, 0 };
+    STAssertEquals(backend.probe(backend.context, "nl.surfnet", "john", &probed), 0, @"Probe finds the item");
+    STAssertEquals(probed.rounds, (uint32_t)10000, @"Probe reads the rounds");
+    STAssertEquals(probed.type, (uint32_t)4, @"Probe reads the type");
+    SecretStoreFileClose(store);
+}
+
+- (void)testListAndRemoveAll {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    uint8_t secret[32] = { 0 };
+    backend.add(backend.context, "nl.surfnet", "john", secret, sizeof(secret), &attributes);
+    backend.add(backend.context, "nl.surfnet", "jane", secret, sizeof(secret), &attributes);
+    backend.add(backend.context, "org.example", "john", secret, sizeof(secret), &attributes);
+    
+    NSMutableSet *accounts = [NSMutableSet set];
+    STAssertEquals(backend.list(backend.context, "nl.surfnet", SecretStoreFileTestsCollect, (__bridge void *)accounts), 0, @"List should succeed");
+    STAssertEqualObjects(accounts, ([NSSet setWithObjects:@"john", @"jane", nil]), @"Lists the items of the service only");
+    
+    STAssertEquals(backend.removeAll(backend.context, "nl.surfnet"), 0, @"Remove all should succeed");
+    STAssertEquals(backend.removeAll(backend.context, "nl.surfnet"), 0, @"Remove all of nothing succeeds");
+    SecretStoreFileClose(store);
+    
+    store = [self openStoreWithBackend:&backend];
+    [accounts removeAllObjects];
+    backend.list(backend.context, "nl.surfnet", SecretStoreFileTestsCollect, (__bridge void *)accounts);
+    STAssertEquals(accounts.count, (NSUInteger)0, @"Removed items stay removed");
+    STAssertNil([self loadFrom:&backend account:"john" attributes:NULL], @"Removed secret is gone");
+    STAssertEquals(backend.probe(backend.context, "org.example", "john", NULL), 0, @"Other services are left alone");
+    SecretStoreFileClose(store);
+}
+
+- (void)testStoreAll {
+    SecretStoreBackend backend;
+    SecretStoreFile *store = [self openStoreWithBackend:&backend];
+    SecretStoreAttributes attributes = { .rounds = 10000, .type = 4 };
+    uint8_t old[32] = { 0 };
+    backend.add(backend.context, "nl.surfnet", "jane", old, sizeof(old), &attributes);
+    
+    uint8_t secrets[3][32];
+    const char *accounts[] = { "john", "jane", "joe" };
+    SecretStoreItem items[3];
+    for (size_t i = 0; i < 3; i++) {
+        memset(secrets[i], (int)i + 1, sizeof(secrets[i]));
+        items[i] = (SecretStoreItem){ accounts[i], secrets[i], sizeof(secrets[i]), attributes, -1 };
+    }
+    STAssertEquals(SecretStoreStoreAll(&backend, "nl.surfnet", items, 3), 0, @"Store all should succeed");
+    for (size_t i = 0; i < 3; i++) {
+        STAssertEquals(items[i].result, 0, @"Every item is stored");
+        STAssertEqualObjects([self loadFrom:&backend account:accounts[i] attributes:NULL], [NSData dataWithBytes:secrets[i] length:sizeof(secrets[i])], @"Loads the stored secret");
+    }
+    STAssertEquals(SecretStoreFileItemCount(store), (size_t)3, @"Existing items are updated, not added");
+    
+    items[0].length = SecretStoreMaxSecretLength + 1;
+    STAssertEquals(SecretStoreStoreAll(&backend, "nl.surfnet", items, 3), EINVAL, @"Reports the failing item");
+    STAssertEquals(items[0].result, EINVAL, @"Oversized secret fails");
+    STAssertEquals(items[1].result, 0, @"The other items are stored anyway");
+    SecretStoreFileClose(store);
+}
+
+@end
@@ -0,0 +1,12 @@
+//
+//  SecureArenaTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SecureArenaTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,139 @@
+//
+//  SecureArenaTests.m
+//  LogicTests
+//
+
+#import "SecureArenaTests.h"
+#import "SecureArena.h"
+#import "NSData+Secure.h"
+
+#import <errno.h>
+
+static BOOL SecureArenaTestsIsZero(const uint8_t *bytes, size_t length) {
+    uint8_t bits = 0;
+    for (size_t i = 0; i < length; i++) {
+        bits |= bytes[i];
+    }
+    return bits == 0;
+}
+
+@interface SecureArenaTests ()
+
+@property (nonatomic, assign) SecureArena *arena;
+
+@end
+
+@implementation SecureArenaTests
+
+- (void)setUp {
+    [super setUp];
+    SecureArena *arena = NULL;
+    STAssertEquals(SecureArenaCreate(4096, &arena), 0, @"Arena should be created");
+    self.arena = arena;
+}
+
+- (void)tearDown {
+    SecureArenaDestroy(self.arena);
+    [super tearDown];
+}
+
+- (void)testReleaseZeroes {
+    void *bytes = NULL;
+    STAssertEquals(SecureArenaAllocate(self.arena, 0, &bytes), EINVAL, @"Nothing to allocate");
+    STAssertEquals(SecureArenaAllocate(self.arena, 100, &bytes), 0, @"Allocation should succeed");
+    STAssertTrue(SecureArenaTestsIsZero(bytes, 128), @"Allocations start zeroed");
+    memset(bytes, 0xa5, 100);
+    
+    SecureArenaMetrics metrics;
+    SecureArenaGetMetrics(self.arena, &metrics);
+    STAssertEquals(metrics.capacity, (size_t)4096, @"Capacity");
+    STAssertEquals(metrics.inUse, (size_t)128, @"Whole chunks are in use");
+    STAssertEquals(metrics.allocations, (uint64_t)1, @"One allocation");
+    
+    // The memory stays mapped, so what the release left behind can be read
+    SecureArenaRelease(self.arena, bytes);
+    STAssertTrue(SecureArenaTestsIsZero(bytes, 128), @"Released bytes are zeroed");
+    SecureArenaGetMetrics(self.arena, &metrics);
+    STAssertEquals(metrics.inUse, (size_t)0, @"Nothing in use");
+    STAssertEquals(metrics.peakInUse, (size_t)128, @"Peak is kept");
+    STAssertEquals(metrics.releases, (uint64_t)1, @"One release");
+}
+
+- (void)testExhaustionAndReuse {
+    void *chunks[4096 / SecureArenaChunkLength];
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        STAssertEquals(SecureArenaAllocate(self.arena, SecureArenaChunkLength, &chunks[i]), 0, @"Allocation should succeed");
+        memset(chunks[i], (int)i + 1, SecureArenaChunkLength);
+    }
+    void *bytes = NULL;
+    STAssertEquals(SecureArenaAllocate(self.arena, 1, &bytes), ENOMEM, @"Arena is full");
+    
+    // Two neighbouring chunks make room for an allocation that needs two
+    SecureArenaRelease(self.arena, chunks[10]);
+    SecureArenaRelease(self.arena, chunks[11]);
+    STAssertEquals(SecureArenaAllocate(self.arena, SecureArenaChunkLength + 1, &bytes), 0, @"Freed run is reused");
+    STAssertEquals(bytes, chunks[10], @"First fit");
+    STAssertTrue(SecureArenaTestsIsZero(bytes, 2 * SecureArenaChunkLength), @"Reused chunks are zeroed");
+    
+    SecureArenaMetrics metrics;
+    SecureArenaGetMetrics(self.arena, &metrics);
+    STAssertEquals(metrics.exhaustions, (uint64_t)1, @"One allocation did not fit");
+    STAssertEquals(metrics.allocations, (uint64_t)65, @"Every allocation is counted");
+    STAssertEquals(metrics.inUse, (size_t)4096, @"Everything in use");
+    
+    // Pointers into the middle of an allocation or outside the arena are ignored
+    SecureArenaRelease(self.arena, (uint8_t *)chunks[0] + 1);
+    STAssertFalse(SecureArenaContains(self.arena, &metrics), @"Stack is not in the arena");
+    
+    SecureArenaRelease(self.arena, bytes);
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        if (i != 10 && i != 11) {
+            SecureArenaRelease(self.arena, chunks[i]);
+        }
+    }
+    SecureArenaGetMetrics(self.arena, &metrics);
+    STAssertEquals(metrics.inUse, (size_t)0, @"Everything released");
+    STAssertEquals(metrics.releases, metrics.allocations, @"Every allocation released once");
+}
+
+- (void)testScopedBuffer {
+    uint8_t *bytes = NULL;
+    {
+        SecureBuffer buffer SecureBufferScoped = { 0 };
+        STAssertEquals(SecureBufferAcquire(self.arena, 32, &buffer), 0, @"Buffer should be acquired");
+        memset(buffer.bytes, 0x42, buffer.length);
+        bytes = buffer.bytes;
+    }
+    STAssertTrue(SecureArenaTestsIsZero(bytes, SecureArenaChunkLength), @"Buffer is zeroed at the end of its scope");
+    
+    SecureBuffer tooLong SecureBufferScoped = { 0 };
+    STAssertEquals(SecureBufferAcquire(self.arena, 4097, &tooLong), ENOMEM, @"Buffer doesn't fit");
+    STAssertTrue(tooLong.bytes == NULL, @"Failed buffer is empty");
+    
+    SecureArenaMetrics metrics;
+    SecureArenaGetMetrics(self.arena, &metrics);
+    STAssertEquals(metrics.inUse, (size_t)0, @"Nothing in use");
+}
+
+- (void)testSecureData {
+    SecureArena *shared = SecureArenaShared();
+    STAssertTrue(shared != NULL, @"Shared arena should exist");
+    SecureArenaMetrics before, after;
+    SecureArenaGetMetrics(shared, &before);
+    
+    const uint8_t *bytes = NULL;
+    @autoreleasepool {
+        uint8_t key[32];
+        memset(key, 0x5a, sizeof(key));
+        NSData *data = [NSData secureDataWithBytes:key length:sizeof(key)];
+        STAssertEqualObjects(data, [NSData dataWithBytes:key length:sizeof(key)], @"Holds a copy of the bytes");
+        STAssertTrue(SecureArenaContains(shared, data.bytes), @"Bytes live in the arena");
+        bytes = data.bytes;
+    }
+    SecureArenaGetMetrics(shared, &after);
+    STAssertTrue(SecureArenaTestsIsZero(bytes, 32), @"Bytes are zeroed when the data is released");
+    STAssertEquals(after.allocations - before.allocations, (uint64_t)1, @"One allocation");
+    STAssertEquals(after.releases - before.releases, (uint64_t)1, @"Released with the data");
+}
+
+@end
@@ -0,0 +1,12 @@
+//
+//  SortKeyTests.h
+//  LogicTests
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SortKeyTests : SenTestCase {
+
+}
+
+@end
@@ -0,0 +1,90 @@
+//
+//  SortKeyTests.m
+//  LogicTests
+//
+
+#import "SortKeyTests.h"
+#import "SortKey.h"
+
+#import <errno.h>
+
+#define SortKeyTestsCount 1000
+
+@implementation SortKeyTests
+
+- (void)testBetween {
+    int64_t key = 0;
+    int64_t lower = 10;
+    int64_t upper = 14;
+    STAssertEquals(SortKeyBetween(&lower, &upper, &key), 0, @"Room between");
+    STAssertEquals(key, (int64_t)12, @"Halfway");
+    STAssertEquals(SortKeyBetween(NULL, &upper, &key), 0, @"Room in front");
+    STAssertEquals(key, upper - SortKeyGap, @"A gap in front");
+    STAssertEquals(SortKeyBetween(&lower, NULL, &key), 0, @"Room after");
+    STAssertEquals(key, lower + SortKeyGap, @"A gap after");
+    STAssertEquals(SortKeyBetween(NULL, NULL, &key), 0, @"First item");
+    STAssertEquals(key, SortKeyGap, @"First key");
+    
+    upper = 11;
+    STAssertEquals(SortKeyBetween(&lower, &upper, &key), ENOSPC, @"Adjacent keys");
+    upper = lower;
+    STAssertEquals(SortKeyBetween(&lower, &upper, &key), ENOSPC, @"Equal keys");
+    
+    lower = SortKeyLimit - 1;
+    STAssertEquals(SortKeyAppend(lower, true, &key), EOVERFLOW, @"Out of bounds");
+}
+
+- (void)testPlaceSpreadsWindow {
+    int64_t keys[3] = { 7, 7, 7 };
+    int64_t key = 0;
+    size_t first = 0;
+    size_t last = 0;
+    STAssertEquals(SortKeyPlace(keys, 3, 1, &key, &first, &last), 0, @"Duplicates are spread out");
+    STAssertTrue(first < last, @"Keys around the position changed");
+    STAssertTrue(keys[0] < key && key < keys[1] && keys[1] < keys[2], @"Order is strict again");
+    STAssertEquals(SortKeyPlace(keys, 3, 4, &key, &first, &last), EINVAL, @"Position past the end");
+}
+
+- (void)testRandomMoves {
+    int64_t *keys = calloc(SortKeyTestsCount, sizeof(int64_t));
+    int64_t *others = calloc(SortKeyTestsCount, sizeof(int64_t));
+    SortKeySpread(keys, SortKeyTestsCount);
+    
+    srandom(20161017);
+    size_t changed = 0;
+    const int moves = 20000;
+    for (int move = 0; move < moves; move++) {
+        // Half of the moves go to the same spot, the worst case for bisection
+        size_t from = random() % SortKeyTestsCount;
+        size_t to = move % 2 == 0 ? 1 : random() % SortKeyTestsCount;
+        
+        size_t count = 0;
+        for (size_t i = 0; i < SortKeyTestsCount; i++) {
+            if (i != from) {
+                others[count++] = keys[i];
+            }
+        }
+        
+        int64_t key = 0;
+        size_t first = 0;
+        size_t last = 0;
+        STAssertEquals(SortKeyPlace(others, count, to, &key, &first, &last), 0, @"Move should succeed");
+        changed += 1 + (last - first);
+        
+        memcpy(keys, others, to * sizeof(int64_t));
+        keys[to] = key;
+        memcpy(keys + to + 1, others + to, (count - to) * sizeof(int64_t));
+        for (size_t i = 1; i < SortKeyTestsCount; i++) {
+            if (keys[i] <= keys[i - 1]) {
+                STFail(@"Keys out of order after move %d", move);
+                break;
+            }
+        }
+    }
+    
+    STAssertTrue(changed < (size_t)moves * 2, @"A move changes %.2f keys on average", (double)changed / moves);
+    free(keys);
+    free(others);
+}
+
+@end